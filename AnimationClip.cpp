@@ -0,0 +1,140 @@
+#include <math.h>
+#include <algorithm>
+#include "AnimationClip.h"
+
+// Instances whose table positions are worked out together in EvaluateBatch
+static const int batchSize = 64;
+
+AnimationClip::AnimationClip(float duration, bool looping)
+{
+	this->duration = duration > 0.0f ? duration : 1.0f;
+	this->looping = looping;
+	sampleRate = 0.0f;
+	numSamples = 0;
+}
+
+void AnimationClip::AddKey(int joint, float time, float value, Interpolation interpolation)
+{
+	Channel *channel = NULL;
+	for (size_t i = 0; i < channels.size(); i++)
+	{
+		if (channels[i].joint == joint)
+			channel = &channels[i];
+	}
+	if (!channel)
+	{
+		channels.push_back(Channel());
+		channel = &channels.back();
+		channel->joint = joint;
+	}
+
+	Key key;
+	key.time = time;
+	key.value = value;
+	key.interpolation = interpolation;
+	std::vector<Key>::iterator position = channel->keys.begin();
+	while (position != channel->keys.end() && position->time <= time)
+		++position;
+	channel->keys.insert(position, key);
+}
+
+float AnimationClip::Evaluate(const Channel &channel, float time) const
+{
+	const std::vector<Key> &keys = channel.keys;
+	if (time <= keys.front().time)
+		return keys.front().value;
+	if (time >= keys.back().time)
+		return keys.back().value;
+
+	size_t next = 1;
+	while (keys[next].time <= time)
+		next++;
+	const Key &from = keys[next - 1];
+	const Key &to = keys[next];
+
+	float t = (time - from.time) / (to.time - from.time);
+	if (from.interpolation == STEP)
+		return from.value;
+	if (from.interpolation == SMOOTH)
+		t = t * t * (3.0f - 2.0f * t);
+	return from.value + t * (to.value - from.value);
+}
+
+void AnimationClip::Bake(float sampleRate)
+{
+	this->sampleRate = sampleRate;
+	// Whole number of intervals, so the last sample lands exactly on duration
+	numSamples = (int)ceil(duration * sampleRate) + 1;
+	if (numSamples < 2)
+		numSamples = 2;
+	float interval = duration / (numSamples - 1);
+	this->sampleRate = 1.0f / interval;
+
+	samples.resize(channels.size() * numSamples);
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		for (int s = 0; s < numSamples; s++)
+			samples[c * numSamples + s] = Evaluate(channels[c], s * interval);
+	}
+}
+
+void AnimationClip::TablePosition(float time, int &index, float &fraction) const
+{
+	float position = time * sampleRate;
+	float last = (float)(numSamples - 1);
+	if (looping)
+		position -= floorf(position / last) * last;
+	else
+		position = std::min(std::max(position, 0.0f), last);
+
+	index = (int)position;
+	if (index > numSamples - 2)
+		index = numSamples - 2;
+	fraction = position - index;
+}
+
+float AnimationClip::Sample(int joint, float time) const
+{
+	if (samples.empty())
+		return 0.0f;
+
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		if (channels[c].joint == joint)
+		{
+			int index;
+			float fraction;
+			TablePosition(time, index, fraction);
+			const float *table = &samples[c * numSamples];
+			return table[index] + fraction * (table[index + 1] - table[index]);
+		}
+	}
+	return 0.0f;
+}
+
+void AnimationClip::EvaluateBatch(const float *times, int count, float weight, float *jointAngles, int stride) const
+{
+	if (samples.empty())
+		return;
+
+	int indices[batchSize];
+	float fractions[batchSize];
+	for (int begin = 0; begin < count; begin += batchSize)
+	{
+		int n = std::min(batchSize, count - begin);
+		for (int i = 0; i < n; i++)
+			TablePosition(times[begin + i], indices[i], fractions[i]);
+
+		for (size_t c = 0; c < channels.size(); c++)
+		{
+			const float *table = &samples[c * numSamples];
+			float *angles = jointAngles + channels[c].joint * stride + begin;
+			for (int i = 0; i < n; i++)
+			{
+				float a = table[indices[i]];
+				float b = table[indices[i] + 1];
+				angles[i] += weight * (a + fractions[i] * (b - a));
+			}
+		}
+	}
+}
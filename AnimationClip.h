@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	AnimationClip.h
+//	Keyframed joint angle curves. Keys are authored per joint, then Bake() samples every
+//	curve at a fixed rate into one table, so evaluating a joint is a table fetch and a lerp
+//	whatever the number of keys or how they interpolate.
+//
+//	EvaluateBatch() poses many instances at once from structure of arrays storage: one row
+//	of angles per joint, one column per instance. Instance clip times are turned into table
+//	positions once, then each joint is a straight loop over its row.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ANIMATIONCLIP_H
+#define ANIMATIONCLIP_H
+
+#include <vector>
+
+class AnimationClip
+{
+public:
+	// How a curve goes from a key to the next one
+	enum Interpolation
+	{
+		STEP,		// holds the key's value
+		LINEAR,
+		SMOOTH		// eases out of the key and into the next
+	};
+
+	// Looping clips wrap time, the others hold their end values outside [0,duration]
+	AnimationClip(float duration, bool looping);
+
+	// Keys of a joint may be added in any order. A joint with one key is constant.
+	void AddKey(int joint, float time, float value, Interpolation interpolation = LINEAR);
+
+	// Samples the curves into the lookup table. Call after the last AddKey and before
+	// evaluating.
+	void Bake(float sampleRate = 120.0f);
+
+	// Angle of one joint at time, 0 for joints the clip does not animate
+	float Sample(int joint, float time) const;
+
+	// Adds weight times the clip's angles at times[i] to every animated joint of instance i.
+	// jointAngles[joint * stride + i] is joint's angle for instance i.
+	void EvaluateBatch(const float *times, int count, float weight, float *jointAngles, int stride) const;
+
+	float GetDuration() const
+	{
+		return duration;
+	}
+	int GetNumChannels() const
+	{
+		return (int)channels.size();
+	}
+	// Size of the baked table
+	int GetTableBytes() const
+	{
+		return (int)(samples.size() * sizeof(float));
+	}
+
+private:
+	struct Key
+	{
+		float time;
+		float value;
+		Interpolation interpolation;
+	};
+
+	// Keys of one animated joint, sorted by time
+	struct Channel
+	{
+		int joint;
+		std::vector<Key> keys;
+	};
+
+	float Evaluate(const Channel &channel, float time) const;
+	// Table position of time, as a sample index and the fraction towards the next one
+	void TablePosition(float time, int &index, float &fraction) const;
+
+	float duration;
+	bool looping;
+	std::vector<Channel> channels;
+
+	float sampleRate;
+	int numSamples;				// per channel, the last one is at duration
+	std::vector<float> samples;	// channel after channel
+};
+
+#endif	//ANIMATIONCLIP_H
@@ -4,19 +4,50 @@
 #define GL_SILENCE_DEPRECATION
 #ifdef __APPLE__
 #include <glut/glut.h>
-#else
+#elif defined(_WIN32)
 #include <windows.h>
 #include <gl/glut.h>
+#else
+#include <GL/glut.h>
 #endif
+#include <float.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 #include <utility>
 #include <vector>
 #include "VECTOR3D.h"
+#include "MATRIX4X4.h"
 //#include "cube.h"
+#include "BoundingBox.h"
+#include "Frustum.h"
+#include "Picking.h"
+#include "Collision.h"
+#include "GLExtensions.h"
+#include "Headless.h"
+#include "SceneGraph.h"
+#include "MaterialRegistry.h"
+#include "NormalKernel.h"
 #include "QuadMesh.h"
+#include "MeshAllocator.h"
+#include "Heightfield.h"
+#include "ChunkedTerrain.h"
+#include "TerrainPager.h"
+#include "GeometryCache.h"
+#include "SoftRasterizer.h"
+#include "RenderQueue.h"
+#include "WorkerPool.h"
+#include "SimulationClock.h"
+#include "AnimationClip.h"
+#include "FramePipeline.h"
+#include "Profiler.h"
+#include "VectorArrays.h"
 
 const int vWidth  = 650;    // Viewport width in pixels
 const int vHeight = 500;    // Viewport height in pixels
@@ -45,7 +76,8 @@ float clawLength = 0.3*lowerLegLength;
 
 char curJoint = 'b';
 
-// Control angles
+// Control angles every robot starts from. Each robot keeps its own copy in RobotState,
+// which the keys then change.
 float robotAngle = 0.0;
 float leftHipAngle = 0.0;
 float leftKneeAngle = 0.0;
@@ -88,18 +120,205 @@ GLfloat light_ambient[] = { 0.2F, 0.2F, 0.2F, 1.0F };
 // Mouse button
 int currentButton;
 
-// A flat open mesh
-QuadMesh *groundMesh = NULL;
+// Left click picks (see pickAt): the robot clicked last, or the ground point clicked last as
+// the target
+int selectedRobot = -1;
+bool groundTargetSet = false;
+VECTOR3D groundTarget;
+// Rays cast through the window in each headless frame to time picking (--pick-rays N)
+int pickRays = 0;
+
+// Every part of every robot as a collision body, part k of robot i is body i * shapes + k.
+// Robots touching are moved apart and out of the ground (off with --no-collisions).
+CollisionWorld robotCollisions;
+bool collisionsEnabled = true;
+
+// Large tiled ground with distance based level of detail, drawn instead of the ground mesh when useTerrain is set
+ChunkedTerrain *terrain = NULL;
+bool useTerrain = false;
+int terrainTiles = 8;           // tiles along each side
+int terrainTileSize = 32;       // quads along a tile side
+float terrainTileLength = 16.0; // units along a tile side
+// Terrain heights from a file instead of terrainHeight() (--heightfield file)
+Heightfield heightfield;
+const char *heightfieldPath = NULL;
+// Endless terrain streamed in around the walking robots (--stream [radius]), drawn instead of
+// the tiled terrain. Tiles further than the radius are cached up to terrainCacheMB.
+TerrainPager *terrainPager = NULL;
+int streamRadius = 0;
+int terrainCacheMB = 64;
+float walkSpeed = 4.0;          // units per second the robots cover while walking
+
+// Camera position, looking at the origin
+VECTOR3D eyePosition = VECTOR3D(0.0f, 6.0f, 22.0f);
+// Ground is drawn this far below the robot
+float groundOffset = -20.0;
+
+// Cylinders and disks, tessellated once and reused every frame
+GeometryCache geometryCache;
+
+// View frustum culling of ground tiles and robot parts
+bool frustumCulling = true;
+CullStats cullStats;
+float farPlane = 40.0;
+
+// Camera matrices, worked out on the CPU in reshape() and loaded into GL as they are
+MATRIX4X4 projectionMatrix;
+MATRIX4X4 viewMatrix;
+
+// Robot materials, ids in MaterialRegistry::Shared()
+int robotBodyMaterial;
+int robotLegMaterial;
+int gunMaterial;
+int robotLowerBodyMaterial;
+
+char lastStatsTitle[256];
+
+// Frame profiler (--profile, --profile-trace file). 'p' shows its overlay in the window and
+// 'P' writes the trace.
+bool profileOverlay = false;
+const char *profileTracePath = NULL;
+int profileTessellations = 0;   // geometryCache tessellations already counted
+
+// Frames drawn on the CPU instead of by GL (--software), the last one saved to
+// softwareImagePath after a headless run (--software-image file)
+SoftRasterizer *softRasterizer = NULL;
+const char *softwareImagePath = NULL;
+
+// Joints of the robot, driven by the control angles
+enum
+{
+    JOINT_ROBOT,
+    JOINT_LEFT_HIP,
+    JOINT_LEFT_KNEE,
+    JOINT_LEFT_FOOT,
+    JOINT_UPPER_LEG,
+    JOINT_LOWER_LEG,
+    JOINT_CANNON,
+    JOINT_COUNT
+};
+
+// Pose controls of one robot
+struct RobotState
+{
+    float jointAngles[JOINT_COUNT];     // degrees, clip output is added on top
+    float walkOffset;                   // seconds the robot is ahead in the walk cycle
+};
 
-// Structure defining a bounding box, currently unused
-typedef struct BoundingBox {
-    VECTOR3D min;
-    VECTOR3D max;
-} BBox;
+// One robot of the crowd. The keys change every robot's controls at once.
+struct RobotInstance
+{
+    VECTOR3D position;
+    RobotState controls;
+    SceneState state;
+};
+
+// Crowd of robots sharing one hierarchy and one set of shapes (--robots N)
+int numRobots = 1;
+float robotSpacing = 15.0;
+SceneGraph robotGraph;
+std::vector<CachedShape *> robotShapes;     // geometry ids used in robotGraph
+std::vector<RobotInstance> robots;
+// Nodes of robotGraph that have a shape
+std::vector<int> robotShapeNodes;
+// Merge the copies of each shape into one draw per shape and material (off with
+// --no-batching, which draws every copy on its own)
+bool batchRobots = true;
 
 // Default Mesh Size
 int meshSize = 16;
 
+// Rendering offscreen with no window (--headless)
+bool headlessMode = false;
+
+// Animations ('c', 'w' and 'g') run on a fixed timestep clock. Each step moves
+// currentAnimation on by the step length, and frames are drawn between previousAnimation
+// and currentAnimation, so speeds are the same at any frame rate.
+struct AnimationState
+{
+    double cannonTime;    // seconds into the cannon clip
+    double walkTime;      // seconds into the walk clip
+    double groundTime;    // seconds of ground waves
+    double travelX;       // how far robot 0 has walked, the streamed terrain moves by this
+    double travelZ;
+};
+SimulationClock simulationClock;
+AnimationState previousAnimation = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+AnimationState currentAnimation = previousAnimation;
+bool idleRunning = false;
+bool vsyncEnabled = false;
+
+// Keyframed joint animation, added on top of the control angles. Clips are baked in
+// initAnimations().
+bool cannonSpinning = false;
+float cannonSpeed = 500.0;      // degrees per second
+AnimationClip cannonClip(360.0f / cannonSpeed, true);
+bool walking = false;
+AnimationClip walkClip(1.8f, true);
+
+// Clip times to draw at, interpolated between simulation steps
+float cannonClipTime = 0.0;
+float walkClipTime = 0.0;
+
+// Animated joint angles of every robot, row JOINT_* holds that joint for each robot
+std::vector<float> robotAnimatedAngles;
+std::vector<float> robotClipTimes;
+
+// Animated ground
+bool groundAnimating = false;
+
+// What a frame is simulated from. The keys collect their changes in pendingInput, and the
+// simulation takes them, with the current settings, at the start of the next frame.
+struct FrameInput
+{
+    // Every robot's joint is set to jointValue if jointSet, then turned by jointTurn
+    bool jointSet[JOINT_COUNT];
+    float jointValue[JOINT_COUNT];
+    float jointTurn[JOINT_COUNT];
+    bool restartWalk;
+    bool resetClock;        // drop the time that passed while nothing animated
+    double frameTime;       // seconds to simulate, < 0 for the real time since the last frame
+
+    bool cannonSpinning;
+    bool walking;
+    bool groundAnimating;
+    bool useTerrain;
+    bool frustumCulling;
+    MATRIX4X4 view;
+    MATRIX4X4 projection;
+};
+
+// Everything display() draws, built by the simulation thread in one of the pipeline's slots.
+// The render thread only reads a slot once it is finished and handed over.
+struct FrameState
+{
+    FrameInput input;                           // what the frame was built from
+    QuadMesh *groundMesh;                       // this slot's copy of the ground
+    float groundMeshTime;                       // time groundMesh was last built for
+    HeightQuadtree groundTree;                  // groundMesh's quads, for picking
+    // World matrix of every robot shape in view, robotShapeNodes.size() entries per robot
+    std::vector<MATRIX4X4> robotTransforms;
+    std::vector<unsigned char> robotShapeVisible;
+    // World box around each robot's shapes in view, a point at the robot when none are
+    std::vector<BBox> robotBoxes;
+    RenderQueue robotQueue;                     // visible shapes, sorted by material and shape
+    CullStats robotCullStats;
+    CollisionStats collisionStats;
+    int robotNodesUpdated;                      // world matrices recomputed, over all robots
+    double robotUpdateMs;
+    double simulationMs;                        // the whole frame
+    double travelX;                             // robot 0's walk, drawn at the origin
+    double travelZ;
+};
+
+// Frames are simulated on the pipeline's thread while display() draws the newest finished
+// one. The simulation thread owns the robots, the animation state and the slot it fills.
+FramePipeline framePipeline;
+FrameState frameStates[FramePipeline::numSlots];
+int drawnFrame = -1;            // slot display() drew last
+std::mutex inputMutex;          // guards pendingInput
+FrameInput pendingInput;
+
 // Prototypes for functions in this module
 void initOpenGL(int w, int h);
 void display(void);
@@ -108,36 +327,232 @@ void mouse(int button, int state, int x, int y);
 void mouseMotionHandler(int xMouse, int yMouse);
 void keyboard(unsigned char key, int x, int y);
 void functionKeys(int key, int x, int y);
-void cannonAnimationHandler(int param);
-void leftStepForwardAnimationHandler(int param);
-void leftStepBackwardAnimationHandler(int param);
-void stepAnimationHandler(int param);
-void drawRobot();
-void drawBody();
-void drawHead();
-void drawCannon();
-void drawLowerBody();
-void drawLeftUpperLeg();
-void drawRightUpperLeg();
-void drawLeftUpperLeg2();
-void drawRightUpperLeg2();
-void drawLeftLowerLeg();
-void drawRightLowerLeg();
-void drawLeftFoot();
-void drawRightFoot();
+void idle();
+void stopTerrainPager();
+void updateIdle();
+void stepAnimation(const FrameInput &input, double step);
+void applyAnimation(double alpha, FrameState &frame);
+void initAnimations();
+void initRobots();
+void startFramePipeline();
+void stopFramePipeline();
+void requestFrame();
+void buildFrame(int slot);
+void applyInput(const FrameInput &input);
+void poseRobots(FrameState &frame);
+void collideRobots(FrameState &frame);
+void queueRobots(FrameState &frame);
+void turnRobotJoint(int joint, float degrees);
+void setRobotJoint(int joint, float angle);
+float groundWaveHeight(float x, float z, float time);
+float terrainHeight(float x, float z, float time);
+bool partVisible(const BBox &box, const Frustum *frustum);
+BBox cylinderBox(float baseRadius, float topRadius, float height);
+int robotShape(CachedShape &shape);
+int addRobotCube(int parent, const VECTOR3D &translation, float sizeX, float sizeY, float sizeZ, int material);
+int addRobotCylinder(int parent, const VECTOR3D &translation, float baseRadius, float topRadius, float height,
+                     GLenum drawStyle, int material);
+int addRobotDisk(int parent, const VECTOR3D &translation, float innerRadius, float outerRadius,
+                 GLenum drawStyle, int material);
+void buildRobotGraph();
+bool pickRobot(const FrameState &frame, const Ray &ray, float maxT, int &robot, float &t);
+bool pickGround(const FrameState &frame, const Ray &ray, float maxT, float &t);
+void pickAt(int x, int y, bool selectRobots);
+void benchmarkPicking(const FrameState &frame, int &robotHits, int &groundHits);
+void drawSoftware(FrameState &frame);
+void showFrameStats();
+void presentFrame();
+void endProfileFrame();
+void runBenchmark(int frames);
+void printMeshMemory(const char *name, const MeshAllocator &allocator);
 
 int main(int argc, char **argv)
 {
-    // Initialize GLUT
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-    glutInitWindowSize(vWidth, vHeight);
-    glutInitWindowPosition(200, 30);
-    glutCreateWindow("Bot 1 - Ramneek Riar");
+    // Command line options. Read before GLUT starts, since the headless mode must not open
+    // a window. Options GLUT knows are skipped here and handled by glutInit.
+    bool verifyNormals = false;
+    int headlessFrames = 0;
+    int benchVectors = 0;
+    const char *writeHeightfield = NULL;
+    int writeHeightfieldSamples = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--verify-normals") == 0)
+        {
+            verifyNormals = true;
+        }
+        else if (strcmp(argv[i], "--slices") == 0 && i + 2 < argc)
+        {
+            // Tessellation of the robot's cylinders and disks (default 100 x 100)
+            int slices = atoi(argv[++i]);
+            int stacks = atoi(argv[++i]);
+            geometryCache.SetTessellation(slices, stacks);
+        }
+        else if (strcmp(argv[i], "--mesh-size") == 0 && i + 1 < argc)
+        {
+            meshSize = atoi(argv[++i]);
+            if (meshSize < 1)
+                meshSize = 1;
+        }
+        else if (strcmp(argv[i], "--robots") == 0 && i + 1 < argc)
+        {
+            // Crowd of robots on a grid, all drawn from the same shapes
+            numRobots = atoi(argv[++i]);
+            if (numRobots < 1)
+                numRobots = 1;
+        }
+        else if (strcmp(argv[i], "--robot-spacing") == 0 && i + 1 < argc)
+        {
+            // Distance between neighbours in the crowd, robots closer than about 15 touch
+            robotSpacing = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--terrain") == 0)
+        {
+            useTerrain = true;
+        }
+        else if (strcmp(argv[i], "--bench-vectors") == 0)
+        {
+            // Time the batch vector functions against the VECTOR3D methods, no GL needed
+            benchVectors = 16 << 20;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                benchVectors = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--heightfield") == 0 && i + 1 < argc)
+        {
+            // Tiled terrain from a heightfield file, loaded as it comes into view
+            heightfieldPath = argv[++i];
+            useTerrain = true;
+        }
+        else if (strcmp(argv[i], "--stream") == 0)
+        {
+            // Stream terrain tiles around the robots as they walk, radius in tiles
+            streamRadius = 4;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                streamRadius = atoi(argv[++i]);
+            useTerrain = true;
+        }
+        else if (strcmp(argv[i], "--terrain-cache") == 0 && i + 1 < argc)
+        {
+            terrainCacheMB = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--walk-speed") == 0 && i + 1 < argc)
+        {
+            walkSpeed = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--write-heightfield") == 0 && i + 2 < argc)
+        {
+            // Sample the terrain hills into a file of N x N heights, at the terrain's resolution
+            writeHeightfield = argv[++i];
+            writeHeightfieldSamples = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            // Time the frame's parts, printed after a headless run or shown with 'p'
+            Profiler::Shared().SetEnabled(true);
+        }
+        else if (strcmp(argv[i], "--profile-trace") == 0 && i + 1 < argc)
+        {
+            // Also keep every zone for chrome://tracing, written after a headless run or with 'P'
+            profileTracePath = argv[++i];
+            Profiler::Shared().SetEnabled(true);
+            Profiler::Shared().StartTrace();
+        }
+        else if (strcmp(argv[i], "--software") == 0)
+        {
+            // Draw with the tiled CPU rasterizer, for machines where GL has no GPU behind it
+            softRasterizer = new SoftRasterizer();
+        }
+        else if (strcmp(argv[i], "--software-image") == 0 && i + 1 < argc)
+        {
+            softwareImagePath = argv[++i];
+            if (!softRasterizer)
+                softRasterizer = new SoftRasterizer();
+        }
+        else if (strcmp(argv[i], "--pick-rays") == 0 && i + 1 < argc)
+        {
+            // Cast this many rays through the window every headless frame and time them
+            pickRays = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-collisions") == 0)
+        {
+            collisionsEnabled = false;
+        }
+        else if (strcmp(argv[i], "--no-batching") == 0)
+        {
+            batchRobots = false;
+        }
+        else if (strcmp(argv[i], "--headless") == 0)
+        {
+            // Render offscreen for a fixed number of frames and print timings
+            headlessMode = true;
+            headlessFrames = 300;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                headlessFrames = atoi(argv[++i]);
+        }
+    }
+
+    if (Profiler::Shared().IsEnabled())
+        Profiler::Shared().SetThreadName("render");
+
+    if (writeHeightfield)
+    {
+        float spacing = terrainTileLength / terrainTileSize;
+        return Heightfield::Write(writeHeightfield, writeHeightfieldSamples, writeHeightfieldSamples,
+                                  spacing, -2.0f, 2.0f, terrainHeight) ? 0 : 1;
+    }
+
+    if (benchVectors > 0)
+    {
+        BenchmarkVectorArrays(benchVectors);
+        return 0;
+    }
+
+    if (headlessMode)
+    {
+        if (!CreateHeadlessContext(vWidth, vHeight))
+            return 1;
+    }
+    else
+    {
+        // Initialize GLUT
+        glutInit(&argc, argv);
+        glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+        glutInitWindowSize(vWidth, vHeight);
+        glutInitWindowPosition(200, 30);
+        glutCreateWindow("Bot 1 - Ramneek Riar");
+    }
+
 
     // Initialize GL
     initOpenGL(vWidth, vHeight);
 
+    if (verifyNormals)
+    {
+        // Check the SIMD normal kernel against the scalar one on the ground mesh
+        frameStates[0].groundMesh->VerifyNormalKernel();
+    }
+
+    startFramePipeline();
+
+    if (headlessMode)
+    {
+        // No window, so nothing calls reshape for us
+        reshape(vWidth, vHeight);
+        runBenchmark(headlessFrames);
+        stopFramePipeline();
+        if (profileTracePath)
+            Profiler::Shared().WriteTrace(profileTracePath);
+        if (softRasterizer && softwareImagePath)
+            softRasterizer->WriteImage(softwareImagePath);
+        delete softRasterizer;
+        // Before the context goes, the tiles free their GL buffers. Cleared so the exit
+        // handler finds nothing left to stop.
+        delete terrainPager;
+        terrainPager = NULL;
+        DestroyHeadlessContext();
+        return 0;
+    }
+
     // Register callback functions
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
@@ -146,6 +561,9 @@ int main(int argc, char **argv)
     glutKeyboardFunc(keyboard);
     glutSpecialFunc(functionKeys);
 
+    // One frame per display refresh while animating
+    vsyncEnabled = SetSwapInterval(1);
+
     // Start event loop, never returns
     glutMainLoop();
 
@@ -182,21 +600,140 @@ void initOpenGL(int w, int h)
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
+    // The same lights and clear colour for the CPU renderer
+    if (softRasterizer)
+    {
+        softRasterizer->SetViewport(w, h);
+        softRasterizer->SetClearColor(0.4F, 0.4F, 0.4F);
+        softRasterizer->SetLight(0, light_position0, light_ambient, light_diffuse, light_specular);
+        softRasterizer->SetLight(1, light_position1, light_ambient, light_diffuse, light_specular);
+        if (useTerrain)
+            printf("The software renderer draws the ground mesh, the terrain needs GL\n");
+    }
+
 
     // Other initializatuion
     // Set up ground quad mesh
     VECTOR3D origin = VECTOR3D(-16.0f, 0.0f, 16.0f);
     VECTOR3D dir1v = VECTOR3D(1.0f, 0.0f, 0.0f);
     VECTOR3D dir2v = VECTOR3D(0.0f, 0.0f, -1.0f);
-    groundMesh = new QuadMesh(meshSize, 32.0);
-    groundMesh->InitMesh(meshSize, origin, 32.0, 32.0, dir1v, dir2v);
-
     VECTOR3D ambient = VECTOR3D(0.0f, 0.05f, 0.0f);
     VECTOR3D diffuse = VECTOR3D(0.4f, 0.8f, 0.4f);
     VECTOR3D specular = VECTOR3D(0.04f, 0.04f, 0.04f);
     float shininess = 0.2;
-    groundMesh->SetMaterial(ambient, diffuse, specular, shininess);
+    // One per frame slot, so the simulation can move the ground of the next frame while
+    // the render thread draws this one
+    for (int i = 0; i < FramePipeline::numSlots; i++)
+    {
+        QuadMesh *groundMesh = new QuadMesh(meshSize, 32.0);
+        groundMesh->InitMesh(meshSize, origin, 32.0, 32.0, dir1v, dir2v);
+        groundMesh->SetMaterial(ambient, diffuse, specular, shininess);
+        frameStates[i].groundMesh = groundMesh;
+        frameStates[i].groundMeshTime = 0.0;
+        frameStates[i].groundTree.Build(*groundMesh);
+    }
 
+    // Set up the tiled terrain, centered under the robot like the ground mesh
+    if (heightfieldPath && heightfield.Open(heightfieldPath))
+    {
+        float lengthX = (heightfield.GetWidth() - 1) * heightfield.GetSpacing();
+        float lengthZ = (heightfield.GetDepth() - 1) * heightfield.GetSpacing();
+        terrainTileLength = terrainTileSize * heightfield.GetSpacing();
+        terrain = new ChunkedTerrain(&heightfield, terrainTileSize);
+        terrain->InitTerrain(VECTOR3D(-0.5f * lengthX, 0.0f, 0.5f * lengthZ));
+    }
+    else
+    {
+        float terrainLength = terrainTiles * terrainTileLength;
+        terrain = new ChunkedTerrain(terrainTiles, terrainTiles, terrainTileSize, terrainTileLength);
+        terrain->InitTerrain(VECTOR3D(-0.5f * terrainLength, 0.0f, 0.5f * terrainLength), terrainHeight, 0.0);
+    }
+    terrain->SetMaterial(ambient, diffuse, specular, shininess);
+    terrain->SetLodDistance(1.5 * terrainTileLength);
+
+    if (streamRadius > 0)
+    {
+        // Same tiles and heights as the tiled terrain, but with no edge
+        terrainPager = new TerrainPager(terrainTileSize, terrainTileLength, streamRadius);
+        if (heightfield.IsOpen())
+            terrainPager->SetHeightfield(&heightfield);
+        else
+            terrainPager->SetHeightFunction(terrainHeight);
+        terrainPager->SetMaterial(ambient, diffuse, specular, shininess);
+        terrainPager->SetLodDistance(1.5 * terrainTileLength);
+        terrainPager->SetMemoryCap((size_t)terrainCacheMB << 20);
+        terrainPager->Start();
+        atexit(stopTerrainPager);
+    }
+
+    initRobots();
+}
+
+// Lay the robots out on a grid going back from the origin, all posed from one robot hierarchy
+void initRobots()
+{
+    int side = (int)ceil(sqrt((double)numRobots));
+    robots.resize(numRobots);
+    for (int i = 0; i < numRobots; i++)
+    {
+        RobotInstance &instance = robots[i];
+        // Columns are rotated so robot 0 stays at the origin
+        int column = (i + side / 2) % side - side / 2;
+        instance.position.Set(column * robotSpacing, 0.0f, -(i / side) * robotSpacing);
+        float *angles = instance.controls.jointAngles;
+        angles[JOINT_ROBOT] = robotAngle + (float)((i * 37) % 360);
+        angles[JOINT_LEFT_HIP] = leftHipAngle;
+        angles[JOINT_LEFT_KNEE] = leftKneeAngle;
+        angles[JOINT_LEFT_FOOT] = leftFootAngle;
+        angles[JOINT_UPPER_LEG] = upperLegAngle;
+        angles[JOINT_LOWER_LEG] = lowerLegAngle;
+        angles[JOINT_CANNON] = cannonAngle + (float)((i * 53) % 360);
+        instance.controls.walkOffset = (float)(i * 0.29);
+    }
+
+    // Pull the camera back far enough to see the whole crowd
+    if (numRobots > 1)
+    {
+        float extent = side * robotSpacing;
+        eyePosition.y += 0.5f * extent;
+        eyePosition.z += 0.5f * extent;
+        farPlane += 2.0f * extent;
+    }
+
+    MaterialRegistry &materials = MaterialRegistry::Shared();
+    robotBodyMaterial = materials.Add(robotBody_mat_ambient, robotBody_mat_diffuse, robotBody_mat_specular,
+                                      robotBody_mat_shininess[0]);
+    robotLegMaterial = materials.Add(robotLeg_mat_ambient, robotLeg_mat_diffuse, robotLeg_mat_specular,
+                                     robotLeg_mat_shininess[0]);
+    gunMaterial = materials.Add(gun_mat_ambient, gun_mat_diffuse, gun_mat_specular, gun_mat_shininess[0]);
+    robotLowerBodyMaterial = materials.Add(robotLowerBody_mat_ambient, robotLowerBody_mat_diffuse,
+                                           robotLowerBody_mat_specular, robotLowerBody_mat_shininess[0]);
+
+    buildRobotGraph();
+    for (int i = 0; i < numRobots; i++)
+        robotGraph.InitState(robots[i].state);
+    robotAnimatedAngles.assign(robotGraph.GetNumJoints() * numRobots, 0.0f);
+    robotClipTimes.resize(numRobots);
+    initAnimations();
+
+    robotShapeNodes.clear();
+    for (int i = 0; i < robotGraph.GetNumNodes(); i++)
+    {
+        if (robotGraph.GetGeometry(i) != SceneGraph::noGeometry)
+            robotShapeNodes.push_back(i);
+    }
+    for (int i = 0; i < FramePipeline::numSlots; i++)
+    {
+        frameStates[i].robotTransforms.resize(robotShapeNodes.size() * numRobots);
+        frameStates[i].robotShapeVisible.assign(robotShapeNodes.size() * numRobots, 0);
+        frameStates[i].robotBoxes.resize(numRobots);
+    }
+    // Cells about half a robot across
+    robotCollisions.SetCellSize(0.5f * robotBodyWidth);
+    robotCollisions.SetNumBodies(collisionsEnabled ? (int)robotShapeNodes.size() * numRobots : 0);
+
+    if (numRobots > 1)
+        printf("%d robots, %d nodes and %d shapes each\n", numRobots, robotGraph.GetNumNodes(), (int)robotShapeNodes.size());
 }
 
 
@@ -204,548 +741,732 @@ void initOpenGL(int w, int h)
 // or glutPostRedisplay() has been called.
 void display(void)
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    bool profiling = Profiler::Shared().IsEnabled();
+    if (profiling)
+        Profiler::Shared().BeginFrame();
+    PROFILE_ZONE("display");
+
+    if (!softRasterizer)
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    cullStats.Reset();
+    botCallCounts.Reset();
+    MaterialRegistry::Shared().GetStats().Reset();
+
+    // Start on the next frame and draw the newest finished one while it is built. A still
+    // scene has nothing to overlap with, so the frame just asked for is drawn right away.
+    requestFrame();
+    {
+        PROFILE_ZONE("wait for frame");
+        if (!(cannonSpinning || walking || groundAnimating) || drawnFrame < 0)
+            framePipeline.Wait();
+        drawnFrame = framePipeline.AcquireFrame();
+    }
+    FrameState &frame = frameStates[drawnFrame];
+    const FrameInput &input = frame.input;
 
-    glLoadIdentity();
-    // Create Viewing Matrix V
-    // Set up the camera at position (0, 6, 22) looking at the origin, up along positive y axis
-    gluLookAt(0.0, 6.0, 22.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+    if (softRasterizer)
+    {
+        drawSoftware(frame);
+    }
+    else
+    {
+        // Draw Robot
+
+        // Apply modelling transformations M to move robot
+        // Current transformation matrix is set to IV, where I is identity matrix
+        // CTM = IV
+        glLoadMatrixf(input.view);
+        {
+            PROFILE_GPU_ZONE("robots");
+            frame.robotQueue.GetStats().Reset();
+            frame.robotQueue.Submit(input.view, MaterialRegistry::Shared());
+        }
+        cullStats.drawn += frame.robotCullStats.drawn;
+        cullStats.culled += frame.robotCullStats.culled;
+
+        // Draw ground. Level of detail and culling are done in the ground's own coordinates.
+        MATRIX4X4 ground = input.view;
+        ground.Translate(0.0, groundOffset, 0.0);
+        glLoadMatrixf(ground);
+        Frustum frustum;
+        frustum.Extract(input.projection, ground);
+        const Frustum *groundFrustum = input.frustumCulling ? &frustum : NULL;
+        if (input.useTerrain && terrainPager)
+        {
+            PROFILE_GPU_ZONE("streamed terrain");
+            // The robots stay at the origin and the terrain moves under them
+            terrainPager->Update(frame.travelX, frame.travelZ);
+            terrainPager->Draw(frame.travelX, frame.travelZ, eyePosition - VECTOR3D(0.0f, groundOffset, 0.0f),
+                               groundFrustum, &cullStats);
+        }
+        else if (input.useTerrain)
+        {
+            PROFILE_GPU_ZONE("terrain");
+            terrain->DrawTerrain(eyePosition - VECTOR3D(0.0f, groundOffset, 0.0f), groundFrustum, &cullStats);
+        }
+        else if (partVisible(frame.groundMesh->GetBoundingBox(), groundFrustum))
+        {
+            PROFILE_GPU_ZONE("ground");
+            frame.groundMesh->DrawMesh(meshSize);
+        }
+    }
 
-    // Draw Robot
+    showFrameStats();
 
-    // Apply modelling transformations M to move robot
-    // Current transformation matrix is set to IV, where I is identity matrix
-    // CTM = IV
-    drawRobot();
+    {
+        PROFILE_ZONE("presentFrame");
+        presentFrame();
+    }
+    if (profiling)
+        endProfileFrame();
+}
 
-    // Draw ground
-    glPushMatrix();
-    glTranslatef(0.0, -20.0, 0.0);
-    groundMesh->DrawMesh(meshSize);
-    glPopMatrix();
+// The frame on the CPU renderer, drawn as display() draws it with GL and copied to the
+// window. The tiled and streamed terrain are GL only, the ground mesh stands in for them.
+void drawSoftware(FrameState &frame)
+{
+    const FrameInput &input = frame.input;
+    softRasterizer->BeginFrame(input.projection);
+    frame.robotQueue.GetStats().Reset();
+    frame.robotQueue.Submit(input.view, *softRasterizer);
+    cullStats.drawn += frame.robotCullStats.drawn;
+    cullStats.culled += frame.robotCullStats.culled;
+
+    MATRIX4X4 ground = input.view;
+    ground.Translate(0.0, groundOffset, 0.0);
+    Frustum frustum;
+    frustum.Extract(input.projection, ground);
+    if (partVisible(frame.groundMesh->GetBoundingBox(), input.frustumCulling ? &frustum : NULL))
+        softRasterizer->DrawMesh(ground, *frame.groundMesh, meshSize);
 
-    glutSwapBuffers();   // Double buffering, swap buffers
+    {
+        PROFILE_ZONE("software rasterizer");
+        softRasterizer->EndFrame();
+    }
+    if (!headlessMode)
+        softRasterizer->Present();
 }
 
-void drawRobot()
+// Hand the frame's counts to the profiler
+void endProfileFrame()
 {
-    glPushMatrix();
-    glRotatef(robotAngle, 0.0, 1.0, 0.0); // spin robot on base.
-        
-//    glPushMatrix();
-//    glRotatef(hipAngle, 0.0, 1.0, 0.0);  // spin robot on hip.
-    drawBody();
-    drawHead();
-    drawCannon();
-    glPopMatrix();
-//    glPopMatrix();
-    
-    // don't want to spin fixed base in this example
-    glPushMatrix();
-     //spin robot
-     glRotatef(robotAngle, 0.0, 1.0, 0.0);
-    drawLowerBody();
-    drawLeftUpperLeg();
-    drawRightUpperLeg();
-    
-    glPopMatrix();
-    glPopMatrix();
+    ProfileCounters counters;
+    counters.drawCalls = botCallCounts.drawCalls;
+    counters.vertices = botCallCounts.vertices;
+    counters.stateChanges = botCallCounts.stateChanges;
+    counters.shapesTessellated = geometryCache.GetNumTessellations() - profileTessellations;
+    profileTessellations = geometryCache.GetNumTessellations();
+    Profiler::Shared().EndFrame(counters);
 }
 
+// Double buffering, swap buffers. Headless there is nothing to swap, but the frame is only
+// done once GL has finished it.
+void presentFrame()
+{
+    if (headlessMode)
+        glFinish();
+    else
+        glutSwapBuffers();
+}
 
-void drawBody()
+// Scripted run for the headless mode. The robots turn, fire and step and the ground waves
+// the same way on every run, so timings can be compared between builds. Each frame is
+// timed from the script update until it is through glFinish and the next frame, built
+// meanwhile, is ready.
+void runBenchmark(int frames)
 {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, robotBody_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, robotBody_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, robotBody_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, robotBody_mat_shininess);
+    if (softRasterizer)
+        printf("Headless: %d frames at %dx%d, software renderer on %d threads\n", frames, vWidth, vHeight,
+               WorkerPool::Shared().GetNumThreads());
+    else
+        printf("Headless: %d frames at %dx%d, GL renderer %s\n", frames, vWidth, vHeight,
+               (const char *)glGetString(GL_RENDERER));
+
+    cannonSpinning = walking = groundAnimating = true;
+
+    std::vector<double> frameTimes;
+    double firstFrame = 0.0;
+    long long triangles = 0, drawCalls = 0, glCalls = 0;
+    double updateMs = 0.0, simulationMs = 0.0;
+    long long softTriangles = 0, softBinned = 0;
+    double softVertexMs = 0.0, softSetupMs = 0.0, softRasterMs = 0.0;
+    long long robotHits = 0, groundHits = 0;
+    double pickMs = 0.0;
+    long long collisionPairs = 0, collisionContacts = 0;
+    double collisionMs = 0.0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // 60 frames a second through the same clock as the window (see requestFrame), with
+        // the cannon, walk and ground animations running
+        turnRobotJoint(JOINT_ROBOT, 0.5f);
+
+        display();
+        framePipeline.Wait();
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        // The first frame uploads every buffer, it is reported on its own
+        if (frame == 0)
+            firstFrame = ms;
+        else
+            frameTimes.push_back(ms);
+        triangles += botCallCounts.triangles;
+        drawCalls += botCallCounts.drawCalls;
+        glCalls += botCallCounts.calls;
+        updateMs += frameStates[drawnFrame].robotUpdateMs;
+        collisionPairs += frameStates[drawnFrame].collisionStats.pairsTested;
+        collisionContacts += frameStates[drawnFrame].collisionStats.contacts;
+        collisionMs += frameStates[drawnFrame].collisionStats.ms;
+        simulationMs += frameStates[drawnFrame].simulationMs;
+        if (softRasterizer)
+        {
+            const SoftRasterizerStats &stats = softRasterizer->GetStats();
+            softTriangles += stats.triangles + stats.lines;
+            softBinned += stats.primitivesBinned;
+            softVertexMs += stats.vertexMs;
+            softSetupMs += stats.setupMs;
+            softRasterMs += stats.rasterMs;
+        }
+        if (pickRays > 0)
+        {
+            std::chrono::steady_clock::time_point pickStart = std::chrono::steady_clock::now();
+            int robotCount, groundCount;
+            benchmarkPicking(frameStates[drawnFrame], robotCount, groundCount);
+            pickMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pickStart).count();
+            robotHits += robotCount;
+            groundHits += groundCount;
+        }
+    }
+
+    if (frameTimes.empty())
+    {
+        printf("first frame %.2f ms\n", firstFrame);
+        return;
+    }
 
-    glPushMatrix();
-    glScalef(robotBodyWidth, robotBodyLength, robotBodyDepth);
-    glutSolidCube(1.0);
-    glPopMatrix();
+    std::sort(frameTimes.begin(), frameTimes.end());
+    double total = 0.0;
+    for (size_t i = 0; i < frameTimes.size(); i++)
+        total += frameTimes[i];
+
+    // Nearest rank percentiles
+    int n = (int)frameTimes.size();
+    double p50 = frameTimes[(int)ceil(0.50 * n) - 1];
+    double p95 = frameTimes[(int)ceil(0.95 * n) - 1];
+    double p99 = frameTimes[(int)ceil(0.99 * n) - 1];
+
+    printf("frame ms: first %.2f  mean %.2f  p50 %.2f  p95 %.2f  p99 %.2f  max %.2f\n",
+           firstFrame, total / n, p50, p95, p99, frameTimes[n - 1]);
+    printf("per frame: %lld triangles, %lld draw calls, %lld GL calls\n",
+           triangles / frames, drawCalls / frames, glCalls / frames);
+    if (softRasterizer)
+        printf("software renderer: %lld triangles and lines a frame, %lld on screen, "
+               "vertices %.2f ms, setup %.2f ms, tiles %.2f ms\n",
+               softTriangles / frames, softBinned / frames, softVertexMs / frames, softSetupMs / frames,
+               softRasterMs / frames);
+    if (pickRays > 0)
+        printf("picking: %d rays a frame in %.3f ms, %.1f%% on robots, %.1f%% on the ground\n",
+               pickRays, pickMs / frames, 100.0 * robotHits / ((double)pickRays * frames),
+               100.0 * groundHits / ((double)pickRays * frames));
+    printf("robots %d (%d shapes drawn, %d culled), %s\n", numRobots, cullStats.drawn, cullStats.culled,
+           useTerrain ? "tiled terrain" : "ground mesh");
+    if (useTerrain && heightfield.IsOpen())
+        printf("heightfield %d x %d samples (%.1f MB file), %d of %d tiles loaded\n",
+               heightfield.GetWidth(), heightfield.GetDepth(), heightfield.GetFileSize() / 1048576.0,
+               terrain->GetTilesLoaded(), terrain->GetNumTiles());
+    if (useTerrain && terrainPager)
+    {
+        const TerrainPager::Stats &stats = terrainPager->GetStats();
+        printf("streamed terrain: walked to (%.0f, %.0f), %d tiles resident, %d pending, %.1f of %d MB, "
+               "%d built, %d evicted, longest upload %.2f ms\n",
+               currentAnimation.travelX, currentAnimation.travelZ, stats.tilesResident, stats.tilesPending,
+               stats.memoryUsed / 1048576.0, terrainCacheMB, stats.tilesBuilt, stats.tilesEvicted, stats.maxUploadMs);
+    }
+    printMeshMemory("mesh memory from the heap", MeshAllocator::Heap());
+    if (useTerrain)
+        printMeshMemory("tiled terrain arena", terrain->GetMeshArena());
+    if (useTerrain && terrainPager)
+        printMeshMemory("streamed terrain pool", terrainPager->GetMeshPool());
+    if (collisionsEnabled)
+        printf("collisions: %d bodies, %lld pairs tested and %lld contacts a frame, %.3f ms\n",
+               (int)robotShapeNodes.size() * numRobots, collisionPairs / frames, collisionContacts / frames,
+               collisionMs / frames);
+    printf("simulation %.3f ms a frame (robot update %.3f ms) on %d threads, overlapped with drawing\n",
+           simulationMs / frames, updateMs / frames, WorkerPool::Shared().GetNumThreads());
+    Profiler::Shared().PrintSummary();
 }
 
-void drawHead()
+// One line of runBenchmark's output for an allocator of mesh vertex and index arrays
+void printMeshMemory(const char *name, const MeshAllocator &allocator)
 {
-    // Set robot material properties per body part. Can have seperate material properties for each part
-    glMaterialfv(GL_FRONT, GL_AMBIENT, robotBody_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, robotBody_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, robotBody_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, robotBody_mat_shininess);
+    MeshAllocatorStats stats = allocator.GetStats();
+    printf("%s: %lld allocations (%lld reused), %lld frees, %.2f MB in use (peak %.2f MB), %.2f MB held\n",
+           name, stats.allocations, stats.reused, stats.frees, stats.bytesInUse / 1048576.0,
+           stats.peakBytesInUse / 1048576.0, stats.bytesHeld / 1048576.0);
+}
 
-    glPushMatrix();
-    // Position head with respect to parent (body)
-    glTranslatef(0, 0.5*robotBodyLength+0.5*headLength, 0); // this will be done last
-    
-    // Build Head
-    glPushMatrix();
-    glScalef(0.8*robotBodyWidth, 0.6*robotBodyWidth, 0.6*robotBodyWidth);
-    glutSolidCube(1.0);
-    glPopMatrix();
+// True if a part with the given bounding box is at least partly inside the frustum, which is
+// in the box's coordinates and NULL when culling is off. Counts the part as drawn or culled.
+bool partVisible(const BBox &box, const Frustum *frustum)
+{
+    if (frustum && frustum->BoxOutside(box))
+    {
+        cullStats.culled++;
+        return false;
+    }
+    cullStats.drawn++;
+    return true;
+}
 
-    glPopMatrix();
+// Box around a GLU cylinder (or disk, with zero height), which runs from z = 0 to z = height
+BBox cylinderBox(float baseRadius, float topRadius, float height)
+{
+    float radius = baseRadius > topRadius ? baseRadius : topRadius;
+    BBox box;
+    box.min.Set(-radius, -radius, 0.0f);
+    box.max.Set(radius, radius, height);
+    return box;
 }
 
-void drawCannon()
+// Geometry id of a cached shape in robotShapes
+int robotShape(CachedShape &shape)
 {
-    // Set robot material properties per body part. Can have seperate material properties for each part
-    glMaterialfv(GL_FRONT, GL_AMBIENT, gun_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, gun_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, gun_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, gun_mat_shininess);
-    
-    glPushMatrix();
-    glTranslatef(0, 0.05*robotBodyLength, 0.1*robotBodyWidth);
-    glRotatef(cannonAngle, 0.0, 0.0, 1.0);
-    glTranslatef(0, -(0.05*robotBodyLength), -(0.1*robotBodyWidth));
-    
-    glPushMatrix();
-    //Position cannon with respect to parent (body)
-    glTranslatef(0, 0.05*robotBodyLength, 0.1*robotBodyWidth);
-    
-    glPushMatrix();
-    // Creating cylinder object for cannon
-    GLUquadricObj *myCannon;
-    myCannon = gluNewQuadric();
-    gluQuadricDrawStyle(myCannon, GLU_LINE);
-    gluCylinder(myCannon, cannonRadius, cannonRadius, cannonHeight, 100, 100);
-    
-    glPushMatrix();
-    glTranslatef(0, 0.2*robotBodyLength, 0.68*robotBodyWidth);
-    glRotatef(-90.0, 1.0, 0.0, 0.0);
-    glTranslatef(0, -(0.2*robotBodyLength), -(0.68*robotBodyWidth));
-    
-    glPushMatrix();
-    //Position cannon with respect to parent (body)
-    glTranslatef(0, 0.2*robotBodyLength, 0.68*robotBodyWidth);
-    
-    glPushMatrix();
-    GLUquadricObj *myCannon_subPart;
-    myCannon_subPart = gluNewQuadric();
-    gluQuadricDrawStyle(myCannon_subPart, GLU_LINE);
-    gluCylinder(myCannon_subPart, 0.4*cannonRadius, 0.4*cannonRadius, 0.1*cannonHeight, 100, 100);
-    
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
+    for (size_t i = 0; i < robotShapes.size(); i++)
+    {
+        if (robotShapes[i] == &shape)
+            return (int)i;
+    }
+    robotShapes.push_back(&shape);
+    return (int)robotShapes.size() - 1;
 }
 
-void drawLowerBody()
+// Unit cube scaled to the given size
+int addRobotCube(int parent, const VECTOR3D &translation, float sizeX, float sizeY, float sizeZ, int material)
 {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, robotLowerBody_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, robotLowerBody_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, robotLowerBody_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, robotLowerBody_mat_shininess);
-    
-    glPushMatrix();
-    glRotatef(90.0, 0.0, 1.0, 0.0);
-    
-    glPushMatrix();
-    // Position lower cylindrical join in respect to body
-    glTranslatef(0.0, -1.5*robotBodyLength, -0.15*robotBodyWidth);
-    
-    glPushMatrix();
-    // Creating cylinder object for lower body
-    gluCylinder(gluNewQuadric(), 0.2*robotBodyWidth, 0.2*robotBodyWidth, 0.5*robotBodyDepth, 100, 100);
-    
-    glPopMatrix();
-    glPopMatrix();
-    
-    glPushMatrix();
-    // Position disk object to close lower body cylinder left side
-    glTranslatef(0.0, -1.5*robotBodyLength, 0.01*robotBodyWidth);
-    
-    glPushMatrix();
-    // Creating disk object to close lower body cylinder sides
-    GLUquadricObj *rightCylinderDisk;
-    rightCylinderDisk = gluNewQuadric();
-    gluQuadricDrawStyle(rightCylinderDisk, GLU_LINE);
-    gluDisk(rightCylinderDisk, 0.0, 0.19*robotBodyWidth, 100, 100);
-    
-    glPopMatrix();
-    glPopMatrix();
-    
-    glPushMatrix();
-    // Position disk object to close lower body cylinder right side
-    glTranslatef(0.0, -1.5*robotBodyLength, 0.15*robotBodyWidth);
-
-    glPushMatrix();
-    // Creating disk object to close lower body cylinder sides
-    GLUquadricObj *leftCylinderDisk;
-    leftCylinderDisk = gluNewQuadric();
-    gluQuadricDrawStyle(leftCylinderDisk, GLU_LINE);
-    gluDisk(leftCylinderDisk, 0.0, 0.19*robotBodyWidth, 100, 100);
-    
-    glPopMatrix();
-    glPopMatrix();
-    
-    glPopMatrix();
+    return robotGraph.AddShape(parent, translation, VECTOR3D(sizeX, sizeY, sizeZ),
+                               robotShape(geometryCache.Cube()), material, MakeCenteredBox(1.0, 1.0, 1.0));
 }
 
-void drawLeftUpperLeg()
+// Cached cylinder, same parameters as gluCylinder
+int addRobotCylinder(int parent, const VECTOR3D &translation, float baseRadius, float topRadius, float height,
+                     GLenum drawStyle, int material)
 {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, robotLeg_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, robotLeg_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, robotLeg_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, robotLeg_mat_shininess);
-    
-    glPushMatrix();
-    glTranslatef(0.25*robotBodyWidth + -0.25*upperLegWidth, -0.5*robotBodyWidth, -0.075*robotBodyWidth);
-    glRotatef(leftHipAngle, 1.0, 0.0, 0.0);
-    glTranslatef(-(0.25*robotBodyWidth + -0.25*upperLegWidth), -(-0.5*robotBodyWidth), -(-0.075*robotBodyWidth));
-    
-    glPushMatrix();
-    glTranslatef(0.25*robotBodyWidth + -0.25*upperLegWidth, -0.5*robotBodyWidth, -0.075*robotBodyWidth);
-    glRotatef(upperLegAngle, 1.0, 0.0, 0.0);
-    glTranslatef(-(0.25*robotBodyWidth + -0.25*upperLegWidth), -(-0.5*robotBodyWidth), -(-0.075*robotBodyWidth));
-    
-    glPushMatrix();
-    // Position upper leg with respect to parent body
-    glTranslatef(0.25*robotBodyWidth + -0.25*upperLegWidth, -0.5*robotBodyWidth, -0.075*robotBodyWidth);
-
-    // build upper leg
-    glPushMatrix();
-    glScalef(upperLegWidth, upperLegLength, upperLegWidth);
-    glutSolidCube(1.0);
-    
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    drawLeftLowerLeg();
+    CachedShape &shape = geometryCache.Cylinder(baseRadius, topRadius, height, drawStyle);
+    return robotGraph.AddShape(parent, translation, VECTOR3D(1.0f, 1.0f, 1.0f), robotShape(shape), material,
+                               cylinderBox(baseRadius, topRadius, height));
 }
 
-void drawRightUpperLeg()
+// Cached disk, same parameters as gluDisk
+int addRobotDisk(int parent, const VECTOR3D &translation, float innerRadius, float outerRadius,
+                 GLenum drawStyle, int material)
 {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, robotLeg_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, robotLeg_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, robotLeg_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, robotLeg_mat_shininess);
-    
-    glPushMatrix();
-    glTranslatef(-(0.25*robotBodyWidth + -0.25*upperLegWidth), -0.5*robotBodyWidth, -0.075*robotBodyWidth);
-    glRotatef(upperLegAngle, 1.0, 0.0, 0.0);
-    glTranslatef((0.25*robotBodyWidth + -0.25*upperLegWidth), 0.5*robotBodyWidth, 0.075*robotBodyWidth);
-    
-    glPushMatrix();
-    // Position upper leg with respect to parent body
-    glTranslatef(-(0.25*robotBodyWidth + -0.25*upperLegWidth), -0.5*robotBodyWidth, -0.075*robotBodyWidth);
-    
-    // build upper leg
-    glPushMatrix();
-    glScalef(upperLegWidth, upperLegLength, upperLegWidth);
-    glutSolidCube(1.0);
-    
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    drawRightLowerLeg();
+    CachedShape &shape = geometryCache.Disk(innerRadius, outerRadius, drawStyle);
+    return robotGraph.AddShape(parent, translation, VECTOR3D(1.0f, 1.0f, 1.0f), robotShape(shape), material,
+                               cylinderBox(outerRadius, outerRadius, 0.0));
 }
 
-void drawLeftLowerLeg()
+// The robot's hierarchy. Joints turn about their pivot by a control angle, the shapes hang
+// off them. Everything below a joint moves with it.
+void buildRobotGraph()
 {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, robotLeg_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, robotLeg_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, robotLeg_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, robotLeg_mat_shininess);
-    
-    glPushMatrix();
-    glTranslatef(0.25*robotBodyWidth + -0.25*upperLegWidth, -0.79*robotBodyWidth, -0.055*robotBodyWidth);
-    glRotatef(leftKneeAngle, 1.0, 0.0, 0.0);
-    glTranslatef(-(0.25*robotBodyWidth + -0.25*upperLegWidth), -(-0.79*robotBodyWidth), -(-0.055*robotBodyWidth));
-    
-    glPushMatrix();
-    glTranslatef(0.25*robotBodyWidth + -0.25*upperLegWidth, -0.79*robotBodyWidth, -0.055*robotBodyWidth);
-    glRotatef(lowerLegAngle, 1.0, 0.0, 0.0);
-    glTranslatef(-(0.25*robotBodyWidth + -0.25*upperLegWidth), -(-0.79*robotBodyWidth), -(-0.055*robotBodyWidth));
-    
-    glPushMatrix();
-    // Position lower leg with respect to parent body
-    glTranslatef(0.25*robotBodyWidth + -0.25*upperLegWidth, -0.79*robotBodyWidth, -0.055*robotBodyWidth);
-
-    // build lower leg
-    glPushMatrix();
-    glScalef(lowerLegWidth, lowerLegLength, lowerLegWidth);
-    glutSolidCube(1.0);
-    
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    drawLeftFoot();
+    VECTOR3D none = VECTOR3D(0.0f, 0.0f, 0.0f);
+    VECTOR3D xAxis = VECTOR3D(1.0f, 0.0f, 0.0f);
+    VECTOR3D yAxis = VECTOR3D(0.0f, 1.0f, 0.0f);
+    VECTOR3D zAxis = VECTOR3D(0.0f, 0.0f, 1.0f);
+
+    // spin robot on base
+    int robot = robotGraph.AddJoint(-1, none, yAxis, JOINT_ROBOT);
+
+    // Body and head
+    addRobotCube(robot, none, robotBodyWidth, robotBodyLength, robotBodyDepth, robotBodyMaterial);
+    addRobotCube(robot, VECTOR3D(0, 0.5*robotBodyLength+0.5*headLength, 0),
+                 0.8*robotBodyWidth, 0.6*robotBodyWidth, 0.6*robotBodyWidth, robotBodyMaterial);
+
+    // Cannon swivels at its base, the short barrel at its end points up
+    VECTOR3D cannonBase = VECTOR3D(0, 0.05*robotBodyLength, 0.1*robotBodyWidth);
+    int cannon = robotGraph.AddJoint(robot, cannonBase, zAxis, JOINT_CANNON);
+    cannon = robotGraph.AddTranslation(cannon, cannonBase);
+    addRobotCylinder(cannon, none, cannonRadius, cannonRadius, cannonHeight, GLU_LINE, gunMaterial);
+    int barrel = robotGraph.AddRotation(cannon, VECTOR3D(0, 0.2*robotBodyLength, 0.68*robotBodyWidth), -90.0, xAxis);
+    addRobotCylinder(barrel, none, 0.4*cannonRadius, 0.4*cannonRadius, 0.1*cannonHeight, GLU_LINE, gunMaterial);
+
+    // Lower body, a cylinder across the hips closed with disks
+    int hips = robotGraph.AddRotation(robot, none, 90.0, yAxis);
+    addRobotCylinder(hips, VECTOR3D(0.0, -1.5*robotBodyLength, -0.15*robotBodyWidth),
+                     0.2*robotBodyWidth, 0.2*robotBodyWidth, 0.5*robotBodyDepth, GLU_FILL, robotLowerBodyMaterial);
+    addRobotDisk(hips, VECTOR3D(0.0, -1.5*robotBodyLength, 0.01*robotBodyWidth),
+                 0.0, 0.19*robotBodyWidth, GLU_LINE, robotLowerBodyMaterial);
+    addRobotDisk(hips, VECTOR3D(0.0, -1.5*robotBodyLength, 0.15*robotBodyWidth),
+                 0.0, 0.19*robotBodyWidth, GLU_LINE, robotLowerBodyMaterial);
+
+    // Legs. The left leg has hip, knee and foot joints the keys drive, upperLegAngle and
+    // lowerLegAngle only tilt the leg segments themselves.
+    float legX = 0.25*robotBodyWidth + -0.25*upperLegWidth;
+    for (int side = 0; side < 2; side++)
+    {
+        bool left = side == 0;
+        float sign = left ? 1.0f : -1.0f;
+
+        VECTOR3D hipPivot = VECTOR3D(sign*legX, -0.5*robotBodyWidth, -0.075*robotBodyWidth);
+        int hip = left ? robotGraph.AddJoint(robot, hipPivot, xAxis, JOINT_LEFT_HIP) : robot;
+        int upperLeg = robotGraph.AddJoint(hip, hipPivot, xAxis, JOINT_UPPER_LEG);
+        addRobotCube(upperLeg, hipPivot, upperLegWidth, upperLegLength, upperLegWidth, robotLegMaterial);
+
+        VECTOR3D kneePivot = VECTOR3D(sign*legX, -0.79*robotBodyWidth, -0.055*robotBodyWidth);
+        int knee = left ? robotGraph.AddJoint(hip, kneePivot, xAxis, JOINT_LEFT_KNEE) : robot;
+        int lowerLeg = robotGraph.AddJoint(knee, kneePivot, xAxis, JOINT_LOWER_LEG);
+        addRobotCube(lowerLeg, kneePivot, lowerLegWidth, lowerLegLength, lowerLegWidth, robotLegMaterial);
+
+        // Ankle cylinder closed with disks, foot and three claws
+        int foot = left ? robotGraph.AddJoint(knee, VECTOR3D(-1.5*lowerLegWidth, -4.1*robotBodyLength, lowerLegWidth),
+                                              xAxis, JOINT_LEFT_FOOT) : robot;
+        int ankle = robotGraph.AddRotation(foot, none, 90.0, yAxis);
+        float ankleZ = left ? 1.0f : -2.1f;
+        addRobotCylinder(ankle, VECTOR3D(-1.5*lowerLegWidth, -4.1*robotBodyLength, ankleZ*lowerLegWidth),
+                         0.3*lowerLegWidth, 0.3*lowerLegWidth, 1.1*lowerLegWidth, GLU_FILL, robotLowerBodyMaterial);
+        addRobotDisk(ankle, VECTOR3D(-1.5*lowerLegWidth, -4.1*robotBodyLength, sign*2.1*lowerLegWidth),
+                     0.0, 0.29*lowerLegWidth, GLU_LINE, robotLowerBodyMaterial);
+        addRobotDisk(ankle, VECTOR3D(-1.5*lowerLegWidth, -4.1*robotBodyLength, sign*1.1*lowerLegWidth),
+                     0.0, 0.29*lowerLegWidth, GLU_LINE, robotLowerBodyMaterial);
+
+        addRobotCube(foot, VECTOR3D(sign*1.55*lowerLegWidth, -5.0*robotBodyLength, 0.6*lowerLegWidth),
+                     lowerLegWidth, 0.3*lowerLegLength, lowerLegWidth, robotLowerBodyMaterial);
+
+        int frontClaw = robotGraph.AddRotation(foot, VECTOR3D(sign*1.55*lowerLegWidth, -5.3*robotBodyLength, 1.3*lowerLegWidth),
+                                               90.0, xAxis);
+        addRobotCube(frontClaw, none, clawWidth, clawLength, clawWidth, robotLowerBodyMaterial);
+
+        float clawX[2] = { 2.2f, 0.9f };
+        for (int c = 0; c < 2; c++)
+        {
+            int claw = robotGraph.AddRotation(foot, VECTOR3D(sign*clawX[c]*lowerLegWidth, -5.3*robotBodyLength, 0.6*lowerLegWidth),
+                                              90.0, xAxis);
+            claw = robotGraph.AddRotation(claw, none, 90.0, zAxis);
+            addRobotCube(claw, none, clawWidth, clawLength, clawWidth, robotLowerBodyMaterial);
+        }
+    }
 }
 
-void drawRightLowerLeg()
+// Start the simulation thread. It is stopped at exit before the worker pool it uses is
+// destroyed, so the pool is made first to be destroyed last.
+void startFramePipeline()
 {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, robotLeg_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, robotLeg_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, robotLeg_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, robotLeg_mat_shininess);
-    
-    glPushMatrix();
-    glTranslatef(-(0.25*robotBodyWidth + -0.25*upperLegWidth), -0.79*robotBodyWidth, -0.055*robotBodyWidth);
-    glRotatef(lowerLegAngle, 1.0, 0.0, 0.0);
-    glTranslatef((0.25*robotBodyWidth + -0.25*upperLegWidth), 0.79*robotBodyWidth, 0.055*robotBodyWidth);
-    
-    glPushMatrix();
-    // Position lower leg with respect to parent body
-    glTranslatef(-(0.25*robotBodyWidth + -0.25*upperLegWidth), -0.79*robotBodyWidth, -0.055*robotBodyWidth);
-
-    // build lower leg
-    glPushMatrix();
-    glScalef(lowerLegWidth, lowerLegLength, lowerLegWidth);
-    glutSolidCube(1.0);
-    
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    drawRightFoot();
+    WorkerPool::Shared();
+    framePipeline.Start(buildFrame);
+    atexit(stopFramePipeline);
 }
 
-void drawLeftFoot()
+void stopFramePipeline()
 {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, robotLowerBody_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, robotLowerBody_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, robotLowerBody_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, robotLowerBody_mat_shininess);
-    
-    glPushMatrix();
-    glTranslatef(-1.5*lowerLegWidth, -4.1*robotBodyLength, lowerLegWidth);
-    glRotatef(leftFootAngle, 1.0, 0.0, 0.0);
-    glTranslatef(1.5*lowerLegWidth, 4.1*robotBodyLength, -lowerLegWidth);
-    
-    glPushMatrix();
-    glRotatef(90.0, 0.0, 1.0, 0.0);
-    
-    glPushMatrix();
-    // Position lower cylindrical join in respect to body
-    glTranslatef(-1.5*lowerLegWidth, -4.1*robotBodyLength, lowerLegWidth);
-    
-    glPushMatrix();
-    // Creating cylinder object for lower body
-    gluCylinder(gluNewQuadric(), 0.3*lowerLegWidth, 0.3*lowerLegWidth, 1.1*lowerLegWidth, 100, 100);
-    
-    glPopMatrix();
-    glPopMatrix();
-    
-    glPushMatrix();
-    // Position disk object to close lower body cylinder left side
-    glTranslatef(-1.5*lowerLegWidth, -4.1*robotBodyLength, -(-2.1*lowerLegWidth));
-
-    glPushMatrix();
-    // Creating disk object to close lower body cylinder sides
-    GLUquadricObj *leftFoot_rightDisk;
-    leftFoot_rightDisk = gluNewQuadric();
-    gluQuadricDrawStyle(leftFoot_rightDisk, GLU_LINE);
-    gluDisk(leftFoot_rightDisk, 0.0, 0.29*lowerLegWidth, 100, 100);
-    
-    glPopMatrix();
-    glPopMatrix();
-
-    glPushMatrix();
-    // Position disk object to close lower body cylinder right side
-    glTranslatef(-1.5*lowerLegWidth, -4.1*robotBodyLength, -(-1.1*lowerLegWidth));
-
-    glPushMatrix();
-    // Creating disk object to close lower body cylinder sides
-    GLUquadricObj *leftFoot_leftDisk;
-    leftFoot_leftDisk = gluNewQuadric();
-    gluQuadricDrawStyle(leftFoot_leftDisk, GLU_LINE);
-    gluDisk(leftFoot_leftDisk, 0.0, 0.29*lowerLegWidth, 100, 100);
-
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    // FOOT
-    glPushMatrix();
-    // Position upper leg with respect to parent body
-    glTranslatef(-(-1.55*lowerLegWidth), -5.0*robotBodyLength, 0.6*lowerLegWidth);
-
-    // build upper leg
-    glPushMatrix();
-    glScalef(lowerLegWidth, 0.3*lowerLegLength, lowerLegWidth);
-    glutSolidCube(1.0);
-
-    glPopMatrix();
-    glPopMatrix();
-    
-    // Front Claw
-    glPushMatrix();
-    glTranslatef(1.55*lowerLegWidth, -5.3*robotBodyLength, 1.3*lowerLegWidth);
-    
-    glPushMatrix();
-    glRotatef(90.0, 1.0, 0.0, 0.0);
-    
-    glPushMatrix();
-    glScalef(clawWidth, clawLength, clawWidth);
-    glutSolidCube(1.0);
+    framePipeline.Stop();
+}
 
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    // Left Claw
-    glPushMatrix();
-    glTranslatef(2.2*lowerLegWidth, -5.3*robotBodyLength, 0.6*lowerLegWidth);
-    
-    glPushMatrix();
-    glRotatef(90.0, 1.0, 0.0, 0.0);
-    glPushMatrix();
-    glRotatef(90.0, 0.0, 0.0, 1.0);
-    
-    glPushMatrix();
-    glScalef(clawWidth, clawLength, clawWidth);
-    glutSolidCube(1.0);
-
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    // Right Claw
-    glPushMatrix();
-    glTranslatef(0.9*lowerLegWidth, -5.3*robotBodyLength, 0.6*lowerLegWidth);
-    
-    glPushMatrix();
-    glRotatef(90.0, 1.0, 0.0, 0.0);
-    glPushMatrix();
-    glRotatef(90.0, 0.0, 0.0, 1.0);
-    
-    glPushMatrix();
-    glScalef(clawWidth, clawLength, clawWidth);
-    glutSolidCube(1.0);
-
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix(); // closing left leg hierarchy here
+// The loader uses the worker pool, so it has to stop before the pool is destroyed at exit.
+// Headless runs have already deleted the pager by then.
+void stopTerrainPager()
+{
+    if (terrainPager)
+        terrainPager->Stop();
 }
 
-void drawRightFoot()
+// Hand the keys pressed since the last frame and the current settings to the simulation
+// and ask for the next frame. The window simulates real time, scripted headless runs 1/60 s
+// a frame, added up if frames are asked for faster than they are built.
+void requestFrame()
 {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, robotLowerBody_mat_ambient);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, robotLowerBody_mat_specular);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, robotLowerBody_mat_diffuse);
-    glMaterialfv(GL_FRONT, GL_SHININESS, robotLowerBody_mat_shininess);
-    
-    glPushMatrix();
-    glRotatef(90.0, 0.0, 1.0, 0.0);
-    
-    glPushMatrix();
-    // Position lower cylindrical join in respect to body
-    glTranslatef(-1.5*lowerLegWidth, -4.1*robotBodyLength, -2.1*lowerLegWidth);
-    
-    glPushMatrix();
-    // Creating cylinder object for lower body
-    gluCylinder(gluNewQuadric(), 0.3*lowerLegWidth, 0.3*lowerLegWidth, 1.1*lowerLegWidth, 100, 100);
-    
-    glPopMatrix();
-    glPopMatrix();
-    
-    glPushMatrix();
-    // Position disk object to close lower body cylinder left side
-    glTranslatef(-1.5*lowerLegWidth, -4.1*robotBodyLength, -2.1*lowerLegWidth);
-
-    glPushMatrix();
-    // Creating disk object to close lower body cylinder sides
-    GLUquadricObj *rightFoot_rightDisk;
-    rightFoot_rightDisk = gluNewQuadric();
-    gluQuadricDrawStyle(rightFoot_rightDisk, GLU_LINE);
-    gluDisk(rightFoot_rightDisk, 0.0, 0.29*lowerLegWidth, 100, 100);
-    
-    glPopMatrix();
-    glPopMatrix();
-
-    glPushMatrix();
-    // Position disk object to close lower body cylinder right side
-    glTranslatef(-1.5*lowerLegWidth, -4.1*robotBodyLength, -1.1*lowerLegWidth);
-
-    glPushMatrix();
-    // Creating disk object to close lower body cylinder sides
-    GLUquadricObj *rightFoot_leftDisk;
-    rightFoot_leftDisk = gluNewQuadric();
-    gluQuadricDrawStyle(rightFoot_leftDisk, GLU_LINE);
-    gluDisk(rightFoot_leftDisk, 0.0, 0.29*lowerLegWidth, 100, 100);
-
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    // FOOT
-    glPushMatrix();
-    // Position upper leg with respect to parent body
-    glTranslatef(-1.55*lowerLegWidth, -5.0*robotBodyLength, 0.6*lowerLegWidth);
-
-    // build upper leg
-    glPushMatrix();
-    glScalef(lowerLegWidth, 0.3*lowerLegLength, lowerLegWidth);
-    glutSolidCube(1.0);
-    
-    glPopMatrix();
-    glPopMatrix();
-    
-    // Front Claw
-    glPushMatrix();
-    glTranslatef(-1.55*lowerLegWidth, -5.3*robotBodyLength, 1.3*lowerLegWidth);
-    
-    glPushMatrix();
-    glRotatef(90.0, 1.0, 0.0, 0.0);
-    
-    glPushMatrix();
-    glScalef(clawWidth, clawLength, clawWidth);
-    glutSolidCube(1.0);
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        FrameInput &input = pendingInput;
+        if (headlessMode)
+            input.frameTime = (input.frameTime > 0.0 ? input.frameTime : 0.0) + 1.0 / 60.0;
+        else
+            input.frameTime = -1.0;
+        input.cannonSpinning = cannonSpinning;
+        input.walking = walking;
+        input.groundAnimating = groundAnimating;
+        input.useTerrain = useTerrain;
+        input.frustumCulling = frustumCulling;
+        input.view = viewMatrix;
+        input.projection = projectionMatrix;
+    }
+    framePipeline.Request();
+}
 
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    // Right Claw
-    glPushMatrix();
-    glTranslatef(-2.2*lowerLegWidth, -5.3*robotBodyLength, 0.6*lowerLegWidth);
-    
-    glPushMatrix();
-    glRotatef(90.0, 1.0, 0.0, 0.0);
-    glPushMatrix();
-    glRotatef(90.0, 0.0, 0.0, 1.0);
-    
-    glPushMatrix();
-    glScalef(clawWidth, clawLength, clawWidth);
-    glutSolidCube(1.0);
-
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    
-    // Left Claw
-    glPushMatrix();
-    glTranslatef(-0.9*lowerLegWidth, -5.3*robotBodyLength, 0.6*lowerLegWidth);
-    
-    glPushMatrix();
-    glRotatef(90.0, 1.0, 0.0, 0.0);
-    glPushMatrix();
-    glRotatef(90.0, 0.0, 0.0, 1.0);
-    
-    glPushMatrix();
-    glScalef(clawWidth, clawLength, clawWidth);
-    glutSolidCube(1.0);
+// Simulation thread: build the frame in the given slot from the input gathered since the
+// last one
+void buildFrame(int slot)
+{
+    PROFILE_ZONE("buildFrame");
+    double start = SimulationClock::Now();
+    FrameState &frame = frameStates[slot];
+    {
+        // Take the input and leave the key presses behind for the next frame
+        std::lock_guard<std::mutex> lock(inputMutex);
+        frame.input = pendingInput;
+        for (int j = 0; j < JOINT_COUNT; j++)
+        {
+            pendingInput.jointSet[j] = false;
+            pendingInput.jointTurn[j] = 0.0f;
+        }
+        pendingInput.restartWalk = false;
+        pendingInput.resetClock = false;
+        pendingInput.frameTime = 0.0;
+    }
+    const FrameInput &input = frame.input;
+    applyInput(input);
+
+    int steps = input.frameTime < 0.0 ? simulationClock.Advance() : simulationClock.Advance(input.frameTime);
+    for (int i = 0; i < steps; i++)
+        stepAnimation(input, simulationClock.GetStep());
+    applyAnimation(simulationClock.Alpha(), frame);
+
+    poseRobots(frame);
+    collideRobots(frame);
+    queueRobots(frame);
+    frame.simulationMs = 1000.0 * (SimulationClock::Now() - start);
+}
+
+// Simulation thread: apply the key presses to every robot and the animation state
+void applyInput(const FrameInput &input)
+{
+    for (int j = 0; j < JOINT_COUNT; j++)
+    {
+        if (!input.jointSet[j] && input.jointTurn[j] == 0.0f)
+            continue;
+        for (int i = 0; i < numRobots; i++)
+        {
+            float &angle = robots[i].controls.jointAngles[j];
+            if (input.jointSet[j])
+                angle = input.jointValue[j];
+            angle += input.jointTurn[j];
+        }
+    }
 
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
-    glPopMatrix();
+    if (input.restartWalk)
+        currentAnimation.walkTime = previousAnimation.walkTime = 0.0;
+    if (input.resetClock)
+    {
+        // Time spent stopped is not simulated
+        simulationClock.Reset();
+        previousAnimation = currentAnimation;
+    }
+}
+
+// Animate every robot, bring its world matrices up to date and work out which of its
+// shapes are in view. Robots are independent, so all of it runs on the worker threads.
+// The matrices of the shapes in view are copied into the frame, so the render thread never
+// reads the robots themselves.
+void poseRobots(FrameState &frame)
+{
+    PROFILE_ZONE("poseRobots");
+    double start = SimulationClock::Now();
+    const FrameInput &input = frame.input;
+    int numShapes = (int)robotShapeNodes.size();
+    Frustum frustum;
+    frustum.Extract(input.projection, input.view);
+
+    std::atomic<int> nodesUpdated(0);
+    WorkerPool::Shared().ParallelFor(numRobots, 64, [&](int begin, int end)
+    {
+        // Clip output for this range of robots. The cannon stays where it stopped, the walk
+        // only counts while walking.
+        int count = end - begin;
+        for (int j = 0; j < JOINT_COUNT; j++)
+            std::fill(&robotAnimatedAngles[j * numRobots + begin], &robotAnimatedAngles[j * numRobots] + end, 0.0f);
+        std::fill(&robotClipTimes[begin], &robotClipTimes[0] + end, cannonClipTime);
+        cannonClip.EvaluateBatch(&robotClipTimes[begin], count, 1.0f, &robotAnimatedAngles[begin], numRobots);
+        if (input.walking)
+        {
+            for (int i = begin; i < end; i++)
+                robotClipTimes[i] = walkClipTime + robots[i].controls.walkOffset;
+            walkClip.EvaluateBatch(&robotClipTimes[begin], count, 1.0f, &robotAnimatedAngles[begin], numRobots);
+        }
+
+        int updated = 0;
+        for (int i = begin; i < end; i++)
+        {
+            RobotInstance &robot = robots[i];
+            std::vector<float> &joints = robot.state.jointAngles;
+            for (int j = 0; j < JOINT_COUNT; j++)
+                joints[j] = robot.controls.jointAngles[j] + robotAnimatedAngles[j * numRobots + i];
+
+            MATRIX4X4 root;
+            root.Translate(robot.position.x, robot.position.y, robot.position.z);
+            robot.state.SetRoot(root);
+            updated += robotGraph.Update(robot.state);
+
+            unsigned char *visible = &frame.robotShapeVisible[i * numShapes];
+            MATRIX4X4 *transforms = &frame.robotTransforms[i * numShapes];
+            BBox &box = frame.robotBoxes[i];
+            box.min = box.max = robot.position;
+            bool anyVisible = false;
+            for (int k = 0; k < numShapes; k++)
+            {
+                int node = robotShapeNodes[k];
+                const MATRIX4X4 &world = robot.state.world[node];
+                if (collisionsEnabled)
+                    robotCollisions.SetBody(i * numShapes + k, i, robotGraph.GetBox(node), world);
+                visible[k] = !input.frustumCulling || !frustum.BoxOutside(robotGraph.GetBox(node), world);
+                if (!visible[k])
+                    continue;
+                transforms[k] = world;
+
+                BBox part = TransformBox(robotGraph.GetBox(node), world);
+                if (!anyVisible)
+                    box = part;
+                ExtendBox(box, part.min.x, part.min.y, part.min.z);
+                ExtendBox(box, part.max.x, part.max.y, part.max.z);
+                anyVisible = true;
+            }
+        }
+        nodesUpdated += updated;
+    });
+    frame.robotNodesUpdated = nodesUpdated;
+    frame.robotUpdateMs = 1000.0 * (SimulationClock::Now() - start);
+}
+
+// Find the parts of robots touching other robots or in the ground and move those robots
+// apart and up out of the ground, from the next frame on. The ground is the ground mesh,
+// or the terrain while that is drawn instead.
+void collideRobots(FrameState &frame)
+{
+    if (!collisionsEnabled)
+        return;
+    PROFILE_ZONE("collideRobots");
+    const HeightQuadtree &groundTree = frame.groundTree;
+    if (frame.input.useTerrain && !softRasterizer)
+    {
+        // The render thread owns the terrain's meshes, so the heights come from where the
+        // meshes get theirs. The streamed terrain is drawn with the walk at the origin and
+        // its highest point is not known, so every part is tested.
+        double travelX = frame.travelX;
+        double travelZ = frame.travelZ;
+        robotCollisions.SetGround([travelX, travelZ](float x, float z) -> float
+        {
+            if (terrainPager)
+                return terrainPager->GetHeight(x + travelX, z + travelZ) + groundOffset;
+            float height;
+            return terrain->GetHeight(x, z, height) ? height + groundOffset : -FLT_MAX;
+        }, FLT_MAX);
+    }
+    else
+        robotCollisions.SetGround([&groundTree](float x, float z) -> float
+        {
+            float height;
+            return groundTree.GetHeight(x, z, height) ? height + groundOffset : -FLT_MAX;
+        }, groundTree.GetBoundingBox().max.y + groundOffset);
+    robotCollisions.FindContacts();
+    frame.collisionStats = robotCollisions.GetStats();
+
+    // The deepest contact of each pair of robots, and of each robot with the ground, first
+    // among that pair's contacts
+    std::vector<Contact> contacts = robotCollisions.GetContacts();
+    std::sort(contacts.begin(), contacts.end(), [](const Contact &a, const Contact &b)
+    {
+        if (a.ownerA != b.ownerA)
+            return a.ownerA < b.ownerA;
+        if (a.ownerB != b.ownerB)
+            return a.ownerB < b.ownerB;
+        return a.depth > b.depth;
+    });
+    for (size_t i = 0; i < contacts.size(); i++)
+    {
+        const Contact &contact = contacts[i];
+        if (i > 0 && contact.ownerA == contacts[i - 1].ownerA && contact.ownerB == contacts[i - 1].ownerB)
+            continue;
+        RobotInstance &a = robots[contact.ownerA];
+        if (contact.ownerB < 0)
+        {
+            a.position.y += contact.depth;
+            continue;
+        }
+
+        // Robots stand on the ground, so they are pushed apart across it, half each way
+        RobotInstance &b = robots[contact.ownerB];
+        VECTOR3D across(contact.normal.x, 0.0f, contact.normal.z);
+        if (across.GetLength() < 0.01f)
+            across.Set(b.position.x - a.position.x, 0.0f, b.position.z - a.position.z);
+        if (across.GetLength() < 0.01f)
+            across.Set(1.0f, 0.0f, 0.0f);
+        across.Normalize();
+        a.position -= across * (0.5f * contact.depth);
+        b.position += across * (0.5f * contact.depth);
+    }
+}
+
+// Queue every robot's visible shapes, to be drawn sorted by material, then shape, so each
+// material is set and each shape bound as few times as possible, then merged into batches
+void queueRobots(FrameState &frame)
+{
+    PROFILE_ZONE("queueRobots");
+    int numShapes = (int)robotShapeNodes.size();
+    frame.robotQueue.Clear();
+    frame.robotCullStats.Reset();
+    for (int k = 0; k < numShapes; k++)
+    {
+        int node = robotShapeNodes[k];
+        int geometry = robotGraph.GetGeometry(node);
+        int material = robotGraph.GetMaterial(node);
+
+        for (int i = 0; i < numRobots; i++)
+        {
+            if (!frame.robotShapeVisible[i * numShapes + k])
+            {
+                frame.robotCullStats.culled++;
+                continue;
+            }
+            frame.robotCullStats.drawn++;
+            frame.robotQueue.Add(material, geometry, robotShapes[geometry], frame.robotTransforms[i * numShapes + k]);
+        }
+    }
+
+    // The software renderer draws the items as they are
+    if (batchRobots && !softRasterizer)
+        frame.robotQueue.BuildBatches();
+}
+
+// Turn a joint of every robot by degrees, from the next frame on
+void turnRobotJoint(int joint, float degrees)
+{
+    std::lock_guard<std::mutex> lock(inputMutex);
+    pendingInput.jointTurn[joint] += degrees;
+}
+
+// Set a joint of every robot to angle, from the next frame on
+void setRobotJoint(int joint, float angle)
+{
+    std::lock_guard<std::mutex> lock(inputMutex);
+    pendingInput.jointSet[joint] = true;
+    pendingInput.jointValue[joint] = angle;
+    pendingInput.jointTurn[joint] = 0.0f;
+}
+
+// Report drawn/culled objects and the state changes made and avoided in the window title
+// whenever they change, and draw the profiler overlay when it is on
+void showFrameStats()
+{
+    if (headlessMode)
+        return;
+
+    if (profileOverlay && Profiler::Shared().IsEnabled())
+        Profiler::Shared().DrawOverlay(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+
+    const MaterialStats &materialStats = MaterialRegistry::Shared().GetStats();
+    const RenderQueueStats &queueStats = frameStates[drawnFrame].robotQueue.GetStats();
+
+    char title[256];
+    sprintf(title, "Bot 1 - Ramneek Riar (drawn %d, culled %d%s, materials %d set %d skipped, shapes %d bound %d reused)",
+            cullStats.drawn, cullStats.culled, frustumCulling ? "" : ", culling off",
+            materialStats.applied, materialStats.skipped, queueStats.binds, queueStats.bindsSkipped);
+    if (selectedRobot >= 0)
+        sprintf(title + strlen(title), ", robot %d selected", selectedRobot);
+    if (groundTargetSet)
+        sprintf(title + strlen(title), ", target (%.1f, %.1f, %.1f)", groundTarget.x, groundTarget.y, groundTarget.z);
+    if (strcmp(title, lastStatsTitle) == 0)
+        return;
+    strcpy(lastStatsTitle, title);
+    glutSetWindowTitle(title);
 }
 
 // Callback, called at initialization and whenever user resizes the window.
@@ -754,21 +1475,20 @@ void reshape(int w, int h)
     // Set up viewport, projection, then change to modelview matrix mode -
     // display function will then set up camera and do modeling transforms.
     glViewport(0, 0, (GLsizei)w, (GLsizei)h);
+    if (softRasterizer)
+        softRasterizer->SetViewport(w, h);
 
+    projectionMatrix.SetPerspective(60.0, (float)w / h, 0.2, farPlane);
     glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(60.0, (GLdouble)w / h, 0.2, 40.0);
+    glLoadMatrixf(projectionMatrix);
 
+    // Create Viewing Matrix V
+    // Set up the camera at eyePosition looking at the origin, up along positive y axis
+    viewMatrix.SetLookAt(eyePosition, VECTOR3D(0.0f, 0.0f, 0.0f), VECTOR3D(0.0f, 1.0f, 0.0f));
     glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-
-    // Set up the camera at position (0, 6, 22) looking at the origin, up along positive y axis
-    gluLookAt(0.0, 6.0, 22.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+    glLoadMatrixf(viewMatrix);
 }
 
-bool cannonStop = false;
-bool leftStep = false;
-
 // Callback, handles input from the keyboard, non-arrow keys
 void keyboard(unsigned char key, int x, int y)
 {
@@ -784,68 +1504,179 @@ void keyboard(unsigned char key, int x, int y)
             curJoint = 'k';
         break;
     case 'c':
-        cannonStop = false;
-        glutTimerFunc(10, cannonAnimationHandler, 0);
+        cannonSpinning = true;
         break;
     case 'C':
-        cannonStop = true;
+        cannonSpinning = false;
         break;
     case 'w':
-        leftStep = false;
-        glutTimerFunc(1800, stepAnimationHandler, 0);
+        if (!walking)
+        {
+            walking = true;
+            std::lock_guard<std::mutex> lock(inputMutex);
+            pendingInput.restartWalk = true;
+        }
         break;
     case 'W':
-        leftHipAngle = 0.0;
-        leftKneeAngle = 0.0;
-        leftFootAngle = 0.0;
-        leftStep = true;
-        glutPostRedisplay();
+        setRobotJoint(JOINT_LEFT_HIP, 0.0f);
+        setRobotJoint(JOINT_LEFT_KNEE, 0.0f);
+        setRobotJoint(JOINT_LEFT_FOOT, 0.0f);
+        walking = false;
+        break;
+    case 'g':
+        groundAnimating = true;
+        break;
+    case 'G':
+        groundAnimating = false;
+        break;
+    case 't':
+        useTerrain = !useTerrain;
+        break;
+    case 'v':
+        frustumCulling = !frustumCulling;
+        break;
+    case 'p':
+        profileOverlay = !profileOverlay;
+        break;
+    case 'P':
+        if (profileTracePath)
+            Profiler::Shared().WriteTrace(profileTracePath);
         break;
     }
 
+    updateIdle();
     glutPostRedisplay();   // Trigger a window redisplay
 }
 
 
-void cannonAnimationHandler(int param)
+// Gentle hills for the tiled terrain, which do not move
+float terrainHeight(float x, float z, float time)
 {
-    if (!cannonStop)
+    (void)time;
+    return 1.5 * sin(0.15 * x) * cos(0.12 * z) + 0.5 * sin(0.05 * x + 0.07 * z);
+}
+
+// Rolling waves across the ground
+float groundWaveHeight(float x, float z, float time)
+{
+    return 0.6 * sin(0.4 * x + 2.0 * time) * cos(0.3 * z + 1.5 * time);
+}
+
+// Idle callback while anything animates. Asks for one redisplay, which has the simulation
+// catch up to the present. With vertical sync each swap waits for the display, which limits this
+// to one call per refresh, otherwise frames are spaced to 60 a second here.
+void idle()
+{
+    if (!vsyncEnabled)
     {
-        cannonAngle += 5.0;
-        glutPostRedisplay();
-        glutTimerFunc(10, cannonAnimationHandler, 0);
+        static double lastFrame = 0.0;
+        double wait = lastFrame + 1.0 / 60.0 - SimulationClock::Now();
+        if (wait > 0.0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        lastFrame = SimulationClock::Now();
     }
+
+    glutPostRedisplay();
 }
 
-void stepAnimationHandler(int param)
+// Keys for the cannon spin and the left leg's step. The leg steps forward 0.8 s into the
+// 1.8 s cycle and back 0.2 s later, easing in and out of each move.
+void initAnimations()
 {
-    if (!leftStep)
+    cannonClip.AddKey(JOINT_CANNON, 0.0f, 0.0f);
+    cannonClip.AddKey(JOINT_CANNON, cannonClip.GetDuration(), 360.0f);
+    cannonClip.Bake();
+
+    const int stepJoints[] = { JOINT_LEFT_HIP, JOINT_LEFT_KNEE };
+    const float stepAngles[] = { -50.0f, 50.0f };
+    for (int i = 0; i < 2; i++)
     {
-        glutTimerFunc(800, leftStepForwardAnimationHandler, 0);
-        glutTimerFunc(1000, leftStepBackwardAnimationHandler, 0);
-        glutTimerFunc(1800, stepAnimationHandler, 0);
-        glutPostRedisplay();
+        walkClip.AddKey(stepJoints[i], 0.0f, 0.0f, AnimationClip::STEP);
+        walkClip.AddKey(stepJoints[i], 0.8f, 0.0f, AnimationClip::SMOOTH);
+        walkClip.AddKey(stepJoints[i], 0.85f, stepAngles[i], AnimationClip::STEP);
+        walkClip.AddKey(stepJoints[i], 0.95f, stepAngles[i], AnimationClip::SMOOTH);
+        walkClip.AddKey(stepJoints[i], 1.0f, 0.0f);
     }
+    walkClip.Bake();
 }
 
-void leftStepForwardAnimationHandler(int param)
+// Run idle() only while something is animating, so a still scene uses no CPU
+void updateIdle()
 {
-    if (!leftStep)
+    bool animating = cannonSpinning || walking || groundAnimating;
+    if (animating && !idleRunning)
+    {
+        // Time spent stopped is not simulated
         {
-            leftHipAngle -= 50.0;
-            leftKneeAngle += 50.0;
-            glutPostRedisplay();
+            std::lock_guard<std::mutex> lock(inputMutex);
+            pendingInput.resetClock = true;
         }
+        glutIdleFunc(idle);
+    }
+    else if (!animating && idleRunning)
+    {
+        glutIdleFunc(NULL);
+    }
+    idleRunning = animating;
 }
 
-void leftStepBackwardAnimationHandler(int param)
+// Simulation thread: one fixed step of every running animation
+void stepAnimation(const FrameInput &input, double step)
 {
-    if (!leftStep)
+    previousAnimation = currentAnimation;
+    if (input.cannonSpinning)
+    {
+        currentAnimation.cannonTime += step;
+        if (previousAnimation.cannonTime >= cannonClip.GetDuration())
+        {
+            // Keep both in range together so interpolating between them still works
+            previousAnimation.cannonTime -= cannonClip.GetDuration();
+            currentAnimation.cannonTime -= cannonClip.GetDuration();
+        }
+    }
+    if (input.walking)
+    {
+        currentAnimation.walkTime += step;
+
+        // Robot 0 walks the way it faces
+        float heading = robots[0].controls.jointAngles[JOINT_ROBOT] * 3.14159265358979f / 180.0f;
+        currentAnimation.travelX += walkSpeed * step * sin(heading);
+        currentAnimation.travelZ += walkSpeed * step * cos(heading);
+        if (previousAnimation.walkTime >= walkClip.GetDuration())
         {
-            leftHipAngle += 50.0;
-            leftKneeAngle -= 50.0;
-            glutPostRedisplay();
+            previousAnimation.walkTime -= walkClip.GetDuration();
+            currentAnimation.walkTime -= walkClip.GetDuration();
         }
+    }
+    if (input.groundAnimating)
+        currentAnimation.groundTime += step;
+}
+
+// Simulation thread: sets the clip times and the frame's ground for drawing, alpha of the
+// way from the previous step to the current one
+void applyAnimation(double alpha, FrameState &frame)
+{
+    PROFILE_ZONE("applyAnimation");
+    AnimationState state;
+    state.cannonTime = previousAnimation.cannonTime + alpha * (currentAnimation.cannonTime - previousAnimation.cannonTime);
+    state.walkTime = previousAnimation.walkTime + alpha * (currentAnimation.walkTime - previousAnimation.walkTime);
+    state.groundTime = previousAnimation.groundTime + alpha * (currentAnimation.groundTime - previousAnimation.groundTime);
+    frame.travelX = previousAnimation.travelX + alpha * (currentAnimation.travelX - previousAnimation.travelX);
+    frame.travelZ = previousAnimation.travelZ + alpha * (currentAnimation.travelZ - previousAnimation.travelZ);
+
+    // The clips themselves are evaluated per robot in poseRobots()
+    cannonClipTime = (float)state.cannonTime;
+    walkClipTime = (float)state.walkTime;
+
+    // Rebuilding the ground is the expensive part, done at most once a frame. Each slot has
+    // its own copy, rebuilt whenever it is behind.
+    float groundTime = (float)state.groundTime;
+    if (groundTime != frame.groundMeshTime)
+    {
+        frame.groundMeshTime = groundTime;
+        frame.groundMesh->UpdateMesh(groundWaveHeight, groundTime);
+        frame.groundTree.Build(*frame.groundMesh);
+    }
 }
 
 
@@ -857,33 +1688,33 @@ void functionKeys(int key, int x, int y)
         case GLUT_KEY_LEFT:
             if (curJoint == 'b')
             {
-                robotAngle -= 2.0;
+                turnRobotJoint(JOINT_ROBOT, -2.0f);
             }
             break;
         case GLUT_KEY_RIGHT:
             if (curJoint == 'b')
             {
-                robotAngle += 2.0;
+                turnRobotJoint(JOINT_ROBOT, 2.0f);
             }
             break;
         case GLUT_KEY_UP:
             if (curJoint == 'k')
             {
-                leftKneeAngle -= 2.0;
+                turnRobotJoint(JOINT_LEFT_KNEE, -2.0f);
             }
             else if (curJoint == 'h')
             {
-                leftHipAngle -= 2.0;
+                turnRobotJoint(JOINT_LEFT_HIP, -2.0f);
             }
             break;
         case GLUT_KEY_DOWN:
             if (curJoint == 'k')
             {
-                leftKneeAngle += 2.0;
+                turnRobotJoint(JOINT_LEFT_KNEE, 2.0f);
             }
             else if (curJoint == 'h')
             {
-                leftHipAngle += 2.0;
+                turnRobotJoint(JOINT_LEFT_HIP, 2.0f);
             }
             break;
     }
@@ -902,8 +1733,7 @@ void mouse(int button, int state, int x, int y)
     case GLUT_LEFT_BUTTON:
         if (state == GLUT_DOWN)
         {
-            ;
-
+            pickAt(x, y, true);
         }
         break;
     case GLUT_RIGHT_BUTTON:
@@ -925,9 +1755,110 @@ void mouseMotionHandler(int xMouse, int yMouse)
 {
     if (currentButton == GLUT_LEFT_BUTTON)
     {
-        ;
+        // Dragging moves the target over the ground
+        pickAt(xMouse, yMouse, false);
     }
 
     glutPostRedisplay();   // Trigger a window redisplay
 }
 
+// Nearest robot part in view the world space ray hits before maxT. Each robot's box is
+// tested first, then the boxes of its parts.
+bool pickRobot(const FrameState &frame, const Ray &ray, float maxT, int &robot, float &t)
+{
+    int numShapes = (int)robotShapeNodes.size();
+    int nearest = -1;
+    for (int i = 0; i < numRobots; i++)
+    {
+        float hit;
+        if (!RayHitsBox(ray, frame.robotBoxes[i], maxT, hit))
+            continue;
+        for (int k = 0; k < numShapes; k++)
+        {
+            if (!frame.robotShapeVisible[i * numShapes + k])
+                continue;
+            Ray local = InverseTransformRay(ray, frame.robotTransforms[i * numShapes + k]);
+            if (RayHitsBox(local, robotGraph.GetBox(robotShapeNodes[k]), maxT, hit))
+            {
+                maxT = hit;
+                nearest = i;
+            }
+        }
+    }
+    if (nearest < 0)
+        return false;
+    robot = nearest;
+    t = maxT;
+    return true;
+}
+
+// Where the world space ray first meets the ground before maxT: the ground mesh, or the
+// tiled or streamed terrain when that is drawn instead. Render thread, which owns the terrain.
+bool pickGround(const FrameState &frame, const Ray &ray, float maxT, float &t)
+{
+    Ray ground = ray;
+    ground.origin.y -= groundOffset;
+    if (frame.input.useTerrain && !softRasterizer)
+    {
+        // The streamed terrain is drawn with the robots' walk at the origin, as display() does
+        if (terrainPager)
+            return terrainPager->Intersect(frame.travelX, frame.travelZ, ground, maxT, t);
+        return terrain->Intersect(ground, maxT, t);
+    }
+    int quad;
+    return frame.groundTree.Intersect(ground, maxT, t, quad);
+}
+
+// What is under window position (x, y) in the frame on screen. The ground becomes the
+// target. If selectRobots is set a robot in front is selected, and the selection is cleared
+// when there is none.
+void pickAt(int x, int y, bool selectRobots)
+{
+    if (drawnFrame < 0)
+        return;
+    const FrameState &frame = frameStates[drawnFrame];
+    Ray ray = UnprojectRay(frame.input.projection, frame.input.view, x + 0.5f, y + 0.5f,
+                           glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+
+    // Rays from UnprojectRay reach the far plane at t = farPlane
+    int robot;
+    float robotT, groundT;
+    bool robotHit = pickRobot(frame, ray, farPlane, robot, robotT);
+    bool groundHit = pickGround(frame, ray, robotHit ? robotT : farPlane, groundT);
+    if (groundHit)
+    {
+        groundTarget = ray.origin + groundT * ray.direction;
+        groundTargetSet = true;
+    }
+    if (selectRobots)
+        selectedRobot = robotHit && !groundHit ? robot : -1;
+}
+
+// Casts pickRays rays through a grid over the window at the frame's robots and ground,
+// split across the worker pool, and counts what they hit
+void benchmarkPicking(const FrameState &frame, int &robotHits, int &groundHits)
+{
+    int side = (int)ceil(sqrt((double)pickRays));
+    std::atomic<int> robots(0), ground(0);
+    WorkerPool::Shared().ParallelFor(pickRays, 256, [&](int begin, int end)
+    {
+        int robotCount = 0, groundCount = 0;
+        for (int i = begin; i < end; i++)
+        {
+            float x = (i % side + 0.5f) * vWidth / side;
+            float y = (i / side + 0.5f) * vHeight / side;
+            Ray ray = UnprojectRay(frame.input.projection, frame.input.view, x, y, vWidth, vHeight);
+            int robot;
+            float robotT, groundT;
+            bool robotHit = pickRobot(frame, ray, farPlane, robot, robotT);
+            if (pickGround(frame, ray, robotHit ? robotT : farPlane, groundT))
+                groundCount++;
+            else if (robotHit)
+                robotCount++;
+        }
+        robots += robotCount;
+        ground += groundCount;
+    });
+    robotHits = robots;
+    groundHits = ground;
+}
@@ -0,0 +1,37 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	BoundingBox.h
+//	Axis aligned bounding box shared by culling and the mesh code
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BOUNDINGBOX_H
+#define BOUNDINGBOX_H
+
+#include "VECTOR3D.h"
+
+// Structure defining a bounding box
+typedef struct BoundingBox {
+	VECTOR3D min;
+	VECTOR3D max;
+} BBox;
+
+// Box around a local (untransformed) part, centered on the origin with the given size
+inline BBox MakeCenteredBox(float sizeX, float sizeY, float sizeZ)
+{
+	BBox box;
+	box.min.Set(-0.5f*sizeX, -0.5f*sizeY, -0.5f*sizeZ);
+	box.max.Set(0.5f*sizeX, 0.5f*sizeY, 0.5f*sizeZ);
+	return box;
+}
+
+// Grow box to contain point p
+inline void ExtendBox(BBox &box, float x, float y, float z)
+{
+	if (x < box.min.x) box.min.x = x;
+	if (y < box.min.y) box.min.y = y;
+	if (z < box.min.z) box.min.z = z;
+	if (x > box.max.x) box.max.x = x;
+	if (y > box.max.y) box.max.y = y;
+	if (z > box.max.z) box.max.z = z;
+}
+
+#endif	//BOUNDINGBOX_H
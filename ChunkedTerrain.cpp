@@ -0,0 +1,340 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <math.h>
+#include <stdio.h>
+#include <utility>
+#include <vector>
+#include "VECTOR3D.h"
+#include "MATRIX4X4.h"
+#include "BoundingBox.h"
+#include "Frustum.h"
+#include "GLExtensions.h"
+#include "NormalKernel.h"
+#include "MaterialRegistry.h"
+#include "QuadMesh.h"
+#include "MeshAllocator.h"
+#include "Picking.h"
+#include "Heightfield.h"
+#include "ChunkedTerrain.h"
+
+ChunkedTerrain::ChunkedTerrain(int tilesX, int tilesZ, int tileSize, float tileLength)
+{
+	heightfield = NULL;
+	Init(tilesX, tilesZ, tileSize, tileLength);
+
+	for (size_t i = 0; i < tiles.size(); i++)
+		tiles[i].mesh = new QuadMesh(this->tileSize, tileLength, &meshArena);
+	tilesLoaded = (int)tiles.size();
+}
+
+ChunkedTerrain::ChunkedTerrain(const Heightfield *heightfield, int tileSize)
+{
+	this->heightfield = heightfield;
+	tileSize = tileSize < 8 ? 8 : (tileSize/8)*8;
+	Init((heightfield->GetWidth() - 1) / tileSize, (heightfield->GetDepth() - 1) / tileSize,
+		tileSize, tileSize * heightfield->GetSpacing());
+}
+
+void ChunkedTerrain::Init(int tilesX, int tilesZ, int tileSize, float tileLength)
+{
+	this->tilesX = tilesX < 1 ? 1 : tilesX;
+	this->tilesZ = tilesZ < 1 ? 1 : tilesZ;
+	this->tileSize = tileSize < 8 ? 8 : (tileSize/8)*8;
+	this->tileLength = tileLength;
+	indexLists.SetTileSize(this->tileSize);
+	lodDistance = 2.0f*tileLength;
+	numLevels = maxLevels;
+	trianglesDrawn = 0;
+	tilesLoaded = 0;
+	material = -1;
+	heightFunction = NULL;
+	heightTime = 0.0f;
+
+	tiles.resize(this->tilesX*this->tilesZ);
+	for (size_t i = 0; i < tiles.size(); i++)
+	{
+		tiles[i].mesh = NULL;
+		tiles[i].level = 0;
+	}
+}
+
+ChunkedTerrain::~ChunkedTerrain()
+{
+	for (size_t i = 0; i < tiles.size(); i++)
+		delete tiles[i].mesh;
+}
+
+void ChunkedTerrain::InitTerrain(VECTOR3D origin, QuadMesh::HeightFunction heightFunction, float time)
+{
+	VECTOR3D dir1 = VECTOR3D(1.0f, 0.0f, 0.0f);
+	VECTOR3D dir2 = VECTOR3D(0.0f, 0.0f, -1.0f);
+
+	this->origin = origin;
+	for (int z = 0; z < tilesZ; z++)
+	{
+		for (int x = 0; x < tilesX; x++)
+		{
+			Tile &tile = GetTile(x, z);
+			VECTOR3D tileOrigin = origin + dir1*(x*tileLength) + dir2*(z*tileLength);
+			tile.mesh->InitMesh(tileSize, tileOrigin, tileLength, tileLength, dir1, dir2);
+			tile.origin = tileOrigin;
+			tile.center = tileOrigin + (dir1 + dir2)*(0.5f*tileLength);
+			tile.bounds = tile.mesh->GetBoundingBox();
+		}
+	}
+	UpdateTerrain(heightFunction, time);
+}
+
+void ChunkedTerrain::InitTerrain(VECTOR3D origin)
+{
+	if (!heightfield)
+		return;
+
+	this->origin = origin;
+	for (int z = 0; z < tilesZ; z++)
+	{
+		for (int x = 0; x < tilesX; x++)
+		{
+			// Sample columns run along +x and sample rows along -z
+			Tile &tile = GetTile(x, z);
+			float minHeight, maxHeight;
+			heightfield->GetHeightRange(x*tileSize, z*tileSize, (x+1)*tileSize, (z+1)*tileSize, minHeight, maxHeight);
+
+			tile.origin = origin + VECTOR3D(x*tileLength, 0.0f, -z*tileLength);
+			tile.bounds.min.Set(tile.origin.x, origin.y + minHeight, tile.origin.z - tileLength);
+			tile.bounds.max.Set(tile.origin.x + tileLength, origin.y + maxHeight, tile.origin.z);
+			tile.center = (tile.bounds.min + tile.bounds.max) * 0.5f;
+		}
+	}
+}
+
+void ChunkedTerrain::LoadTile(Tile &tile, int x, int z)
+{
+	tile.mesh = new QuadMesh(tileSize, tileLength, &meshArena);
+	tile.mesh->InitMesh(tileSize, tile.origin, tileLength, tileLength, VECTOR3D(1.0f, 0.0f, 0.0f), VECTOR3D(0.0f, 0.0f, -1.0f));
+	heightfield->LoadTile(*tile.mesh, x*tileSize, z*tileSize);
+	if (material >= 0)
+		tile.mesh->SetMaterial(material);
+	tile.bounds = tile.mesh->GetBoundingBox();
+	tile.tree.Build(*tile.mesh);
+	tilesLoaded++;
+}
+
+void ChunkedTerrain::UpdateTerrain(QuadMesh::HeightFunction heightFunction, float time)
+{
+	if (!heightFunction)
+		return;
+
+	this->heightFunction = heightFunction;
+	heightTime = time;
+	for (size_t i = 0; i < tiles.size(); i++)
+	{
+		tiles[i].mesh->UpdateMeshPadded(heightFunction, time);
+		tiles[i].center.y = heightFunction(tiles[i].center.x, tiles[i].center.z, time);
+		tiles[i].bounds = tiles[i].mesh->GetBoundingBox();
+		tiles[i].tree.Build(*tiles[i].mesh);
+	}
+}
+
+bool ChunkedTerrain::Intersect(const Ray &ray, float maxT, float &t) const
+{
+	bool hit = false;
+	for (size_t i = 0; i < tiles.size(); i++)
+	{
+		const Tile &tile = tiles[i];
+		float entry, tileT;
+		int quad;
+		if (!tile.mesh || !RayHitsBox(ray, tile.bounds, maxT, entry))
+			continue;
+		if (tile.tree.Intersect(ray, maxT, tileT, quad))
+		{
+			maxT = tileT;
+			hit = true;
+		}
+	}
+	if (hit)
+		t = maxT;
+	return hit;
+}
+
+void ChunkedTerrain::SetMaterial(VECTOR3D ambient, VECTOR3D diffuse, VECTOR3D specular, double shininess)
+{
+	material = MaterialRegistry::Shared().Add(ambient, diffuse, specular, shininess);
+	for (size_t i = 0; i < tiles.size(); i++)
+	{
+		if (tiles[i].mesh)
+			tiles[i].mesh->SetMaterial(material);
+	}
+}
+
+int ChunkedTerrain::SelectLevel(const Tile &tile, const VECTOR3D &eye) const
+{
+	float distance = (tile.center - eye).GetLength();
+	int level = 0;
+	float threshold = lodDistance;
+	while (distance > threshold && level < numLevels-1)
+	{
+		level++;
+		threshold *= 2.0f;
+	}
+	return level;
+}
+
+void ChunkedTerrain::DrawTerrain(const VECTOR3D &eye, const Frustum *frustum, CullStats *stats)
+{
+	for (size_t i = 0; i < tiles.size(); i++)
+		tiles[i].level = SelectLevel(tiles[i], eye);
+
+	trianglesDrawn = 0;
+	for (int z = 0; z < tilesZ; z++)
+	{
+		for (int x = 0; x < tilesX; x++)
+		{
+			Tile &tile = GetTile(x, z);
+			if (frustum && frustum->BoxOutside(tile.bounds))
+			{
+				if (stats)
+					stats->culled++;
+				continue;
+			}
+			if (!tile.mesh)
+				LoadTile(tile, x, z);
+			if (stats)
+				stats->drawn++;
+
+			// Edges facing a coarser neighbour take the neighbour's level.
+			// Sides: 0 front (first row), 1 right, 2 back (last row), 3 left
+			int sideLevels[4];
+			sideLevels[0] = z > 0 ? GetTile(x, z-1).level : tile.level;
+			sideLevels[1] = x < tilesX-1 ? GetTile(x+1, z).level : tile.level;
+			sideLevels[2] = z < tilesZ-1 ? GetTile(x, z+1).level : tile.level;
+			sideLevels[3] = x > 0 ? GetTile(x-1, z).level : tile.level;
+			for (int side = 0; side < 4; side++)
+			{
+				if (sideLevels[side] < tile.level)
+					sideLevels[side] = tile.level;
+			}
+
+			const MeshIndexList &list = indexLists.Get(tile.level, sideLevels);
+			tile.mesh->DrawMesh(list);
+			trianglesDrawn += (int)list.indices.size()/3;
+		}
+	}
+}
+
+TerrainIndexLists::~TerrainIndexLists()
+{
+	std::map<int, MeshIndexList *>::iterator it;
+	for (it = lists.begin(); it != lists.end(); ++it)
+	{
+		if (it->second->buffer)
+			botDeleteBuffers(1, &it->second->buffer);
+		delete it->second;
+	}
+}
+
+const MeshIndexList &TerrainIndexLists::Get(int level, const int sideLevels[4])
+{
+	int key = level | (sideLevels[0] << 2) | (sideLevels[1] << 4) | (sideLevels[2] << 6) | (sideLevels[3] << 8);
+
+	std::map<int, MeshIndexList *>::iterator it = lists.find(key);
+	if (it != lists.end())
+		return *it->second;
+
+	MeshIndexList *list = new MeshIndexList();
+	Build(*list, level, sideLevels);
+
+	LoadGLExtensions();
+	if (GLBuffersSupported() && !list->indices.empty())
+	{
+		botGenBuffers(1, &list->buffer);
+		botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, list->buffer);
+		botBufferData(GL_ELEMENT_ARRAY_BUFFER, list->indices.size()*sizeof(GLuint), &list->indices[0], GL_STATIC_DRAW);
+		botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	lists[key] = list;
+	return *list;
+}
+
+void TerrainIndexLists::Build(MeshIndexList &list, int level, const int sideLevels[4]) const
+{
+	int stride = 1 << level;
+	int n = tileSize;
+
+	// Snap a vertex on an edge shared with a coarser tile down to that tile's stride
+	struct Snap
+	{
+		int n;
+		int sideStrides[4];
+
+		GLuint operator()(int x, int y) const
+		{
+			if (y == 0)
+				x = (x / sideStrides[0]) * sideStrides[0];
+			else if (y == n)
+				x = (x / sideStrides[2]) * sideStrides[2];
+			if (x == n)
+				y = (y / sideStrides[1]) * sideStrides[1];
+			else if (x == 0)
+				y = (y / sideStrides[3]) * sideStrides[3];
+			return (GLuint)(y*(n+1) + x);
+		}
+	} snap;
+	snap.n = n;
+	for (int side = 0; side < 4; side++)
+		snap.sideStrides[side] = 1 << sideLevels[side];
+
+	list.indices.clear();
+	for (int y = 0; y < n; y += stride)
+	{
+		for (int x = 0; x < n; x += stride)
+		{
+			// Same counterclockwise corners and split as QuadMesh
+			GLuint i0 = snap(x, y);
+			GLuint i1 = snap(x+stride, y);
+			GLuint i2 = snap(x+stride, y+stride);
+			GLuint i3 = snap(x, y+stride);
+
+			// Triangles collapsed by snapping are dropped
+			if (i0 != i1 && i1 != i2 && i0 != i2)
+			{
+				list.indices.push_back(i0);
+				list.indices.push_back(i1);
+				list.indices.push_back(i2);
+			}
+			if (i0 != i2 && i2 != i3 && i0 != i3)
+			{
+				list.indices.push_back(i0);
+				list.indices.push_back(i2);
+				list.indices.push_back(i3);
+			}
+		}
+	}
+}
+
+bool ChunkedTerrain::GetHeight(float x, float z, float &height) const
+{
+	float u = x - origin.x;
+	float v = origin.z - z;
+	if (u < 0.0f || v < 0.0f || u > tilesX*tileLength || v > tilesZ*tileLength)
+		return false;
+	if (heightfield)
+	{
+		// Sample columns run along +x and sample rows along -z, as InitTerrain lays them out
+		float spacing = tileLength / tileSize;
+		height = heightfield->GetHeight(u / spacing, v / spacing);
+		return true;
+	}
+	if (!heightFunction)
+		return false;
+	height = heightFunction(x, z, heightTime);
+	return true;
+}
@@ -0,0 +1,157 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	ChunkedTerrain.h
+//	Ground made of a grid of QuadMesh tiles, each drawn at a level of detail picked
+//	from its distance to the eye
+//
+//	Every tile keeps its full resolution vertices. Level L draws every (1<<L)th vertex,
+//	so levels only differ in their index lists, and those are the same for every tile
+//	of the same size. Where a tile meets a coarser neighbour, the vertices along the
+//	shared edge are snapped down to the neighbour's stride, so both tiles trace the
+//	same edge and no cracks open between them.
+//
+//	Terrain over a Heightfield file creates no tiles up front. A tile's mesh is built
+//	from the mapped file the first time it passes the frustum test, and until then its
+//	box comes from the file's block height ranges.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CHUNKEDTERRAIN_H
+#define CHUNKEDTERRAIN_H
+
+#include <map>
+#include <vector>
+#include "MeshAllocator.h"
+#include "Picking.h"
+
+class Heightfield;
+
+// Index lists of one tile size for every level and combination of neighbour levels,
+// built on first use and shared by all tiles of that size
+class TerrainIndexLists
+{
+public:
+	TerrainIndexLists() : tileSize(0) {}
+	~TerrainIndexLists();
+
+	// Quads along a tile side, set before the first Get
+	void SetTileSize(int tileSize)
+	{
+		this->tileSize = tileSize;
+	}
+
+	// sideLevels are the levels the front, right, back and left edges snap to, none finer
+	// than level
+	const MeshIndexList &Get(int level, const int sideLevels[4]);
+
+private:
+	void Build(MeshIndexList &list, int level, const int sideLevels[4]) const;
+
+	int tileSize;
+
+	// By level and the levels of the four neighbours
+	std::map<int, MeshIndexList *> lists;
+};
+
+class ChunkedTerrain
+{
+public:
+	static const int maxLevels = 4;		// strides 1, 2, 4, 8
+
+	// tileSize is the number of quads along a tile side and must be a multiple of 8.
+	// The terrain covers tilesX*tileLength by tilesZ*tileLength units.
+	ChunkedTerrain(int tilesX, int tilesZ, int tileSize, float tileLength);
+	// Tiles of tileSize x tileSize quads over the samples of an open heightfield, which
+	// must outlive the terrain
+	ChunkedTerrain(const Heightfield *heightfield, int tileSize);
+	~ChunkedTerrain();
+
+	// Lay the tiles out from origin (front left corner) along +x and -z, like the ground mesh,
+	// and give them heights
+	void InitTerrain(VECTOR3D origin, QuadMesh::HeightFunction heightFunction, float time);
+	void UpdateTerrain(QuadMesh::HeightFunction heightFunction, float time);
+	// Same layout for heightfield terrain, whose heights come from the file
+	void InitTerrain(VECTOR3D origin);
+
+	void SetMaterial(VECTOR3D ambient, VECTOR3D diffuse, VECTOR3D specular, double shininess);
+
+	// Tiles closer than lodDistance are drawn at full resolution, each doubling of the
+	// distance after that drops one level
+	void SetLodDistance(float distance)
+	{
+		lodDistance = distance;
+	}
+
+	// eye and frustum are in the terrain's own coordinates. Tiles outside the frustum
+	// (when one is given) are skipped and counted in stats.
+	void DrawTerrain(const VECTOR3D &eye, const Frustum *frustum = NULL, CullStats *stats = NULL);
+
+	// Nearest hit before maxT of a ray in the terrain's coordinates with the tiles that have
+	// a mesh. Does not change the terrain, so calls on several threads can overlap.
+	bool Intersect(const Ray &ray, float maxT, float &t) const;
+	// Height at (x, z) in the terrain's coordinates from the heights the tiles are built
+	// from, false off its edges. Reads no tile, so any thread may call it.
+	bool GetHeight(float x, float z, float &height) const;
+
+	int GetTrianglesDrawn() const
+	{
+		return trianglesDrawn;
+	}
+
+	int GetNumTiles() const
+	{
+		return (int)tiles.size();
+	}
+	// Tiles with a mesh, all of them unless the terrain is over a heightfield
+	int GetTilesLoaded() const
+	{
+		return tilesLoaded;
+	}
+	// Tile meshes live as long as the terrain, so they are packed into the chunks of one
+	// arena and freed with it
+	const MeshArena &GetMeshArena() const
+	{
+		return meshArena;
+	}
+
+private:
+	struct Tile
+	{
+		QuadMesh *mesh;		// NULL until a heightfield tile is first drawn
+		HeightQuadtree tree;	// over the mesh, for Intersect
+		VECTOR3D origin;	// front left corner
+		VECTOR3D center;
+		BBox bounds;
+		int level;
+	};
+
+	Tile &GetTile(int x, int z)
+	{
+		return tiles[z*tilesX + x];
+	}
+
+	void Init(int tilesX, int tilesZ, int tileSize, float tileLength);
+	void LoadTile(Tile &tile, int x, int z);
+	int SelectLevel(const Tile &tile, const VECTOR3D &eye) const;
+
+	int tilesX;
+	int tilesZ;
+	int tileSize;
+	float tileLength;
+	float lodDistance;
+	int numLevels;
+	int trianglesDrawn;
+	int tilesLoaded;
+
+	// Source of the tile heights, NULL for terrain from a height function
+	const Heightfield *heightfield;
+	QuadMesh::HeightFunction heightFunction;
+	float heightTime;
+	VECTOR3D origin;		// front left corner of the first tile
+	int material;
+
+	std::vector<Tile> tiles;
+	MeshArena meshArena;		// render thread
+
+	TerrainIndexLists indexLists;
+};
+
+#endif	//CHUNKEDTERRAIN_H
@@ -0,0 +1,304 @@
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "VECTOR3D.h"
+#include "MATRIX4X4.h"
+#include "BoundingBox.h"
+#include "WorkerPool.h"
+#include "Collision.h"
+
+CollisionWorld::CollisionWorld(float cellSize) : cellSize(cellSize), groundMaxHeight(0.0f), bucketMask(0)
+{
+	stats.bodies = stats.cellEntries = stats.pairsTested = stats.contacts = 0;
+	stats.ms = 0.0;
+}
+
+void CollisionWorld::SetNumBodies(int count)
+{
+	bodies.resize(count);
+}
+
+void CollisionWorld::SetBody(int index, int owner, const BBox &box, const MATRIX4X4 &transform)
+{
+	Body &body = bodies[index];
+	body.owner = owner;
+	body.center = transform.TransformPoint(0.5f * (box.min + box.max));
+
+	// The transform's columns are the box's axes scaled. The aligned box reaches as far
+	// along each world axis as the half sizes spread over it.
+	const float *m = transform.entries;
+	float half[3] = { 0.5f * (box.max.x - box.min.x), 0.5f * (box.max.y - box.min.y), 0.5f * (box.max.z - box.min.z) };
+	VECTOR3D extent;
+	for (int i = 0; i < 3; i++)
+	{
+		VECTOR3D column(m[i*4], m[i*4 + 1], m[i*4 + 2]);
+		float length = column.GetLength();
+		body.axes[i] = length > 0.0f ? column / length : VECTOR3D(i == 0, i == 1, i == 2);
+		body.halfSize[i] = half[i] * length;
+		extent += VECTOR3D(fabsf(column.x), fabsf(column.y), fabsf(column.z)) * half[i];
+	}
+	body.box.min = body.center - extent;
+	body.box.max = body.center + extent;
+
+	body.cells[0] = CellOf(body.box.min.x);
+	body.cells[1] = CellOf(body.box.max.x);
+	body.cells[2] = CellOf(body.box.min.y);
+	body.cells[3] = CellOf(body.box.max.y);
+	body.cells[4] = CellOf(body.box.min.z);
+	body.cells[5] = CellOf(body.box.max.z);
+}
+
+// floor(coordinate / cellSize), without the library call floorf can be
+int CollisionWorld::CellOf(float coordinate) const
+{
+	float cell = coordinate * (1.0f / cellSize);
+	int truncated = (int)cell;
+	return cell < truncated ? truncated - 1 : truncated;
+}
+
+// Cells next to each other along x go to buckets next to each other, and rows of cells
+// along z and layers along y start far enough apart not to meet in a scene of a few
+// thousand cells across. Bodies placed near the one before, as the parts of a robot and the
+// robots of a crowd are, then fill the table from a few places at a time rather than all
+// over it.
+unsigned int CollisionWorld::Bucket(int x, int y, int z) const
+{
+	return ((unsigned int)x + (unsigned int)z * 4099u + (unsigned int)y * 786433u) & bucketMask;
+}
+
+// Puts an entry for every cell each body overlaps into entries, sorted by bucket
+void CollisionWorld::HashBodies()
+{
+	// Counting sort. The first pass counts the entries, and from that the table is sized
+	// for at least as many buckets as entries, so most cells have a bucket to themselves.
+	int numEntries = 0;
+	for (size_t i = 0; i < bodies.size(); i++)
+	{
+		const int *cells = bodies[i].cells;
+		numEntries += (cells[1] - cells[0] + 1) * (cells[3] - cells[2] + 1) * (cells[5] - cells[4] + 1);
+	}
+	unsigned int numBuckets = 1;
+	while (numBuckets < (unsigned int)numEntries)
+		numBuckets <<= 1;
+	bucketMask = numBuckets - 1;
+
+	bucketStart.assign(numBuckets + 1, 0);
+	for (size_t i = 0; i < bodies.size(); i++)
+	{
+		const int *cells = bodies[i].cells;
+		for (int z = cells[4]; z <= cells[5]; z++)
+			for (int y = cells[2]; y <= cells[3]; y++)
+				for (int x = cells[0]; x <= cells[1]; x++)
+					bucketStart[Bucket(x, y, z) + 1]++;
+	}
+	for (unsigned int b = 1; b <= numBuckets; b++)
+		bucketStart[b] += bucketStart[b - 1];
+
+	// bucketStart[b] is moved on past each entry placed in bucket b, which leaves it at the
+	// start of b + 1, and is then shifted back
+	entries.resize(numEntries);
+	for (size_t i = 0; i < bodies.size(); i++)
+	{
+		const int *cells = bodies[i].cells;
+		CellEntry entry;
+		entry.body = (int)i;
+		entry.owner = bodies[i].owner;
+		for (entry.z = cells[4]; entry.z <= cells[5]; entry.z++)
+			for (entry.y = cells[2]; entry.y <= cells[3]; entry.y++)
+				for (entry.x = cells[0]; entry.x <= cells[1]; entry.x++)
+					entries[bucketStart[Bucket(entry.x, entry.y, entry.z)]++] = entry;
+	}
+	for (unsigned int b = numBuckets; b > 0; b--)
+		bucketStart[b] = bucketStart[b - 1];
+	bucketStart[0] = 0;
+}
+
+static inline bool BoxesOverlap(const BBox &a, const BBox &b)
+{
+	return a.min.x <= b.max.x && b.min.x <= a.max.x &&
+	       a.min.y <= b.max.y && b.min.y <= a.max.y &&
+	       a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+// Candidate pairs in buckets [bucketBegin, bucketEnd) and their contacts. runEnd is room
+// for the entries of a bucket.
+void CollisionWorld::FindPairs(int bucketBegin, int bucketEnd, std::vector<Contact> &found, int &tested,
+                               std::vector<int> &runEnd) const
+{
+	for (int bucket = bucketBegin; bucket < bucketEnd; bucket++)
+	{
+		int begin = bucketStart[bucket];
+		int end = bucketStart[bucket + 1];
+		if (end - begin < 2)
+			continue;
+
+		// Entries are in body order, so when an owner's bodies are numbered one after
+		// another its entries in the bucket are too. runEnd[i] is the next entry with
+		// another owner, the pairs before it are skipped without being looked at.
+		if ((int)runEnd.size() < end - begin)
+			runEnd.resize(end - begin);
+		int *next = &runEnd[0] - begin;
+		next[end - 1] = end;
+		for (int i = end - 2; i >= begin; i--)
+			next[i] = entries[i].owner == entries[i + 1].owner ? next[i + 1] : i + 1;
+
+		for (int i = begin; i < end; i++)
+		{
+			const CellEntry &cell = entries[i];
+			const Body &first = bodies[cell.body];
+			for (int j = next[i]; j < end; j++)
+			{
+				// Other cells can share the bucket
+				const CellEntry &other = entries[j];
+				if (other.x != cell.x || other.y != cell.y || other.z != cell.z || other.owner == cell.owner)
+					continue;
+				const Body &second = bodies[other.body];
+				if (!BoxesOverlap(first.box, second.box))
+					continue;
+				// The pair shares every cell of the overlap, it is taken in the first
+				if (std::max(first.cells[0], second.cells[0]) != cell.x ||
+				    std::max(first.cells[2], second.cells[2]) != cell.y ||
+				    std::max(first.cells[4], second.cells[4]) != cell.z)
+					continue;
+
+				tested++;
+				int a = std::min(cell.body, other.body);
+				int b = std::max(cell.body, other.body);
+				Contact contact;
+				if (!BoxesTouch(bodies[a], bodies[b], contact.normal, contact.depth))
+					continue;
+				contact.bodyA = a;
+				contact.bodyB = b;
+				contact.ownerA = bodies[a].owner;
+				contact.ownerB = bodies[b].owner;
+				found.push_back(contact);
+			}
+		}
+	}
+}
+
+// Bodies in [begin, end) whose lowest corner is below the ground
+void CollisionWorld::FindGroundContacts(int begin, int end, std::vector<Contact> &found) const
+{
+	for (int i = begin; i < end; i++)
+	{
+		const Body &body = bodies[i];
+		if (body.box.min.y >= groundMaxHeight)
+			continue;
+		VECTOR3D lowest = body.center;
+		for (int k = 0; k < 3; k++)
+			lowest -= body.axes[k] * (body.axes[k].y >= 0.0f ? body.halfSize[k] : -body.halfSize[k]);
+		float height = ground(lowest.x, lowest.z);
+		if (height <= lowest.y)
+			continue;
+
+		Contact contact;
+		contact.bodyA = i;
+		contact.bodyB = -1;
+		contact.ownerA = body.owner;
+		contact.ownerB = -1;
+		contact.normal.Set(0.0f, 1.0f, 0.0f);
+		contact.depth = height - lowest.y;
+		found.push_back(contact);
+	}
+}
+
+// How far the box reaches from its centre along a unit axis
+static inline float Reach(const VECTOR3D *axes, const float *halfSize, const VECTOR3D &axis)
+{
+	return halfSize[0] * fabsf(axis.DotProduct(axes[0])) +
+	       halfSize[1] * fabsf(axis.DotProduct(axes[1])) +
+	       halfSize[2] * fabsf(axis.DotProduct(axes[2]));
+}
+
+// Separating axis test. The boxes touch unless they are apart along the face normals of
+// either or the cross product of an edge of each. The axis they overlap least along gives
+// the normal and depth.
+bool CollisionWorld::BoxesTouch(const Body &a, const Body &b, VECTOR3D &normal, float &depth)
+{
+	VECTOR3D axes[15];
+	for (int i = 0; i < 3; i++)
+	{
+		axes[i] = a.axes[i];
+		axes[3 + i] = b.axes[i];
+		for (int j = 0; j < 3; j++)
+			axes[6 + i*3 + j] = a.axes[i].CrossProduct(b.axes[j]);
+	}
+
+	VECTOR3D offset = b.center - a.center;
+	depth = FLT_MAX;
+	for (int k = 0; k < 15; k++)
+	{
+		VECTOR3D axis = axes[k];
+		float length = axis.GetLength();
+		// Edges close to parallel, covered by the face normals
+		if (length < 1e-4f)
+			continue;
+		axis /= length;
+
+		float distance = axis.DotProduct(offset);
+		float overlap = Reach(a.axes, a.halfSize, axis) + Reach(b.axes, b.halfSize, axis) - fabsf(distance);
+		if (overlap < 0.0f)
+			return false;
+		if (overlap < depth)
+		{
+			depth = overlap;
+			normal = distance < 0.0f ? -axis : axis;
+		}
+	}
+	return true;
+}
+
+static bool ContactBefore(const Contact &a, const Contact &b)
+{
+	return a.bodyA != b.bodyA ? a.bodyA < b.bodyA : a.bodyB < b.bodyB;
+}
+
+void CollisionWorld::FindContacts()
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	contacts.clear();
+	HashBodies();
+
+	std::atomic<int> tested(0);
+	if (!bodies.empty())
+	{
+		WorkerPool::Shared().ParallelFor(bucketMask + 1, 1024, [&](int begin, int end)
+		{
+			std::vector<Contact> found;
+			std::vector<int> runEnd;
+			int count = 0;
+			FindPairs(begin, end, found, count, runEnd);
+			tested += count;
+			if (found.empty())
+				return;
+			std::lock_guard<std::mutex> lock(contactsMutex);
+			contacts.insert(contacts.end(), found.begin(), found.end());
+		});
+	}
+	if (ground && !bodies.empty())
+	{
+		WorkerPool::Shared().ParallelFor((int)bodies.size(), 1024, [&](int begin, int end)
+		{
+			std::vector<Contact> found;
+			FindGroundContacts(begin, end, found);
+			if (found.empty())
+				return;
+			std::lock_guard<std::mutex> lock(contactsMutex);
+			contacts.insert(contacts.end(), found.begin(), found.end());
+		});
+	}
+	// Chunks finish in any order
+	std::sort(contacts.begin(), contacts.end(), ContactBefore);
+
+	stats.bodies = (int)bodies.size();
+	stats.cellEntries = (int)entries.size();
+	stats.pairsTested = tested;
+	stats.contacts = (int)contacts.size();
+	stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
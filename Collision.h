@@ -0,0 +1,137 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	Collision.h
+//	Contacts between many oriented boxes, each a local box and the transform placing it,
+//	and between the boxes and the ground
+//
+//	The broad phase hashes the world aligned box around each body into every cell of a
+//	uniform grid it overlaps. Two bodies in the same cell whose aligned boxes overlap are a
+//	candidate pair, taken only in the cell holding the corner where the overlap starts, so
+//	each pair is found once without a set of pairs already seen. The narrow phase tests the
+//	oriented boxes on their separating axes. The work grows with the number of bodies and of
+//	pairs close together, not with the square of the number of bodies.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "BoundingBox.h"
+
+// Two bodies touching, or a body in the ground when bodyB is -1
+struct Contact
+{
+	int bodyA;			// the lower index
+	int bodyB;
+	int ownerA;
+	int ownerB;			// -1 for the ground
+	VECTOR3D normal;	// unit, from A towards B, up out of the ground
+	float depth;		// how far apart along the normal A and B have to move to separate
+};
+
+// Counts and time of the last FindContacts
+struct CollisionStats
+{
+	int bodies;
+	int cellEntries;	// body and cell pairs hashed
+	int pairsTested;	// candidate pairs given to the narrow phase
+	int contacts;
+	double ms;
+};
+
+class CollisionWorld
+{
+public:
+	// Height of the ground at world (x, z), -FLT_MAX where there is none
+	typedef std::function<float(float x, float z)> GroundFunction;
+
+	// cellSize around the size of a typical body. Much smaller puts each body in many
+	// cells, much larger puts many bodies in each cell.
+	CollisionWorld(float cellSize = 4.0f);
+
+	// Takes effect for the bodies set after it
+	void SetCellSize(float size)
+	{
+		cellSize = size;
+	}
+	// Bodies are tested against the ground when their box reaches below maxHeight, the
+	// highest the ground gets. No ground while the function is empty. The function is
+	// called from the worker threads.
+	void SetGround(const GroundFunction &function, float maxHeight)
+	{
+		ground = function;
+		groundMaxHeight = maxHeight;
+	}
+
+	// Sizes the bodies for SetBody, which must then be called for every index before
+	// FindContacts. Calls for different indices may run on different threads at once.
+	void SetNumBodies(int count);
+	int GetNumBodies() const
+	{
+		return (int)bodies.size();
+	}
+	// box in the local coordinates of transform, which may rotate and scale but not shear,
+	// as the scene graph's transforms. Bodies with the same owner never touch each other.
+	// Giving the bodies of an owner consecutive indices lets the broad phase skip past them
+	// together.
+	void SetBody(int index, int owner, const BBox &box, const MATRIX4X4 &transform);
+	// World aligned box around the body
+	const BBox &GetBodyBox(int index) const
+	{
+		return bodies[index].box;
+	}
+
+	// Finds every contact, sorted by bodyA then bodyB. The pairs and the ground are tested
+	// across the shared worker pool.
+	void FindContacts();
+	const std::vector<Contact> &GetContacts() const
+	{
+		return contacts;
+	}
+	const CollisionStats &GetStats() const
+	{
+		return stats;
+	}
+
+private:
+	struct Body
+	{
+		int owner;
+		BBox box;
+		VECTOR3D center;
+		VECTOR3D axes[3];	// unit
+		float halfSize[3];	// along each axis
+		int cells[6];		// first and last cell along x, y and z
+	};
+
+	struct CellEntry
+	{
+		int x, y, z;
+		int body;
+		int owner;
+	};
+
+	int CellOf(float coordinate) const;
+	unsigned int Bucket(int x, int y, int z) const;
+	void HashBodies();
+	void FindPairs(int bucketBegin, int bucketEnd, std::vector<Contact> &found, int &tested,
+	               std::vector<int> &runEnd) const;
+	void FindGroundContacts(int begin, int end, std::vector<Contact> &found) const;
+	static bool BoxesTouch(const Body &a, const Body &b, VECTOR3D &normal, float &depth);
+
+	float cellSize;
+	GroundFunction ground;
+	float groundMaxHeight;
+	std::vector<Body> bodies;
+
+	unsigned int bucketMask;
+	std::vector<int> bucketStart;		// entries of bucket i are [bucketStart[i], bucketStart[i+1])
+	std::vector<CellEntry> entries;		// by bucket
+
+	std::mutex contactsMutex;			// guards contacts while the pool adds to it
+	std::vector<Contact> contacts;
+	CollisionStats stats;
+};
+
+#endif	//COLLISION_H
@@ -0,0 +1,102 @@
+#include "Profiler.h"
+#include "FramePipeline.h"
+
+// Set in readySlot when it holds a frame the render thread has not picked up yet
+static const int freshFrame = 4;
+static const int slotMask = 3;
+
+FramePipeline::FramePipeline()
+{
+	requested = false;
+	building = false;
+	stopping = false;
+	writeSlot = 0;
+	readySlot = 1;
+	readSlot = 2;
+	anyFrame = false;
+}
+
+FramePipeline::~FramePipeline()
+{
+	Stop();
+}
+
+void FramePipeline::Start(const FrameFunction &func)
+{
+	Stop();
+	frameFunction = func;
+	stopping = false;
+	thread = std::thread(&FramePipeline::Run, this);
+}
+
+void FramePipeline::Stop()
+{
+	if (!thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	thread.join();
+}
+
+void FramePipeline::Request()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requested = true;
+	}
+	wake.notify_one();
+}
+
+void FramePipeline::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [&] { return !requested && !building; });
+}
+
+int FramePipeline::AcquireFrame()
+{
+	if (readySlot.load() & freshFrame)
+	{
+		// Hand the frame drawn last back in exchange for the new one
+		readSlot = readySlot.exchange(readSlot) & slotMask;
+		anyFrame = true;
+	}
+	return anyFrame ? readSlot : -1;
+}
+
+void FramePipeline::Run()
+{
+	PROFILE_THREAD("frame pipeline");
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || requested; });
+			if (stopping)
+				break;
+			requested = false;
+			building = true;
+		}
+
+		frameFunction(writeSlot);
+		// Publish, and carry on with whichever slot was holding the previous frame
+		writeSlot = readySlot.exchange(writeSlot | freshFrame) & slotMask;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			building = false;
+		}
+		idle.notify_all();
+	}
+
+	// Nobody is left to build frames for anyone still waiting
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requested = false;
+		building = false;
+	}
+	idle.notify_all();
+}
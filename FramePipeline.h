@@ -0,0 +1,65 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	FramePipeline.h
+//	Builds the next frame on a simulation thread while the render thread draws the last
+//	finished one
+//
+//	Frames live in three slots. The simulation thread fills one, the render thread draws
+//	from another, and the third holds the newest finished frame. Publishing a frame and
+//	picking it up are each one atomic exchange of slot numbers, so neither side locks or
+//	waits on the other to get at frame state.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAMEPIPELINE_H
+#define FRAMEPIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class FramePipeline
+{
+public:
+	static const int numSlots = 3;
+
+	// Fills the given slot with a complete frame, called on the simulation thread
+	typedef std::function<void(int slot)> FrameFunction;
+
+	FramePipeline();
+	~FramePipeline();
+
+	void Start(const FrameFunction &func);
+	// Finishes the frame being built, if any, and ends the simulation thread
+	void Stop();
+
+	// Asks for one more frame. Requests made while a frame is being built are merged into
+	// one frame built after it.
+	void Request();
+	// Blocks until every requested frame is finished
+	void Wait();
+
+	// Slot of the newest finished frame. It stays the render thread's, untouched by the
+	// simulation, until the next call. -1 before the first frame is finished.
+	int AcquireFrame();
+
+private:
+	void Run();
+
+	std::thread thread;
+	FrameFunction frameFunction;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	bool requested;
+	bool building;
+	bool stopping;
+
+	int writeSlot;					// simulation thread only
+	int readSlot;					// render thread only
+	bool anyFrame;					// render thread only, a frame has been acquired
+	std::atomic<int> readySlot;		// newest finished slot, or'ed with freshFrame until acquired
+};
+
+#endif	//FRAMEPIPELINE_H
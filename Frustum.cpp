@@ -0,0 +1,82 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <math.h>
+#include "VECTOR3D.h"
+#include "Frustum.h"
+
+void Frustum::Extract(const float projection[16], const float modelview[16])
+{
+	// clip = projection * modelview, column major
+	float clip[16];
+	for (int col = 0; col < 4; col++)
+	{
+		for (int row = 0; row < 4; row++)
+		{
+			clip[col*4 + row] = projection[row]      * modelview[col*4]
+			                  + projection[4 + row]  * modelview[col*4 + 1]
+			                  + projection[8 + row]  * modelview[col*4 + 2]
+			                  + projection[12 + row] * modelview[col*4 + 3];
+		}
+	}
+
+	// Left/right, bottom/top, near/far are the w row plus/minus the x, y and z rows
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			planes[i*2][j]     = clip[j*4 + 3] + clip[j*4 + i];
+			planes[i*2 + 1][j] = clip[j*4 + 3] - clip[j*4 + i];
+		}
+	}
+}
+
+void Frustum::ExtractFromGL(const float projection[16])
+{
+	float modelview[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+	Extract(projection, modelview);
+}
+
+bool Frustum::BoxOutside(const BBox &box) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const float *p = planes[i];
+
+		// Corner furthest along the plane normal, if even that one is behind the plane so is the box
+		float x = p[0] >= 0 ? box.max.x : box.min.x;
+		float y = p[1] >= 0 ? box.max.y : box.min.y;
+		float z = p[2] >= 0 ? box.max.z : box.min.z;
+		if (p[0]*x + p[1]*y + p[2]*z + p[3] < 0)
+			return true;
+	}
+	return false;
+}
+
+bool Frustum::BoxOutside(const BBox &box, const float transform[16]) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		// The plane moved into the box's space is the plane row times the transform
+		float p[4];
+		for (int j = 0; j < 4; j++)
+		{
+			p[j] = planes[i][0]*transform[j*4] + planes[i][1]*transform[j*4 + 1]
+			     + planes[i][2]*transform[j*4 + 2] + planes[i][3]*transform[j*4 + 3];
+		}
+
+		float x = p[0] >= 0 ? box.max.x : box.min.x;
+		float y = p[1] >= 0 ? box.max.y : box.min.y;
+		float z = p[2] >= 0 ? box.max.z : box.min.z;
+		if (p[0]*x + p[1]*y + p[2]*z + p[3] < 0)
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,48 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	Frustum.h
+//	View frustum planes for culling, taken from the projection and modelview matrices
+//
+//	Planes extracted from projection*modelview are in the modelview's object space, so
+//	extracting with the current GL matrices lets a part test its own local box.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "BoundingBox.h"
+
+class Frustum
+{
+public:
+	// Column major 4x4 matrices as returned by glGetFloatv
+	void Extract(const float projection[16], const float modelview[16]);
+
+	// Uses the current GL_MODELVIEW_MATRIX with the given projection
+	void ExtractFromGL(const float projection[16]);
+
+	// True if the box is completely outside one of the six planes
+	bool BoxOutside(const BBox &box) const;
+
+	// Same for a box in the local coordinates of a column major transform, so parts placed
+	// on the CPU can be tested without touching the GL matrices
+	bool BoxOutside(const BBox &box, const float transform[16]) const;
+
+private:
+	// ax + by + cz + d >= 0 inside
+	float planes[6][4];
+};
+
+// Per-frame culling counters
+struct CullStats
+{
+	int drawn;
+	int culled;
+
+	CullStats() : drawn(0), culled(0) {}
+	void Reset()
+	{
+		drawn = culled = 0;
+	}
+};
+
+#endif	//FRUSTUM_H
@@ -0,0 +1,136 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#include <OpenGL/OpenGL.h>
+#include <dlfcn.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <GL/glx.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+
+#include "GLExtensions.h"
+
+BOTGLGENBUFFERS		botGenBuffers = NULL;
+BOTGLDELETEBUFFERS	botDeleteBuffers = NULL;
+BOTGLBINDBUFFER		botBindBuffer = NULL;
+BOTGLBUFFERDATA		botBufferData = NULL;
+BOTGLBUFFERSUBDATA	botBufferSubData = NULL;
+
+BOTGLGENQUERIES			botGenQueries = NULL;
+BOTGLDELETEQUERIES		botDeleteQueries = NULL;
+BOTGLQUERYCOUNTER		botQueryCounter = NULL;
+BOTGLGETQUERYOBJECTIV	botGetQueryObjectiv = NULL;
+BOTGLGETQUERYOBJECTUI64V	botGetQueryObjectui64v = NULL;
+BOTGLGETINTEGER64V		botGetInteger64v = NULL;
+
+static bool extensionsLoaded = false;
+
+GLCallCounts botCallCounts;
+
+static void *GetProc(const char *name)
+{
+#if defined(_WIN32)
+	return (void *)wglGetProcAddress(name);
+#elif defined(__APPLE__)
+	return dlsym(RTLD_DEFAULT, name);
+#else
+	return (void *)glXGetProcAddressARB((const GLubyte *)name);
+#endif
+}
+
+// Try the core name first, then the ARB suffixed one
+static void *GetProcCoreOrARB(const char *name)
+{
+	void *proc = GetProc(name);
+	if (!proc)
+	{
+		char arbName[128];
+		snprintf(arbName, sizeof(arbName), "%sARB", name);
+		proc = GetProc(arbName);
+	}
+	return proc;
+}
+
+void LoadGLExtensions()
+{
+	if (extensionsLoaded)
+		return;
+	extensionsLoaded = true;
+
+	const char *version = (const char *)glGetString(GL_VERSION);
+	const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+	bool hasVBO = (version && (version[0] > '1' || (version[0] == '1' && version[2] >= '5'))) ||
+	              (extensions && strstr(extensions, "GL_ARB_vertex_buffer_object"));
+
+	if (hasVBO)
+	{
+		botGenBuffers = (BOTGLGENBUFFERS)GetProcCoreOrARB("glGenBuffers");
+		botDeleteBuffers = (BOTGLDELETEBUFFERS)GetProcCoreOrARB("glDeleteBuffers");
+		botBindBuffer = (BOTGLBINDBUFFER)GetProcCoreOrARB("glBindBuffer");
+		botBufferData = (BOTGLBUFFERDATA)GetProcCoreOrARB("glBufferData");
+		botBufferSubData = (BOTGLBUFFERSUBDATA)GetProcCoreOrARB("glBufferSubData");
+	}
+
+	// ARB_timer_query has no suffixed names
+	bool hasTimerQuery = (version && (version[0] > '3' || (version[0] == '3' && version[2] >= '3'))) ||
+	                     (extensions && strstr(extensions, "GL_ARB_timer_query"));
+	if (hasTimerQuery)
+	{
+		botGenQueries = (BOTGLGENQUERIES)GetProcCoreOrARB("glGenQueries");
+		botDeleteQueries = (BOTGLDELETEQUERIES)GetProcCoreOrARB("glDeleteQueries");
+		botQueryCounter = (BOTGLQUERYCOUNTER)GetProc("glQueryCounter");
+		botGetQueryObjectiv = (BOTGLGETQUERYOBJECTIV)GetProcCoreOrARB("glGetQueryObjectiv");
+		botGetQueryObjectui64v = (BOTGLGETQUERYOBJECTUI64V)GetProc("glGetQueryObjectui64v");
+		botGetInteger64v = (BOTGLGETINTEGER64V)GetProc("glGetInteger64v");
+	}
+}
+
+bool GLBuffersSupported()
+{
+	return botGenBuffers && botDeleteBuffers && botBindBuffer && botBufferData && botBufferSubData;
+}
+
+bool GLTimerQueriesSupported()
+{
+	return botGenQueries && botDeleteQueries && botQueryCounter && botGetQueryObjectiv &&
+	       botGetQueryObjectui64v && botGetInteger64v;
+}
+
+bool SetSwapInterval(int interval)
+{
+#if defined(_WIN32)
+	typedef BOOL (APIENTRY *SWAPINTERVALEXT)(int interval);
+	SWAPINTERVALEXT swapInterval = (SWAPINTERVALEXT)GetProc("wglSwapIntervalEXT");
+	return swapInterval && swapInterval(interval);
+#elif defined(__APPLE__)
+	GLint value = interval;
+	CGLContextObj context = CGLGetCurrentContext();
+	return context && CGLSetParameter(context, kCGLCPSwapInterval, &value) == kCGLNoError;
+#else
+	// glXGetProcAddress returns a stub for any name, so check the extension string
+	Display *display = glXGetCurrentDisplay();
+	if (!display)
+		return false;
+	const char *extensions = glXQueryExtensionsString(display, DefaultScreen(display));
+	if (extensions && strstr(extensions, "GLX_MESA_swap_control"))
+	{
+		typedef int (*SWAPINTERVALMESA)(unsigned int interval);
+		SWAPINTERVALMESA swapInterval = (SWAPINTERVALMESA)GetProc("glXSwapIntervalMESA");
+		return swapInterval && swapInterval(interval) == 0;
+	}
+	if (extensions && strstr(extensions, "GLX_SGI_swap_control") && interval > 0)
+	{
+		typedef int (*SWAPINTERVALSGI)(int interval);
+		SWAPINTERVALSGI swapInterval = (SWAPINTERVALSGI)GetProc("glXSwapIntervalSGI");
+		return swapInterval && swapInterval(interval) == 0;
+	}
+	return false;
+#endif
+}
@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	GLExtensions.h
+//	Runtime loading of the GL entry points that are not part of GL 1.1
+//	(the Windows headers stop at 1.1, so buffer objects must be fetched at runtime)
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef GLEXTENSIONS_H
+#define GLEXTENSIONS_H
+
+#include <stddef.h>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER				0x8892
+#define GL_ELEMENT_ARRAY_BUFFER		0x8893
+#endif
+#ifndef GL_STATIC_DRAW
+#define GL_STATIC_DRAW				0x88E4
+#define GL_DYNAMIC_DRAW				0x88E8
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT				0x8866
+#define GL_QUERY_RESULT_AVAILABLE	0x8867
+#endif
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP				0x8E28
+#endif
+#ifndef GL_UNSIGNED_INT_8_8_8_8_REV
+#define GL_UNSIGNED_INT_8_8_8_8_REV	0x8367
+#endif
+
+// Buffer objects (GL 1.5 / ARB_vertex_buffer_object)
+typedef void (APIENTRY *BOTGLGENBUFFERS)(GLsizei n, GLuint *buffers);
+typedef void (APIENTRY *BOTGLDELETEBUFFERS)(GLsizei n, const GLuint *buffers);
+typedef void (APIENTRY *BOTGLBINDBUFFER)(GLenum target, GLuint buffer);
+typedef void (APIENTRY *BOTGLBUFFERDATA)(GLenum target, ptrdiff_t size, const void *data, GLenum usage);
+typedef void (APIENTRY *BOTGLBUFFERSUBDATA)(GLenum target, ptrdiff_t offset, ptrdiff_t size, const void *data);
+
+extern BOTGLGENBUFFERS		botGenBuffers;
+extern BOTGLDELETEBUFFERS	botDeleteBuffers;
+extern BOTGLBINDBUFFER		botBindBuffer;
+extern BOTGLBUFFERDATA		botBufferData;
+extern BOTGLBUFFERSUBDATA	botBufferSubData;
+
+// Timer queries (GL 3.3 / ARB_timer_query), timestamps in nanoseconds
+typedef void (APIENTRY *BOTGLGENQUERIES)(GLsizei n, GLuint *ids);
+typedef void (APIENTRY *BOTGLDELETEQUERIES)(GLsizei n, const GLuint *ids);
+typedef void (APIENTRY *BOTGLQUERYCOUNTER)(GLuint id, GLenum target);
+typedef void (APIENTRY *BOTGLGETQUERYOBJECTIV)(GLuint id, GLenum pname, GLint *params);
+typedef void (APIENTRY *BOTGLGETQUERYOBJECTUI64V)(GLuint id, GLenum pname, unsigned long long *params);
+typedef void (APIENTRY *BOTGLGETINTEGER64V)(GLenum pname, long long *data);
+
+extern BOTGLGENQUERIES			botGenQueries;
+extern BOTGLDELETEQUERIES		botDeleteQueries;
+extern BOTGLQUERYCOUNTER		botQueryCounter;
+extern BOTGLGETQUERYOBJECTIV	botGetQueryObjectiv;
+extern BOTGLGETQUERYOBJECTUI64V	botGetQueryObjectui64v;
+extern BOTGLGETINTEGER64V		botGetInteger64v;
+
+// Must be called once a GL context is current. Safe to call more than once.
+void LoadGLExtensions();
+
+// True when buffer objects can be used, otherwise callers fall back to client-side arrays
+bool GLBuffersSupported();
+
+// True when GL timestamps can be queried, for the profiler's GPU zones
+bool GLTimerQueriesSupported();
+
+// Swap interval of the current window, 1 waits for vertical sync on each swap. Returns
+// false when the platform gives no way to set it.
+bool SetSwapInterval(int interval);
+
+// GL calls made by the mesh, shape, material and render queue draw paths, counted where
+// they are issued so benchmarks can report them
+struct GLCallCounts
+{
+	int calls;			// every counted call, draws included
+	int drawCalls;
+	int triangles;
+	int vertices;		// indices sent by the draws
+	int stateChanges;	// materials and vertex arrays bound
+
+	GLCallCounts() : calls(0), drawCalls(0), triangles(0), vertices(0), stateChanges(0) {}
+	void Reset()
+	{
+		calls = drawCalls = triangles = vertices = stateChanges = 0;
+	}
+};
+
+extern GLCallCounts botCallCounts;
+
+inline void CountGLCalls(int count)
+{
+	botCallCounts.calls += count;
+}
+
+inline void CountGLDraw(int triangles, int vertices)
+{
+	botCallCounts.calls++;
+	botCallCounts.drawCalls++;
+	botCallCounts.triangles += triangles;
+	botCallCounts.vertices += vertices;
+}
+
+inline void CountGLStateChange()
+{
+	botCallCounts.stateChanges++;
+}
+
+#endif	//GLEXTENSIONS_H
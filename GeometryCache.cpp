@@ -0,0 +1,330 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <math.h>
+#include "VECTOR3D.h"
+#include "GLExtensions.h"
+#include "GeometryCache.h"
+
+static const double PI = 3.14159265358979323846;
+
+enum { SHAPE_CYLINDER, SHAPE_DISK, SHAPE_CUBE };
+
+void CachedShape::Draw()
+{
+	if (indices.empty())
+		return;
+
+	Bind();
+	DrawBound();
+	Unbind();
+}
+
+void CachedShape::Bind()
+{
+	if (indices.empty())
+		return;
+
+	if (!uploaded)
+	{
+		uploaded = true;
+		LoadGLExtensions();
+		if (GLBuffersSupported())
+		{
+			// All positions followed by all normals, like QuadMesh
+			ptrdiff_t arrayBytes = positions.size()*sizeof(GLfloat);
+			botGenBuffers(1, &vertexBuffer);
+			botBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+			botBufferData(GL_ARRAY_BUFFER, 2*arrayBytes, NULL, GL_STATIC_DRAW);
+			botBufferSubData(GL_ARRAY_BUFFER, 0, arrayBytes, &positions[0]);
+			botBufferSubData(GL_ARRAY_BUFFER, arrayBytes, arrayBytes, &normals[0]);
+			botBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			botGenBuffers(1, &indexBuffer);
+			botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+			botBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+			botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+	}
+
+	const GLfloat *positionBase = &positions[0];
+	const GLfloat *normalBase = &normals[0];
+	if (vertexBuffer && indexBuffer)
+	{
+		botBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+		positionBase = NULL;
+		normalBase = (const GLfloat *)(positions.size()*sizeof(GLfloat));
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, positionBase);
+	glNormalPointer(GL_FLOAT, 0, normalBase);
+	CountGLCalls(vertexBuffer && indexBuffer ? 6 : 4);
+	CountGLStateChange();
+}
+
+void CachedShape::DrawBound()
+{
+	if (indices.empty())
+		return;
+
+	const GLuint *indexBase = (vertexBuffer && indexBuffer) ? NULL : &indices[0];
+	glDrawElements(primitive, (GLsizei)indices.size(), GL_UNSIGNED_INT, indexBase);
+	CountGLDraw(primitive == GL_TRIANGLES ? (int)indices.size()/3 : 0, (int)indices.size());
+}
+
+void CachedShape::Unbind()
+{
+	if (indices.empty())
+		return;
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	if (vertexBuffer && indexBuffer)
+	{
+		botBindBuffer(GL_ARRAY_BUFFER, 0);
+		botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	CountGLCalls(vertexBuffer && indexBuffer ? 4 : 2);
+}
+
+void CachedShape::Release()
+{
+	if (vertexBuffer)
+		botDeleteBuffers(1, &vertexBuffer);
+	if (indexBuffer)
+		botDeleteBuffers(1, &indexBuffer);
+	vertexBuffer = 0;
+	indexBuffer = 0;
+	uploaded = false;
+}
+
+bool GeometryCache::ShapeKey::operator<(const ShapeKey &rhs) const
+{
+	if (type != rhs.type) return type < rhs.type;
+	if (a != rhs.a) return a < rhs.a;
+	if (b != rhs.b) return b < rhs.b;
+	if (c != rhs.c) return c < rhs.c;
+	return drawStyle < rhs.drawStyle;
+}
+
+GeometryCache::GeometryCache(int slices, int stacks)
+{
+	numTessellations = 0;
+	this->slices = slices < 3 ? 3 : slices;
+	this->stacks = stacks < 1 ? 1 : stacks;
+}
+
+// Buffer objects are left alone here, the GL context may already be gone at exit
+GeometryCache::~GeometryCache()
+{
+	std::map<ShapeKey, CachedShape *>::iterator it;
+	for (it = shapes.begin(); it != shapes.end(); ++it)
+		delete it->second;
+}
+
+void GeometryCache::SetTessellation(int slices, int stacks)
+{
+	Clear();
+	this->slices = slices < 3 ? 3 : slices;
+	this->stacks = stacks < 1 ? 1 : stacks;
+}
+
+void GeometryCache::Clear()
+{
+	std::map<ShapeKey, CachedShape *>::iterator it;
+	for (it = shapes.begin(); it != shapes.end(); ++it)
+	{
+		it->second->Release();
+		delete it->second;
+	}
+	shapes.clear();
+}
+
+CachedShape &GeometryCache::Cylinder(float baseRadius, float topRadius, float height, GLenum drawStyle)
+{
+	ShapeKey key = { SHAPE_CYLINDER, baseRadius, topRadius, height, drawStyle };
+	std::map<ShapeKey, CachedShape *>::iterator it = shapes.find(key);
+	if (it != shapes.end())
+		return *it->second;
+
+	CachedShape *shape = new CachedShape();
+	BuildCylinder(*shape, baseRadius, topRadius, height, drawStyle);
+	shapes[key] = shape;
+	numTessellations++;
+	return *shape;
+}
+
+CachedShape &GeometryCache::Disk(float innerRadius, float outerRadius, GLenum drawStyle)
+{
+	ShapeKey key = { SHAPE_DISK, innerRadius, outerRadius, 0.0f, drawStyle };
+	std::map<ShapeKey, CachedShape *>::iterator it = shapes.find(key);
+	if (it != shapes.end())
+		return *it->second;
+
+	CachedShape *shape = new CachedShape();
+	BuildDisk(*shape, innerRadius, outerRadius, drawStyle);
+	shapes[key] = shape;
+	numTessellations++;
+	return *shape;
+}
+
+CachedShape &GeometryCache::Cube()
+{
+	ShapeKey key = { SHAPE_CUBE, 1.0f, 1.0f, 1.0f, GLU_FILL };
+	std::map<ShapeKey, CachedShape *>::iterator it = shapes.find(key);
+	if (it != shapes.end())
+		return *it->second;
+
+	CachedShape *shape = new CachedShape();
+	BuildCube(*shape);
+	shapes[key] = shape;
+	numTessellations++;
+	return *shape;
+}
+
+// Cylinder along +z from 0 to height, x = r*sin(angle), y = r*cos(angle) as in GLU
+void GeometryCache::BuildCylinder(CachedShape &shape, float baseRadius, float topRadius, float height, GLenum drawStyle) const
+{
+	float nz = height != 0.0f ? (baseRadius - topRadius)/height : 0.0f;
+	float nScale = 1.0f/(float)sqrt(1.0f + nz*nz);
+
+	for (int j = 0; j <= stacks; j++)
+	{
+		float t = (float)j/stacks;
+		float radius = baseRadius + (topRadius - baseRadius)*t;
+		for (int i = 0; i <= slices; i++)
+		{
+			double angle = 2.0*PI*(i == slices ? 0 : i)/slices;
+			float s = (float)sin(angle);
+			float c = (float)cos(angle);
+			shape.positions.push_back(radius*s);
+			shape.positions.push_back(radius*c);
+			shape.positions.push_back(height*t);
+			shape.normals.push_back(s*nScale);
+			shape.normals.push_back(c*nScale);
+			shape.normals.push_back(nz*nScale);
+		}
+	}
+	// Going around in +i is clockwise seen from outside, so swap the winding
+	BuildGridIndices(shape, slices, stacks, true, drawStyle == GLU_LINE);
+}
+
+// Disk in the z = 0 plane facing +z, rings from innerRadius out to outerRadius
+void GeometryCache::BuildDisk(CachedShape &shape, float innerRadius, float outerRadius, GLenum drawStyle) const
+{
+	for (int j = 0; j <= stacks; j++)
+	{
+		float radius = innerRadius + (outerRadius - innerRadius)*j/stacks;
+		for (int i = 0; i <= slices; i++)
+		{
+			double angle = 2.0*PI*(i == slices ? 0 : i)/slices;
+			shape.positions.push_back(radius*(float)sin(angle));
+			shape.positions.push_back(radius*(float)cos(angle));
+			shape.positions.push_back(0.0f);
+			shape.normals.push_back(0.0f);
+			shape.normals.push_back(0.0f);
+			shape.normals.push_back(1.0f);
+		}
+	}
+	BuildGridIndices(shape, slices, stacks, false, drawStyle == GLU_LINE);
+}
+
+// Vertices form (columns+1) x (rows+1) rows, the last column repeating the first. Filled
+// shapes get two triangles per cell, line shapes get every ring and every spoke.
+void GeometryCache::BuildGridIndices(CachedShape &shape, int columns, int rows, bool swapWinding, bool lines) const
+{
+	int stride = columns + 1;
+
+	if (lines)
+	{
+		shape.primitive = GL_LINES;
+		for (int j = 0; j <= rows; j++)
+		{
+			for (int i = 0; i < columns; i++)
+			{
+				shape.indices.push_back(j*stride + i);
+				shape.indices.push_back(j*stride + i + 1);
+			}
+		}
+		for (int i = 0; i < columns; i++)
+		{
+			for (int j = 0; j < rows; j++)
+			{
+				shape.indices.push_back(j*stride + i);
+				shape.indices.push_back((j+1)*stride + i);
+			}
+		}
+		return;
+	}
+
+	shape.primitive = GL_TRIANGLES;
+	for (int j = 0; j < rows; j++)
+	{
+		for (int i = 0; i < columns; i++)
+		{
+			GLuint i0 = j*stride + i;
+			GLuint i1 = j*stride + i + 1;
+			GLuint i2 = (j+1)*stride + i + 1;
+			GLuint i3 = (j+1)*stride + i;
+			if (swapWinding)
+			{
+				GLuint t = i1;
+				i1 = i3;
+				i3 = t;
+			}
+			shape.indices.push_back(i0);
+			shape.indices.push_back(i1);
+			shape.indices.push_back(i2);
+			shape.indices.push_back(i0);
+			shape.indices.push_back(i2);
+			shape.indices.push_back(i3);
+		}
+	}
+}
+
+// Four vertices per face so every face gets its own normal
+void GeometryCache::BuildCube(CachedShape &shape) const
+{
+	static const float faceNormals[6][3] =
+	{
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+	};
+
+	shape.primitive = GL_TRIANGLES;
+	for (int f = 0; f < 6; f++)
+	{
+		VECTOR3D n(faceNormals[f][0], faceNormals[f][1], faceNormals[f][2]);
+		// Two axes across the face with u x v = n, so the corners go counterclockwise
+		VECTOR3D u(n.y, n.z, n.x);
+		VECTOR3D v = n.CrossProduct(u);
+
+		GLuint first = (GLuint)(shape.positions.size()/3);
+		static const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+		for (int c = 0; c < 4; c++)
+		{
+			VECTOR3D p = (n + u*corners[c][0] + v*corners[c][1])*0.5f;
+			shape.positions.push_back(p.x);
+			shape.positions.push_back(p.y);
+			shape.positions.push_back(p.z);
+			shape.normals.push_back(n.x);
+			shape.normals.push_back(n.y);
+			shape.normals.push_back(n.z);
+		}
+		shape.indices.push_back(first);
+		shape.indices.push_back(first + 1);
+		shape.indices.push_back(first + 2);
+		shape.indices.push_back(first);
+		shape.indices.push_back(first + 2);
+		shape.indices.push_back(first + 3);
+	}
+}
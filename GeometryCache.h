@@ -0,0 +1,88 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	GeometryCache.h
+//	Cylinders and disks tessellated once, the way gluCylinder/gluDisk would, plus a unit
+//	cube, kept in vertex/index buffers for reuse every frame
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef GEOMETRYCACHE_H
+#define GEOMETRYCACHE_H
+
+#include <map>
+#include <vector>
+
+// A tessellated shape. Drawn as triangles (GLU_FILL) or lines (GLU_LINE).
+struct CachedShape
+{
+	std::vector<GLfloat> positions;
+	std::vector<GLfloat> normals;
+	std::vector<GLuint> indices;
+	GLenum primitive;
+	GLuint vertexBuffer;
+	GLuint indexBuffer;
+	bool uploaded;
+
+	CachedShape() : primitive(GL_TRIANGLES), vertexBuffer(0), indexBuffer(0), uploaded(false) {}
+
+	void Draw();
+	void Release();
+
+	// Draw split up, so many copies of the shape can be drawn with one bind:
+	// Bind(), then DrawBound() once per copy, then Unbind()
+	void Bind();
+	void DrawBound();
+	void Unbind();
+};
+
+class GeometryCache
+{
+public:
+	GeometryCache(int slices = 100, int stacks = 100);
+	~GeometryCache();
+
+	// Changes the tessellation of shapes built from now on and drops the cached ones
+	void SetTessellation(int slices, int stacks);
+
+	// Same parameters and conventions as gluCylinder/gluDisk, drawStyle is GLU_FILL or GLU_LINE.
+	// The shape is tessellated on first use only.
+	CachedShape &Cylinder(float baseRadius, float topRadius, float height, GLenum drawStyle);
+	CachedShape &Disk(float innerRadius, float outerRadius, GLenum drawStyle);
+
+	// Unit cube centered on the origin with flat faces, like glutSolidCube(1.0)
+	CachedShape &Cube();
+
+	// Frees every shape, including its buffer objects, needs the GL context
+	void Clear();
+
+	int GetNumShapes() const
+	{
+		return (int)shapes.size();
+	}
+
+	// Shapes tessellated since startup
+	int GetNumTessellations() const
+	{
+		return numTessellations;
+	}
+
+private:
+	struct ShapeKey
+	{
+		int type;
+		float a, b, c;
+		GLenum drawStyle;
+
+		bool operator<(const ShapeKey &rhs) const;
+	};
+
+	void BuildCylinder(CachedShape &shape, float baseRadius, float topRadius, float height, GLenum drawStyle) const;
+	void BuildDisk(CachedShape &shape, float innerRadius, float outerRadius, GLenum drawStyle) const;
+	void BuildCube(CachedShape &shape) const;
+	void BuildGridIndices(CachedShape &shape, int columns, int rows, bool swapWinding, bool lines) const;
+
+	int slices;
+	int stacks;
+	int numTessellations;
+	std::map<ShapeKey, CachedShape *> shapes;
+};
+
+#endif	//GEOMETRYCACHE_H
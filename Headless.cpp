@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+#include "Headless.h"
+
+#if defined(__linux__) && !defined(BOT_NO_EGL)
+#define BOT_HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef BOT_HEADLESS_EGL
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA	0x31DD
+#endif
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLSurface surface = EGL_NO_SURFACE;
+static EGLContext context = EGL_NO_CONTEXT;
+
+// The surfaceless platform needs no X server. Older EGLs only have the default display.
+static EGLDisplay OpenDisplay()
+{
+	const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless"))
+	{
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+		{
+			EGLDisplay platformDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			if (platformDisplay != EGL_NO_DISPLAY && eglInitialize(platformDisplay, NULL, NULL))
+				return platformDisplay;
+		}
+	}
+
+	EGLDisplay defaultDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (defaultDisplay != EGL_NO_DISPLAY && eglInitialize(defaultDisplay, NULL, NULL))
+		return defaultDisplay;
+	return EGL_NO_DISPLAY;
+}
+
+bool HeadlessSupported()
+{
+	return true;
+}
+
+bool CreateHeadlessContext(int width, int height)
+{
+	display = OpenDisplay();
+	if (display == EGL_NO_DISPLAY)
+	{
+		printf("Headless: no EGL display\n");
+		return false;
+	}
+
+	EGLint configAttributes[] =
+	{
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (!eglChooseConfig(display, configAttributes, &config, 1, &numConfigs) || numConfigs < 1)
+	{
+		printf("Headless: no EGL config with desktop GL and a depth buffer\n");
+		DestroyHeadlessContext();
+		return false;
+	}
+
+	EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+	surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+
+	// Fixed function GL, so no core profile
+	eglBindAPI(EGL_OPENGL_API);
+	context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+
+	if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context))
+	{
+		printf("Headless: could not create a %dx%d offscreen context (EGL error 0x%x)\n", width, height, eglGetError());
+		DestroyHeadlessContext();
+		return false;
+	}
+	return true;
+}
+
+void DestroyHeadlessContext()
+{
+	if (display == EGL_NO_DISPLAY)
+		return;
+
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (context != EGL_NO_CONTEXT)
+		eglDestroyContext(display, context);
+	if (surface != EGL_NO_SURFACE)
+		eglDestroySurface(display, surface);
+	eglTerminate(display);
+
+	display = EGL_NO_DISPLAY;
+	surface = EGL_NO_SURFACE;
+	context = EGL_NO_CONTEXT;
+}
+
+#else
+
+bool HeadlessSupported()
+{
+	return false;
+}
+
+bool CreateHeadlessContext(int width, int height)
+{
+	printf("Headless: not built in on this platform\n");
+	return false;
+}
+
+void DestroyHeadlessContext()
+{
+}
+
+#endif
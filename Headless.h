@@ -0,0 +1,20 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	Headless.h
+//	Offscreen GL context for running without a window, so the demo can be benchmarked on
+//	machines with no display. Uses an EGL pbuffer, which Mesa's software renderer
+//	(llvmpipe) provides even without a GPU or X server.
+//
+//	Built on Linux unless BOT_NO_EGL is defined, needs -lEGL.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// False when headless rendering is not built in
+bool HeadlessSupported();
+
+// Creates a width x height offscreen surface and makes its context current
+bool CreateHeadlessContext(int width, int height);
+void DestroyHeadlessContext();
+
+#endif	//HEADLESS_H
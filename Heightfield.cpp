@@ -0,0 +1,271 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+#include "VECTOR3D.h"
+#include "BoundingBox.h"
+#include "NormalKernel.h"
+#include "QuadMesh.h"
+#include "Heightfield.h"
+
+static const char heightfieldMagic[4] = { 'B', 'H', 'F', '1' };
+static const int heightfieldBlockSize = 64;		// 8KB blocks, two pages
+static const size_t heightfieldAlignment = 4096;
+
+Heightfield::Heightfield()
+{
+	memset(&header, 0, sizeof(header));
+	blockShift = 0;
+	blockMask = 0;
+	blockSamples = 0;
+	blocksX = 0;
+	blocksZ = 0;
+	blockRanges = NULL;
+	samples = NULL;
+	mapping = NULL;
+	mappedSize = 0;
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	fileMapping = NULL;
+#endif
+}
+
+bool Heightfield::Open(const char *path)
+{
+	Close();
+
+#ifdef _WIN32
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		printf("Heightfield %s: cannot open\n", path);
+		return false;
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	mappedSize = (size_t)size.QuadPart;
+	fileMapping = mappedSize ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	mapping = fileMapping ? MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		printf("Heightfield %s: cannot open\n", path);
+		return false;
+	}
+	struct stat info;
+	mappedSize = fstat(fd, &info) == 0 ? (size_t)info.st_size : 0;
+	mapping = mappedSize ? mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	// The mapping keeps the file alive
+	close(fd);
+	if (mapping == MAP_FAILED)
+		mapping = NULL;
+	else
+		// Tiles read scattered blocks, so read ahead would mostly fetch pages nobody asked for
+		madvise(mapping, mappedSize, MADV_RANDOM);
+#endif
+	if (!mapping)
+	{
+		printf("Heightfield %s: cannot map\n", path);
+		Close();
+		return false;
+	}
+
+	if (mappedSize < sizeof(HeightfieldHeader))
+	{
+		printf("Heightfield %s: too short\n", path);
+		Close();
+		return false;
+	}
+	memcpy(&header, mapping, sizeof(header));
+
+	bool valid = memcmp(header.magic, heightfieldMagic, 4) == 0 &&
+		header.width >= 2 && header.depth >= 2 && header.spacing > 0.0f &&
+		header.blockSize >= 1 && header.blockSize <= 4096 && (header.blockSize & (header.blockSize - 1)) == 0;
+	if (valid)
+	{
+		blockShift = 0;
+		while ((1u << blockShift) < header.blockSize)
+			blockShift++;
+		blockMask = header.blockSize - 1;
+		blockSamples = header.blockSize * header.blockSize;
+		blocksX = (header.width + blockMask) >> blockShift;
+		blocksZ = (header.depth + blockMask) >> blockShift;
+
+		size_t numBlocks = (size_t)blocksX * blocksZ;
+		valid = sizeof(HeightfieldHeader) + numBlocks*2*sizeof(uint16_t) <= header.dataOffset &&
+			header.dataOffset % sizeof(uint16_t) == 0 &&
+			header.dataOffset + numBlocks*blockSamples*sizeof(uint16_t) <= mappedSize;
+	}
+	if (!valid)
+	{
+		printf("Heightfield %s: not a valid heightfield file\n", path);
+		Close();
+		return false;
+	}
+
+	const char *bytes = (const char *)mapping;
+	blockRanges = (const uint16_t *)(bytes + sizeof(HeightfieldHeader));
+	samples = (const uint16_t *)(bytes + header.dataOffset);
+	return true;
+}
+
+void Heightfield::Close()
+{
+#ifdef _WIN32
+	if (mapping)
+		UnmapViewOfFile(mapping);
+	if (fileMapping)
+		CloseHandle(fileMapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	fileMapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (mapping)
+		munmap(mapping, mappedSize);
+#endif
+	mapping = NULL;
+	mappedSize = 0;
+	blockRanges = NULL;
+	samples = NULL;
+}
+
+float Heightfield::GetHeight(float x, float z) const
+{
+	int x0 = (int)floorf(x);
+	int z0 = (int)floorf(z);
+	float u = x - x0;
+	float v = z - z0;
+	float front = GetHeight(x0, z0) + u * (GetHeight(x0 + 1, z0) - GetHeight(x0, z0));
+	float back = GetHeight(x0, z0 + 1) + u * (GetHeight(x0 + 1, z0 + 1) - GetHeight(x0, z0 + 1));
+	return front + v * (back - front);
+}
+
+void Heightfield::GetHeightRange(int x0, int z0, int x1, int z1, float &minHeight, float &maxHeight) const
+{
+	int bx0 = (x0 < 0 ? 0 : x0) >> blockShift;
+	int bz0 = (z0 < 0 ? 0 : z0) >> blockShift;
+	int bx1 = (x1 < (int)header.width ? x1 : header.width - 1) >> blockShift;
+	int bz1 = (z1 < (int)header.depth ? z1 : header.depth - 1) >> blockShift;
+
+	int low = 0xffff, high = 0;
+	for (int bz = bz0; bz <= bz1; bz++)
+	{
+		for (int bx = bx0; bx <= bx1; bx++)
+		{
+			const uint16_t *range = blockRanges + ((size_t)bz*blocksX + bx)*2;
+			if (range[0] < low)
+				low = range[0];
+			if (range[1] > high)
+				high = range[1];
+		}
+	}
+	if (low > high)
+		low = high = 0;
+	minHeight = header.heightOffset + header.heightScale * low;
+	maxHeight = header.heightOffset + header.heightScale * high;
+}
+
+void Heightfield::LoadTile(QuadMesh &mesh, int x0, int z0) const
+{
+	int n = mesh.GetMeshSize() + 3;
+	std::vector<float> heights(n*n);
+	for (int z = 0; z < n; z++)
+	{
+		for (int x = 0; x < n; x++)
+			heights[z*n + x] = GetHeight(x0 + x - 1, z0 + z - 1);
+	}
+	mesh.UpdateMeshPadded(&heights[0]);
+}
+
+bool Heightfield::Write(const char *path, int width, int depth, float spacing,
+                        float minHeight, float maxHeight, HeightFunction heightFunction)
+{
+	if (width < 2 || depth < 2 || spacing <= 0.0f || maxHeight < minHeight)
+		return false;
+
+	FILE *f = fopen(path, "wb");
+	if (!f)
+	{
+		printf("Heightfield %s: cannot create\n", path);
+		return false;
+	}
+
+	const int blockSize = heightfieldBlockSize;
+	int blocksX = (width + blockSize - 1) / blockSize;
+	int blocksZ = (depth + blockSize - 1) / blockSize;
+	size_t rangeBytes = (size_t)blocksX*blocksZ*2*sizeof(uint16_t);
+
+	HeightfieldHeader header;
+	memcpy(header.magic, heightfieldMagic, 4);
+	header.width = width;
+	header.depth = depth;
+	header.blockSize = blockSize;
+	header.spacing = spacing;
+	header.heightOffset = minHeight;
+	header.heightScale = maxHeight > minHeight ? (maxHeight - minHeight) / 65535.0f : 1.0f;
+	size_t dataOffset = sizeof(header) + rangeBytes;
+	header.dataOffset = (uint32_t)((dataOffset + heightfieldAlignment - 1) / heightfieldAlignment * heightfieldAlignment);
+
+	// Header and block ranges are written last, once the ranges are known
+	std::vector<uint16_t> ranges(blocksX*blocksZ*2);
+	bool ok = fseek(f, header.dataOffset, SEEK_SET) == 0;
+
+	// One row of blocks at a time, quantized, then written block by block
+	std::vector<uint16_t> rowBlocks((size_t)blocksX*blockSize*blockSize);
+	for (int bz = 0; bz < blocksZ && ok; bz++)
+	{
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			ranges[(bz*blocksX + bx)*2] = 0xffff;
+			ranges[(bz*blocksX + bx)*2 + 1] = 0;
+		}
+		for (int row = 0; row < blockSize; row++)
+		{
+			int z = bz*blockSize + row;
+			for (int x = 0; x < blocksX*blockSize; x++)
+			{
+				// Padding repeats the last sample, so it does not widen the block range
+				int sx = x < width ? x : width - 1;
+				int sz = z < depth ? z : depth - 1;
+				float height = heightFunction(sx*spacing, sz*spacing, 0.0f);
+				float scaled = (height - minHeight) / header.heightScale;
+				uint16_t sample = (uint16_t)(scaled <= 0.0f ? 0 : scaled >= 65535.0f ? 65535 : (int)(scaled + 0.5f));
+
+				int bx = x / blockSize;
+				rowBlocks[(size_t)bx*blockSize*blockSize + row*blockSize + x % blockSize] = sample;
+				uint16_t *range = &ranges[(bz*blocksX + bx)*2];
+				if (sample < range[0])
+					range[0] = sample;
+				if (sample > range[1])
+					range[1] = sample;
+			}
+		}
+		ok = fwrite(&rowBlocks[0], sizeof(uint16_t), rowBlocks.size(), f) == rowBlocks.size();
+	}
+
+	ok = ok && fseek(f, 0, SEEK_SET) == 0 &&
+		fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(&ranges[0], sizeof(uint16_t), ranges.size(), f) == ranges.size();
+	ok = fclose(f) == 0 && ok;
+	if (!ok)
+		printf("Heightfield %s: write failed\n", path);
+	return ok;
+}
@@ -0,0 +1,127 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	Heightfield.h
+//	Read only terrain heights in a compact binary file, memory mapped
+//
+//	Samples are 16 bit, scaled and offset into heights, and stored in square blocks so
+//	that a terrain tile reads a few contiguous pages rather than one page per row of an
+//	8K wide file. Nothing is read up front: the OS pages blocks in as tiles are built
+//	from them, and the per-block height ranges after the header let the terrain cull
+//	tiles it has never loaded.
+//
+//	File layout (little endian):
+//		HeightfieldHeader
+//		min and max sample of every block, 2 x uint16, blocks in row major order
+//		from dataOffset (a multiple of 4096): the blocks, blockSize x blockSize uint16
+//		samples each, row major. Blocks on the far edges are padded to full size.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class QuadMesh;
+
+struct HeightfieldHeader
+{
+	char magic[4];			// "BHF1"
+	uint32_t width;			// samples along x
+	uint32_t depth;			// samples along z
+	uint32_t blockSize;		// samples along a block side, a power of two
+	float spacing;			// units between neighbouring samples
+	float heightOffset;		// height = heightOffset + heightScale*sample
+	float heightScale;
+	uint32_t dataOffset;	// bytes from the start of the file to the first block
+};
+
+class Heightfield
+{
+public:
+	// Same signature as QuadMesh::HeightFunction
+	typedef float (*HeightFunction)(float x, float z, float time);
+
+	Heightfield();
+	~Heightfield()
+	{
+		Close();
+	}
+
+	// Maps the file and checks its header. Returns false (and prints why) if it is not a
+	// valid heightfield.
+	bool Open(const char *path);
+	void Close();
+
+	bool IsOpen() const
+	{
+		return samples != NULL;
+	}
+
+	int GetWidth() const
+	{
+		return (int)header.width;
+	}
+	int GetDepth() const
+	{
+		return (int)header.depth;
+	}
+	float GetSpacing() const
+	{
+		return header.spacing;
+	}
+	size_t GetFileSize() const
+	{
+		return mappedSize;
+	}
+
+	// Height of sample (x,z), clamped to the field
+	float GetHeight(int x, int z) const
+	{
+		if (x < 0) x = 0; else if (x >= (int)header.width) x = header.width - 1;
+		if (z < 0) z = 0; else if (z >= (int)header.depth) z = header.depth - 1;
+		const uint16_t *block = samples + ((size_t)(z >> blockShift)*blocksX + (x >> blockShift)) * blockSamples;
+		return header.heightOffset + header.heightScale * block[((z & blockMask) << blockShift) + (x & blockMask)];
+	}
+
+	// Height between samples, x and z counted in samples: bilinear between the four around
+	// (x,z), clamped to the field like GetHeight
+	float GetHeight(float x, float z) const;
+
+	// Range of heights over samples [x0,x1] x [z0,z1] from the block table, without touching
+	// the samples. May be wider than the exact range.
+	void GetHeightRange(int x0, int z0, int x1, int z1, float &minHeight, float &maxHeight) const;
+
+	// Sets the heights of a mesh built by QuadMesh::InitMesh from samples
+	// [x0,x0+meshSize] x [z0,z0+meshSize], straight from the mapped blocks, then refreshes
+	// its normals and bounds. Mesh column x is sample x0+x and mesh row z is sample z0+z.
+	// The border normals take in the samples one past the tile, as its neighbours do.
+	void LoadTile(QuadMesh &mesh, int x0, int z0) const;
+
+	// Writes a width x depth field sampled from heightFunction at (x*spacing, z*spacing, 0),
+	// with heights clamped to [minHeight, maxHeight]
+	static bool Write(const char *path, int width, int depth, float spacing,
+	                  float minHeight, float maxHeight, HeightFunction heightFunction);
+
+private:
+	Heightfield(const Heightfield &);
+	Heightfield &operator=(const Heightfield &);
+
+	HeightfieldHeader header;
+	int blockShift;
+	int blockMask;
+	int blockSamples;		// blockSize*blockSize
+	int blocksX;
+	int blocksZ;
+
+	const uint16_t *blockRanges;	// min, max pairs
+	const uint16_t *samples;		// first block
+
+	void *mapping;
+	size_t mappedSize;
+#ifdef _WIN32
+	void *file;
+	void *fileMapping;
+#endif
+};
+
+#endif	//HEIGHTFIELD_H
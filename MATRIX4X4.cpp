@@ -0,0 +1,48 @@
+#include <math.h>
+#include "MathSIMD.h"
+#include "VECTOR3D.h"
+#include "VECTOR4D.h"
+#include "MATRIX4X4.h"
+
+static_assert(sizeof(VECTOR3D) == 3*sizeof(float), "VECTOR3D arrays must be packed x,y,z");
+
+// Four VECTOR3Ds at a time are split into x, y and z registers, transformed with the matrix
+// entries splatted across the lanes and packed back, so no lane is spent on a missing w
+static void TransformArray(const MATRIX4X4 & m, const VECTOR3D * in, VECTOR3D * out, int count, bool points)
+{
+	const float *e = m.entries;
+	SimdFloat4 m0 = SimdSplat(e[0]), m1 = SimdSplat(e[1]), m2 = SimdSplat(e[2]);
+	SimdFloat4 m4 = SimdSplat(e[4]), m5 = SimdSplat(e[5]), m6 = SimdSplat(e[6]);
+	SimdFloat4 m8 = SimdSplat(e[8]), m9 = SimdSplat(e[9]), m10 = SimdSplat(e[10]);
+	float w = points ? 1.0f : 0.0f;
+	SimdFloat4 m12 = SimdSplat(e[12]*w), m13 = SimdSplat(e[13]*w), m14 = SimdSplat(e[14]*w);
+
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		SimdFloat4 x, y, z;
+		SimdLoadXYZ4(&in[i].x, x, y, z);
+		SimdFloat4 rx = SimdMulAdd(x, m0, SimdMulAdd(y, m4, SimdMulAdd(z, m8, m12)));
+		SimdFloat4 ry = SimdMulAdd(x, m1, SimdMulAdd(y, m5, SimdMulAdd(z, m9, m13)));
+		SimdFloat4 rz = SimdMulAdd(x, m2, SimdMulAdd(y, m6, SimdMulAdd(z, m10, m14)));
+		SimdStoreXYZ4(&out[i].x, rx, ry, rz);
+	}
+	for (; i < count; i++)
+		out[i] = points ? m.TransformPoint(in[i]) : m.TransformDirection(in[i]);
+}
+
+void TransformPoints(const MATRIX4X4 & m, const VECTOR3D * in, VECTOR3D * out, int count)
+{
+	TransformArray(m, in, out, count, true);
+}
+
+void TransformDirections(const MATRIX4X4 & m, const VECTOR3D * in, VECTOR3D * out, int count)
+{
+	TransformArray(m, in, out, count, false);
+}
+
+void TransformVectors(const MATRIX4X4 & m, const VECTOR4D * in, VECTOR4D * out, int count)
+{
+	for (int i = 0; i < count; i++)
+		out[i] = m * in[i];
+}
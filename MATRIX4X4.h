@@ -0,0 +1,159 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	MATRIX4X4.h
+//	Class declaration for a 4x4 matrix, column major like OpenGL so it can be handed to
+//	glLoadMatrixf/glMultMatrixf directly. Products run a column at a time on SIMD lanes.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MATRIX4X4_H
+#define MATRIX4X4_H
+
+#include <math.h>
+#include "MathSIMD.h"
+#include "VECTOR3D.h"
+#include "VECTOR4D.h"
+
+class BOT_MATH_ALIGN MATRIX4X4
+{
+public:
+	MATRIX4X4()
+	{	LoadIdentity();	}
+
+	MATRIX4X4(const float *rhs)
+	{	for (int i = 0; i < 16; i++) entries[i] = rhs[i];	}
+
+	void LoadIdentity(void)
+	{
+		for (int i = 0; i < 16; i++)
+			entries[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+	}
+
+	// Same as the GL calls of the same name: this = this * op
+	void Translate(float x, float y, float z)
+	{
+		for (int row = 0; row < 4; row++)
+			entries[12+row] += entries[row]*x + entries[4+row]*y + entries[8+row]*z;
+	}
+
+	void Scale(float x, float y, float z)
+	{
+		for (int row = 0; row < 4; row++)
+		{
+			entries[row] *= x;
+			entries[4+row] *= y;
+			entries[8+row] *= z;
+		}
+	}
+
+	// angle in degrees around (x,y,z), as glRotatef
+	void Rotate(float angle, float x, float y, float z)
+	{
+		MATRIX4X4 r;
+		r.SetRotation(angle, x, y, z);
+		*this = (*this) * r;
+	}
+
+	void SetRotation(float angle, float x, float y, float z)
+	{
+		LoadIdentity();
+		float length = (float)sqrt(x*x + y*y + z*z);
+		if (length == 0.0f)
+			return;
+		x /= length; y /= length; z /= length;
+
+		float radians = angle * 3.14159265358979f / 180.0f;
+		float c = (float)cos(radians);
+		float s = (float)sin(radians);
+		float t = 1.0f - c;
+
+		entries[0] = t*x*x + c;		entries[4] = t*x*y - s*z;	entries[8] = t*x*z + s*y;
+		entries[1] = t*x*y + s*z;	entries[5] = t*y*y + c;		entries[9] = t*y*z - s*x;
+		entries[2] = t*x*z - s*y;	entries[6] = t*y*z + s*x;	entries[10] = t*z*z + c;
+	}
+
+	// Same as gluPerspective, fovy in degrees
+	void SetPerspective(float fovy, float aspect, float zNear, float zFar)
+	{
+		for (int i = 0; i < 16; i++)
+			entries[i] = 0.0f;
+		float f = 1.0f / (float)tan(0.5f * fovy * 3.14159265358979f / 180.0f);
+		entries[0] = f / aspect;
+		entries[5] = f;
+		entries[10] = (zFar + zNear) / (zNear - zFar);
+		entries[11] = -1.0f;
+		entries[14] = 2.0f * zFar * zNear / (zNear - zFar);
+	}
+
+	// Same as gluLookAt
+	void SetLookAt(const VECTOR3D & eye, const VECTOR3D & center, const VECTOR3D & up)
+	{
+		VECTOR3D forward = center - eye;
+		forward.Normalize();
+		VECTOR3D side = forward.CrossProduct(up);
+		side.Normalize();
+		VECTOR3D newUp = side.CrossProduct(forward);
+
+		LoadIdentity();
+		entries[0] = side.x;	entries[4] = side.y;	entries[8] = side.z;
+		entries[1] = newUp.x;	entries[5] = newUp.y;	entries[9] = newUp.z;
+		entries[2] = -forward.x;	entries[6] = -forward.y;	entries[10] = -forward.z;
+		Translate(-eye.x, -eye.y, -eye.z);
+	}
+
+	SimdFloat4 LoadColumn(int col) const
+	{	return SimdLoad(entries + col*4);	}
+
+	MATRIX4X4 operator*(const MATRIX4X4 & rhs) const
+	{
+		// Each result column is this matrix's columns weighted by a column of rhs
+		SimdFloat4 c0 = LoadColumn(0), c1 = LoadColumn(1), c2 = LoadColumn(2), c3 = LoadColumn(3);
+		MATRIX4X4 result;
+		for (int col = 0; col < 4; col++)
+		{
+			const float *r = rhs.entries + col*4;
+			SimdFloat4 sum = SimdMul(c0, SimdSplat(r[0]));
+			sum = SimdMulAdd(c1, SimdSplat(r[1]), sum);
+			sum = SimdMulAdd(c2, SimdSplat(r[2]), sum);
+			sum = SimdMulAdd(c3, SimdSplat(r[3]), sum);
+			SimdStore(result.entries + col*4, sum);
+		}
+		return result;
+	}
+
+	VECTOR4D operator*(const VECTOR4D & v) const
+	{
+		SimdFloat4 sum = SimdMul(LoadColumn(0), SimdSplat(v.x));
+		sum = SimdMulAdd(LoadColumn(1), SimdSplat(v.y), sum);
+		sum = SimdMulAdd(LoadColumn(2), SimdSplat(v.z), sum);
+		sum = SimdMulAdd(LoadColumn(3), SimdSplat(v.w), sum);
+		return VECTOR4D::FromSimd(sum);
+	}
+
+	VECTOR3D TransformPoint(const VECTOR3D & p) const
+	{
+		return VECTOR3D(entries[0]*p.x + entries[4]*p.y + entries[8]*p.z + entries[12],
+		                entries[1]*p.x + entries[5]*p.y + entries[9]*p.z + entries[13],
+		                entries[2]*p.x + entries[6]*p.y + entries[10]*p.z + entries[14]);
+	}
+
+	VECTOR3D TransformDirection(const VECTOR3D & v) const
+	{
+		return VECTOR3D(entries[0]*v.x + entries[4]*v.y + entries[8]*v.z,
+		                entries[1]*v.x + entries[5]*v.y + entries[9]*v.z,
+		                entries[2]*v.x + entries[6]*v.y + entries[10]*v.z);
+	}
+
+	//cast to pointer to a (float *) for glLoadMatrixf etc
+	operator float* () const {return (float*) this;}
+	operator const float* () const {return (const float*) this;}
+
+	//member variables
+	float entries[16];
+};
+
+// Batch versions of TransformPoint/TransformDirection. in and out may be the same array.
+void TransformPoints(const MATRIX4X4 & m, const VECTOR3D * in, VECTOR3D * out, int count);
+void TransformDirections(const MATRIX4X4 & m, const VECTOR3D * in, VECTOR3D * out, int count);
+// Full 4d transform, for homogeneous coordinates
+void TransformVectors(const MATRIX4X4 & m, const VECTOR4D * in, VECTOR4D * out, int count);
+
+#endif	//MATRIX4X4_H
@@ -0,0 +1,93 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <math.h>
+#include <string.h>
+#include "VECTOR3D.h"
+#include "GLExtensions.h"
+#include "MaterialRegistry.h"
+
+MaterialRegistry::MaterialRegistry()
+{
+	boundMaterial = -1;
+}
+
+MaterialRegistry &MaterialRegistry::Shared()
+{
+	static MaterialRegistry registry;
+	return registry;
+}
+
+int MaterialRegistry::Add(const Material &material)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		if (memcmp(&materials[i], &material, sizeof(Material)) == 0)
+			return (int)i;
+	}
+	materials.push_back(material);
+	return (int)materials.size() - 1;
+}
+
+int MaterialRegistry::Add(const GLfloat ambient[4], const GLfloat diffuse[4], const GLfloat specular[4], GLfloat shininess)
+{
+	Material material;
+	for (int i = 0; i < 4; i++)
+	{
+		material.ambient[i] = ambient[i];
+		material.diffuse[i] = diffuse[i];
+		material.specular[i] = specular[i];
+	}
+	material.shininess[0] = shininess;
+	return Add(material);
+}
+
+int MaterialRegistry::Add(VECTOR3D ambient, VECTOR3D diffuse, VECTOR3D specular, double shininess)
+{
+	GLfloat a[4] = { ambient.x, ambient.y, ambient.z, 1.0f };
+	GLfloat d[4] = { diffuse.x, diffuse.y, diffuse.z, 1.0f };
+	GLfloat s[4] = { specular.x, specular.y, specular.z, 1.0f };
+	return Add(a, d, s, (GLfloat)shininess);
+}
+
+Material MaterialRegistry::Get(int id)
+{
+	// Unknown ids get GL's default material
+	Material material = { { 0.2f, 0.2f, 0.2f, 1.0f }, { 0.8f, 0.8f, 0.8f, 1.0f }, { 0.0f, 0.0f, 0.0f, 1.0f }, { 0.0f } };
+	std::lock_guard<std::mutex> lock(mutex);
+	if (id >= 0 && id < (int)materials.size())
+		material = materials[id];
+	return material;
+}
+
+void MaterialRegistry::Apply(int id)
+{
+	if (id == boundMaterial)
+	{
+		stats.skipped++;
+		return;
+	}
+
+	// Another thread may be adding a material
+	std::lock_guard<std::mutex> lock(mutex);
+	if (id < 0 || id >= (int)materials.size())
+		return;
+
+	const Material &material = materials[id];
+	glMaterialfv(GL_FRONT, GL_AMBIENT, material.ambient);
+	glMaterialfv(GL_FRONT, GL_SPECULAR, material.specular);
+	glMaterialfv(GL_FRONT, GL_DIFFUSE, material.diffuse);
+	glMaterialfv(GL_FRONT, GL_SHININESS, material.shininess);
+	CountGLCalls(4);
+	CountGLStateChange();
+	boundMaterial = id;
+	stats.applied++;
+}
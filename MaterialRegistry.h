@@ -0,0 +1,79 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	MaterialRegistry.h
+//	Materials referred to by integer id, and the one place glMaterialfv is called from, so
+//	setting the material that is already bound costs nothing
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MATERIALREGISTRY_H
+#define MATERIALREGISTRY_H
+
+#include <mutex>
+#include <vector>
+
+// Front face material, same layout glMaterialfv takes
+struct Material
+{
+	GLfloat ambient[4];
+	GLfloat diffuse[4];
+	GLfloat specular[4];
+	GLfloat shininess[1];
+};
+
+// Per-frame counts of material state changes
+struct MaterialStats
+{
+	int applied;	// materials actually sent to GL
+	int skipped;	// requests for the material already bound
+
+	MaterialStats() : applied(0), skipped(0) {}
+	void Reset()
+	{
+		applied = skipped = 0;
+	}
+};
+
+class MaterialRegistry
+{
+public:
+	MaterialRegistry();
+
+	// Returns the id of the material, registering it if no identical one exists yet.
+	// Safe to call from any thread.
+	int Add(const Material &material);
+	int Add(const GLfloat ambient[4], const GLfloat diffuse[4], const GLfloat specular[4], GLfloat shininess);
+	// Opaque colours, as QuadMesh::SetMaterial takes them
+	int Add(VECTOR3D ambient, VECTOR3D diffuse, VECTOR3D specular, double shininess);
+
+	// Copy of material id, for renderers that light without GL. Safe from any thread.
+	Material Get(int id);
+
+	// Makes id the current material, skipped when it already is. Needs the GL context.
+	void Apply(int id);
+
+	// Forget what is bound, for when something else may have called glMaterialfv
+	void Invalidate()
+	{
+		boundMaterial = -1;
+	}
+
+	int GetNumMaterials() const
+	{
+		return (int)materials.size();
+	}
+
+	MaterialStats &GetStats()
+	{
+		return stats;
+	}
+
+	// Registry used by the meshes and the demo
+	static MaterialRegistry &Shared();
+
+private:
+	std::vector<Material> materials;
+	std::mutex mutex;
+	int boundMaterial;
+	MaterialStats stats;
+};
+
+#endif	//MATERIALREGISTRY_H
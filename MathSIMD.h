@@ -0,0 +1,248 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	MathSIMD.h
+//	Four float lanes for the math classes (VECTOR4D, QUATERNION, MATRIX4X4), built on SSE
+//	on x86, where every 64 bit CPU has it, on NEON on ARM, and on plain floats otherwise.
+//	Define BOT_MATH_SCALAR to force the plain version.
+//
+//	The classes are 16 byte aligned, but loads and stores are unaligned so they stay
+//	correct where the allocator does not honour the alignment (32 bit heaps).
+//
+//	SimdLoadXYZ4/SimdStoreXYZ4 move four packed x,y,z vectors (VECTOR3D arrays, QuadMesh
+//	positions) in and out of one register per component, for the batch functions
+//	(MATRIX4X4.cpp, VectorArrays.cpp).
+//
+//	The comparisons give lane masks for SimdAnd, SimdSelect and SimdMoveMask (the software
+//	rasterizer's coverage and depth tests). Only use masks with those.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MATHSIMD_H
+#define MATHSIMD_H
+
+#if !defined(BOT_MATH_SCALAR)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define BOT_MATH_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BOT_MATH_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#include <math.h>
+
+#define BOT_MATH_ALIGN	alignas(16)
+
+#if defined(BOT_MATH_SSE)
+
+typedef __m128 SimdFloat4;
+
+inline SimdFloat4 SimdLoad(const float *p)		{ return _mm_loadu_ps(p); }
+inline void SimdStore(float *p, SimdFloat4 a)	{ _mm_storeu_ps(p, a); }
+inline SimdFloat4 SimdSplat(float f)			{ return _mm_set1_ps(f); }
+inline SimdFloat4 SimdAdd(SimdFloat4 a, SimdFloat4 b)	{ return _mm_add_ps(a, b); }
+inline SimdFloat4 SimdSub(SimdFloat4 a, SimdFloat4 b)	{ return _mm_sub_ps(a, b); }
+inline SimdFloat4 SimdMul(SimdFloat4 a, SimdFloat4 b)	{ return _mm_mul_ps(a, b); }
+// a*b + c
+inline SimdFloat4 SimdMulAdd(SimdFloat4 a, SimdFloat4 b, SimdFloat4 c)	{ return _mm_add_ps(_mm_mul_ps(a, b), c); }
+inline SimdFloat4 SimdDiv(SimdFloat4 a, SimdFloat4 b)	{ return _mm_div_ps(a, b); }
+inline SimdFloat4 SimdSqrt(SimdFloat4 a)				{ return _mm_sqrt_ps(a); }
+
+// 1/sqrt(a): the hardware estimate plus one Newton-Raphson step, good to about 22 bits
+inline SimdFloat4 SimdRsqrt(SimdFloat4 a)
+{
+	__m128 r = _mm_rsqrt_ps(a);
+	return _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), a), _mm_mul_ps(r, r))));
+}
+
+// test > 0 ? a : b in every lane
+inline SimdFloat4 SimdSelectPositive(SimdFloat4 test, SimdFloat4 a, SimdFloat4 b)
+{
+	__m128 mask = _mm_cmpgt_ps(test, _mm_setzero_ps());
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Lanes a, b, c, d in that order
+inline SimdFloat4 SimdSet(float a, float b, float c, float d)	{ return _mm_setr_ps(a, b, c, d); }
+inline SimdFloat4 SimdMin(SimdFloat4 a, SimdFloat4 b)	{ return _mm_min_ps(a, b); }
+inline SimdFloat4 SimdMax(SimdFloat4 a, SimdFloat4 b)	{ return _mm_max_ps(a, b); }
+
+// Masks with every bit of a lane set where the comparison holds
+inline SimdFloat4 SimdCmpGE(SimdFloat4 a, SimdFloat4 b)	{ return _mm_cmpge_ps(a, b); }
+inline SimdFloat4 SimdCmpLT(SimdFloat4 a, SimdFloat4 b)	{ return _mm_cmplt_ps(a, b); }
+inline SimdFloat4 SimdAnd(SimdFloat4 a, SimdFloat4 b)	{ return _mm_and_ps(a, b); }
+// mask ? a : b in every lane
+inline SimdFloat4 SimdSelect(SimdFloat4 mask, SimdFloat4 a, SimdFloat4 b)
+{	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));	}
+// Bit i set where lane i of the mask is
+inline int SimdMoveMask(SimdFloat4 mask)	{ return _mm_movemask_ps(mask); }
+
+// p holds x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+inline void SimdLoadXYZ4(const float *p, SimdFloat4 &x, SimdFloat4 &y, SimdFloat4 &z)
+{
+	__m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+	x = _mm_shuffle_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3,3,3,0)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(1,1,2,2)), _MM_SHUFFLE(2,0,1,0));
+	y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0,0,1,1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2,2,3,3)), _MM_SHUFFLE(2,0,2,0));
+	z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1,1,2,2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3,3,0,0)), _MM_SHUFFLE(2,0,2,0));
+}
+
+inline void SimdStoreXYZ4(float *p, SimdFloat4 x, SimdFloat4 y, SimdFloat4 z)
+{
+	_mm_storeu_ps(p, _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0,0,0,0)), _mm_shuffle_ps(z, x, _MM_SHUFFLE(1,1,0,0)), _MM_SHUFFLE(2,0,2,0)));
+	_mm_storeu_ps(p + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1,1,1,1)), _mm_shuffle_ps(x, y, _MM_SHUFFLE(2,2,2,2)), _MM_SHUFFLE(2,0,2,0)));
+	_mm_storeu_ps(p + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3,3,2,2)), _mm_shuffle_ps(y, z, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(2,0,2,0)));
+}
+
+#elif defined(BOT_MATH_NEON)
+
+typedef float32x4_t SimdFloat4;
+
+inline SimdFloat4 SimdLoad(const float *p)		{ return vld1q_f32(p); }
+inline void SimdStore(float *p, SimdFloat4 a)	{ vst1q_f32(p, a); }
+inline SimdFloat4 SimdSplat(float f)			{ return vdupq_n_f32(f); }
+inline SimdFloat4 SimdAdd(SimdFloat4 a, SimdFloat4 b)	{ return vaddq_f32(a, b); }
+inline SimdFloat4 SimdSub(SimdFloat4 a, SimdFloat4 b)	{ return vsubq_f32(a, b); }
+inline SimdFloat4 SimdMul(SimdFloat4 a, SimdFloat4 b)	{ return vmulq_f32(a, b); }
+inline SimdFloat4 SimdMulAdd(SimdFloat4 a, SimdFloat4 b, SimdFloat4 c)	{ return vmlaq_f32(c, a, b); }
+
+#if defined(__aarch64__)
+inline SimdFloat4 SimdDiv(SimdFloat4 a, SimdFloat4 b)	{ return vdivq_f32(a, b); }
+inline SimdFloat4 SimdSqrt(SimdFloat4 a)				{ return vsqrtq_f32(a); }
+#else
+// 32 bit NEON has no divide or square root
+inline SimdFloat4 SimdDiv(SimdFloat4 a, SimdFloat4 b)
+{
+	float pa[4], pb[4];
+	vst1q_f32(pa, a);
+	vst1q_f32(pb, b);
+	for (int i = 0; i < 4; i++)
+		pa[i] /= pb[i];
+	return vld1q_f32(pa);
+}
+inline SimdFloat4 SimdSqrt(SimdFloat4 a)
+{
+	float p[4];
+	vst1q_f32(p, a);
+	for (int i = 0; i < 4; i++)
+		p[i] = sqrtf(p[i]);
+	return vld1q_f32(p);
+}
+#endif
+
+// 1/sqrt(a): the estimate plus two Newton-Raphson steps, NEON's estimate being only 8 bits
+inline SimdFloat4 SimdRsqrt(SimdFloat4 a)
+{
+	float32x4_t r = vrsqrteq_f32(a);
+	r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a, r), r));
+	return vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(a, r), r));
+}
+
+inline SimdFloat4 SimdSelectPositive(SimdFloat4 test, SimdFloat4 a, SimdFloat4 b)
+{	return vbslq_f32(vcgtq_f32(test, vdupq_n_f32(0.0f)), a, b);	}
+
+inline SimdFloat4 SimdSet(float a, float b, float c, float d)
+{	float p[4] = { a, b, c, d }; return vld1q_f32(p);	}
+inline SimdFloat4 SimdMin(SimdFloat4 a, SimdFloat4 b)	{ return vminq_f32(a, b); }
+inline SimdFloat4 SimdMax(SimdFloat4 a, SimdFloat4 b)	{ return vmaxq_f32(a, b); }
+
+inline SimdFloat4 SimdCmpGE(SimdFloat4 a, SimdFloat4 b)	{ return vreinterpretq_f32_u32(vcgeq_f32(a, b)); }
+inline SimdFloat4 SimdCmpLT(SimdFloat4 a, SimdFloat4 b)	{ return vreinterpretq_f32_u32(vcltq_f32(a, b)); }
+inline SimdFloat4 SimdAnd(SimdFloat4 a, SimdFloat4 b)
+{	return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)));	}
+inline SimdFloat4 SimdSelect(SimdFloat4 mask, SimdFloat4 a, SimdFloat4 b)
+{	return vbslq_f32(vreinterpretq_u32_f32(mask), a, b);	}
+// NEON has no movemask, the top bit of each lane is gathered by hand
+inline int SimdMoveMask(SimdFloat4 mask)
+{
+	uint32x4_t bits = vshrq_n_u32(vreinterpretq_u32_f32(mask), 31);
+	return (int)(vgetq_lane_u32(bits, 0) | (vgetq_lane_u32(bits, 1) << 1) |
+	             (vgetq_lane_u32(bits, 2) << 2) | (vgetq_lane_u32(bits, 3) << 3));
+}
+
+inline void SimdLoadXYZ4(const float *p, SimdFloat4 &x, SimdFloat4 &y, SimdFloat4 &z)
+{
+	float32x4x3_t v = vld3q_f32(p);
+	x = v.val[0];
+	y = v.val[1];
+	z = v.val[2];
+}
+
+inline void SimdStoreXYZ4(float *p, SimdFloat4 x, SimdFloat4 y, SimdFloat4 z)
+{
+	float32x4x3_t v;
+	v.val[0] = x;
+	v.val[1] = y;
+	v.val[2] = z;
+	vst3q_f32(p, v);
+}
+
+#else
+
+struct SimdFloat4
+{
+	float v[4];
+};
+
+inline SimdFloat4 SimdLoad(const float *p)
+{	SimdFloat4 r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r;	}
+inline void SimdStore(float *p, SimdFloat4 a)
+{	for (int i = 0; i < 4; i++) p[i] = a.v[i];	}
+inline SimdFloat4 SimdSplat(float f)
+{	SimdFloat4 r; for (int i = 0; i < 4; i++) r.v[i] = f; return r;	}
+inline SimdFloat4 SimdAdd(SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a;	}
+inline SimdFloat4 SimdSub(SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a;	}
+inline SimdFloat4 SimdMul(SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a;	}
+inline SimdFloat4 SimdMulAdd(SimdFloat4 a, SimdFloat4 b, SimdFloat4 c)
+{	for (int i = 0; i < 4; i++) c.v[i] += a.v[i]*b.v[i]; return c;	}
+inline SimdFloat4 SimdDiv(SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) a.v[i] /= b.v[i]; return a;	}
+inline SimdFloat4 SimdSqrt(SimdFloat4 a)
+{	for (int i = 0; i < 4; i++) a.v[i] = sqrtf(a.v[i]); return a;	}
+inline SimdFloat4 SimdRsqrt(SimdFloat4 a)
+{	for (int i = 0; i < 4; i++) a.v[i] = 1.0f / sqrtf(a.v[i]); return a;	}
+inline SimdFloat4 SimdSelectPositive(SimdFloat4 test, SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) if (!(test.v[i] > 0.0f)) a.v[i] = b.v[i]; return a;	}
+inline SimdFloat4 SimdSet(float a, float b, float c, float d)
+{	SimdFloat4 r; r.v[0] = a; r.v[1] = b; r.v[2] = c; r.v[3] = d; return r;	}
+inline SimdFloat4 SimdMin(SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) if (b.v[i] < a.v[i]) a.v[i] = b.v[i]; return a;	}
+inline SimdFloat4 SimdMax(SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) if (b.v[i] > a.v[i]) a.v[i] = b.v[i]; return a;	}
+
+// Mask lanes are 1 or 0 here
+inline SimdFloat4 SimdCmpGE(SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) a.v[i] = a.v[i] >= b.v[i] ? 1.0f : 0.0f; return a;	}
+inline SimdFloat4 SimdCmpLT(SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) a.v[i] = a.v[i] < b.v[i] ? 1.0f : 0.0f; return a;	}
+inline SimdFloat4 SimdAnd(SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) a.v[i] = a.v[i] != 0.0f && b.v[i] != 0.0f ? 1.0f : 0.0f; return a;	}
+inline SimdFloat4 SimdSelect(SimdFloat4 mask, SimdFloat4 a, SimdFloat4 b)
+{	for (int i = 0; i < 4; i++) if (mask.v[i] == 0.0f) a.v[i] = b.v[i]; return a;	}
+inline int SimdMoveMask(SimdFloat4 mask)
+{	int bits = 0; for (int i = 0; i < 4; i++) if (mask.v[i] != 0.0f) bits |= 1 << i; return bits;	}
+
+inline void SimdLoadXYZ4(const float *p, SimdFloat4 &x, SimdFloat4 &y, SimdFloat4 &z)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		x.v[i] = p[i*3];
+		y.v[i] = p[i*3+1];
+		z.v[i] = p[i*3+2];
+	}
+}
+
+inline void SimdStoreXYZ4(float *p, SimdFloat4 x, SimdFloat4 y, SimdFloat4 z)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		p[i*3] = x.v[i];
+		p[i*3+1] = y.v[i];
+		p[i*3+2] = z.v[i];
+	}
+}
+
+#endif
+
+#endif	//MATHSIMD_H
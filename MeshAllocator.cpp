@@ -0,0 +1,219 @@
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "MeshAllocator.h"
+
+// Allocate hands out multiples of this from the arena, so every piece stays aligned like
+// the chunk it comes from, which the heap aligns for SIMD loads
+static const size_t arenaAlignment = 16;
+
+MeshAllocator::MeshAllocator()
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+MeshAllocatorStats MeshAllocator::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	return stats;
+}
+
+void MeshAllocator::CountAllocate(size_t bytes, bool reused)
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	stats.allocations++;
+	if (reused)
+		stats.reused++;
+	stats.bytesInUse += bytes;
+	if (stats.bytesInUse > stats.peakBytesInUse)
+		stats.peakBytesInUse = stats.bytesInUse;
+}
+
+void MeshAllocator::CountFree(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	stats.frees++;
+	stats.bytesInUse -= bytes;
+}
+
+void MeshAllocator::CountHeld(size_t taken, size_t released)
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	stats.bytesHeld += taken;
+	stats.bytesHeld -= released;
+}
+
+class HeapMeshAllocator : public MeshAllocator
+{
+public:
+	void *Allocate(size_t bytes)
+	{
+		void *memory = ::operator new(bytes, std::nothrow);
+		if (!memory)
+			return NULL;
+		CountHeld(bytes, 0);
+		CountAllocate(bytes, false);
+		return memory;
+	}
+
+	void Free(void *memory, size_t bytes)
+	{
+		if (!memory)
+			return;
+		::operator delete(memory);
+		CountFree(bytes);
+		CountHeld(0, bytes);
+	}
+};
+
+MeshAllocator &MeshAllocator::Heap()
+{
+	static HeapMeshAllocator heap;
+	return heap;
+}
+
+MeshPool::MeshPool(size_t maxPooledBytes) : pooledBytes(0), maxPooledBytes(maxPooledBytes)
+{
+}
+
+MeshPool::~MeshPool()
+{
+	Trim();
+}
+
+void *MeshPool::Allocate(size_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<size_t, std::vector<void *> >::iterator it = freeBlocks.find(bytes);
+		if (it != freeBlocks.end() && !it->second.empty())
+		{
+			void *memory = it->second.back();
+			it->second.pop_back();
+			pooledBytes -= bytes;
+			CountAllocate(bytes, true);
+			return memory;
+		}
+	}
+
+	// Out of the lock, the heap has its own
+	void *memory = ::operator new(bytes, std::nothrow);
+	if (!memory)
+		return NULL;
+	CountHeld(bytes, 0);
+	CountAllocate(bytes, false);
+	return memory;
+}
+
+void MeshPool::Free(void *memory, size_t bytes)
+{
+	if (!memory)
+		return;
+	CountFree(bytes);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (pooledBytes + bytes <= maxPooledBytes)
+		{
+			freeBlocks[bytes].push_back(memory);
+			pooledBytes += bytes;
+			return;
+		}
+	}
+	::operator delete(memory);
+	CountHeld(0, bytes);
+}
+
+void MeshPool::SetMaxPooledBytes(size_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		maxPooledBytes = bytes;
+		if (pooledBytes <= maxPooledBytes)
+			return;
+	}
+	Trim();
+}
+
+void MeshPool::Trim()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<size_t, std::vector<void *> >::iterator it;
+	for (it = freeBlocks.begin(); it != freeBlocks.end(); ++it)
+	{
+		for (size_t i = 0; i < it->second.size(); i++)
+			::operator delete(it->second[i]);
+		CountHeld(0, it->first * it->second.size());
+	}
+	freeBlocks.clear();
+	pooledBytes = 0;
+}
+
+MeshArena::MeshArena(size_t chunkBytes) : chunkBytes(chunkBytes), current(0), offset(0), live(0)
+{
+}
+
+MeshArena::~MeshArena()
+{
+	Release();
+}
+
+void *MeshArena::Allocate(size_t bytes)
+{
+	size_t size = (bytes + arenaAlignment - 1) & ~(arenaAlignment - 1);
+	// Nothing is in use, and nothing can be freed before this returns, so the chunks are
+	// all free
+	if (live == 0)
+	{
+		current = 0;
+		offset = 0;
+	}
+
+	while (current < chunks.size() && offset + size > chunks[current].size)
+	{
+		current++;
+		offset = 0;
+	}
+	bool reused = current < chunks.size();
+	if (!reused)
+	{
+		Chunk chunk;
+		chunk.size = size > chunkBytes ? size : chunkBytes;
+		chunk.memory = (char *)::operator new(chunk.size, std::nothrow);
+		if (!chunk.memory)
+			return NULL;
+		chunks.push_back(chunk);
+		CountHeld(chunk.size, 0);
+	}
+
+	void *memory = chunks[current].memory + offset;
+	offset += size;
+	live++;
+	CountAllocate(bytes, reused);
+	return memory;
+}
+
+void MeshArena::Free(void *memory, size_t bytes)
+{
+	if (!memory)
+		return;
+	CountFree(bytes);
+	live--;
+}
+
+void MeshArena::Release()
+{
+	if (live != 0)
+		return;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		::operator delete(chunks[i].memory);
+		CountHeld(0, chunks[i].size);
+	}
+	chunks.clear();
+	current = 0;
+	offset = 0;
+}
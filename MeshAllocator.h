@@ -0,0 +1,114 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	MeshAllocator.h
+//	Where QuadMesh gets the memory for its vertex and index arrays
+//
+//	Meshes use the heap unless they are given another allocator. A MeshPool keeps the
+//	arrays of freed meshes by size and hands them to the next mesh of the same size, so
+//	terrain tiles evicted and built again as the centre moves reuse each other's memory
+//	rather than going through the heap. A MeshArena hands out pieces of a few large chunks
+//	one after another and only takes memory back once all of it is free, for meshes that
+//	one thread builds together and that go away together.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MESHALLOCATOR_H
+#define MESHALLOCATOR_H
+
+#include <stddef.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Counts since the allocator was created, and bytes now
+struct MeshAllocatorStats
+{
+	long long allocations;
+	long long frees;
+	long long reused;			// allocations served from memory the allocator already held
+	size_t bytesInUse;			// allocated and not yet freed
+	size_t peakBytesInUse;
+	size_t bytesHeld;			// taken from the heap, in use or kept for reuse
+};
+
+class MeshAllocator
+{
+public:
+	virtual ~MeshAllocator() {}
+
+	// bytes aligned for any vertex or index type, NULL when out of memory
+	virtual void *Allocate(size_t bytes) = 0;
+	// Memory from Allocate, with the size it was allocated with. NULL is ignored.
+	virtual void Free(void *memory, size_t bytes) = 0;
+
+	MeshAllocatorStats GetStats() const;
+
+	// Plain heap, the default for meshes. Any thread.
+	static MeshAllocator &Heap();
+
+protected:
+	MeshAllocator();
+	void CountAllocate(size_t bytes, bool reused);
+	void CountFree(size_t bytes);
+	void CountHeld(size_t taken, size_t released);
+
+private:
+	mutable std::mutex statsMutex;
+	MeshAllocatorStats stats;
+};
+
+// Size class pool. Any thread may allocate and free, a block freed on one thread can go to
+// a mesh built on another.
+class MeshPool : public MeshAllocator
+{
+public:
+	// Keeps up to maxPooledBytes of freed blocks, those past it go back to the heap
+	MeshPool(size_t maxPooledBytes = 16 << 20);
+	// Blocks still in use must have been freed
+	~MeshPool();
+
+	void *Allocate(size_t bytes);
+	void Free(void *memory, size_t bytes);
+
+	void SetMaxPooledBytes(size_t bytes);
+	// Gives the kept blocks back to the heap
+	void Trim();
+
+private:
+	std::mutex mutex;
+	std::map<size_t, std::vector<void *> > freeBlocks;	// by size
+	size_t pooledBytes;
+	size_t maxPooledBytes;
+};
+
+// Bump allocator over chunks of chunkBytes, bigger requests get a chunk of their own.
+// Allocate from one thread at a time, normally one arena per building thread; Free may be
+// called from any. Freed pieces are not reused on their own: once everything allocated is
+// freed the next Allocate starts from the first chunk again.
+class MeshArena : public MeshAllocator
+{
+public:
+	MeshArena(size_t chunkBytes = 1 << 20);
+	// Everything allocated must have been freed
+	~MeshArena();
+
+	void *Allocate(size_t bytes);
+	void Free(void *memory, size_t bytes);
+
+	// Gives the chunks back to the heap. Allocating thread, with nothing in use.
+	void Release();
+
+private:
+	struct Chunk
+	{
+		char *memory;
+		size_t size;
+	};
+
+	size_t chunkBytes;
+	std::vector<Chunk> chunks;
+	size_t current;				// chunk allocations come from
+	size_t offset;				// into it
+	std::atomic<int> live;		// allocations not yet freed
+};
+
+#endif	//MESHALLOCATOR_H
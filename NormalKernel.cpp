@@ -0,0 +1,316 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "NormalKernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NORMAL_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE
+#define TARGET_AVX2
+#else
+#define TARGET_SSE	__attribute__((target("sse2")))
+#define TARGET_AVX2	__attribute__((target("avx2,fma")))
+#endif
+#endif
+
+// One grid row split into separate x, y and z arrays so that neighbouring
+// vertices can be loaded into SIMD lanes directly
+struct PlanarRow
+{
+	int row;
+	std::vector<float> x, y, z;
+};
+
+// The three rows a normal row depends on. Consecutive rows land in different
+// slots, so walking down the grid deinterleaves every row only once.
+class RowWindow
+{
+public:
+	RowWindow(const float *positions, int cols) : positions(positions), cols(cols)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			slots[i].row = -1;
+			slots[i].x.resize(cols);
+			slots[i].y.resize(cols);
+			slots[i].z.resize(cols);
+		}
+	}
+
+	const PlanarRow &Get(int row)
+	{
+		PlanarRow &slot = slots[row % 3];
+		if (slot.row != row)
+		{
+			const float *p = positions + row*cols*3;
+			for (int c = 0; c < cols; c++)
+			{
+				slot.x[c] = p[c*3];
+				slot.y[c] = p[c*3+1];
+				slot.z[c] = p[c*3+2];
+			}
+			slot.row = row;
+		}
+		return slot;
+	}
+
+private:
+	const float *positions;
+	int cols;
+	PlanarRow slots[3];
+};
+
+struct NormalRowArgs
+{
+	const PlanarRow *down, *center, *up;
+	float *nx, *ny, *nz;	// output, indexed from colBegin
+	int cols;
+	int colBegin;
+};
+
+// Reference version for a single vertex, also used for the grid edges
+static inline void GridNormal(const NormalRowArgs &a, int c)
+{
+	int left = c > 0 ? c-1 : 0;
+	int right = c < a.cols-1 ? c+1 : a.cols-1;
+
+	float dux = a.center->x[right] - a.center->x[left];
+	float duy = a.center->y[right] - a.center->y[left];
+	float duz = a.center->z[right] - a.center->z[left];
+	float dvx = a.up->x[c] - a.down->x[c];
+	float dvy = a.up->y[c] - a.down->y[c];
+	float dvz = a.up->z[c] - a.down->z[c];
+
+	float nx = duy*dvz - duz*dvy;
+	float ny = duz*dvx - dux*dvz;
+	float nz = dux*dvy - duy*dvx;
+	float len = (float)sqrt(nx*nx + ny*ny + nz*nz);
+	float inv = len > 0 ? 1.0f/len : 0.0f;
+
+	a.nx[c-a.colBegin] = nx*inv;
+	a.ny[c-a.colBegin] = ny*inv;
+	a.nz[c-a.colBegin] = nz*inv;
+}
+
+static void NormalRowScalar(const NormalRowArgs &a, int c0, int c1)
+{
+	for (int c = c0; c < c1; c++)
+		GridNormal(a, c);
+}
+
+#ifdef NORMAL_KERNEL_X86
+
+// Interior columns only (both neighbours exist), 4 vertices per iteration.
+// Returns the first column it did not process.
+TARGET_SSE static int NormalRowSSE(const NormalRowArgs &a, int c0, int c1)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 threeHalves = _mm_set1_ps(1.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	int c = c0;
+	for (; c + 4 <= c1; c += 4)
+	{
+		__m128 dux = _mm_sub_ps(_mm_loadu_ps(&a.center->x[c+1]), _mm_loadu_ps(&a.center->x[c-1]));
+		__m128 duy = _mm_sub_ps(_mm_loadu_ps(&a.center->y[c+1]), _mm_loadu_ps(&a.center->y[c-1]));
+		__m128 duz = _mm_sub_ps(_mm_loadu_ps(&a.center->z[c+1]), _mm_loadu_ps(&a.center->z[c-1]));
+		__m128 dvx = _mm_sub_ps(_mm_loadu_ps(&a.up->x[c]), _mm_loadu_ps(&a.down->x[c]));
+		__m128 dvy = _mm_sub_ps(_mm_loadu_ps(&a.up->y[c]), _mm_loadu_ps(&a.down->y[c]));
+		__m128 dvz = _mm_sub_ps(_mm_loadu_ps(&a.up->z[c]), _mm_loadu_ps(&a.down->z[c]));
+
+		__m128 nx = _mm_sub_ps(_mm_mul_ps(duy, dvz), _mm_mul_ps(duz, dvy));
+		__m128 ny = _mm_sub_ps(_mm_mul_ps(duz, dvx), _mm_mul_ps(dux, dvz));
+		__m128 nz = _mm_sub_ps(_mm_mul_ps(dux, dvy), _mm_mul_ps(duy, dvx));
+
+		// Approximate reciprocal square root plus one Newton-Raphson step, zero length stays zero
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+		__m128 r = _mm_rsqrt_ps(len2);
+		r = _mm_mul_ps(r, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, len2), _mm_mul_ps(r, r))));
+		r = _mm_and_ps(r, _mm_cmpgt_ps(len2, zero));
+
+		_mm_storeu_ps(&a.nx[c-a.colBegin], _mm_mul_ps(nx, r));
+		_mm_storeu_ps(&a.ny[c-a.colBegin], _mm_mul_ps(ny, r));
+		_mm_storeu_ps(&a.nz[c-a.colBegin], _mm_mul_ps(nz, r));
+	}
+	return c;
+}
+
+// Same as NormalRowSSE, 8 vertices per iteration
+TARGET_AVX2 static int NormalRowAVX2(const NormalRowArgs &a, int c0, int c1)
+{
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 threeHalves = _mm256_set1_ps(1.5f);
+	const __m256 zero = _mm256_setzero_ps();
+
+	int c = c0;
+	for (; c + 8 <= c1; c += 8)
+	{
+		__m256 dux = _mm256_sub_ps(_mm256_loadu_ps(&a.center->x[c+1]), _mm256_loadu_ps(&a.center->x[c-1]));
+		__m256 duy = _mm256_sub_ps(_mm256_loadu_ps(&a.center->y[c+1]), _mm256_loadu_ps(&a.center->y[c-1]));
+		__m256 duz = _mm256_sub_ps(_mm256_loadu_ps(&a.center->z[c+1]), _mm256_loadu_ps(&a.center->z[c-1]));
+		__m256 dvx = _mm256_sub_ps(_mm256_loadu_ps(&a.up->x[c]), _mm256_loadu_ps(&a.down->x[c]));
+		__m256 dvy = _mm256_sub_ps(_mm256_loadu_ps(&a.up->y[c]), _mm256_loadu_ps(&a.down->y[c]));
+		__m256 dvz = _mm256_sub_ps(_mm256_loadu_ps(&a.up->z[c]), _mm256_loadu_ps(&a.down->z[c]));
+
+		__m256 nx = _mm256_fmsub_ps(duy, dvz, _mm256_mul_ps(duz, dvy));
+		__m256 ny = _mm256_fmsub_ps(duz, dvx, _mm256_mul_ps(dux, dvz));
+		__m256 nz = _mm256_fmsub_ps(dux, dvy, _mm256_mul_ps(duy, dvx));
+
+		__m256 len2 = _mm256_fmadd_ps(nz, nz, _mm256_fmadd_ps(ny, ny, _mm256_mul_ps(nx, nx)));
+		__m256 r = _mm256_rsqrt_ps(len2);
+		r = _mm256_mul_ps(r, _mm256_fnmadd_ps(_mm256_mul_ps(half, len2), _mm256_mul_ps(r, r), threeHalves));
+		r = _mm256_and_ps(r, _mm256_cmp_ps(len2, zero, _CMP_GT_OQ));
+
+		_mm256_storeu_ps(&a.nx[c-a.colBegin], _mm256_mul_ps(nx, r));
+		_mm256_storeu_ps(&a.ny[c-a.colBegin], _mm256_mul_ps(ny, r));
+		_mm256_storeu_ps(&a.nz[c-a.colBegin], _mm256_mul_ps(nz, r));
+	}
+	return c;
+}
+
+static bool CpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	if (!osxsave || !fma || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+#endif	// NORMAL_KERNEL_X86
+
+NormalKernelPath SelectNormalKernel(NormalKernelPath requested)
+{
+#ifdef NORMAL_KERNEL_X86
+	static const bool hasAVX2 = CpuHasAVX2();
+
+	if (requested == NORMAL_KERNEL_AUTO)
+		return hasAVX2 ? NORMAL_KERNEL_AVX2 : NORMAL_KERNEL_SSE;
+	if (requested == NORMAL_KERNEL_AVX2 && !hasAVX2)
+		return NORMAL_KERNEL_SSE;
+	return requested;
+#else
+	return NORMAL_KERNEL_SCALAR;
+#endif
+}
+
+const char *NormalKernelName(NormalKernelPath path)
+{
+	switch (path)
+	{
+	case NORMAL_KERNEL_SCALAR:	return "scalar";
+	case NORMAL_KERNEL_SSE:		return "SSE";
+	case NORMAL_KERNEL_AVX2:	return "AVX2";
+	default:					return "auto";
+	}
+}
+
+// Normals for columns [colBegin,colEnd) and rows [rowBegin,rowEnd) of the grid, written to
+// normals as a grid outCols wide whose first row and column are grid row and column
+// outOrigin
+static void NormalRows(const float *positions, int cols, int rows, int colBegin, int rowBegin,
+                       int colEnd, int rowEnd, NormalKernelPath path, float *normals, int outCols,
+                       int outOrigin)
+{
+	path = SelectNormalKernel(path);
+
+	int width = colEnd - colBegin;
+	std::vector<float> out(width*3);
+	RowWindow window(positions, cols);
+
+	NormalRowArgs args;
+	args.nx = &out[0];
+	args.ny = &out[width];
+	args.nz = &out[width*2];
+	args.cols = cols;
+	args.colBegin = colBegin;
+
+	// Columns with both neighbours inside the grid can use the SIMD kernels
+	int interiorBegin = colBegin > 1 ? colBegin : 1;
+	int interiorEnd = colEnd < cols-1 ? colEnd : cols-1;
+
+	for (int r = rowBegin; r < rowEnd; r++)
+	{
+		args.down = &window.Get(r > 0 ? r-1 : 0);
+		args.center = &window.Get(r);
+		args.up = &window.Get(r < rows-1 ? r+1 : rows-1);
+
+		int c = colBegin;
+		if (interiorBegin < interiorEnd)
+		{
+			NormalRowScalar(args, colBegin, interiorBegin);
+			c = interiorBegin;
+#ifdef NORMAL_KERNEL_X86
+			if (path == NORMAL_KERNEL_AVX2)
+				c = NormalRowAVX2(args, c, interiorEnd);
+			if (path != NORMAL_KERNEL_SCALAR)
+				c = NormalRowSSE(args, c, interiorEnd);
+#endif
+		}
+		NormalRowScalar(args, c, colEnd);
+
+		float *n = normals + ((r - outOrigin)*outCols + colBegin - outOrigin)*3;
+		for (int i = 0; i < width; i++)
+		{
+			n[i*3]   = args.nx[i];
+			n[i*3+1] = args.ny[i];
+			n[i*3+2] = args.nz[i];
+		}
+	}
+}
+
+void ComputeGridNormals(const float *positions, float *normals, int cols, int rows,
+                        int colBegin, int rowBegin, int colEnd, int rowEnd,
+                        NormalKernelPath path)
+{
+	if (colBegin < 0) colBegin = 0;
+	if (rowBegin < 0) rowBegin = 0;
+	if (colEnd > cols) colEnd = cols;
+	if (rowEnd > rows) rowEnd = rows;
+	if (colBegin >= colEnd || rowBegin >= rowEnd)
+		return;
+
+	NormalRows(positions, cols, rows, colBegin, rowBegin, colEnd, rowEnd, path, normals, cols, 0);
+}
+
+void ComputePaddedGridNormals(const float *positions, float *normals, int cols, int rows,
+                              int rowBegin, int rowEnd, NormalKernelPath path)
+{
+	if (rowBegin < 0) rowBegin = 0;
+	if (rowEnd > rows) rowEnd = rows;
+	if (cols <= 0 || rowBegin >= rowEnd)
+		return;
+
+	// Every vertex of the inner grid has both neighbours in the padded one
+	NormalRows(positions, cols+2, rows+2, 1, rowBegin+1, cols+1, rowEnd+1, path, normals, cols, 1);
+}
+
+float CompareGridNormals(const float *positions, int cols, int rows, NormalKernelPath path)
+{
+	std::vector<float> reference(cols*rows*3), tested(cols*rows*3);
+	ComputeGridNormals(positions, &reference[0], cols, rows, 0, 0, cols, rows, NORMAL_KERNEL_SCALAR);
+	ComputeGridNormals(positions, &tested[0], cols, rows, 0, 0, cols, rows, path);
+
+	float maxError = 0.0f;
+	for (size_t i = 0; i < reference.size(); i++)
+	{
+		float error = (float)fabs(reference[i] - tested[i]);
+		if (error > maxError)
+			maxError = error;
+	}
+	return maxError;
+}
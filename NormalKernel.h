@@ -0,0 +1,43 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	NormalKernel.h
+//	Vertex normals for a regular grid of packed x,y,z positions (as stored by QuadMesh)
+//
+//	The area weighted normal of a grid vertex is the sum of the normals of the quads
+//	around it, which for a regular grid reduces to the cross product of the central
+//	differences along the row and along the column. That makes every vertex independent,
+//	so whole rows can be processed 4 (SSE) or 8 (AVX2) vertices at a time.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef NORMALKERNEL_H
+#define NORMALKERNEL_H
+
+enum NormalKernelPath
+{
+	NORMAL_KERNEL_AUTO,		// best path supported by this CPU
+	NORMAL_KERNEL_SCALAR,
+	NORMAL_KERNEL_SSE,
+	NORMAL_KERNEL_AVX2
+};
+
+// Writes unit normals for the vertices in columns [colBegin,colEnd) and rows [rowBegin,rowEnd)
+// of a cols x rows grid. Rows run along the second mesh direction, columns along the first.
+// Paths the CPU does not support fall back to the next best one.
+void ComputeGridNormals(const float *positions, float *normals, int cols, int rows,
+                        int colBegin, int rowBegin, int colEnd, int rowEnd,
+                        NormalKernelPath path = NORMAL_KERNEL_AUTO);
+
+// Same for rows [rowBegin,rowEnd) of the cols x rows grid inside positions, which is a
+// (cols+2) x (rows+2) grid with one extra ring of samples around it; normals is cols x rows.
+// The border vertices get central differences like the rest rather than one-sided ones, so
+// neighbouring tiles cut from one surface get the same normals along their shared edge.
+void ComputePaddedGridNormals(const float *positions, float *normals, int cols, int rows,
+                              int rowBegin, int rowEnd, NormalKernelPath path = NORMAL_KERNEL_AUTO);
+
+// Correctness mode: runs the requested path and the scalar path over the whole grid and
+// returns the largest per component difference between them
+float CompareGridNormals(const float *positions, int cols, int rows, NormalKernelPath path = NORMAL_KERNEL_AUTO);
+
+NormalKernelPath SelectNormalKernel(NormalKernelPath requested = NORMAL_KERNEL_AUTO);
+const char *NormalKernelName(NormalKernelPath path);
+
+#endif	//NORMALKERNEL_H
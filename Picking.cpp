@@ -0,0 +1,325 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <math.h>
+#include <utility>
+#include <vector>
+#include "VECTOR3D.h"
+#include "MATRIX4X4.h"
+#include "BoundingBox.h"
+#include "NormalKernel.h"
+#include "QuadMesh.h"
+#include "Picking.h"
+
+Ray UnprojectRay(const MATRIX4X4 &projection, const MATRIX4X4 &view, float x, float y, int width, int height)
+{
+	// Direction through the point on the z = -1 plane in eye coordinates, where the
+	// projection puts (ndcX, ndcY) for a frustum with its apex at the eye
+	const float *p = projection.entries;
+	float ndcX = 2.0f * x / width - 1.0f;
+	float ndcY = 1.0f - 2.0f * y / height;
+	Ray eye;
+	eye.direction.Set((ndcX + p[8]) / p[0], (ndcY + p[9]) / p[5], -1.0f);
+	return InverseTransformRay(eye, view);
+}
+
+Ray MakeRay(const VECTOR3D &from, const VECTOR3D &to)
+{
+	Ray ray;
+	ray.origin = from;
+	ray.direction = to - from;
+	return ray;
+}
+
+Ray InverseTransformRay(const Ray &ray, const MATRIX4X4 &transform)
+{
+	// Inverse of the 3x3 part from its cofactors, applied after taking off the translation
+	const float *m = transform.entries;
+	float a = m[0], b = m[4], c = m[8];
+	float d = m[1], e = m[5], f = m[9];
+	float g = m[2], h = m[6], i = m[10];
+	float inverse[9] = { e*i - f*h, c*h - b*i, b*f - c*e,
+	                     f*g - d*i, a*i - c*g, c*d - a*f,
+	                     d*h - e*g, b*g - a*h, a*e - b*d };
+	float invDet = 1.0f / (a*inverse[0] + b*inverse[3] + c*inverse[6]);
+	for (int k = 0; k < 9; k++)
+		inverse[k] *= invDet;
+
+	VECTOR3D p = ray.origin - VECTOR3D(m[12], m[13], m[14]);
+	const VECTOR3D &v = ray.direction;
+	Ray local;
+	local.origin.Set(inverse[0]*p.x + inverse[1]*p.y + inverse[2]*p.z,
+	                 inverse[3]*p.x + inverse[4]*p.y + inverse[5]*p.z,
+	                 inverse[6]*p.x + inverse[7]*p.y + inverse[8]*p.z);
+	local.direction.Set(inverse[0]*v.x + inverse[1]*v.y + inverse[2]*v.z,
+	                    inverse[3]*v.x + inverse[4]*v.y + inverse[5]*v.z,
+	                    inverse[6]*v.x + inverse[7]*v.y + inverse[8]*v.z);
+	return local;
+}
+
+// Narrows [tNear, tFar] to where the ray is between min and max on one axis. A ray along
+// the slab's plane gives NaN, which the comparisons leave out.
+static inline void ClipSlab(float min, float max, float origin, float invDirection, float &tNear, float &tFar)
+{
+	float t0 = (min - origin) * invDirection;
+	float t1 = (max - origin) * invDirection;
+	if (t0 > t1)
+		std::swap(t0, t1);
+	if (t0 > tNear)
+		tNear = t0;
+	if (t1 < tFar)
+		tFar = t1;
+}
+
+// RayHitsBox with 1/direction worked out once for many boxes
+static inline bool BoxEntry(const BBox &box, const VECTOR3D &origin, const VECTOR3D &invDirection, float maxT,
+                            float &t)
+{
+	float tNear = 0.0f, tFar = maxT;
+	ClipSlab(box.min.x, box.max.x, origin.x, invDirection.x, tNear, tFar);
+	ClipSlab(box.min.y, box.max.y, origin.y, invDirection.y, tNear, tFar);
+	ClipSlab(box.min.z, box.max.z, origin.z, invDirection.z, tNear, tFar);
+	t = tNear;
+	return tNear <= tFar && tNear < maxT;
+}
+
+bool RayHitsBox(const Ray &ray, const BBox &box, float maxT, float &t)
+{
+	VECTOR3D invDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+	return BoxEntry(box, ray.origin, invDirection, maxT, t);
+}
+
+BBox TransformBox(const BBox &box, const MATRIX4X4 &transform)
+{
+	// Centre moved by the transform, half size spread over the axes by the absolute values
+	// of the 3x3 part
+	const float *m = transform.entries;
+	VECTOR3D center = transform.TransformPoint(0.5f * (box.min + box.max));
+	VECTOR3D half = 0.5f * (box.max - box.min);
+	VECTOR3D extent(fabsf(m[0])*half.x + fabsf(m[4])*half.y + fabsf(m[8])*half.z,
+	                fabsf(m[1])*half.x + fabsf(m[5])*half.y + fabsf(m[9])*half.z,
+	                fabsf(m[2])*half.x + fabsf(m[6])*half.y + fabsf(m[10])*half.z);
+	BBox result;
+	result.min = center - extent;
+	result.max = center + extent;
+	return result;
+}
+
+// Moller-Trumbore, from either side
+static inline bool RayHitsTriangle(const Ray &ray, const float *a, const float *b, const float *c, float maxT,
+                                   float &t)
+{
+	VECTOR3D edge1(b[0] - a[0], b[1] - a[1], b[2] - a[2]);
+	VECTOR3D edge2(c[0] - a[0], c[1] - a[1], c[2] - a[2]);
+	VECTOR3D p = ray.direction.CrossProduct(edge2);
+	float det = edge1.DotProduct(p);
+	if (det == 0.0f)
+		return false;
+	float invDet = 1.0f / det;
+
+	VECTOR3D s(ray.origin.x - a[0], ray.origin.y - a[1], ray.origin.z - a[2]);
+	float u = s.DotProduct(p) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	VECTOR3D q = s.CrossProduct(edge1);
+	float v = ray.direction.DotProduct(q) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	float hit = edge2.DotProduct(q) * invDet;
+	if (hit < 0.0f || hit >= maxT)
+		return false;
+	t = hit;
+	return true;
+}
+
+HeightQuadtree::HeightQuadtree() : meshSize(0)
+{
+}
+
+void HeightQuadtree::Build(const QuadMesh &mesh)
+{
+	int size = mesh.GetMeshSize();
+	const GLfloat *source = mesh.GetPositions();
+	positions.assign(source, source + (size + 1) * (size + 1) * 3);
+
+	if (size != meshSize || nodes.empty())
+	{
+		meshSize = size;
+		nodes.clear();
+		Node root;
+		root.x0 = root.y0 = 0;
+		root.x1 = root.y1 = size;
+		root.firstChild = root.numChildren = 0;
+		nodes.push_back(root);
+		Split(0);
+	}
+
+	// Children come after their parent, so going backwards every child is done first
+	for (int i = (int)nodes.size() - 1; i >= 0; i--)
+	{
+		Node &node = nodes[i];
+		if (node.numChildren == 0)
+		{
+			FitLeaf(node);
+			continue;
+		}
+		node.box = nodes[node.firstChild].box;
+		for (int c = 1; c < node.numChildren; c++)
+		{
+			const BBox &child = nodes[node.firstChild + c].box;
+			ExtendBox(node.box, child.min.x, child.min.y, child.min.z);
+			ExtendBox(node.box, child.max.x, child.max.y, child.max.z);
+		}
+	}
+}
+
+// Halves the node's quads along both sides, the children next to each other in nodes
+void HeightQuadtree::Split(int index)
+{
+	Node node = nodes[index];
+	if (node.x1 - node.x0 <= 1 && node.y1 - node.y0 <= 1)
+		return;
+
+	int midX = node.x1 - node.x0 > 1 ? (node.x0 + node.x1) / 2 : node.x1;
+	int midY = node.y1 - node.y0 > 1 ? (node.y0 + node.y1) / 2 : node.y1;
+	int xs[3] = { node.x0, midX, node.x1 };
+	int ys[3] = { node.y0, midY, node.y1 };
+
+	int first = (int)nodes.size();
+	for (int y = 0; y < 2; y++)
+	{
+		for (int x = 0; x < 2; x++)
+		{
+			if (xs[x] == xs[x + 1] || ys[y] == ys[y + 1])
+				continue;
+			Node child;
+			child.x0 = xs[x];
+			child.x1 = xs[x + 1];
+			child.y0 = ys[y];
+			child.y1 = ys[y + 1];
+			child.firstChild = child.numChildren = 0;
+			nodes.push_back(child);
+		}
+	}
+	int count = (int)nodes.size() - first;
+	nodes[index].firstChild = first;
+	nodes[index].numChildren = count;
+	for (int c = 0; c < count; c++)
+		Split(first + c);
+}
+
+void HeightQuadtree::FitLeaf(Node &node) const
+{
+	const float *p = &positions[(node.y0 * (meshSize + 1) + node.x0) * 3];
+	const float *q = p + (meshSize + 1) * 3;
+	node.box.min.Set(p[0], p[1], p[2]);
+	node.box.max = node.box.min;
+	ExtendBox(node.box, p[3], p[4], p[5]);
+	ExtendBox(node.box, q[0], q[1], q[2]);
+	ExtendBox(node.box, q[3], q[4], q[5]);
+}
+
+// The quad's two triangles, split as QuadMesh draws them
+bool HeightQuadtree::IntersectQuad(const Ray &ray, int x, int y, float maxT, float &t) const
+{
+	const float *p0 = &positions[(y * (meshSize + 1) + x) * 3];
+	const float *p1 = p0 + 3;
+	const float *p3 = p0 + (meshSize + 1) * 3;
+	const float *p2 = p3 + 3;
+	bool hit = RayHitsTriangle(ray, p0, p1, p2, maxT, t);
+	if (hit)
+		maxT = t;
+	return RayHitsTriangle(ray, p0, p2, p3, maxT, t) || hit;
+}
+
+bool HeightQuadtree::Intersect(const Ray &ray, float maxT, float &t, int &quad) const
+{
+	if (nodes.empty())
+		return false;
+	VECTOR3D invDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+
+	// Nodes the ray enters and still to visit, the nearest on top. A visit adds at most four
+	// for one taken off, three more for each level down.
+	struct Entry
+	{
+		int node;
+		float t;
+	};
+	Entry stack[128];
+	int top = 0;
+	float entry;
+	if (!BoxEntry(nodes[0].box, ray.origin, invDirection, maxT, entry))
+		return false;
+	stack[top].node = 0;
+	stack[top].t = entry;
+	top++;
+
+	float nearest = maxT;
+	int nearestQuad = -1;
+	while (top > 0)
+	{
+		Entry current = stack[--top];
+		// Something nearer was hit since the node was put on the stack
+		if (current.t >= nearest)
+			continue;
+
+		const Node &node = nodes[current.node];
+		if (node.numChildren == 0)
+		{
+			float hit;
+			if (IntersectQuad(ray, node.x0, node.y0, nearest, hit))
+			{
+				nearest = hit;
+				nearestQuad = node.x0 + node.y0 * meshSize;
+			}
+			continue;
+		}
+
+		// Children the ray enters, sorted farthest first so the nearest comes off next
+		Entry children[4];
+		int count = 0;
+		for (int c = 0; c < node.numChildren; c++)
+		{
+			int child = node.firstChild + c;
+			if (!BoxEntry(nodes[child].box, ray.origin, invDirection, nearest, entry))
+				continue;
+			int k = count++;
+			for (; k > 0 && children[k - 1].t < entry; k--)
+				children[k] = children[k - 1];
+			children[k].node = child;
+			children[k].t = entry;
+		}
+		for (int c = 0; c < count; c++)
+			stack[top++] = children[c];
+	}
+
+	if (nearestQuad < 0)
+		return false;
+	t = nearest;
+	quad = nearestQuad;
+	return true;
+}
+
+bool HeightQuadtree::GetHeight(float x, float z, float &height) const
+{
+	if (nodes.empty())
+		return false;
+	// Straight down from above the highest vertex
+	const BBox &box = nodes[0].box;
+	Ray down;
+	down.origin.Set(x, box.max.y + 1.0f, z);
+	down.direction.Set(0.0f, -1.0f, 0.0f);
+	float t;
+	int quad;
+	if (!Intersect(down, box.max.y - box.min.y + 2.0f, t, quad))
+		return false;
+	height = down.origin.y - t;
+	return true;
+}
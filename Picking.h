@@ -0,0 +1,98 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	Picking.h
+//	Rays from the cursor into the scene and what they hit first: the ground mesh through a
+//	quadtree of bounding boxes over its quads, robot parts through their boxes
+//
+//	The quadtree splits the grid in four down to single quads. Each node keeps the box around
+//	its quads, which on a height grid is the node's rectangle between its lowest and highest
+//	vertex, so a ray only descends into the few nodes it passes through and tests the two
+//	triangles of a handful of quads. Queries do not change the tree and can run on any number
+//	of threads at once, for cursor picking and line of sight tests alike.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PICKING_H
+#define PICKING_H
+
+#include <vector>
+#include "BoundingBox.h"
+
+class QuadMesh;
+
+// Points origin + t*direction for t >= 0. direction need not be unit length, t is in
+// multiples of it.
+struct Ray
+{
+	VECTOR3D origin;
+	VECTOR3D direction;
+};
+
+// Ray from the eye through window position (x, y), y down as GLUT gives it, for a
+// perspective projection (MATRIX4X4::SetPerspective) and a rigid view (SetLookAt).
+// t = 1 is one unit along the view direction.
+Ray UnprojectRay(const MATRIX4X4 &projection, const MATRIX4X4 &view, float x, float y, int width, int height);
+
+// Ray from one point to another, t = 1 at the second, for line of sight tests
+Ray MakeRay(const VECTOR3D &from, const VECTOR3D &to);
+
+// The same ray in the local coordinates of an affine transform. t is unchanged, so hits in
+// the local coordinates are at the same t along the original ray.
+Ray InverseTransformRay(const Ray &ray, const MATRIX4X4 &transform);
+
+// True if the ray enters the box before maxT. t is where it enters, 0 if it starts inside.
+bool RayHitsBox(const Ray &ray, const BBox &box, float maxT, float &t);
+
+// Box around a box in the local coordinates of an affine transform
+BBox TransformBox(const BBox &box, const MATRIX4X4 &transform);
+
+class HeightQuadtree
+{
+public:
+	HeightQuadtree();
+
+	// Copies the mesh's vertices and fits the boxes to them. The nodes are only laid out
+	// again when the mesh size changed, so calling this after every UpdateMesh is cheap.
+	void Build(const QuadMesh &mesh);
+
+	// Nearest hit with the mesh's triangles before maxT, both sides count. quad is the hit
+	// quad, column + row*meshSize. Ray and hit are in the mesh's coordinates.
+	bool Intersect(const Ray &ray, float maxT, float &t, int &quad) const;
+	// Height of the mesh's surface at (x, z), for a mesh over the x z plane. False off the
+	// mesh.
+	bool GetHeight(float x, float z, float &height) const;
+
+	int GetMeshSize() const
+	{
+		return meshSize;
+	}
+	// Box around the whole mesh, once built
+	const BBox &GetBoundingBox() const
+	{
+		return nodes[0].box;
+	}
+	// Bytes of the copied vertices and the nodes
+	size_t GetMemoryUsage() const
+	{
+		return positions.capacity()*sizeof(float) + nodes.capacity()*sizeof(Node);
+	}
+
+private:
+	// Quads [x0,x1) x [y0,y1). Children are numChildren nodes from firstChild on, none for
+	// a single quad.
+	struct Node
+	{
+		BBox box;
+		int x0, y0, x1, y1;
+		int firstChild;
+		int numChildren;
+	};
+
+	void Split(int node);
+	void FitLeaf(Node &node) const;
+	bool IntersectQuad(const Ray &ray, int x, int y, float maxT, float &t) const;
+
+	int meshSize;
+	std::vector<float> positions;	// (meshSize+1)^2 packed x,y,z, row by row
+	std::vector<Node> nodes;		// parents before children, root first
+};
+
+#endif	//PICKING_H
@@ -0,0 +1,483 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "GLExtensions.h"
+#include "Profiler.h"
+
+// GPU results older than this many frames are waited for rather than polled
+static const int maxGpuLatency = 4;
+// Queries made at a time
+static const int queryBatch = 32;
+
+// The calling thread's buffer, and the profiler it belongs to
+struct ProfilerThreadSlot
+{
+	const Profiler *owner;
+	void *buffer;
+};
+static thread_local ProfilerThreadSlot profilerThread = { NULL, NULL };
+
+Profiler::Profiler()
+{
+	enabled = false;
+	epoch = std::chrono::steady_clock::now();
+	gpu.name = "GPU";
+	gpu.id = 0;
+	gpuOffset = 0;
+	frame = 0;
+	frameStart = 0;
+	frameThread = 0;
+	tracing = false;
+	traceEvents = 0;
+	maxTraceEvents = 0;
+	traceTruncated = false;
+	summaryFrameMs = 0.0;
+}
+
+// Queries are left alone here, the GL context may already be gone at exit
+Profiler::~Profiler()
+{
+	for (size_t i = 0; i < threads.size(); i++)
+		delete threads[i];
+}
+
+Profiler &Profiler::Shared()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+void Profiler::SetEnabled(bool enabled)
+{
+#ifdef BOT_NO_PROFILER
+	(void)enabled;
+	printf("Profiler: built with BOT_NO_PROFILER, not enabled\n");
+#else
+	this->enabled = enabled;
+#endif
+}
+
+void Profiler::StartTrace(size_t maxEvents)
+{
+	tracing = true;
+	traceEvents = 0;
+	maxTraceEvents = maxEvents;
+	traceTruncated = false;
+}
+
+long long Profiler::Now() const
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+Profiler::ThreadBuffer *Profiler::GetThreadBuffer()
+{
+	if (profilerThread.owner == this)
+		return (ThreadBuffer *)profilerThread.buffer;
+
+	ThreadBuffer *buffer = new ThreadBuffer();
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		buffer->id = (int)threads.size() + 1;
+		threads.push_back(buffer);
+	}
+	snprintf(buffer->defaultName, sizeof(buffer->defaultName), "thread %d", buffer->id);
+	buffer->name = buffer->defaultName;
+	profilerThread.owner = this;
+	profilerThread.buffer = buffer;
+	return buffer;
+}
+
+void Profiler::SetThreadName(const char *name)
+{
+	ThreadBuffer *buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	buffer->name = name;
+}
+
+void Profiler::BeginZone(const char *name)
+{
+	ThreadBuffer *buffer = GetThreadBuffer();
+	Event event = { name, Now(), 0, (int)buffer->open.size() };
+	buffer->open.push_back(event);
+}
+
+void Profiler::EndZone()
+{
+	ThreadBuffer *buffer = GetThreadBuffer();
+	if (buffer->open.empty())
+		return;
+	Event event = buffer->open.back();
+	buffer->open.pop_back();
+	event.end = Now();
+
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	buffer->events.push_back(event);
+}
+
+unsigned int Profiler::NewQuery()
+{
+	if (freeQueries.empty())
+	{
+		GLuint ids[queryBatch];
+		botGenQueries(queryBatch, ids);
+		freeQueries.insert(freeQueries.end(), ids, ids + queryBatch);
+	}
+	unsigned int id = freeQueries.back();
+	freeQueries.pop_back();
+	return id;
+}
+
+void Profiler::BeginGpuZone(const char *name)
+{
+	if (!GLTimerQueriesSupported())
+		return;
+	GpuZone zone = { name, NewQuery(), 0, (int)openGpuZones.size(), gpuOffset, frame };
+	botQueryCounter(zone.begin, GL_TIMESTAMP);
+	openGpuZones.push_back(zone);
+}
+
+void Profiler::EndGpuZone()
+{
+	if (openGpuZones.empty())
+		return;
+	GpuZone zone = openGpuZones.back();
+	openGpuZones.pop_back();
+	zone.end = NewQuery();
+	botQueryCounter(zone.end, GL_TIMESTAMP);
+	pendingGpuZones.push_back(zone);
+}
+
+void Profiler::BeginFrame()
+{
+	frameStart = Now();
+	frameThread = GetThreadBuffer()->id;
+
+	// GL time is on its own clock, matched up with ours once a frame
+	if (GLTimerQueriesSupported())
+	{
+		long long glTime = 0;
+		botGetInteger64v(GL_TIMESTAMP, &glTime);
+		gpuOffset = Now() - glTime;
+	}
+}
+
+void Profiler::EndFrame(const ProfileCounters &counters)
+{
+	FrameRecord record = { frameStart, Now(), counters };
+	intervalFrames.push_back(record);
+	if (tracing)
+		traceFrames.push_back(record);
+
+	CollectGpuZones(false);
+	frame++;
+	if ((int)intervalFrames.size() >= summaryFrames)
+		Summarize();
+}
+
+// Queries finish in the order they were issued, so the first one not done ends the search
+void Profiler::CollectGpuZones(bool wait)
+{
+	size_t done = 0;
+	for (; done < pendingGpuZones.size(); done++)
+	{
+		const GpuZone &zone = pendingGpuZones[done];
+		if (!wait && frame - zone.frame < maxGpuLatency)
+		{
+			GLint available = 0;
+			botGetQueryObjectiv(zone.end, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+		}
+
+		unsigned long long begin = 0, end = 0;
+		botGetQueryObjectui64v(zone.begin, GL_QUERY_RESULT, &begin);
+		botGetQueryObjectui64v(zone.end, GL_QUERY_RESULT, &end);
+		Event event = { zone.name, (long long)begin + zone.offset, (long long)end + zone.offset, zone.depth };
+		{
+			std::lock_guard<std::mutex> lock(gpu.mutex);
+			gpu.events.push_back(event);
+		}
+		freeQueries.push_back(zone.begin);
+		freeQueries.push_back(zone.end);
+	}
+	pendingGpuZones.erase(pendingGpuZones.begin(), pendingGpuZones.begin() + done);
+}
+
+// Adds the events ended since the last call to the interval totals, and to the trace
+void Profiler::Flush()
+{
+	std::vector<ThreadBuffer *> buffers;
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		buffers = threads;
+	}
+	buffers.push_back(&gpu);
+
+	std::vector<Event> events;
+	for (size_t b = 0; b < buffers.size(); b++)
+	{
+		ThreadBuffer *buffer = buffers[b];
+		const char *thread;
+		{
+			std::lock_guard<std::mutex> lock(buffer->mutex);
+			events.swap(buffer->events);
+			thread = buffer->name;
+		}
+
+		for (size_t i = 0; i < events.size(); i++)
+		{
+			// Zones are told apart by name and thread. GPU zones add their time to the CPU
+			// zone of the same name on the frame's thread.
+			const Event &event = events[i];
+			int threadId = buffer == &gpu ? frameThread : buffer->id;
+			size_t t = 0;
+			while (t < intervalTotals.size() &&
+			       (intervalTotals[t].threadId != threadId || strcmp(intervalTotals[t].name, event.name) != 0))
+				t++;
+			if (t == intervalTotals.size())
+			{
+				ZoneTotals totals = { event.name, thread, threadId, event.depth, event.start, 0, 0, 0, false };
+				intervalTotals.push_back(totals);
+			}
+
+			ZoneTotals &totals = intervalTotals[t];
+			if (buffer == &gpu)
+			{
+				totals.gpuTime += event.end - event.start;
+				totals.hasGpu = true;
+			}
+			else
+			{
+				totals.cpuTime += event.end - event.start;
+				totals.calls++;
+				totals.thread = thread;
+				totals.depth = event.depth;
+			}
+			if (event.start < totals.first)
+				totals.first = event.start;
+		}
+
+		if (tracing)
+		{
+			size_t room = maxTraceEvents - traceEvents;
+			size_t kept = events.size() < room ? events.size() : room;
+			buffer->traced.insert(buffer->traced.end(), events.begin(), events.begin() + kept);
+			traceEvents += kept;
+			if (kept < events.size())
+			{
+				tracing = false;
+				traceTruncated = true;
+			}
+		}
+		events.clear();
+	}
+}
+
+void Profiler::Summarize()
+{
+	Flush();
+
+	int frames = (int)intervalFrames.size();
+	if (frames == 0)
+		return;
+
+	// Threads in the order they first recorded, zones in the order they first ran
+	std::sort(intervalTotals.begin(), intervalTotals.end(), [](const ZoneTotals &a, const ZoneTotals &b) {
+		if (a.threadId != b.threadId)
+			return a.threadId < b.threadId;
+		return a.first < b.first;
+	});
+
+	summary.clear();
+	for (size_t i = 0; i < intervalTotals.size(); i++)
+	{
+		const ZoneTotals &totals = intervalTotals[i];
+		ProfileZoneSummary zone;
+		zone.name = totals.name;
+		zone.thread = totals.thread;
+		zone.depth = totals.depth;
+		zone.cpuMs = totals.cpuTime / 1e6 / frames;
+		zone.gpuMs = totals.hasGpu ? totals.gpuTime / 1e6 / frames : -1.0;
+		zone.calls = (double)totals.calls / frames;
+		summary.push_back(zone);
+	}
+
+	long long frameTime = 0;
+	long long drawCalls = 0, vertices = 0, stateChanges = 0, shapesTessellated = 0;
+	for (int i = 0; i < frames; i++)
+	{
+		const FrameRecord &record = intervalFrames[i];
+		frameTime += record.end - record.start;
+		drawCalls += record.counters.drawCalls;
+		vertices += record.counters.vertices;
+		stateChanges += record.counters.stateChanges;
+		shapesTessellated += record.counters.shapesTessellated;
+	}
+	summaryFrameMs = frameTime / 1e6 / frames;
+	summaryCounters.drawCalls = (int)(drawCalls / frames);
+	summaryCounters.vertices = (int)(vertices / frames);
+	summaryCounters.stateChanges = (int)(stateChanges / frames);
+	summaryCounters.shapesTessellated = (int)(shapesTessellated / frames);
+
+	intervalFrames.clear();
+	intervalTotals.clear();
+}
+
+void Profiler::PrintSummary() const
+{
+	if (summary.empty())
+		return;
+
+	printf("profile, per frame over the last %d frames: %.2f ms, %d draw calls, %d vertices, %d state changes, "
+	       "%d shapes tessellated\n", summaryFrames, summaryFrameMs, summaryCounters.drawCalls,
+	       summaryCounters.vertices, summaryCounters.stateChanges, summaryCounters.shapesTessellated);
+	printf("  %-32s %-16s %8s %8s %7s\n", "zone", "thread", "cpu ms", "gpu ms", "calls");
+	for (size_t i = 0; i < summary.size(); i++)
+	{
+		const ProfileZoneSummary &zone = summary[i];
+		char name[64];
+		snprintf(name, sizeof(name), "%*s%s", 2*zone.depth, "", zone.name);
+		char gpuMs[16] = "-";
+		if (zone.gpuMs >= 0.0)
+			snprintf(gpuMs, sizeof(gpuMs), "%.3f", zone.gpuMs);
+		printf("  %-32s %-16s %8.3f %8s %7.1f\n", name, zone.thread, zone.cpuMs, gpuMs, zone.calls);
+	}
+}
+
+void Profiler::DrawOverlay(int width, int height) const
+{
+	std::vector<std::string> lines;
+	char line[160];
+	snprintf(line, sizeof(line), "%.2f ms  %d draws  %d vertices  %d state changes  %d tessellated",
+	         summaryFrameMs, summaryCounters.drawCalls, summaryCounters.vertices, summaryCounters.stateChanges,
+	         summaryCounters.shapesTessellated);
+	lines.push_back(line);
+	for (size_t i = 0; i < summary.size(); i++)
+	{
+		const ProfileZoneSummary &zone = summary[i];
+		char name[64];
+		snprintf(name, sizeof(name), "%*s%s", 2*zone.depth, "", zone.name);
+		if (zone.gpuMs >= 0.0)
+			snprintf(line, sizeof(line), "%-30s %-14s %7.3f  gpu %7.3f", name, zone.thread, zone.cpuMs, zone.gpuMs);
+		else
+			snprintf(line, sizeof(line), "%-30s %-14s %7.3f", name, zone.thread, zone.cpuMs);
+		lines.push_back(line);
+	}
+
+	glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0.0, width, height, 0.0, -1.0, 1.0);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glColor3f(1.0f, 1.0f, 0.6f);
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		glRasterPos2i(8, 18 + 15*(int)i);
+		for (const char *c = lines[i].c_str(); *c; c++)
+			glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+	}
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+}
+
+// Names are string literals of ours, quotes and backslashes are all that need escaping
+static void WriteJSONString(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fputc('\\', f);
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+bool Profiler::WriteTrace(const char *path)
+{
+	CollectGpuZones(true);
+	Flush();
+
+	FILE *f = fopen(path, "w");
+	if (!f)
+	{
+		printf("Profiler: cannot write %s\n", path);
+		return false;
+	}
+
+	std::vector<ThreadBuffer *> buffers;
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		buffers = threads;
+	}
+	buffers.push_back(&gpu);
+
+	// Timestamps and durations in microseconds
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Bot1\"}}");
+	size_t events = 0;
+	for (size_t b = 0; b < buffers.size(); b++)
+	{
+		ThreadBuffer *buffer = buffers[b];
+		const char *name;
+		{
+			std::lock_guard<std::mutex> lock(buffer->mutex);
+			name = buffer->name;
+		}
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", buffer->id);
+		WriteJSONString(f, name);
+		fprintf(f, "}}");
+
+		for (size_t i = 0; i < buffer->traced.size(); i++)
+		{
+			const Event &event = buffer->traced[i];
+			fprintf(f, ",\n{\"name\":");
+			WriteJSONString(f, event.name);
+			fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+			        buffer == &gpu ? "gpu" : "cpu", event.start / 1000.0, (event.end - event.start) / 1000.0, buffer->id);
+		}
+		events += buffer->traced.size();
+	}
+
+	for (size_t i = 0; i < traceFrames.size(); i++)
+	{
+		const FrameRecord &record = traceFrames[i];
+		fprintf(f, ",\n{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+		        record.start / 1000.0, (record.end - record.start) / 1000.0, frameThread);
+		fprintf(f, ",\n{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"draw calls\":%d,"
+		        "\"vertices\":%d,\"state changes\":%d,\"shapes tessellated\":%d}}", record.start / 1000.0,
+		        record.counters.drawCalls, record.counters.vertices, record.counters.stateChanges,
+		        record.counters.shapesTessellated);
+	}
+	fprintf(f, "\n]}\n");
+
+	bool ok = fclose(f) == 0;
+	if (ok)
+		printf("Profiler: %d frames, %d zones written to %s%s\n", (int)traceFrames.size(), (int)events, path,
+		       traceTruncated ? " (truncated, event limit reached)" : "");
+	else
+		printf("Profiler: cannot write %s\n", path);
+	return ok;
+}
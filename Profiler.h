@@ -0,0 +1,249 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	Profiler.h
+//	Frame profiler: nested CPU zones on any thread, GL timestamps around the render
+//	thread's subsystems and per frame counters, averaged for an on-screen overlay and
+//	exported as Chrome trace events (chrome://tracing or ui.perfetto.dev)
+//
+//	Zones are placed with the PROFILE_* macros below. While the profiler is off a zone is
+//	one flag test; built with BOT_NO_PROFILER defined the macros are empty and the
+//	profiler can not be turned on. Each thread records into its own buffer, so zones on
+//	different threads do not contend. GPU results are read a few frames late, once the
+//	queries are done, so timing never stalls the pipeline.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// Counts for one frame, filled in by the caller at EndFrame
+struct ProfileCounters
+{
+	int drawCalls;
+	int vertices;			// sent by the draw calls
+	int stateChanges;		// materials and vertex arrays bound
+	int shapesTessellated;	// cylinders, disks and cubes built, what the GLU quadrics cost every frame
+
+	ProfileCounters() : drawCalls(0), vertices(0), stateChanges(0), shapesTessellated(0) {}
+};
+
+// One zone's averages over the last summary interval
+struct ProfileZoneSummary
+{
+	const char *name;
+	const char *thread;
+	int depth;				// nesting within its thread
+	double cpuMs;			// per frame
+	double gpuMs;			// per frame, < 0 when the zone has no GPU timing
+	double calls;			// per frame
+};
+
+class Profiler
+{
+public:
+	Profiler();
+	~Profiler();
+
+	// Profiler the zone macros record into
+	static Profiler &Shared();
+
+	// Off by default. Stays off when built with BOT_NO_PROFILER.
+	void SetEnabled(bool enabled);
+	bool IsEnabled() const
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	// Keeps every zone and frame from now on for WriteTrace, up to maxEvents zones
+	void StartTrace(size_t maxEvents = 1 << 20);
+	// Writes what was kept as Chrome trace event JSON. Returns false if it could not.
+	bool WriteTrace(const char *path);
+
+	// Name of the calling thread in the overlay and the trace, must outlive the profiler
+	void SetThreadName(const char *name);
+
+	// Render thread, around each frame. EndFrame takes the frame's counters, collects the
+	// GPU timings that have come in and, every summaryFrames frames, makes a new summary.
+	void BeginFrame();
+	void EndFrame(const ProfileCounters &counters);
+
+	// Any thread, properly nested. Names must outlive the profiler, string literals do.
+	void BeginZone(const char *name);
+	void EndZone();
+	// Render thread, needs the GL context: GL timestamps before and after the commands
+	// issued in between. Does nothing without timer queries.
+	void BeginGpuZone(const char *name);
+	void EndGpuZone();
+
+	// Averages over the last summary interval
+	const std::vector<ProfileZoneSummary> &GetSummary() const
+	{
+		return summary;
+	}
+	const ProfileCounters &GetSummaryCounters() const
+	{
+		return summaryCounters;
+	}
+	double GetSummaryFrameMs() const
+	{
+		return summaryFrameMs;
+	}
+
+	// Prints the summary as a table
+	void PrintSummary() const;
+	// Draws the summary in the top left corner of a width x height viewport. Uses the GLUT
+	// bitmap fonts, so only with a GLUT window.
+	void DrawOverlay(int width, int height) const;
+
+	static const int summaryFrames = 60;
+
+private:
+	Profiler(const Profiler &);
+	Profiler &operator=(const Profiler &);
+
+	struct Event
+	{
+		const char *name;
+		long long start;		// nanoseconds since the profiler was made
+		long long end;
+		int depth;
+	};
+
+	struct ThreadBuffer
+	{
+		const char *name;
+		char defaultName[16];
+		int id;
+		std::vector<Event> open;		// zones begun and not ended, owner thread only
+		std::mutex mutex;				// guards name and events
+		std::vector<Event> events;		// ended since the last Flush
+		std::vector<Event> traced;		// render thread only
+	};
+
+	struct GpuZone
+	{
+		const char *name;
+		unsigned int begin;		// query ids
+		unsigned int end;
+		int depth;
+		long long offset;		// CPU minus GL time when issued
+		int frame;
+	};
+
+	struct FrameRecord
+	{
+		long long start;
+		long long end;
+		ProfileCounters counters;
+	};
+
+	struct ZoneTotals
+	{
+		const char *name;
+		const char *thread;
+		int threadId;
+		int depth;
+		long long first;		// start of the first call in the interval
+		long long cpuTime;
+		long long gpuTime;
+		int calls;
+		bool hasGpu;
+	};
+
+	long long Now() const;
+	ThreadBuffer *GetThreadBuffer();
+	unsigned int NewQuery();
+	void CollectGpuZones(bool wait);
+	void Flush();
+	void Summarize();
+
+	std::atomic<bool> enabled;
+	std::chrono::steady_clock::time_point epoch;
+
+	std::mutex threadsMutex;
+	std::vector<ThreadBuffer *> threads;
+
+	// Render thread
+	ThreadBuffer gpu;					// GPU zones, recorded like a thread
+	std::vector<GpuZone> openGpuZones;
+	std::vector<GpuZone> pendingGpuZones;	// in the order they ended
+	std::vector<unsigned int> freeQueries;
+	long long gpuOffset;
+	int frame;
+	long long frameStart;
+	int frameThread;					// id of the thread the frames run on
+	std::vector<FrameRecord> intervalFrames;
+	std::vector<ZoneTotals> intervalTotals;
+
+	// Trace, render thread
+	bool tracing;
+	size_t traceEvents;
+	size_t maxTraceEvents;
+	bool traceTruncated;
+	std::vector<FrameRecord> traceFrames;
+
+	std::vector<ProfileZoneSummary> summary;
+	ProfileCounters summaryCounters;
+	double summaryFrameMs;
+};
+
+// Times the enclosing scope on the calling thread
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char *name) : active(Profiler::Shared().IsEnabled())
+	{
+		if (active)
+			Profiler::Shared().BeginZone(name);
+	}
+	~ProfileZone()
+	{
+		if (active)
+			Profiler::Shared().EndZone();
+	}
+
+private:
+	bool active;
+};
+
+// Times the enclosing scope on the render thread and the GL work issued in it
+class GpuProfileZone
+{
+public:
+	explicit GpuProfileZone(const char *name) : active(Profiler::Shared().IsEnabled())
+	{
+		if (active)
+		{
+			Profiler::Shared().BeginZone(name);
+			Profiler::Shared().BeginGpuZone(name);
+		}
+	}
+	~GpuProfileZone()
+	{
+		if (active)
+		{
+			Profiler::Shared().EndGpuZone();
+			Profiler::Shared().EndZone();
+		}
+	}
+
+private:
+	bool active;
+};
+
+#ifndef BOT_NO_PROFILER
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_JOIN(profileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileZone PROFILE_JOIN(profileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) Profiler::Shared().SetThreadName(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_GPU_ZONE(name) ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#endif
+
+#endif	//PROFILER_H
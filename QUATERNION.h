@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	QUATERNION.h
+//	Class declaration for a rotation quaternion, (x,y,z) the vector part and w the scalar
+//	part. Angles are in degrees like glRotatef and MATRIX4X4::Rotate.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef QUATERNION_H
+#define QUATERNION_H
+
+#include <math.h>
+#include "MathSIMD.h"
+#include "VECTOR3D.h"
+#include "VECTOR4D.h"
+#include "MATRIX4X4.h"
+
+class BOT_MATH_ALIGN QUATERNION
+{
+public:
+	//constructors, the default is no rotation
+	QUATERNION(void)	:	x(0.0f), y(0.0f), z(0.0f), w(1.0f)
+	{}
+
+	QUATERNION(float newX, float newY, float newZ, float newW)	:	x(newX), y(newY), z(newZ), w(newW)
+	{}
+
+	// angle in degrees around axis, which need not be unit length
+	QUATERNION(float angle, const VECTOR3D & axis)
+	{	SetFromAxisAngle(angle, axis);	}
+
+	void SetFromAxisAngle(float angle, const VECTOR3D & axis)
+	{
+		float length = axis.GetLength();
+		if (length == 0.0f)
+		{
+			x = y = z = 0.0f;
+			w = 1.0f;
+			return;
+		}
+		float halfAngle = 0.5f * angle * 3.14159265358979f / 180.0f;
+		float s = (float)sin(halfAngle) / length;
+		x = axis.x * s;
+		y = axis.y * s;
+		z = axis.z * s;
+		w = (float)cos(halfAngle);
+	}
+
+	void LoadIdentity(void)
+	{	x=y=z=0.0f;	w=1.0f;	}
+
+	float DotProduct(const QUATERNION & rhs) const
+	{	return VECTOR4D(&x).DotProduct(VECTOR4D(&rhs.x));	}
+
+	void Normalize()
+	{
+		float norm = (float)sqrt(DotProduct(*this));
+		if (norm > 0.0f)
+			SimdStore(&x, SimdMul(SimdLoad(&x), SimdSplat(1.0f / norm)));
+	}
+
+	// Inverse of a unit quaternion
+	QUATERNION GetConjugate() const
+	{	return QUATERNION(-x, -y, -z, w);	}
+
+	// Rotation by rhs followed by this one
+	QUATERNION operator*(const QUATERNION & rhs) const
+	{
+		return QUATERNION(w*rhs.x + x*rhs.w + y*rhs.z - z*rhs.y,
+		                  w*rhs.y - x*rhs.z + y*rhs.w + z*rhs.x,
+		                  w*rhs.z + x*rhs.y - y*rhs.x + z*rhs.w,
+		                  w*rhs.w - x*rhs.x - y*rhs.y - z*rhs.z);
+	}
+
+	VECTOR3D Rotate(const VECTOR3D & v) const
+	{
+		// v + 2w(q x v) + 2q x (q x v), q the vector part
+		VECTOR3D q(x, y, z);
+		VECTOR3D t = q.CrossProduct(v) * 2.0f;
+		return v + t * w + q.CrossProduct(t);
+	}
+
+	// Shortest path interpolation between unit quaternions, falling back to a normalized
+	// lerp where they are too close for the angle to be accurate
+	QUATERNION Slerp(const QUATERNION & q2, float factor) const
+	{
+		QUATERNION to = q2;
+		float cosAngle = DotProduct(q2);
+		if (cosAngle < 0.0f)
+		{
+			to = QUATERNION(-q2.x, -q2.y, -q2.z, -q2.w);
+			cosAngle = -cosAngle;
+		}
+
+		float from = 1.0f - factor, toFactor = factor;
+		if (cosAngle < 0.9995f)
+		{
+			float angle = (float)acos(cosAngle);
+			float s = (float)sin(angle);
+			from = (float)sin(from * angle) / s;
+			toFactor = (float)sin(toFactor * angle) / s;
+		}
+
+		QUATERNION result;
+		SimdStore(&result.x, SimdMulAdd(SimdLoad(&x), SimdSplat(from), SimdMul(SimdLoad(&to.x), SimdSplat(toFactor))));
+		result.Normalize();
+		return result;
+	}
+
+	// Rotation matrix of a unit quaternion
+	MATRIX4X4 GetMatrix() const
+	{
+		MATRIX4X4 m;
+		float xx = x*x, yy = y*y, zz = z*z;
+		float xy = x*y, xz = x*z, yz = y*z;
+		float wx = w*x, wy = w*y, wz = w*z;
+
+		m.entries[0] = 1.0f - 2.0f*(yy + zz);	m.entries[4] = 2.0f*(xy - wz);			m.entries[8] = 2.0f*(xz + wy);
+		m.entries[1] = 2.0f*(xy + wz);			m.entries[5] = 1.0f - 2.0f*(xx + zz);	m.entries[9] = 2.0f*(yz - wx);
+		m.entries[2] = 2.0f*(xz - wy);			m.entries[6] = 2.0f*(yz + wx);			m.entries[10] = 1.0f - 2.0f*(xx + yy);
+		return m;
+	}
+
+	//member variables
+	float x;
+	float y;
+	float z;
+	float w;
+};
+
+#endif	//QUATERNION_H
@@ -1,9 +1,11 @@
 #define GL_SILENCE_DEPRECATION
 #ifdef __APPLE__
 #include <glut/glut.h>
-#else
+#elif defined(_WIN32)
 #include <windows.h>
 #include <gl/glut.h>
+#else
+#include <GL/glut.h>
 #endif
 #include <math.h>
 #include <stdio.h>
@@ -11,74 +13,103 @@
 #include <math.h>
 #include <utility>
 #include <vector>
+#include <mutex>
 #include "VECTOR3D.h"
+#include "BoundingBox.h"
+#include "GLExtensions.h"
+#include "NormalKernel.h"
+#include "VectorArrays.h"
+#include "MaterialRegistry.h"
+#include "WorkerPool.h"
+#include "Profiler.h"
+#include "MeshAllocator.h"
 
 #include "QuadMesh.h"
 
 
-QuadMesh::QuadMesh(int maxMeshSize, float meshDim)
+QuadMesh::QuadMesh(int maxMeshSize, float meshDim, MeshAllocator *allocator)
 {
 	minMeshSize =1;
 	numVertices = 0;
-	vertices = NULL;
+	positions = NULL;
+	normals = NULL;
 	numQuads = 0;
-	quads = NULL;
+	triangleIndices = NULL;
+	indexType = GL_UNSIGNED_INT;
 	numFacesDrawn = 0;
+	meshSize = 0;
+	vertexBuffer = 0;
+	indexBuffer = 0;
+	renderDataDirty = false;
+	dirtyRowBegin = 0;
+	dirtyRowEnd = 0;
+	normalKernel = NORMAL_KERNEL_AUTO;
+	this->allocator = allocator ? allocator : &MeshAllocator::Heap();
 	
 	this->maxMeshSize = maxMeshSize < minMeshSize ? minMeshSize : maxMeshSize;
 	this->meshDim = meshDim;
 	CreateMemory();
 
-	// Setup the material and lights used for the mesh
-	mat_ambient[0] = 0.0;
-	mat_ambient[1] = 0.0;
-	mat_ambient[2] = 0.0;
-	mat_ambient[3] = 1.0;
-	mat_specular[0] = 0.0;
-	mat_specular[1] = 0.0;
-	mat_specular[2] = 0.0;
-	mat_specular[3] = 1.0;
-	mat_diffuse[0] = 0.9;
-	mat_diffuse[1] = 0.5;
-	mat_diffuse[2] = 0.0;
-	mat_diffuse[3] = 1.0;
-	mat_shininess[0] = 0.0;
+	// Setup the material used for the mesh
+	SetMaterial(VECTOR3D(0.0, 0.0, 0.0), VECTOR3D(0.9, 0.5, 0.0), VECTOR3D(0.0, 0.0, 0.0), 0.0);
     
 }
 
 void QuadMesh::SetMaterial(VECTOR3D ambient, VECTOR3D diffuse, VECTOR3D specular, double shininess)
 {
-	mat_ambient[0] = ambient.x;
-	mat_ambient[1] = ambient.y;
-	mat_ambient[2] = ambient.z;
-	mat_ambient[3] = 1.0;
-	mat_specular[0] = specular.x;
-	mat_specular[1] = specular.y;
-	mat_specular[2] = specular.z;
-	mat_specular[3] = 1.0;
-	mat_diffuse[0] = diffuse.x;
-	mat_diffuse[1] = diffuse.y;
-	mat_diffuse[2] = diffuse.z;
-	mat_diffuse[3] = 1.0;
-	mat_shininess[0] = shininess;
+	material = MaterialRegistry::Shared().Add(ambient, diffuse, specular, shininess);
 }
 
 bool QuadMesh::CreateMemory()
 {
-	vertices = new MeshVertex[(maxMeshSize+1)*(maxMeshSize+1)];
-	if(!vertices)
-	{
-		return false;
-	}
+	size_t maxVertices = (maxMeshSize+1)*(maxMeshSize+1);
+	size_t maxQuads = maxMeshSize*maxMeshSize;
+	indexType = maxVertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 
-	quads = new MeshQuad[maxMeshSize*maxMeshSize];
-	if(!quads)
+	positions = (GLfloat *)allocator->Allocate(maxVertices*3*sizeof(GLfloat));
+	normals = (GLfloat *)allocator->Allocate(maxVertices*3*sizeof(GLfloat));
+	triangleIndices = allocator->Allocate(maxQuads*6*IndexSize());
+	if(!positions || !normals || !triangleIndices)
 	{
+		// All or nothing, so positions says whether the arrays are there
+		FreeMemory();
 		return false;
 	}
 
 	return true;
 }
+
+bool QuadMesh::Reserve(int maxMeshSize)
+{
+	if(maxMeshSize <= this->maxMeshSize && positions)
+		return true;
+
+	FreeMemory();
+	meshSize = 0;
+	dirtyRowBegin = dirtyRowEnd = 0;
+	if(maxMeshSize > this->maxMeshSize)
+		this->maxMeshSize = maxMeshSize;
+	return CreateMemory();
+}
+
+template <typename Index>
+static void BuildGridIndices(Index *triangleIndices, int meshSize)
+{
+	for(int j=0; j < meshSize; j++)
+	{
+		for(int k=0; k < meshSize; k++)
+		{
+			// Counterclockwise order
+			Index i0 = (Index)(j*    (meshSize+1)+k);
+			Index i1 = (Index)(j*    (meshSize+1)+k+1);
+			Index i2 = (Index)((j+1)*(meshSize+1)+k+1);
+			Index i3 = (Index)((j+1)*(meshSize+1)+k);
+			triangleIndices[0] = i0; triangleIndices[1] = i1; triangleIndices[2] = i2;
+			triangleIndices[3] = i0; triangleIndices[4] = i2; triangleIndices[5] = i3;
+			triangleIndices += 6;
+		}
+	}
+}
 		
 
 
@@ -89,6 +120,9 @@ bool QuadMesh::InitMesh(int meshSize,VECTOR3D origin,double meshLength,double me
 	double sf1,sf2; 
     
 	VECTOR3D v1,v2;
+
+	if(meshSize < minMeshSize || !Reserve(meshSize))
+		return false;
 	
 	v1.x = dir1.x;
 	v1.y = dir1.y;
@@ -107,6 +141,9 @@ bool QuadMesh::InitMesh(int meshSize,VECTOR3D origin,double meshLength,double me
 	
 	// VERTICES
 	numVertices=(meshSize+1)*(meshSize+1);
+	meshOrigin = origin;
+	stepU = v1;
+	stepV = v2;
 	
 	// Starts at front left corner of mesh 
 	o.Set(origin.x,origin.y,origin.z);
@@ -120,7 +157,9 @@ bool QuadMesh::InitMesh(int meshSize,VECTOR3D origin,double meshLength,double me
 			meshpt.y = o.y + j * v1.y;
 			meshpt.z = o.z + j * v1.z;
             
-			vertices[currentVertex].position.Set(meshpt.x,meshpt.y,meshpt.z);
+			positions[currentVertex*3]   = meshpt.x;
+			positions[currentVertex*3+1] = meshpt.y;
+			positions[currentVertex*3+2] = meshpt.z;
 			currentVertex++;
 		}
 		// go to next row in mesh (negative z direction)
@@ -129,141 +168,461 @@ bool QuadMesh::InitMesh(int meshSize,VECTOR3D origin,double meshLength,double me
 	
 	// Build Quad Polygons
 	numQuads=(meshSize)*(meshSize);
-	int currentQuad=0;
+	if(indexType == GL_UNSIGNED_SHORT)
+		BuildGridIndices((GLushort *)triangleIndices, meshSize);
+	else
+		BuildGridIndices((GLuint *)triangleIndices, meshSize);
 
-	for(int j=0; j < meshSize; j++)
-	{
-		for(int k=0; k < meshSize; k++)
-		{
-			// Counterclockwise order
-			quads[currentQuad].vertices[0]=&vertices[j*    (meshSize+1)+k];
-			quads[currentQuad].vertices[1]=&vertices[j*    (meshSize+1)+k+1];
-			quads[currentQuad].vertices[2]=&vertices[(j+1)*(meshSize+1)+k+1];
-			quads[currentQuad].vertices[3]=&vertices[(j+1)*(meshSize+1)+k];
-			currentQuad++;
-		}
-	}
+	this->meshSize = meshSize;
+	bounds.min.Set(positions[0], positions[1], positions[2]);
+	bounds.max = bounds.min;
+	for(int i=1; i < numVertices; i++)
+		ExtendBox(bounds, positions[i*3], positions[i*3+1], positions[i*3+2]);
 
-    this->ComputeNormals();
+	this->ComputeGridNormals();
+	renderDataDirty = true;
 
 	return true;
 }
 
 void QuadMesh::DrawMesh(int meshSize)
 {
-	int currentQuad=0;
+	// Quads are stored row by row, so the first meshSize*meshSize of them are drawn as before
+	if (meshSize > this->meshSize)
+		meshSize = this->meshSize;
+	GLsizei numIndices = 6*meshSize*meshSize;
+	if (numIndices <= 0)
+		return;
+	PROFILE_ZONE("QuadMesh::DrawMesh");
+
+	// Whole mesh in one indexed call, from buffer objects when we have them
+	BeginDraw();
+	if (indexBuffer)
+	{
+		botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+		glDrawElements(GL_TRIANGLES, numIndices, indexType, NULL);
+		botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		CountGLCalls(2);
+	}
+	else
+	{
+		glDrawElements(GL_TRIANGLES, numIndices, indexType, triangleIndices);
+	}
+	CountGLDraw(numIndices/3, numIndices);
+	numFacesDrawn = meshSize*meshSize;
+	EndDraw();
+}
+
+void QuadMesh::DrawMesh(const MeshIndexList &indexList)
+{
+	if (indexList.indices.empty())
+		return;
+	PROFILE_ZONE("QuadMesh::DrawMesh");
+
+	BeginDraw();
+	if (indexList.buffer)
+	{
+		botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexList.buffer);
+		glDrawElements(GL_TRIANGLES, (GLsizei)indexList.indices.size(), GL_UNSIGNED_INT, NULL);
+		botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		CountGLCalls(2);
+	}
+	else
+	{
+		glDrawElements(GL_TRIANGLES, (GLsizei)indexList.indices.size(), GL_UNSIGNED_INT, &indexList.indices[0]);
+	}
+	CountGLDraw((int)indexList.indices.size()/3, (int)indexList.indices.size());
+	numFacesDrawn = (int)indexList.indices.size()/6;
+	EndDraw();
+}
+
+void QuadMesh::Upload()
+{
+	if (renderDataDirty)
+		UploadRenderData();
+	else if (dirtyRowBegin < dirtyRowEnd)
+		UploadDirtyRows();
+}
 
-	glMaterialfv(GL_FRONT, GL_AMBIENT, mat_ambient);
-	glMaterialfv(GL_FRONT, GL_SPECULAR, mat_specular);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
-	glMaterialfv(GL_FRONT, GL_SHININESS, mat_shininess);
+size_t QuadMesh::GetMemoryUsage() const
+{
+	size_t maxVertices = (maxMeshSize+1)*(maxMeshSize+1);
+	size_t maxQuads = maxMeshSize*maxMeshSize;
+	size_t bytes = maxVertices*6*sizeof(GLfloat) + maxQuads*6*IndexSize();
+	if (vertexBuffer)
+		bytes += numVertices*6*sizeof(GLfloat) + numQuads*6*IndexSize();
+	return bytes;
+}
+
+// Upload pending changes, set the material and point GL at the position and normal arrays.
+// The vertex buffer holds all positions followed by all normals.
+void QuadMesh::BeginDraw()
+{
+	Upload();
 
-	for(int j=0; j< meshSize; j++)
+	MaterialRegistry::Shared().Apply(material);
+
+	const GLfloat *positionBase = positions;
+	const GLfloat *normalBase = normals;
+	if (vertexBuffer)
 	{
-		for(int k=0; k< meshSize; k++)
-		{
-			glBegin(GL_QUADS);
-			
-			glNormal3f(quads[currentQuad].vertices[0]->normal.x,
-				       quads[currentQuad].vertices[0]->normal.y,
-					   quads[currentQuad].vertices[0]->normal.z);
-			glVertex3f(quads[currentQuad].vertices[0]->position.x,
-				       quads[currentQuad].vertices[0]->position.y,
-					   quads[currentQuad].vertices[0]->position.z);
-			
-			glNormal3f(quads[currentQuad].vertices[1]->normal.x,
-				       quads[currentQuad].vertices[1]->normal.y,
-					   quads[currentQuad].vertices[1]->normal.z);
-			
-			glVertex3f(quads[currentQuad].vertices[1]->position.x,
-				       quads[currentQuad].vertices[1]->position.y,
-					   quads[currentQuad].vertices[1]->position.z);
-			
-			glNormal3f(quads[currentQuad].vertices[2]->normal.x,
-				       quads[currentQuad].vertices[2]->normal.y,
-					   quads[currentQuad].vertices[2]->normal.z);
-			
-			glVertex3f(quads[currentQuad].vertices[2]->position.x,
-				       quads[currentQuad].vertices[2]->position.y,
-					   quads[currentQuad].vertices[2]->position.z);
-			
-			glNormal3f(quads[currentQuad].vertices[3]->normal.x,
-				       quads[currentQuad].vertices[3]->normal.y,
-					   quads[currentQuad].vertices[3]->normal.z);
-			
-			glVertex3f(quads[currentQuad].vertices[3]->position.x,
-				       quads[currentQuad].vertices[3]->position.y,
-					   quads[currentQuad].vertices[3]->position.z);
-			glEnd();
-			currentQuad++;
-		}
+		botBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		positionBase = NULL;
+		normalBase = (const GLfloat *)(numVertices*3*sizeof(GLfloat));
 	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, positionBase);
+	glNormalPointer(GL_FLOAT, 0, normalBase);
+	CountGLCalls(vertexBuffer ? 5 : 4);
+	CountGLStateChange();
 }
 
+void QuadMesh::EndDraw()
+{
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
 
+	if (vertexBuffer)
+		botBindBuffer(GL_ARRAY_BUFFER, 0);
+	CountGLCalls(vertexBuffer ? 3 : 2);
+}
 
+void QuadMesh::UploadRenderData()
+{
+	renderDataDirty = false;
+	dirtyRowBegin = dirtyRowEnd = 0;
 
+	LoadGLExtensions();
+	if (!GLBuffersSupported() || numQuads == 0)
+		return;
 
+	if (!vertexBuffer)
+		botGenBuffers(1, &vertexBuffer);
+	if (!indexBuffer)
+		botGenBuffers(1, &indexBuffer);
 
+	ptrdiff_t arrayBytes = numVertices*3*sizeof(GLfloat);
+	botBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	botBufferData(GL_ARRAY_BUFFER, 2*arrayBytes, NULL, GL_STATIC_DRAW);
+	botBufferSubData(GL_ARRAY_BUFFER, 0, arrayBytes, positions);
+	botBufferSubData(GL_ARRAY_BUFFER, arrayBytes, arrayBytes, normals);
+	botBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	botBufferData(GL_ELEMENT_ARRAY_BUFFER, numQuads*6*IndexSize(), triangleIndices, GL_STATIC_DRAW);
+	botBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// Re-upload the positions and normals of the dirty rows. Rows are contiguous in both arrays.
+void QuadMesh::UploadDirtyRows()
+{
+	int rowFloats = (meshSize+1)*3;
+	ptrdiff_t arrayBytes = numVertices*3*sizeof(GLfloat);
+	ptrdiff_t offset = dirtyRowBegin*rowFloats*sizeof(GLfloat);
+	ptrdiff_t size = (dirtyRowEnd - dirtyRowBegin)*rowFloats*sizeof(GLfloat);
+	dirtyRowBegin = dirtyRowEnd = 0;
+
+	if (!vertexBuffer)
+		return;
+
+	botBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	botBufferSubData(GL_ARRAY_BUFFER, offset, size, (const char *)positions + offset);
+	botBufferSubData(GL_ARRAY_BUFFER, arrayBytes + offset, size, (const char *)normals + offset);
+	botBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void QuadMesh::ReleaseRenderData()
+{
+	if (vertexBuffer)
+		botDeleteBuffers(1, &vertexBuffer);
+	if (indexBuffer)
+		botDeleteBuffers(1, &indexBuffer);
+	vertexBuffer = 0;
+	indexBuffer = 0;
+}
 
 void QuadMesh::FreeMemory()
 {
-	if(vertices)
-		delete [] vertices;
-	vertices=NULL;
+	size_t maxVertices = (maxMeshSize+1)*(maxMeshSize+1);
+	size_t maxQuads = maxMeshSize*maxMeshSize;
+
+	allocator->Free(positions, maxVertices*3*sizeof(GLfloat));
+	positions=NULL;
+	allocator->Free(normals, maxVertices*3*sizeof(GLfloat));
+	normals=NULL;
 	numVertices=0;
 
-	if(quads)
-		delete [] quads;
-	quads=NULL;
+	allocator->Free(triangleIndices, maxQuads*6*IndexSize());
+	triangleIndices=NULL;
 	numQuads=0;
 }
 
+static inline VECTOR3D LoadVector(const GLfloat *array, GLuint index)
+{
+	return VECTOR3D(array + index*3);
+}
+
+static inline void AddVector(GLfloat *array, GLuint index, const VECTOR3D &v)
+{
+	array[index*3]   += v.x;
+	array[index*3+1] += v.y;
+	array[index*3+2] += v.z;
+}
+
+// Scalar reference: every quad adds its corner normals (cross product of the two edges
+// leaving the corner, so larger quads weigh more) to its vertices, then each vertex
+// normal is normalized once all adjacent quads have contributed.
 void QuadMesh::ComputeNormals() 
 {
-	int currentQuad=0;
+	for(int i=0; i < numVertices*3; i++)
+		normals[i] = 0.0f;
+
+	// Quad (k,j) has its corners counterclockwise from vertex (k,j), as BuildGridIndices
+	// orders them
+	for(int currentQuad=0; currentQuad < numQuads; currentQuad++)
+	{
+		int j = currentQuad / meshSize;
+		int k = currentQuad % meshSize;
+		GLuint i0 = j*(meshSize+1) + k;
+		GLuint i1 = i0 + 1;
+		GLuint i3 = i0 + meshSize + 1;
+		GLuint i2 = i3 + 1;
+		VECTOR3D p0 = LoadVector(positions, i0);
+		VECTOR3D p1 = LoadVector(positions, i1);
+		VECTOR3D p2 = LoadVector(positions, i2);
+		VECTOR3D p3 = LoadVector(positions, i3);
+
+		VECTOR3D e0 = p1 - p0; 
+		VECTOR3D e1 = p2 - p1; 
+		VECTOR3D e2 = p3 - p2; 
+		VECTOR3D e3 = p0 - p3; 
+
+		AddVector(normals, i0, e0.CrossProduct(-e3));
+		AddVector(normals, i1, e1.CrossProduct(-e0));
+		AddVector(normals, i2, e2.CrossProduct(-e1));
+		AddVector(normals, i3, e3.CrossProduct(-e2));
+	}
+
+	// The normal array is packed x,y,z, the same layout as a VECTOR3D array
+	NormalizeArray((VECTOR3D *)normals, numVertices);
+}
+
+// Rows per chunk handed to a worker. Each chunk deinterleaves two extra rows for its
+// normals, so chunks should not get much smaller than this.
+static const int rowGrain = 16;
+
+void QuadMesh::UpdateRegion(int x0, int y0, int x1, int y1)
+{
+	if (x0 > x1 || y0 > y1)
+		return;
+
+	// A vertex normal depends on its four neighbours, so the normals one vertex
+	// outside the changed region change as well
+	int colBegin = x0 > 0 ? x0-1 : 0;
+	int rowBegin = y0 > 0 ? y0-1 : 0;
+	int colEnd = x1+2 < meshSize+1 ? x1+2 : meshSize+1;
+	int rowEnd = y1+2 < meshSize+1 ? y1+2 : meshSize+1;
+
+	// Heights may have dropped as well as risen, so a full update recomputes the bounds
+	// while a partial one can only grow them
+	bool wholeMesh = colBegin == 0 && rowBegin == 0 && colEnd == meshSize+1 && rowEnd == meshSize+1;
+	if (wholeMesh)
+	{
+		bounds.min.Set(positions[0], positions[1], positions[2]);
+		bounds.max = bounds.min;
+	}
+	std::mutex boundsMutex;
+
+	WorkerPool::Shared().ParallelFor(rowEnd - rowBegin, rowGrain, [&](int begin, int end)
+	{
+		::ComputeGridNormals(positions, normals, meshSize+1, meshSize+1,
+			colBegin, rowBegin + begin, colEnd, rowBegin + end, normalKernel);
+
+		const GLfloat *p = positions + ((rowBegin + begin)*(meshSize+1) + colBegin)*3;
+		BBox chunkBounds;
+		chunkBounds.min.Set(p[0], p[1], p[2]);
+		chunkBounds.max = chunkBounds.min;
+		for (int y = rowBegin + begin; y < rowBegin + end; y++)
+		{
+			p = positions + (y*(meshSize+1) + colBegin)*3;
+			for (int x = colBegin; x < colEnd; x++, p += 3)
+				ExtendBox(chunkBounds, p[0], p[1], p[2]);
+		}
+
+		std::lock_guard<std::mutex> lock(boundsMutex);
+		ExtendBox(bounds, chunkBounds.min.x, chunkBounds.min.y, chunkBounds.min.z);
+		ExtendBox(bounds, chunkBounds.max.x, chunkBounds.max.y, chunkBounds.max.z);
+	});
+
+	if (dirtyRowBegin < dirtyRowEnd)
+	{
+		dirtyRowBegin = rowBegin < dirtyRowBegin ? rowBegin : dirtyRowBegin;
+		dirtyRowEnd = rowEnd > dirtyRowEnd ? rowEnd : dirtyRowEnd;
+	}
+	else
+	{
+		dirtyRowBegin = rowBegin;
+		dirtyRowEnd = rowEnd;
+	}
+}
+
+void QuadMesh::UpdateMesh(HeightFunction heightFunction, float time, int rowBegin, int rowEnd)
+{
+	if (rowEnd < 0 || rowEnd > meshSize+1)
+		rowEnd = meshSize+1;
+	if (rowBegin < 0)
+		rowBegin = 0;
+	if (rowBegin >= rowEnd)
+		return;
+
+	WorkerPool::Shared().ParallelFor(rowEnd - rowBegin, rowGrain, [&](int begin, int end)
+	{
+		for (int y = rowBegin + begin; y < rowBegin + end; y++)
+		{
+			GLfloat *p = positions + y*(meshSize+1)*3;
+			VECTOR3D base = meshOrigin + stepV*(float)y;
+			for (int x = 0; x <= meshSize; x++, p += 3)
+			{
+				p[0] = base.x;
+				p[1] = base.y + heightFunction(base.x, base.z, time);
+				p[2] = base.z;
+				base += stepU;
+			}
+		}
+	});
+
+	UpdateRegion(0, rowBegin, meshSize, rowEnd-1);
+}
+
+void QuadMesh::UpdateMesh(const float *heights, int rowBegin, int rowEnd)
+{
+	if (rowEnd < 0 || rowEnd > meshSize+1)
+		rowEnd = meshSize+1;
+	if (rowBegin < 0)
+		rowBegin = 0;
+	if (rowBegin >= rowEnd)
+		return;
+
+	WorkerPool::Shared().ParallelFor(rowEnd - rowBegin, rowGrain, [&](int begin, int end)
+	{
+		for (int y = rowBegin + begin; y < rowBegin + end; y++)
+		{
+			GLfloat *p = positions + y*(meshSize+1)*3;
+			const float *h = heights + y*(meshSize+1);
+			float baseY = meshOrigin.y + stepV.y*y;
+			for (int x = 0; x <= meshSize; x++)
+				p[x*3+1] = baseY + stepU.y*x + h[x];
+		}
+	});
+
+	UpdateRegion(0, rowBegin, meshSize, rowEnd-1);
+}
+
+void QuadMesh::UpdateMesh()
+{
+	UpdateRegion(0, 0, meshSize, meshSize);
+}
 
-	for(int j=0; j< this->maxMeshSize; j++)
+void QuadMesh::UpdateMeshPadded(const float *heights)
+{
+	if (meshSize <= 0)
+		return;
+
+	// The mesh's vertices with the ring around them, the ring continuing the flat plane
+	// past the edges
+	int n = meshSize + 3;
+	std::vector<GLfloat> padded(n*n*3);
+	WorkerPool::Shared().ParallelFor(n, rowGrain, [&](int begin, int end)
 	{
-		for(int k=0; k< this->maxMeshSize; k++)
+		for (int y = begin; y < end; y++)
 		{
-			VECTOR3D n0,n1,n2,n3,e0,e1,e2,e3,ne0,ne1,ne2,ne3;
-			
-			quads[currentQuad].vertices[0]->normal.LoadZero();
-			quads[currentQuad].vertices[1]->normal.LoadZero();
-			quads[currentQuad].vertices[2]->normal.LoadZero();
-			quads[currentQuad].vertices[3]->normal.LoadZero();
-			e0 = quads[currentQuad].vertices[1]->position - quads[currentQuad].vertices[0]->position; 
-			e1 = quads[currentQuad].vertices[2]->position - quads[currentQuad].vertices[1]->position; 
-			e2 = quads[currentQuad].vertices[3]->position - quads[currentQuad].vertices[2]->position; 
-			e3 = quads[currentQuad].vertices[0]->position - quads[currentQuad].vertices[3]->position; 
-			e0.Normalize();
-			e1.Normalize();
-			e2.Normalize();
-			e3.Normalize();
-			
-			n0 = e0.CrossProduct(-e3);
-			n0.Normalize();
-			quads[currentQuad].vertices[0]->normal += n0;
-			
-			n1 = e1.CrossProduct(-e0);
-			n1.Normalize();
-			quads[currentQuad].vertices[1]->normal += n1;
-
-			n2 = e2.CrossProduct(-e1);
-			n2.Normalize();
-			quads[currentQuad].vertices[2]->normal += n2;
-
-			n3 = e3.CrossProduct(-e2);
-			n3.Normalize();
-			quads[currentQuad].vertices[3]->normal += n3;
-			
-			quads[currentQuad].vertices[0]->normal.Normalize();
-			quads[currentQuad].vertices[1]->normal.Normalize();
-			quads[currentQuad].vertices[2]->normal.Normalize();
-			quads[currentQuad].vertices[3]->normal.Normalize();
-			
-			currentQuad++;
+			GLfloat *q = &padded[y*n*3];
+			const float *h = heights + y*n;
+			VECTOR3D base = meshOrigin + stepV*(float)(y-1) - stepU;
+			for (int x = 0; x < n; x++, q += 3)
+			{
+				q[0] = base.x;
+				q[1] = base.y + h[x];
+				q[2] = base.z;
+				base += stepU;
+			}
+			if (y == 0 || y == n-1)
+				continue;
+
+			// Row y-1 of the mesh keeps the x and z InitMesh gave it
+			GLfloat *p = positions + (y-1)*(meshSize+1)*3;
+			q = &padded[(y*n + 1)*3];
+			for (int x = 0; x <= meshSize; x++, p += 3, q += 3)
+			{
+				p[1] = q[1];
+				q[0] = p[0];
+				q[2] = p[2];
+			}
 		}
+	});
+
+	WorkerPool::Shared().ParallelFor(meshSize+1, rowGrain, [&](int begin, int end)
+	{
+		::ComputePaddedGridNormals(&padded[0], normals, meshSize+1, meshSize+1, begin, end, normalKernel);
+	});
+
+	bounds.min.Set(positions[0], positions[1], positions[2]);
+	bounds.max = bounds.min;
+	for (int i = 1; i < numVertices; i++)
+		ExtendBox(bounds, positions[i*3], positions[i*3+1], positions[i*3+2]);
+	dirtyRowBegin = 0;
+	dirtyRowEnd = meshSize+1;
+}
+
+void QuadMesh::UpdateMeshPadded(HeightFunction heightFunction, float time)
+{
+	if (meshSize <= 0)
+		return;
+
+	int n = meshSize + 3;
+	std::vector<float> heights(n*n);
+	WorkerPool::Shared().ParallelFor(n, rowGrain, [&](int begin, int end)
+	{
+		for (int y = begin; y < end; y++)
+		{
+			VECTOR3D base = meshOrigin + stepV*(float)(y-1) - stepU;
+			for (int x = 0; x < n; x++)
+			{
+				heights[y*n + x] = heightFunction(base.x, base.z, time);
+				base += stepU;
+			}
+		}
+	});
+	UpdateMeshPadded(&heights[0]);
+}
+
+void QuadMesh::ComputeGridNormals()
+{
+	::ComputeGridNormals(positions, normals, meshSize+1, meshSize+1, 0, 0, meshSize+1, meshSize+1, normalKernel);
+}
+
+bool QuadMesh::VerifyNormalKernel(float tolerance)
+{
+	NormalKernelPath path = SelectNormalKernel(normalKernel);
+	float kernelError = CompareGridNormals(positions, meshSize+1, meshSize+1, path);
+
+	// Also check the kernel against the per-quad accumulation in ComputeNormals
+	std::vector<GLfloat> kernelNormals(normals, normals + numVertices*3);
+	ComputeNormals();
+	float quadError = 0.0f;
+	for (int i = 0; i < numVertices*3; i++)
+	{
+		float error = (float)fabs(normals[i] - kernelNormals[i]);
+		if (error > quadError)
+			quadError = error;
 	}
+	for (int i = 0; i < numVertices*3; i++)
+		normals[i] = kernelNormals[i];
+
+	bool ok = kernelError <= tolerance && quadError <= tolerance;
+	printf("Normal kernel %s: max error %g vs scalar kernel, %g vs per-quad normals (%s)\n",
+		NormalKernelName(path), kernelError, quadError, ok ? "ok" : "FAILED");
+	return ok;
 }
@@ -1,51 +1,92 @@
-struct MeshVertex
+// Triangle list over a mesh's own vertices, drawn instead of the full resolution triangles
+// (terrain LOD levels). buffer is 0 when the indices are used as a client array.
+struct MeshIndexList
 {
-	VECTOR3D	position;
-	VECTOR3D    normal;
-};
-
-
+	std::vector<GLuint> indices;
+	GLuint buffer;
 
-struct MeshQuad
-{
-	// pointers to vertices of each quad
-	MeshVertex *vertices[4];	
+	MeshIndexList() : buffer(0) {}
 };
 
+class MeshAllocator;
+
 class QuadMesh
 {
 private:
 	
+	// Largest grid the arrays have room for, see Reserve
 	int maxMeshSize;
 	int minMeshSize;
 	float meshDim;
 
+	// Where the vertex and index arrays come from
+	MeshAllocator *allocator;
+
+	// Vertex data is kept as separate contiguous arrays of packed x,y,z floats
 	int numVertices;
-	MeshVertex *vertices;
+	GLfloat *positions;
+	GLfloat *normals;
 
+	// Quads are the grid cells, row by row, and their 4 vertices (counterclockwise) follow
+	// from the row and column, so no per-quad indices are stored.
+	// Triangle indices are 16 bit when the whole grid fits, otherwise 32 bit; indexType
+	// says which (GL_UNSIGNED_SHORT/INT)
 	int numQuads;
-	MeshQuad *quads;
+	GLenum indexType;
 
 	int numFacesDrawn;
+
+	// Size of the grid built by the last InitMesh, and the flat plane it was built on:
+	// vertex (x,y) rests at meshOrigin + x*stepU + y*stepV before any height is applied
+	int meshSize;
+	VECTOR3D meshOrigin;
+	VECTOR3D stepU;
+	VECTOR3D stepV;
+
+	// Shared triangle index list (two per quad, 16 or 32 bit as indexType says). The position and
+	// normal arrays plus this list are uploaded to buffer objects, or used as client arrays without VBOs
+	void *triangleIndices;
+	GLuint vertexBuffer;
+	GLuint indexBuffer;
+	bool renderDataDirty;
+
+	// Vertex rows [dirtyRowBegin,dirtyRowEnd) changed since the last upload
+	int dirtyRowBegin;
+	int dirtyRowEnd;
+
+	// Box around all vertices, kept up to date by InitMesh, UpdateRegion and UpdateMesh
+	BBox bounds;
+
+	// Which normal kernel InitMesh and later deformations use
+	NormalKernelPath normalKernel;
 	
-	GLfloat mat_ambient[4];
-    GLfloat mat_specular[4];
-    GLfloat mat_diffuse[4];
-	GLfloat mat_shininess[1];
+	// Id in MaterialRegistry::Shared()
+	int material;
 
 	
 private:
 	bool CreateMemory();
 	void FreeMemory();
+	void UploadRenderData();
+	void UploadDirtyRows();
+	void BeginDraw();
+	void EndDraw();
+	void ReleaseRenderData();
+	int IndexSize() const
+	{
+		return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	}
 
 public:
 
 	typedef std::pair<int, int> MaxMeshDim;
 
-	QuadMesh(int maxMeshSize = 40, float meshDim = 1.0f);
+	// Arrays from allocator, the heap when NULL. The allocator must outlive the mesh.
+	QuadMesh(int maxMeshSize = 40, float meshDim = 1.0f, MeshAllocator *allocator = NULL);
 	
 	~QuadMesh()
 	{
+		ReleaseRenderData();
 		FreeMemory();
 	}
 
@@ -53,12 +94,110 @@ public:
 	{
 		return MaxMeshDim(minMeshSize, maxMeshSize);
 	}
+
+	int GetMeshSize() const
+	{
+		return meshSize;
+	}
+
+	const BBox &GetBoundingBox() const
+	{
+		return bounds;
+	}
+
+	int GetNumFacesDrawn() const
+	{
+		return numFacesDrawn;
+	}
+
+	// Vertex arrays and the shared triangle list (GetIndexType() says 16 or 32 bit), for
+	// drawing without GL (SoftRasterizer). The first 6*n*n indices are the n x n mesh.
+	int GetNumVertices() const
+	{
+		return numVertices;
+	}
+	const GLfloat *GetPositions() const
+	{
+		return positions;
+	}
+	const GLfloat *GetNormals() const
+	{
+		return normals;
+	}
+	const void *GetTriangleIndices() const
+	{
+		return triangleIndices;
+	}
+	GLenum GetIndexType() const
+	{
+		return indexType;
+	}
 	
+	// Grows the arrays first when meshSize is past the largest they have room for
 	bool InitMesh(int meshSize, VECTOR3D origin, double meshLength, double meshWidth,VECTOR3D dir1, VECTOR3D dir2);
+	// Makes room for grids up to maxMeshSize quads on a side. Arrays big enough already are
+	// kept with the mesh on them; otherwise they are replaced and the mesh is empty until the
+	// next InitMesh. False when out of memory.
+	bool Reserve(int maxMeshSize);
 	void DrawMesh(int meshSize);
+	void DrawMesh(const MeshIndexList &indexList);
+	// Uploads pending vertex changes now rather than at the next draw, so a caller can
+	// spread the uploads of new meshes over several frames. Needs the GL context.
+	void Upload();
+	// Bytes of vertex and index data held in memory and in GL buffers
+	size_t GetMemoryUsage() const;
+
+	// Height of the ground above the base plane at world position (x,z) at the given time
+	typedef float (*HeightFunction)(float x, float z, float time);
+
+	// Per-frame deformation. Rows are split across the shared worker pool, normals are
+	// refreshed afterwards and only rows [rowBegin,rowEnd) are re-uploaded on the next draw
+	// (rowEnd < 0 means up to the last row).
+	void UpdateMesh(HeightFunction heightFunction, float time, int rowBegin = 0, int rowEnd = -1);
+	// Same, with heights from a (meshSize+1) x (meshSize+1) row major array
+	void UpdateMesh(const float *heights, int rowBegin = 0, int rowEnd = -1);
+	// Refresh normals and re-upload everything after SetVertexHeight calls across the grid
 	void UpdateMesh();
+	// For terrain tiles: heights from a (meshSize+3) x (meshSize+3) row major array with one
+	// extra ring of samples around the mesh, which the border normals are worked out from, so
+	// they match those of the neighbouring tiles. Updates the whole mesh.
+	void UpdateMeshPadded(const float *heights);
+	// Same, with the heights and the extra ring from the height function
+	void UpdateMeshPadded(HeightFunction heightFunction, float time);
 	void SetMaterial(VECTOR3D ambient, VECTOR3D diffuse, VECTOR3D specular, double shininess);
+	// Use a material already in MaterialRegistry::Shared()
+	void SetMaterial(int materialId)
+	{
+		material = materialId;
+	}
+	int GetMaterial() const
+	{
+		return material;
+	}
 	void ComputeNormals();
+
+	// Vertex (x,y) is column x, row y of the grid, both in [0,meshSize]
+	void SetVertexHeight(int x, int y, float height)
+	{
+		positions[(y*(meshSize+1) + x)*3 + 1] = height;
+	}
+	float GetVertexHeight(int x, int y) const
+	{
+		return positions[(y*(meshSize+1) + x)*3 + 1];
+	}
+
+	// Call after changing the heights of vertices in [x0,x1] x [y0,y1] (inclusive). Recomputes
+	// only the normals that depend on them and re-uploads only the affected rows.
+	void UpdateRegion(int x0, int y0, int x1, int y1);
+
+	// Recompute all normals with the SIMD grid kernel
+	void ComputeGridNormals();
+	void SetNormalKernel(NormalKernelPath path)
+	{
+		normalKernel = path;
+	}
+	// Compares the selected normal kernel against the scalar one, true if within tolerance
+	bool VerifyNormalKernel(float tolerance = 1e-4f);
 	
 	
 };
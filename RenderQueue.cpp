@@ -0,0 +1,214 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "VECTOR3D.h"
+#include "MATRIX4X4.h"
+#include "GLExtensions.h"
+#include "WorkerPool.h"
+#include "MaterialRegistry.h"
+#include "GeometryCache.h"
+#include "SoftRasterizer.h"
+#include "RenderQueue.h"
+
+void RenderQueue::Add(int material, int geometry, CachedShape *shape, const MATRIX4X4 &transform)
+{
+	// 16 bits of material, 16 of geometry, 32 of sequence so equal keys keep their order
+	Item item;
+	item.key = ((unsigned long long)(material & 0xffff) << 48)
+	         | ((unsigned long long)(geometry & 0xffff) << 32)
+	         | (unsigned long long)(unsigned int)items.size();
+	item.shape = shape;
+	item.transform = &transform;
+	item.material = material;
+	items.push_back(item);
+}
+
+// Takes normals through transform the way GL does, by the inverse transpose of its 3x3 part.
+// The columns of that are the cross products of the other two columns over the
+// determinant; only its sign is kept, as GL_NORMALIZE rescales the normals anyway.
+static MATRIX4X4 NormalMatrix(const MATRIX4X4 &transform)
+{
+	const float *m = transform.entries;
+	VECTOR3D c0(m[0], m[1], m[2]), c1(m[4], m[5], m[6]), c2(m[8], m[9], m[10]);
+	VECTOR3D n0 = c1.CrossProduct(c2);
+	VECTOR3D n1 = c2.CrossProduct(c0);
+	VECTOR3D n2 = c0.CrossProduct(c1);
+	if (c0.DotProduct(n0) < 0.0f)
+	{
+		n0 = -n0;
+		n1 = -n1;
+		n2 = -n2;
+	}
+
+	MATRIX4X4 normal;
+	float *e = normal.entries;
+	e[0] = n0.x;	e[4] = n1.x;	e[8] = n2.x;
+	e[1] = n0.y;	e[5] = n1.y;	e[9] = n2.y;
+	e[2] = n0.z;	e[6] = n1.z;	e[10] = n2.z;
+	return normal;
+}
+
+void RenderQueue::BuildBatches()
+{
+	std::sort(items.begin(), items.end());
+
+	// Runs of items with the same material and shape
+	numBatches = 0;
+	itemBatches.resize(items.size());
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const Item &item = items[i];
+		if (numBatches == 0 || item.material != batches[numBatches - 1].material ||
+		    item.shape != batches[numBatches - 1].shape)
+		{
+			if (numBatches == (int)batches.size())
+				batches.push_back(Batch());
+			Batch &batch = batches[numBatches++];
+			batch.material = item.material;
+			batch.shape = item.shape;
+			batch.firstItem = (int)i;
+			batch.numItems = 0;
+		}
+		Batch &batch = batches[numBatches - 1];
+		batch.numItems++;
+		itemBatches[i] = numBatches - 1;
+	}
+
+	// The indices only change with the shape and the number of copies
+	for (int b = 0; b < numBatches; b++)
+	{
+		Batch &batch = batches[b];
+		size_t floats = batch.shape->positions.size();
+		batch.positions.resize(floats * batch.numItems);
+		batch.normals.resize(floats * batch.numItems);
+		batch.indicesValid = batch.indexedShape == batch.shape && batch.indexedCopies == batch.numItems;
+		if (!batch.indicesValid)
+			batch.indices.resize(batch.shape->indices.size() * batch.numItems);
+	}
+
+	// Each item fills its copy's part of its batch's arrays
+	WorkerPool::Shared().ParallelFor((int)items.size(), 16, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			Batch &batch = batches[itemBatches[i]];
+			const CachedShape &shape = *batch.shape;
+			int copy = i - batch.firstItem;
+			int vertices = (int)shape.positions.size() / 3;
+			if (vertices == 0)
+				continue;
+
+			const MATRIX4X4 &transform = *items[i].transform;
+			TransformPoints(transform, (const VECTOR3D *)&shape.positions[0],
+			                (VECTOR3D *)&batch.positions[copy * vertices * 3], vertices);
+			TransformDirections(NormalMatrix(transform), (const VECTOR3D *)&shape.normals[0],
+			                    (VECTOR3D *)&batch.normals[copy * vertices * 3], vertices);
+
+			if (batch.indicesValid)
+				continue;
+			size_t count = shape.indices.size();
+			GLuint *indices = &batch.indices[copy * count];
+			GLuint offset = (GLuint)(copy * vertices);
+			for (size_t k = 0; k < count; k++)
+				indices[k] = shape.indices[k] + offset;
+		}
+	});
+
+	for (int b = 0; b < numBatches; b++)
+	{
+		batches[b].indexedShape = batches[b].shape;
+		batches[b].indexedCopies = batches[b].numItems;
+	}
+}
+
+void RenderQueue::SubmitBatches(const MATRIX4X4 &view, MaterialRegistry &materials)
+{
+	glPushMatrix();
+	glLoadMatrixf(view);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	CountGLCalls(4);
+	CountGLStateChange();
+	for (int b = 0; b < numBatches; b++)
+	{
+		const Batch &batch = batches[b];
+		if (batch.indices.empty())
+			continue;
+
+		materials.Apply(batch.material);
+		glVertexPointer(3, GL_FLOAT, 0, &batch.positions[0]);
+		glNormalPointer(GL_FLOAT, 0, &batch.normals[0]);
+		glDrawElements(batch.shape->primitive, (GLsizei)batch.indices.size(), GL_UNSIGNED_INT, &batch.indices[0]);
+		CountGLCalls(2);
+		CountGLDraw(batch.shape->primitive == GL_TRIANGLES ? (int)batch.indices.size()/3 : 0,
+		            (int)batch.indices.size());
+		stats.binds++;
+		stats.bindsSkipped += batch.numItems - 1;
+	}
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glPopMatrix();
+	CountGLCalls(4);
+
+	stats.items += (int)items.size();
+}
+
+void RenderQueue::Submit(const MATRIX4X4 &view, MaterialRegistry &materials)
+{
+	if (numBatches > 0)
+	{
+		SubmitBatches(view, materials);
+		return;
+	}
+
+	// Items usually come in nearly sorted, which std::sort handles quickly
+	std::sort(items.begin(), items.end());
+
+	glPushMatrix();
+	CachedShape *boundShape = NULL;
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		const Item &item = items[i];
+
+		materials.Apply(item.material);
+		if (item.shape != boundShape)
+		{
+			if (boundShape)
+				boundShape->Unbind();
+			boundShape = item.shape;
+			boundShape->Bind();
+			stats.binds++;
+		}
+		else
+		{
+			stats.bindsSkipped++;
+		}
+
+		glLoadMatrixf(view * *item.transform);
+		CountGLCalls(1);
+		boundShape->DrawBound();
+	}
+	if (boundShape)
+		boundShape->Unbind();
+	glPopMatrix();
+	CountGLCalls(2);
+
+	stats.items += (int)items.size();
+}
+
+void RenderQueue::Submit(const MATRIX4X4 &view, SoftRasterizer &rasterizer)
+{
+	std::sort(items.begin(), items.end());
+	for (size_t i = 0; i < items.size(); i++)
+		rasterizer.DrawShape(view * *items[i].transform, *items[i].shape, items[i].material);
+	stats.items += (int)items.size();
+}
@@ -0,0 +1,114 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	RenderQueue.h
+//	Draw items collected over a frame, sorted by material and then geometry so that
+//	consecutive items share as much GL state as possible
+//
+//	Batching goes further and merges all copies of a shape with one material into a single
+//	vertex array in world coordinates, built across the worker pool on the thread that
+//	fills the queue. Submit then makes one draw per shape and material, however many
+//	copies there are, at the cost of transforming the copies' vertices on the CPU each
+//	frame.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <vector>
+
+// Per-frame counts of geometry binds
+struct RenderQueueStats
+{
+	int items;
+	int binds;			// shapes bound
+	int bindsSkipped;	// items that reused the bound shape
+
+	RenderQueueStats() : items(0), binds(0), bindsSkipped(0) {}
+	void Reset()
+	{
+		items = binds = bindsSkipped = 0;
+	}
+};
+
+class RenderQueue
+{
+public:
+	void Clear()
+	{
+		items.clear();
+		numBatches = 0;
+	}
+
+	// geometry is any id that is the same for items sharing shape, used to sort them.
+	// transform must stay valid until Submit.
+	void Add(int material, int geometry, CachedShape *shape, const MATRIX4X4 &transform);
+
+	// Merges the items added so far into one vertex array per shape and material, which the
+	// GL Submit draws in place of the items. Uses the shared worker pool. The arrays are
+	// kept from frame to frame, so their memory is only allocated as the batches grow.
+	void BuildBatches();
+
+	RenderQueue() : numBatches(0) {}
+
+	// Draw everything, each item with view * transform as its modelview matrix, or each
+	// batch with view after BuildBatches
+	void Submit(const MATRIX4X4 &view, MaterialRegistry &materials);
+	// Same order, drawn by the software renderer instead of GL
+	void Submit(const MATRIX4X4 &view, SoftRasterizer &rasterizer);
+
+	int GetNumItems() const
+	{
+		return (int)items.size();
+	}
+	int GetNumBatches() const
+	{
+		return numBatches;
+	}
+
+	RenderQueueStats &GetStats()
+	{
+		return stats;
+	}
+
+private:
+	struct Item
+	{
+		// material, geometry and the order items came in, packed so one compare sorts
+		unsigned long long key;
+		CachedShape *shape;
+		const MATRIX4X4 *transform;
+		int material;
+
+		bool operator<(const Item &rhs) const
+		{
+			return key < rhs.key;
+		}
+	};
+
+	// Copies of one shape with one material: items [firstItem, firstItem+numItems) once sorted
+	struct Batch
+	{
+		int material;
+		CachedShape *shape;
+		int firstItem;
+		int numItems;
+		std::vector<GLfloat> positions;		// world coordinates, one copy after another
+		std::vector<GLfloat> normals;		// not unit length, GL_NORMALIZE must be on
+		std::vector<GLuint> indices;
+		CachedShape *indexedShape;			// shape and copies indices was built for
+		int indexedCopies;
+		bool indicesValid;					// indices need no rebuilding this frame
+
+		Batch() : material(-1), shape(NULL), firstItem(0), numItems(0), indexedShape(NULL), indexedCopies(0),
+		          indicesValid(false) {}
+	};
+
+	void SubmitBatches(const MATRIX4X4 &view, MaterialRegistry &materials);
+
+	std::vector<Item> items;
+	std::vector<Batch> batches;				// the first numBatches are this frame's
+	int numBatches;
+	std::vector<int> itemBatches;			// batch of each sorted item
+	RenderQueueStats stats;
+};
+
+#endif	//RENDERQUEUE_H
@@ -0,0 +1,162 @@
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+#include "VECTOR3D.h"
+#include "MATRIX4X4.h"
+#include "BoundingBox.h"
+#include "SceneGraph.h"
+
+void SceneState::SetRoot(const MATRIX4X4 &root)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		if (this->root.entries[i] != root.entries[i])
+		{
+			this->root = root;
+			rootDirty = true;
+			return;
+		}
+	}
+}
+
+SceneGraph::SceneGraph()
+{
+	numJoints = 0;
+}
+
+int SceneGraph::AddNode(const Node &node)
+{
+	if (node.parent >= (int)nodes.size())
+	{
+		printf("SceneGraph: parent %d of node %d does not exist yet\n", node.parent, (int)nodes.size());
+		return -1;
+	}
+	if (node.joint >= numJoints)
+		numJoints = node.joint + 1;
+	nodes.push_back(node);
+	return (int)nodes.size() - 1;
+}
+
+int SceneGraph::AddTranslation(int parent, const VECTOR3D &translation)
+{
+	return AddRotation(parent, translation, 0.0f, VECTOR3D(0.0f, 1.0f, 0.0f));
+}
+
+int SceneGraph::AddRotation(int parent, const VECTOR3D &translation, float angle, const VECTOR3D &axis)
+{
+	Node node;
+	node.parent = parent;
+	node.joint = -1;
+	node.translation = translation;
+	node.pivot = VECTOR3D(0.0f, 0.0f, 0.0f);
+	node.axis = axis;
+	node.angle = angle;
+	node.scale = VECTOR3D(1.0f, 1.0f, 1.0f);
+	node.geometry = noGeometry;
+	node.material = 0;
+	node.box = MakeCenteredBox(0.0f, 0.0f, 0.0f);
+	return AddNode(node);
+}
+
+int SceneGraph::AddJoint(int parent, const VECTOR3D &pivot, const VECTOR3D &axis, int joint)
+{
+	Node node;
+	node.parent = parent;
+	node.joint = joint;
+	node.translation = VECTOR3D(0.0f, 0.0f, 0.0f);
+	node.pivot = pivot;
+	node.axis = axis;
+	node.angle = 0.0f;
+	node.scale = VECTOR3D(1.0f, 1.0f, 1.0f);
+	node.geometry = noGeometry;
+	node.material = 0;
+	node.box = MakeCenteredBox(0.0f, 0.0f, 0.0f);
+	return AddNode(node);
+}
+
+int SceneGraph::AddShape(int parent, const VECTOR3D &translation, const VECTOR3D &scale,
+                         int geometry, int material, const BBox &box)
+{
+	Node node;
+	node.parent = parent;
+	node.joint = -1;
+	node.translation = translation;
+	node.pivot = VECTOR3D(0.0f, 0.0f, 0.0f);
+	node.axis = VECTOR3D(0.0f, 1.0f, 0.0f);
+	node.angle = 0.0f;
+	node.scale = scale;
+	node.geometry = geometry;
+	node.material = material;
+	node.box = box;
+	return AddNode(node);
+}
+
+void SceneGraph::InitState(SceneState &state) const
+{
+	state.jointAngles.assign(numJoints, 0.0f);
+	state.local.resize(nodes.size());
+	state.world.resize(nodes.size());
+	state.localAngles.assign(nodes.size(), 0.0f);
+	state.dirty.assign(nodes.size(), 1);
+	state.root.LoadIdentity();
+	state.rootDirty = true;
+
+	for (size_t i = 0; i < nodes.size(); i++)
+		BuildLocal(nodes[i], nodes[i].angle, state.local[i]);
+}
+
+void SceneGraph::BuildLocal(const Node &node, float angle, MATRIX4X4 &local) const
+{
+	local.LoadIdentity();
+	local.Translate(node.translation.x + node.pivot.x, node.translation.y + node.pivot.y,
+	                node.translation.z + node.pivot.z);
+	if (angle != 0.0f)
+		local.Rotate(angle, node.axis.x, node.axis.y, node.axis.z);
+	local.Translate(-node.pivot.x, -node.pivot.y, -node.pivot.z);
+	local.Scale(node.scale.x, node.scale.y, node.scale.z);
+}
+
+int SceneGraph::Update(SceneState &state) const
+{
+	int numNodes = (int)nodes.size();
+	int numUpdated = 0;
+
+	for (int i = 0; i < numNodes; i++)
+	{
+		const Node &node = nodes[i];
+
+		// Only joints can change their local matrix
+		bool changed = state.dirty[i] != 0;
+		if (node.joint >= 0)
+		{
+			float angle = node.angle + state.jointAngles[node.joint];
+			if (angle != state.localAngles[i])
+			{
+				state.localAngles[i] = angle;
+				BuildLocal(node, angle, state.local[i]);
+				changed = true;
+			}
+		}
+
+		// Parents come first, so their dirty flag is already final
+		if (node.parent >= 0)
+			changed = changed || state.dirty[node.parent];
+		else
+			changed = changed || state.rootDirty;
+		state.dirty[i] = changed;
+
+		if (changed)
+		{
+			const MATRIX4X4 &parentWorld = node.parent >= 0 ? state.world[node.parent] : state.root;
+			state.world[i] = parentWorld * state.local[i];
+			numUpdated++;
+		}
+	}
+
+	// Flags are cleared after the pass, children needed them while it ran
+	for (int i = 0; i < numNodes; i++)
+		state.dirty[i] = 0;
+	state.rootDirty = false;
+
+	return numUpdated;
+}
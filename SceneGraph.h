@@ -0,0 +1,114 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	SceneGraph.h
+//	Flat hierarchy of nodes stored in an array in parent-before-child order, so world
+//	transforms come out of a single pass over the array
+//
+//	A node's local transform is T(translation) * T(pivot) * R(axis, angle) * T(-pivot) * S(scale)
+//	where angle is the node's fixed angle plus the angle of its joint, if it has one.
+//	The graph only describes the hierarchy. Joint angles and the matrices worked out from
+//	them live in a SceneState, one per copy of the hierarchy being posed.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <vector>
+
+// Joint angles and cached matrices of one copy of a SceneGraph
+struct SceneState
+{
+	std::vector<float> jointAngles;		// degrees, set these then call SceneGraph::Update
+	std::vector<MATRIX4X4> local;
+	std::vector<MATRIX4X4> world;
+
+	// Places the whole hierarchy, world = root * ... * local
+	void SetRoot(const MATRIX4X4 &root);
+
+	const MATRIX4X4 &GetRoot() const
+	{
+		return root;
+	}
+
+private:
+	friend class SceneGraph;
+
+	MATRIX4X4 root;
+	bool rootDirty;
+	std::vector<float> localAngles;		// angle each local matrix was built with
+	std::vector<unsigned char> dirty;
+};
+
+class SceneGraph
+{
+public:
+	// No geometry, used for grouping and joints
+	static const int noGeometry = -1;
+
+	SceneGraph();
+
+	// Each Add returns the index of the new node. parent must be an existing node, or -1
+	// for a root, so nodes always come after their parent.
+	int AddTranslation(int parent, const VECTOR3D &translation);
+	int AddRotation(int parent, const VECTOR3D &translation, float angle, const VECTOR3D &axis);
+	// Rotates by the angle of the given joint around pivot
+	int AddJoint(int parent, const VECTOR3D &pivot, const VECTOR3D &axis, int joint);
+	// A drawable leaf, geometry and material are ids the caller gives meaning to.
+	// box is the geometry's box before scaling.
+	int AddShape(int parent, const VECTOR3D &translation, const VECTOR3D &scale,
+	             int geometry, int material, const BBox &box);
+
+	int GetNumNodes() const
+	{
+		return (int)nodes.size();
+	}
+	int GetNumJoints() const
+	{
+		return numJoints;
+	}
+	int GetParent(int node) const
+	{
+		return nodes[node].parent;
+	}
+	int GetGeometry(int node) const
+	{
+		return nodes[node].geometry;
+	}
+	int GetMaterial(int node) const
+	{
+		return nodes[node].material;
+	}
+	const BBox &GetBox(int node) const
+	{
+		return nodes[node].box;
+	}
+
+	// Sizes the state for this graph and marks everything dirty
+	void InitState(SceneState &state) const;
+
+	// Rebuilds the local matrices whose angle changed and the world matrices below them.
+	// Returns the number of world matrices recomputed.
+	int Update(SceneState &state) const;
+
+private:
+	struct Node
+	{
+		int parent;
+		int joint;			// -1 when the angle is fixed
+		VECTOR3D translation;
+		VECTOR3D pivot;
+		VECTOR3D axis;
+		float angle;
+		VECTOR3D scale;
+		int geometry;
+		int material;
+		BBox box;
+	};
+
+	int AddNode(const Node &node);
+	void BuildLocal(const Node &node, float angle, MATRIX4X4 &local) const;
+
+	std::vector<Node> nodes;
+	int numJoints;
+};
+
+#endif	//SCENEGRAPH_H
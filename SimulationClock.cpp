@@ -0,0 +1,44 @@
+#include <chrono>
+#include "SimulationClock.h"
+
+SimulationClock::SimulationClock(double step, double maxFrameTime)
+{
+	this->step = step;
+	this->maxFrameTime = maxFrameTime;
+	Reset();
+}
+
+void SimulationClock::Reset()
+{
+	accumulator = 0.0;
+	lastTime = Now();
+}
+
+int SimulationClock::Advance()
+{
+	double now = Now();
+	double frameTime = now - lastTime;
+	lastTime = now;
+	return Advance(frameTime);
+}
+
+int SimulationClock::Advance(double frameTime)
+{
+	if (frameTime > maxFrameTime)
+		frameTime = maxFrameTime;
+	if (frameTime > 0.0)
+		accumulator += frameTime;
+
+	int steps = 0;
+	while (accumulator >= step)
+	{
+		accumulator -= step;
+		steps++;
+	}
+	return steps;
+}
+
+double SimulationClock::Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
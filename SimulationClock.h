@@ -0,0 +1,48 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	SimulationClock.h
+//	Fixed timestep clock. Real time is fed in each frame and handed out as whole steps of
+//	the same length, so the simulation advances the same way whatever the frame rate or
+//	timer jitter. Alpha() is how far real time has got into the next step, for rendering
+//	between the last two simulation states.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SIMULATIONCLOCK_H
+#define SIMULATIONCLOCK_H
+
+class SimulationClock
+{
+public:
+	// step and maxFrameTime in seconds. Frames longer than maxFrameTime (a breakpoint, a
+	// dragged window) are cut short rather than run as a burst of catch up steps.
+	SimulationClock(double step = 1.0 / 120.0, double maxFrameTime = 0.25);
+
+	// Start counting from now, dropping any time not yet simulated
+	void Reset();
+
+	// Adds the real time since the last call and returns how many steps to simulate
+	int Advance();
+	// Same with the frame time given, for scripted runs
+	int Advance(double frameTime);
+
+	double GetStep() const
+	{
+		return step;
+	}
+
+	// Fraction of a step between the last simulated state and now, in [0,1)
+	double Alpha() const
+	{
+		return accumulator / step;
+	}
+
+	// Monotonic time in seconds
+	static double Now();
+
+private:
+	double step;
+	double maxFrameTime;
+	double accumulator;
+	double lastTime;
+};
+
+#endif	//SIMULATIONCLOCK_H
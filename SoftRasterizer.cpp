@@ -0,0 +1,919 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "VECTOR3D.h"
+#include "MATRIX4X4.h"
+#include "BoundingBox.h"
+#include "GLExtensions.h"
+#include "NormalKernel.h"
+#include "MaterialRegistry.h"
+#include "GeometryCache.h"
+#include "QuadMesh.h"
+#include "WorkerPool.h"
+#include "Profiler.h"
+#include "SoftRasterizer.h"
+
+// Half width of the guard band in normalized device coordinates (the screen is 1). Inside
+// it window coordinates stay small enough for exact edge setup, outside it is clipped.
+static const float guardBand = 4.0f;
+
+// Channels already scaled to 0..255 and offset by 0.5, so truncating rounds
+static inline unsigned int PackColor(float red, float green, float blue)
+{
+	return (unsigned int)red | ((unsigned int)green << 8) | ((unsigned int)blue << 16) | 0xff000000u;
+}
+
+// floorf is a library call without SSE4.1, and most primitives are only ever rounded
+static inline int FloorToInt(float x)
+{
+	int i = (int)x;
+	return x < (float)i ? i - 1 : i;
+}
+
+// First and last pixel whose centre is at or past, or at or before, a window coordinate
+// snapped to 1/16 pixel: ceil(x - 0.5) and floor(x - 0.5) on the exact sixteenths
+static inline int FirstPixel(float x)
+{
+	return ((int)(x * 16.0f) + 7) >> 4;
+}
+
+static inline int LastPixel(float x)
+{
+	return ((int)(x * 16.0f) - 8) >> 4;
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+SoftRasterizer::SoftRasterizer()
+{
+	width = height = stride = 0;
+	tilesX = tilesY = blocksX = 0;
+	clearColor = PackColor(0.5f, 0.5f, 0.5f);
+	for (int i = 0; i < maxLights; i++)
+		lights[i].enabled = false;
+	for (int i = 0; i < 3; i++)
+		modelAmbient[i] = 0.2f;
+	modelAmbient[3] = 1.0f;
+	numPrimitives = 0;
+	numChunks = 0;
+	memset(&stats, 0, sizeof(stats));
+	SetViewport(1, 1);
+}
+
+void SoftRasterizer::SetViewport(int width, int height)
+{
+	this->width = width < 1 ? 1 : width;
+	this->height = height < 1 ? 1 : height;
+	tilesX = (this->width + tileSize - 1) / tileSize;
+	tilesY = (this->height + tileSize - 1) / tileSize;
+	stride = tilesX * tileSize;
+	blocksX = stride / blockSize;
+
+	// Whole tiles, so the rasterizer never checks for the right and top edges
+	int rows = tilesY * tileSize;
+	color.assign((size_t)stride * rows, clearColor);
+	depth.assign((size_t)stride * rows, 1.0f);
+	blockDepth.assign((size_t)blocksX * (rows / blockSize), 1.0f);
+}
+
+void SoftRasterizer::SetClearColor(float red, float green, float blue)
+{
+	float channels[3] = { red, green, blue };
+	for (int i = 0; i < 3; i++)
+		channels[i] = (channels[i] < 0.0f ? 0.0f : channels[i] > 1.0f ? 1.0f : channels[i]) * 255.0f + 0.5f;
+	clearColor = PackColor(channels[0], channels[1], channels[2]);
+}
+
+void SoftRasterizer::SetLight(int light, const GLfloat position[4], const GLfloat ambient[4], const GLfloat diffuse[4],
+                              const GLfloat specular[4])
+{
+	if (light < 0 || light >= maxLights)
+		return;
+	Light &l = lights[light];
+	l.enabled = true;
+	for (int i = 0; i < 4; i++)
+	{
+		l.position[i] = position[i];
+		l.ambient[i] = ambient[i];
+		l.diffuse[i] = diffuse[i];
+		l.specular[i] = specular[i];
+	}
+}
+
+void SoftRasterizer::SetLightModelAmbient(const GLfloat ambient[4])
+{
+	for (int i = 0; i < 4; i++)
+		modelAmbient[i] = ambient[i];
+}
+
+void SoftRasterizer::BeginFrame(const MATRIX4X4 &projection)
+{
+	this->projection = projection;
+	draws.clear();
+	numPrimitives = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+SoftRasterizer::Draw &SoftRasterizer::AddDraw(const MATRIX4X4 &modelView, int material, int numVertices,
+                                              int numPrimitives)
+{
+	Material m = MaterialRegistry::Shared().Get(material);
+	draws.push_back(Draw());
+	Draw &draw = draws.back();
+	draw.modelView = modelView;
+
+	// Cofactors of the 3x3 over its determinant, the inverse transpose that carries normals.
+	// Listed by rows, stored by columns.
+	const float *e = modelView.entries;
+	float cofactors[9] =
+	{
+		e[5]*e[10] - e[9]*e[6], e[9]*e[2] - e[1]*e[10], e[1]*e[6] - e[5]*e[2],
+		e[8]*e[6] - e[4]*e[10], e[0]*e[10] - e[8]*e[2], e[4]*e[2] - e[0]*e[6],
+		e[4]*e[9] - e[8]*e[5], e[8]*e[1] - e[0]*e[9], e[0]*e[5] - e[4]*e[1]
+	};
+	float determinant = e[0]*cofactors[0] + e[4]*cofactors[1] + e[8]*cofactors[2];
+	float scale = determinant != 0.0f ? 1.0f / determinant : 1.0f;
+	for (int i = 0; i < 9; i++)
+		draw.normalMatrix[(i % 3) * 3 + i / 3] = cofactors[i] * scale;
+
+	for (int i = 0; i < 3; i++)
+		draw.baseColor[i] = m.ambient[i] * modelAmbient[i];
+	draw.shineTable = FindShineTable(m.shininess[0]);
+	for (int l = 0; l < maxLights; l++)
+	{
+		if (!lights[l].enabled)
+			continue;
+		for (int i = 0; i < 3; i++)
+		{
+			draw.lights[l].ambient[i] = m.ambient[i] * lights[l].ambient[i];
+			draw.lights[l].diffuse[i] = m.diffuse[i] * lights[l].diffuse[i];
+			draw.lights[l].specular[i] = m.specular[i] * lights[l].specular[i];
+		}
+	}
+
+	draw.firstVertex = stats.vertices;
+	draw.numVertices = numVertices;
+	draw.firstPrimitive = this->numPrimitives;
+	draw.numPrimitives = numPrimitives;
+	stats.vertices += numVertices;
+	this->numPrimitives += numPrimitives;
+	stats.draws++;
+	return draw;
+}
+
+void SoftRasterizer::DrawShape(const MATRIX4X4 &modelView, const CachedShape &shape, int material)
+{
+	bool lines = shape.primitive == GL_LINES;
+	if (!lines && shape.primitive != GL_TRIANGLES)
+		return;
+	int count = (int)shape.indices.size() / (lines ? 2 : 3);
+	if (count == 0)
+		return;
+
+	Draw &draw = AddDraw(modelView, material, (int)shape.positions.size() / 3, count);
+	draw.positions = &shape.positions[0];
+	draw.normals = &shape.normals[0];
+	draw.indices = &shape.indices[0];
+	draw.shortIndices = false;
+	draw.lines = lines;
+	if (lines)
+		stats.lines += count;
+	else
+		stats.triangles += count;
+}
+
+void SoftRasterizer::DrawMesh(const MATRIX4X4 &modelView, const QuadMesh &mesh, int meshSize)
+{
+	if (meshSize > mesh.GetMeshSize())
+		meshSize = mesh.GetMeshSize();
+	int count = 2 * meshSize * meshSize;
+	if (count <= 0)
+		return;
+
+	Draw &draw = AddDraw(modelView, mesh.GetMaterial(), mesh.GetNumVertices(), count);
+	draw.positions = mesh.GetPositions();
+	draw.normals = mesh.GetNormals();
+	draw.indices = mesh.GetTriangleIndices();
+	draw.shortIndices = mesh.GetIndexType() == GL_UNSIGNED_SHORT;
+	draw.lines = false;
+	stats.triangles += count;
+}
+
+// Draw holding item first of the frame's vertices (field firstVertex) or primitives
+int SoftRasterizer::FindDraw(int first, int Draw::*field) const
+{
+	int low = 0, high = (int)draws.size() - 1;
+	while (low < high)
+	{
+		int middle = (low + high + 1) / 2;
+		if (draws[middle].*field <= first)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return low;
+}
+
+void SoftRasterizer::EndFrame()
+{
+	PROFILE_ZONE("SoftRasterizer::EndFrame");
+	WorkerPool &pool = WorkerPool::Shared();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	vertices.resize(stats.vertices);
+	if (stats.vertices > 0)
+		pool.ParallelFor(stats.vertices, 1024, [this](int begin, int end) { TransformVertices(begin, end); });
+	stats.vertexMs = MillisecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	numChunks = (numPrimitives + setupChunkSize - 1) / setupChunkSize;
+	if ((int)chunks.size() < numChunks)
+		chunks.resize(numChunks);
+	pool.ParallelFor(numChunks, 1, [this](int begin, int end)
+	{
+		for (int chunk = begin; chunk < end; chunk++)
+			SetupPrimitives(chunk);
+	});
+	for (int i = 0; i < numChunks; i++)
+	{
+		stats.primitivesBinned += chunks[i].binned;
+		stats.tileEntries += chunks[i].tileEntries;
+	}
+	stats.setupMs = MillisecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	pool.ParallelFor(tilesX * tilesY, 1, [this](int begin, int end)
+	{
+		for (int tile = begin; tile < end; tile++)
+			RasterizeTile(tile);
+	});
+	stats.rasterMs = MillisecondsSince(start);
+}
+
+void SoftRasterizer::TransformVertices(int begin, int end)
+{
+	PROFILE_ZONE("SoftRasterizer::TransformVertices");
+	int d = FindDraw(begin, &Draw::firstVertex);
+	for (int i = begin; i < end; d++)
+	{
+		int drawEnd = std::min(end, draws[d].firstVertex + draws[d].numVertices);
+		while (i < drawEnd)
+		{
+			int count = std::min(4, drawEnd - i);
+			TransformVertices(draws[d], i, count);
+			i += count;
+		}
+	}
+}
+
+// Eye space position, clip coordinates and the fixed function lighting of up to four
+// vertices of one draw, a vertex per lane. The local viewer is off and there is no
+// attenuation, as the scene sets up GL.
+void SoftRasterizer::TransformVertices(const Draw &draw, int first, int count)
+{
+	const float *position = draw.positions + 3 * (first - draw.firstVertex);
+	const float *normal = draw.normals + 3 * (first - draw.firstVertex);
+	float padded[2][12];
+	if (count < 4)
+	{
+		memset(padded, 0, sizeof(padded));
+		memcpy(padded[0], position, count * 3 * sizeof(float));
+		memcpy(padded[1], normal, count * 3 * sizeof(float));
+		position = padded[0];
+		normal = padded[1];
+	}
+
+	SimdFloat4 px, py, pz, nx, ny, nz;
+	SimdLoadXYZ4(position, px, py, pz);
+	SimdLoadXYZ4(normal, nx, ny, nz);
+
+	const float *m = draw.modelView.entries;
+	SimdFloat4 ex = SimdMulAdd(SimdSplat(m[0]), px, SimdMulAdd(SimdSplat(m[4]), py, SimdMulAdd(SimdSplat(m[8]), pz, SimdSplat(m[12]))));
+	SimdFloat4 ey = SimdMulAdd(SimdSplat(m[1]), px, SimdMulAdd(SimdSplat(m[5]), py, SimdMulAdd(SimdSplat(m[9]), pz, SimdSplat(m[13]))));
+	SimdFloat4 ez = SimdMulAdd(SimdSplat(m[2]), px, SimdMulAdd(SimdSplat(m[6]), py, SimdMulAdd(SimdSplat(m[10]), pz, SimdSplat(m[14]))));
+	const float *p = projection.entries;
+	float clip[4][4];
+	for (int k = 0; k < 4; k++)
+		SimdStore(clip[k], SimdMulAdd(SimdSplat(p[k]), ex, SimdMulAdd(SimdSplat(p[4+k]), ey,
+		                   SimdMulAdd(SimdSplat(p[8+k]), ez, SimdSplat(p[12+k])))));
+
+	// GL_NORMALIZE
+	const float *nm = draw.normalMatrix;
+	SimdFloat4 tx = SimdMulAdd(SimdSplat(nm[0]), nx, SimdMulAdd(SimdSplat(nm[3]), ny, SimdMul(SimdSplat(nm[6]), nz)));
+	SimdFloat4 ty = SimdMulAdd(SimdSplat(nm[1]), nx, SimdMulAdd(SimdSplat(nm[4]), ny, SimdMul(SimdSplat(nm[7]), nz)));
+	SimdFloat4 tz = SimdMulAdd(SimdSplat(nm[2]), nx, SimdMulAdd(SimdSplat(nm[5]), ny, SimdMul(SimdSplat(nm[8]), nz)));
+	const SimdFloat4 zero = SimdSplat(0.0f), tiny = SimdSplat(1e-20f);
+	SimdFloat4 scale = SimdRsqrt(SimdMax(SimdMulAdd(tx, tx, SimdMulAdd(ty, ty, SimdMul(tz, tz))), tiny));
+	nx = SimdMul(tx, scale);
+	ny = SimdMul(ty, scale);
+	nz = SimdMul(tz, scale);
+
+	SimdFloat4 c[3];
+	for (int k = 0; k < 3; k++)
+		c[k] = SimdSplat(draw.baseColor[k]);
+	const std::vector<float> &shine = shineTables[draw.shineTable].second;
+	for (int l = 0; l < maxLights; l++)
+	{
+		const Light &light = lights[l];
+		if (!light.enabled)
+			continue;
+		const LightProducts &products = draw.lights[l];
+
+		SimdFloat4 lx, ly, lz;
+		if (light.position[3] != 0.0f)
+		{
+			lx = SimdSub(SimdSplat(light.position[0] / light.position[3]), ex);
+			ly = SimdSub(SimdSplat(light.position[1] / light.position[3]), ey);
+			lz = SimdSub(SimdSplat(light.position[2] / light.position[3]), ez);
+		}
+		else
+		{
+			lx = SimdSplat(light.position[0]);
+			ly = SimdSplat(light.position[1]);
+			lz = SimdSplat(light.position[2]);
+		}
+		scale = SimdRsqrt(SimdMax(SimdMulAdd(lx, lx, SimdMulAdd(ly, ly, SimdMul(lz, lz))), tiny));
+		lx = SimdMul(lx, scale);
+		ly = SimdMul(ly, scale);
+		lz = SimdMul(lz, scale);
+		SimdFloat4 diffuse = SimdMulAdd(nx, lx, SimdMulAdd(ny, ly, SimdMul(nz, lz)));
+
+		// Half vector towards a viewer infinitely far along +z
+		SimdFloat4 hz = SimdAdd(lz, SimdSplat(1.0f));
+		SimdFloat4 specular = SimdMul(SimdMulAdd(nx, lx, SimdMulAdd(ny, ly, SimdMul(nz, hz))),
+		                              SimdRsqrt(SimdMax(SimdMulAdd(lx, lx, SimdMulAdd(ly, ly, SimdMul(hz, hz))), tiny)));
+
+		// Specular only shows on the lit side
+		float diffuseLanes[4], specularLanes[4];
+		SimdStore(diffuseLanes, diffuse);
+		SimdStore(specularLanes, specular);
+		for (int lane = 0; lane < 4; lane++)
+			specularLanes[lane] = diffuseLanes[lane] > 0.0f ? Shine(shine, specularLanes[lane]) : 0.0f;
+		diffuse = SimdMax(diffuse, zero);
+		specular = SimdLoad(specularLanes);
+
+		for (int k = 0; k < 3; k++)
+		{
+			c[k] = SimdAdd(c[k], SimdSplat(products.ambient[k]));
+			c[k] = SimdMulAdd(diffuse, SimdSplat(products.diffuse[k]), c[k]);
+			c[k] = SimdMulAdd(specular, SimdSplat(products.specular[k]), c[k]);
+		}
+	}
+	float color[3][4];
+	for (int k = 0; k < 3; k++)
+		SimdStore(color[k], SimdMul(SimdMin(SimdMax(c[k], zero), SimdSplat(1.0f)), SimdSplat(255.0f)));
+
+	for (int lane = 0; lane < count; lane++)
+	{
+		Vertex &vertex = vertices[first + lane];
+		for (int k = 0; k < 4; k++)
+			vertex.clip[k] = clip[k][lane];
+		for (int k = 0; k < 3; k++)
+			vertex.color[k] = color[k][lane];
+
+		float x = vertex.clip[0], y = vertex.clip[1], z = vertex.clip[2], w = vertex.clip[3];
+		float guard = guardBand * w;
+		int outcode = 0;
+		if (x < -w) outcode |= CLIP_LEFT;
+		if (x > w) outcode |= CLIP_RIGHT;
+		if (y < -w) outcode |= CLIP_BOTTOM;
+		if (y > w) outcode |= CLIP_TOP;
+		if (z < -w) outcode |= CLIP_NEAR;
+		if (z > w) outcode |= CLIP_FAR;
+		if (x < -guard) outcode |= CLIP_GUARD_LEFT;
+		if (x > guard) outcode |= CLIP_GUARD_RIGHT;
+		if (y < -guard) outcode |= CLIP_GUARD_BOTTOM;
+		if (y > guard) outcode |= CLIP_GUARD_TOP;
+		vertex.outcode = outcode;
+		if (!(outcode & CLIP_NEEDED))
+			ProjectVertex(vertex);
+	}
+}
+
+// x^shininess for x in [0,1], interpolated in a table made once per shininess, as powf
+// for every lit vertex would cost more than the rest of the lighting
+float SoftRasterizer::Shine(const std::vector<float> &table, float x)
+{
+	if (x <= 0.0f)
+		return 0.0f;
+	float f = x * shineTableSize;
+	int i = (int)f;
+	if (i >= shineTableSize)
+		return table[shineTableSize];
+	return table[i] + (f - i) * (table[i+1] - table[i]);
+}
+
+int SoftRasterizer::FindShineTable(float shininess)
+{
+	for (size_t i = 0; i < shineTables.size(); i++)
+	{
+		if (shineTables[i].first == shininess)
+			return (int)i;
+	}
+	std::vector<float> table(shineTableSize + 1);
+	for (int i = 0; i <= shineTableSize; i++)
+		table[i] = powf((float)i / shineTableSize, shininess);
+	shineTables.push_back(std::make_pair(shininess, table));
+	return (int)shineTables.size() - 1;
+}
+
+// Window coordinates. x and y are snapped to 1/16 pixel, so edge setup from them is exact.
+void SoftRasterizer::ProjectVertex(Vertex &vertex) const
+{
+	float invW = 1.0f / vertex.clip[3];
+	float x = (vertex.clip[0] * invW * 0.5f + 0.5f) * width;
+	float y = (vertex.clip[1] * invW * 0.5f + 0.5f) * height;
+	vertex.x = FloorToInt(x * 16.0f + 0.5f) * (1.0f / 16.0f);
+	vertex.y = FloorToInt(y * 16.0f + 0.5f) * (1.0f / 16.0f);
+	vertex.z = vertex.clip[2] * invW * 0.5f + 0.5f;
+}
+
+void SoftRasterizer::SetupPrimitives(int chunkIndex)
+{
+	PROFILE_ZONE("SoftRasterizer::SetupPrimitives");
+	Chunk &chunk = chunks[chunkIndex];
+	chunk.triangles.clear();
+	chunk.lines.clear();
+	chunk.bins.resize(tilesX * tilesY);
+	for (size_t i = 0; i < chunk.bins.size(); i++)
+		chunk.bins[i].clear();
+	chunk.binned = 0;
+	chunk.tileEntries = 0;
+
+	int begin = chunkIndex * setupChunkSize;
+	int end = std::min(begin + setupChunkSize, numPrimitives);
+	int d = FindDraw(begin, &Draw::firstPrimitive);
+	for (int p = begin; p < end; p++)
+	{
+		while (p >= draws[d].firstPrimitive + draws[d].numPrimitives)
+			d++;
+		const Draw &draw = draws[d];
+		int corners = draw.lines ? 2 : 3;
+		int first = (p - draw.firstPrimitive) * corners;
+
+		const Vertex *v[3];
+		int outside = ~0, crossed = 0;
+		for (int k = 0; k < corners; k++)
+		{
+			GLuint index = draw.shortIndices ? ((const GLushort *)draw.indices)[first + k]
+			                                 : ((const GLuint *)draw.indices)[first + k];
+			v[k] = &vertices[draw.firstVertex + index];
+			outside &= v[k]->outcode;
+			crossed |= v[k]->outcode;
+		}
+
+		// All beyond one side of the view volume
+		if (outside & (CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_NEAR | CLIP_FAR))
+			continue;
+
+		if (!(crossed & CLIP_NEEDED))
+		{
+			if (draw.lines)
+				SetupLine(chunk, *v[0], *v[1]);
+			else
+				SetupTriangle(chunk, *v[0], *v[1], *v[2]);
+			continue;
+		}
+
+		// A triangle gains at most one corner per plane
+		Vertex polygon[8], scratch[8];
+		for (int k = 0; k < corners; k++)
+			polygon[k] = *v[k];
+		int count = ClipPolygon(polygon, corners, !draw.lines, crossed & CLIP_NEEDED, scratch);
+		for (int k = 0; k < count; k++)
+			ProjectVertex(polygon[k]);
+		if (draw.lines)
+		{
+			if (count == 2)
+				SetupLine(chunk, polygon[0], polygon[1]);
+		}
+		else
+		{
+			for (int k = 2; k < count; k++)
+				SetupTriangle(chunk, polygon[0], polygon[k-1], polygon[k]);
+		}
+	}
+}
+
+// Sutherland-Hodgman against each of the given planes, in clip coordinates. A line is an
+// open polygon of two corners. New corners are always worked out from the inside end of
+// the edge, so the triangles on both sides of a clipped edge get the very same corner.
+int SoftRasterizer::ClipPolygon(Vertex *polygon, int count, bool closed, int planes, Vertex *scratch) const
+{
+	static const int planeBits[5] = { CLIP_NEAR, CLIP_GUARD_LEFT, CLIP_GUARD_RIGHT, CLIP_GUARD_BOTTOM, CLIP_GUARD_TOP };
+	for (int plane = 0; plane < 5 && count > 0; plane++)
+	{
+		if (!(planes & planeBits[plane]))
+			continue;
+
+		float distance[8];
+		for (int i = 0; i < count; i++)
+		{
+			const float *c = polygon[i].clip;
+			switch (planeBits[plane])
+			{
+			case CLIP_NEAR:			distance[i] = c[2] + c[3]; break;
+			case CLIP_GUARD_LEFT:	distance[i] = guardBand*c[3] + c[0]; break;
+			case CLIP_GUARD_RIGHT:	distance[i] = guardBand*c[3] - c[0]; break;
+			case CLIP_GUARD_BOTTOM:	distance[i] = guardBand*c[3] + c[1]; break;
+			default:				distance[i] = guardBand*c[3] - c[1]; break;
+			}
+		}
+
+		int kept = 0;
+		for (int i = 0; i < count; i++)
+		{
+			bool inside = distance[i] >= 0.0f;
+			if (inside)
+				scratch[kept++] = polygon[i];
+			if (!closed && i == count - 1)
+				break;
+
+			int next = (i + 1) % count;
+			if (inside == (distance[next] >= 0.0f))
+				continue;
+			int in = inside ? i : next;
+			int out = inside ? next : i;
+			float t = distance[in] / (distance[in] - distance[out]);
+			Vertex &corner = scratch[kept++];
+			for (int k = 0; k < 4; k++)
+				corner.clip[k] = polygon[in].clip[k] + t * (polygon[out].clip[k] - polygon[in].clip[k]);
+			for (int k = 0; k < 3; k++)
+				corner.color[k] = polygon[in].color[k] + t * (polygon[out].color[k] - polygon[in].color[k]);
+		}
+		for (int i = 0; i < kept; i++)
+			polygon[i] = scratch[i];
+		count = kept;
+	}
+	return count;
+}
+
+void SoftRasterizer::SetupTriangle(Chunk &chunk, const Vertex &v0, const Vertex &v1, const Vertex &v2)
+{
+	// Pixels whose centres can be inside, on screen. Most triangles of the finely
+	// tessellated parts cover none and stop here.
+	Triangle t;
+	t.minX = std::max(FirstPixel(std::min(v0.x, std::min(v1.x, v2.x))), 0);
+	t.maxX = std::min(LastPixel(std::max(v0.x, std::max(v1.x, v2.x))), width - 1);
+	if (t.minX > t.maxX)
+		return;
+	t.minY = std::max(FirstPixel(std::min(v0.y, std::min(v1.y, v2.y))), 0);
+	t.maxY = std::min(LastPixel(std::max(v0.y, std::max(v1.y, v2.y))), height - 1);
+	if (t.minY > t.maxY)
+		return;
+
+	// Twice the area in pixels, turned positive, since nothing is culled
+	const Vertex *a = &v0, *b = &v1, *c = &v2;
+	float area = (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+	if (!(area > 0.0f || area < 0.0f))
+		return;
+	if (area < 0.0f)
+	{
+		std::swap(b, c);
+		area = -area;
+	}
+
+	const Vertex *edges[3][2] = { { b, c }, { c, a }, { a, b } };
+	for (int i = 0; i < 3; i++)
+	{
+		const Vertex &from = *edges[i][0];
+		const Vertex &to = *edges[i][1];
+		bool forward = from.x < to.x || (from.x == to.x && from.y < to.y);
+		const Vertex &base = forward ? from : to;
+		t.edgeX[i] = base.x;
+		t.edgeY[i] = base.y;
+		t.edgeDX[i] = to.x - from.x;
+		t.edgeDY[i] = to.y - from.y;
+		// Top left rule: pixel centres exactly on an edge belong to the triangle on its left
+		bool topLeft = t.edgeDY[i] < 0.0f || (t.edgeDY[i] == 0.0f && t.edgeDX[i] > 0.0f);
+		t.edgeMin[i] = topLeft ? 0.0f : FLT_MIN;
+	}
+	t.invArea = 1.0f / area;
+
+	t.z0 = a->z;
+	t.dz1 = b->z - a->z;
+	t.dz2 = c->z - a->z;
+	t.zMin = std::min(a->z, std::min(b->z, c->z));
+	t.w0 = 1.0f / a->clip[3];
+	t.w1 = 1.0f / b->clip[3];
+	t.w2 = 1.0f / c->clip[3];
+	for (int k = 0; k < 3; k++)
+	{
+		t.color0[k] = a->color[k] + 0.5f;
+		t.dColor1[k] = b->color[k] - a->color[k];
+		t.dColor2[k] = c->color[k] - a->color[k];
+	}
+
+	unsigned int index = (unsigned int)chunk.triangles.size();
+	chunk.triangles.push_back(t);
+	Bin(chunk, index, t.minX, t.minY, t.maxX, t.maxY);
+}
+
+void SoftRasterizer::SetupLine(Chunk &chunk, const Vertex &v0, const Vertex &v1)
+{
+	Line line;
+	float dx = v1.x - v0.x, dy = v1.y - v0.y;
+	line.xMajor = fabsf(dx) >= fabsf(dy);
+	const Vertex *p = &v0, *q = &v1;
+	if (line.xMajor ? dx < 0.0f : dy < 0.0f)
+		std::swap(p, q);
+
+	// Columns (or rows) whose centres the line passes, the far end left out
+	float major0 = line.xMajor ? p->x : p->y;
+	float major1 = line.xMajor ? q->x : q->y;
+	float minor0 = line.xMajor ? p->y : p->x;
+	float minor1 = line.xMajor ? q->y : q->x;
+	line.first = std::max(FirstPixel(major0), 0);
+	line.last = std::min(FirstPixel(major1) - 1, (line.xMajor ? width : height) - 1);
+	if (line.first > line.last)
+		return;
+
+	float slope = (minor1 - minor0) / (major1 - major0);
+	int minorA = FloorToInt(minor0 + (line.first + 0.5f - major0) * slope);
+	int minorB = FloorToInt(minor0 + (line.last + 0.5f - major0) * slope);
+	int minMinor = std::max(std::min(minorA, minorB), 0);
+	int maxMinor = std::min(std::max(minorA, minorB), (line.xMajor ? height : width) - 1);
+	if (minMinor > maxMinor)
+		return;
+	line.minX = line.xMajor ? line.first : minMinor;
+	line.maxX = line.xMajor ? line.last : maxMinor;
+	line.minY = line.xMajor ? minMinor : line.first;
+	line.maxY = line.xMajor ? maxMinor : line.last;
+
+	line.x0 = p->x;
+	line.y0 = p->y;
+	line.z0 = p->z;
+	line.x1 = q->x;
+	line.y1 = q->y;
+	line.z1 = q->z;
+	line.zMin = std::min(p->z, q->z);
+	for (int k = 0; k < 3; k++)
+	{
+		line.color0[k] = p->color[k] + 0.5f;
+		line.color1[k] = q->color[k] + 0.5f;
+	}
+
+	unsigned int index = (unsigned int)chunk.lines.size();
+	chunk.lines.push_back(line);
+	Bin(chunk, lineBit | index, line.minX, line.minY, line.maxX, line.maxY);
+}
+
+void SoftRasterizer::Bin(Chunk &chunk, unsigned int index, int minX, int minY, int maxX, int maxY)
+{
+	for (int y = minY / tileSize; y <= maxY / tileSize; y++)
+	{
+		for (int x = minX / tileSize; x <= maxX / tileSize; x++)
+		{
+			chunk.bins[y * tilesX + x].push_back(index);
+			chunk.tileEntries++;
+		}
+	}
+	chunk.binned++;
+}
+
+void SoftRasterizer::RasterizeTile(int tile)
+{
+	PROFILE_ZONE("SoftRasterizer::RasterizeTile");
+	int tileX = (tile % tilesX) * tileSize;
+	int tileY = (tile / tilesX) * tileSize;
+
+	// Each tile clears its own pixels, while they are about to be used anyway
+	for (int y = tileY; y < tileY + tileSize; y++)
+	{
+		std::fill(&color[(size_t)y * stride + tileX], &color[(size_t)y * stride + tileX] + tileSize, clearColor);
+		std::fill(&depth[(size_t)y * stride + tileX], &depth[(size_t)y * stride + tileX] + tileSize, 1.0f);
+	}
+	for (int y = tileY / blockSize; y < (tileY + tileSize) / blockSize; y++)
+	{
+		float *row = &blockDepth[(size_t)y * blocksX];
+		std::fill(row + tileX / blockSize, row + (tileX + tileSize) / blockSize, 1.0f);
+	}
+
+	for (int c = 0; c < numChunks; c++)
+	{
+		const Chunk &chunk = chunks[c];
+		const std::vector<unsigned int> &bin = chunk.bins[tile];
+		for (size_t i = 0; i < bin.size(); i++)
+		{
+			if (bin[i] & lineBit)
+				RasterizeLine(chunk.lines[bin[i] & ~lineBit], tileX, tileY);
+			else
+				RasterizeTriangle(chunk.triangles[bin[i]], tileX, tileY);
+		}
+	}
+}
+
+void SoftRasterizer::RasterizeTriangle(const Triangle &t, int tileX, int tileY)
+{
+	int x0 = std::max(t.minX, tileX), x1 = std::min(t.maxX, tileX + tileSize - 1);
+	int y0 = std::max(t.minY, tileY), y1 = std::min(t.maxY, tileY + tileSize - 1);
+
+	SimdFloat4 edgeX[3], edgeDX[3], edgeDY[3], edgeMin[3];
+	for (int e = 0; e < 3; e++)
+	{
+		edgeX[e] = SimdSplat(t.edgeX[e]);
+		edgeDX[e] = SimdSplat(t.edgeDX[e]);
+		edgeDY[e] = SimdSplat(t.edgeDY[e]);
+		edgeMin[e] = SimdSplat(t.edgeMin[e]);
+	}
+	const SimdFloat4 laneOffsets = SimdSet(0.5f, 1.5f, 2.5f, 3.5f);
+	const SimdFloat4 invArea = SimdSplat(t.invArea);
+	const SimdFloat4 z0 = SimdSplat(t.z0), dz1 = SimdSplat(t.dz1), dz2 = SimdSplat(t.dz2);
+	const SimdFloat4 w0 = SimdSplat(t.w0), dw1 = SimdSplat(t.w1 - t.w0), dw2 = SimdSplat(t.w2 - t.w0);
+	const SimdFloat4 w1 = SimdSplat(t.w1), w2 = SimdSplat(t.w2);
+	// Weights on the edges can round a little past the vertex colours
+	const SimdFloat4 zero = SimdSplat(0.0f), maxChannel = SimdSplat(255.5f);
+
+	for (int blockY = y0 & ~(blockSize - 1); blockY <= y1; blockY += blockSize)
+	{
+		for (int blockX = x0 & ~(blockSize - 1); blockX <= x1; blockX += blockSize)
+		{
+			float &farthest = blockDepth[(size_t)(blockY / blockSize) * blocksX + blockX / blockSize];
+			if (t.zMin >= farthest)
+				continue;
+
+			// Edge functions are linear, so the corner pixels tell whether the block is
+			// wholly outside one edge, or wholly inside the triangle
+			SimdFloat4 cornerX = SimdSet(blockX + 0.5f, blockX + blockSize - 0.5f, blockX + 0.5f, blockX + blockSize - 0.5f);
+			SimdFloat4 cornerY = SimdSet(blockY + 0.5f, blockY + 0.5f, blockY + blockSize - 0.5f, blockY + blockSize - 0.5f);
+			int inside = 15;
+			bool outside = false;
+			for (int e = 0; e < 3; e++)
+			{
+				SimdFloat4 value = SimdSub(SimdMul(SimdSub(cornerY, SimdSplat(t.edgeY[e])), edgeDX[e]),
+				                           SimdMul(SimdSub(cornerX, edgeX[e]), edgeDY[e]));
+				int corners = SimdMoveMask(SimdCmpGE(value, edgeMin[e]));
+				outside |= corners == 0;
+				inside &= corners;
+			}
+			if (outside)
+				continue;
+
+			int rowBegin = std::max(y0, blockY), rowEnd = std::min(y1, blockY + blockSize - 1);
+			int columnBegin = std::max(x0, blockX) & ~3, columnEnd = std::min(x1, blockX + blockSize - 1);
+			for (int y = rowBegin; y <= rowEnd; y++)
+			{
+				float *depthRow = &depth[(size_t)y * stride];
+				unsigned int *colorRow = &color[(size_t)y * stride];
+				SimdFloat4 rowValue[3];
+				for (int e = 0; e < 3; e++)
+					rowValue[e] = SimdSplat((y + 0.5f - t.edgeY[e]) * t.edgeDX[e]);
+
+				for (int x = columnBegin; x <= columnEnd; x += 4)
+				{
+					// Evaluated outright at every pixel, not stepped, so shared edges stay exact
+					SimdFloat4 px = SimdAdd(SimdSplat((float)x), laneOffsets);
+					SimdFloat4 e0 = SimdSub(rowValue[0], SimdMul(SimdSub(px, edgeX[0]), edgeDY[0]));
+					SimdFloat4 e1 = SimdSub(rowValue[1], SimdMul(SimdSub(px, edgeX[1]), edgeDY[1]));
+					SimdFloat4 e2 = SimdSub(rowValue[2], SimdMul(SimdSub(px, edgeX[2]), edgeDY[2]));
+					SimdFloat4 mask = SimdAnd(SimdAnd(SimdCmpGE(e0, edgeMin[0]), SimdCmpGE(e1, edgeMin[1])),
+					                          SimdCmpGE(e2, edgeMin[2]));
+					if (!SimdMoveMask(mask))
+						continue;
+
+					// Barycentric weights of vertices 1 and 2; depth is linear on screen
+					SimdFloat4 b1 = SimdMul(e1, invArea);
+					SimdFloat4 b2 = SimdMul(e2, invArea);
+					SimdFloat4 z = SimdAdd(z0, SimdAdd(SimdMul(b1, dz1), SimdMul(b2, dz2)));
+					SimdFloat4 old = SimdLoad(depthRow + x);
+					mask = SimdAnd(mask, SimdCmpLT(z, old));
+					int written = SimdMoveMask(mask);
+					if (!written)
+						continue;
+					SimdStore(depthRow + x, SimdSelect(mask, z, old));
+
+					// Colour is linear in 1/w
+					SimdFloat4 w = SimdAdd(w0, SimdAdd(SimdMul(b1, dw1), SimdMul(b2, dw2)));
+					SimdFloat4 r = SimdDiv(SimdSplat(1.0f), w);
+					SimdFloat4 p1 = SimdMul(SimdMul(b1, w1), r);
+					SimdFloat4 p2 = SimdMul(SimdMul(b2, w2), r);
+					float channels[3][4];
+					for (int k = 0; k < 3; k++)
+					{
+						SimdFloat4 channel = SimdAdd(SimdSplat(t.color0[k]),
+						                             SimdAdd(SimdMul(p1, SimdSplat(t.dColor1[k])), SimdMul(p2, SimdSplat(t.dColor2[k]))));
+						SimdStore(channels[k], SimdMin(SimdMax(channel, zero), maxChannel));
+					}
+					for (int lane = 0; lane < 4; lane++)
+					{
+						if (written & (1 << lane))
+							colorRow[x + lane] = PackColor(channels[0][lane], channels[1][lane], channels[2][lane]);
+					}
+				}
+			}
+
+			// Covered blocks get their farthest depth again, which only ever comes nearer
+			if (inside == 15)
+			{
+				SimdFloat4 maximum = SimdSplat(0.0f);
+				for (int y = blockY; y < blockY + blockSize; y++)
+				{
+					const float *row = &depth[(size_t)y * stride + blockX];
+					maximum = SimdMax(maximum, SimdMax(SimdLoad(row), SimdLoad(row + 4)));
+				}
+				float lanes[4];
+				SimdStore(lanes, maximum);
+				farthest = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+			}
+		}
+	}
+}
+
+void SoftRasterizer::RasterizeLine(const Line &line, int tileX, int tileY)
+{
+	int tileMajor = line.xMajor ? tileX : tileY;
+	int begin = std::max(line.first, tileMajor);
+	int end = std::min(line.last, tileMajor + tileSize - 1);
+	float major0 = line.xMajor ? line.x0 : line.y0;
+	float majorLength = line.xMajor ? line.x1 - line.x0 : line.y1 - line.y0;
+	float minor0 = line.xMajor ? line.y0 : line.x0;
+	float minorLength = line.xMajor ? line.y1 - line.y0 : line.x1 - line.x0;
+
+	for (int m = begin; m <= end; m++)
+	{
+		float t = (m + 0.5f - major0) / majorLength;
+		int n = FloorToInt(minor0 + t * minorLength);
+		int x = line.xMajor ? m : n;
+		int y = line.xMajor ? n : m;
+		if (x < tileX || x >= tileX + tileSize || y < tileY || y >= tileY + tileSize || x >= width || y >= height)
+			continue;
+
+		float z = line.z0 + t * (line.z1 - line.z0);
+		float &d = depth[(size_t)y * stride + x];
+		if (!(z < d))
+			continue;
+		d = z;
+		color[(size_t)y * stride + x] = PackColor(line.color0[0] + t * (line.color1[0] - line.color0[0]),
+		                                          line.color0[1] + t * (line.color1[1] - line.color0[1]),
+		                                          line.color0[2] + t * (line.color1[2] - line.color0[2]));
+	}
+}
+
+void SoftRasterizer::Present() const
+{
+	glPushAttrib(GL_ENABLE_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glRasterPos2f(-1.0f, -1.0f);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+	glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, &color[0]);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+	CountGLCalls(16);
+}
+
+bool SoftRasterizer::WriteImage(const char *path) const
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("Cannot write image %s\n", path);
+		return false;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	std::vector<unsigned char> row(width * 3);
+	for (int y = height - 1; y >= 0; y--)
+	{
+		const unsigned int *pixels = &color[(size_t)y * stride];
+		for (int x = 0; x < width; x++)
+		{
+			row[x*3] = (unsigned char)(pixels[x] & 0xff);
+			row[x*3 + 1] = (unsigned char)((pixels[x] >> 8) & 0xff);
+			row[x*3 + 2] = (unsigned char)((pixels[x] >> 16) & 0xff);
+		}
+		fwrite(&row[0], 1, row.size(), file);
+	}
+	bool written = !ferror(file);
+	fclose(file);
+	return written;
+}
@@ -0,0 +1,233 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	SoftRasterizer.h
+//	CPU renderer for the robot scene, for machines with no GPU, where the GL driver is a
+//	generic software one that is far slower than a renderer made for this scene
+//
+//	Lit, smooth shaded triangles and lines come out as the fixed function pipeline draws
+//	them with the scene's state: positional lights, GL_NORMALIZE, a GL_LESS depth test and
+//	no face culling. Draws are collected over the frame and done in EndFrame in three passes
+//	over the shared worker pool. Vertices are transformed and lit. Primitives are clipped
+//	against the near plane, set up and binned into 64x64 pixel tiles, a chunk of primitives
+//	at a time so each tile still sees them in the order they were drawn. Then the tiles are
+//	rasterized, one per thread at a time, so no two threads ever write the same pixel.
+//
+//	Coverage is tested four pixels at a time. Each edge is evaluated from the same endpoint
+//	in both triangles that share it, so the two get exactly opposite values and every pixel
+//	on the edge is drawn once. Each 8x8 block keeps the farthest depth in it once a triangle
+//	has covered it, and triangles behind that are skipped a block at a time.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SOFTRASTERIZER_H
+#define SOFTRASTERIZER_H
+
+#include <utility>
+#include <vector>
+
+struct CachedShape;
+class QuadMesh;
+
+// Counts and pass times of the last frame
+struct SoftRasterizerStats
+{
+	int draws;
+	int vertices;
+	int triangles;			// drawn, before clipping
+	int lines;
+	int primitivesBinned;	// on screen after clipping, in at least one tile
+	int tileEntries;		// primitive and tile pairs rasterized
+	double vertexMs;
+	double setupMs;
+	double rasterMs;
+};
+
+class SoftRasterizer
+{
+public:
+	SoftRasterizer();
+
+	void SetViewport(int width, int height);
+	void SetClearColor(float red, float green, float blue);
+	// Position in eye coordinates, as glLightfv(GL_POSITION) with an identity modelview,
+	// w = 0 for a directional light. Setting a light turns it on.
+	void SetLight(int light, const GLfloat position[4], const GLfloat ambient[4], const GLfloat diffuse[4],
+	              const GLfloat specular[4]);
+	// GL_LIGHT_MODEL_AMBIENT, 0.2 grey unless set
+	void SetLightModelAmbient(const GLfloat ambient[4]);
+
+	// Draws are kept from BeginFrame and drawn in EndFrame. Their vertex and index arrays
+	// must not change until then.
+	void BeginFrame(const MATRIX4X4 &projection);
+	void DrawShape(const MATRIX4X4 &modelView, const CachedShape &shape, int material);
+	// The first meshSize x meshSize quads, as QuadMesh::DrawMesh(meshSize)
+	void DrawMesh(const MATRIX4X4 &modelView, const QuadMesh &mesh, int meshSize);
+	void EndFrame();
+
+	// The last frame, RGBA packed with red in the low byte, rows bottom up as glReadPixels
+	// returns them and GetStride() pixels apart
+	const unsigned int *GetColorBuffer() const
+	{
+		return &color[0];
+	}
+	int GetStride() const
+	{
+		return stride;
+	}
+	int GetWidth() const
+	{
+		return width;
+	}
+	int GetHeight() const
+	{
+		return height;
+	}
+
+	// Copies the last frame to the GL draw buffer, filling the viewport
+	void Present() const;
+	// Writes the last frame as a binary PPM. Returns false if it could not.
+	bool WriteImage(const char *path) const;
+
+	const SoftRasterizerStats &GetStats() const
+	{
+		return stats;
+	}
+
+	static const int maxLights = 8;
+	static const int tileSize = 64;
+	static const int blockSize = 8;
+
+private:
+	struct Light
+	{
+		bool enabled;
+		float position[4];
+		float ambient[4];
+		float diffuse[4];
+		float specular[4];
+	};
+
+	// Material times light colours, worked out once per draw
+	struct LightProducts
+	{
+		float ambient[3];
+		float diffuse[3];
+		float specular[3];
+	};
+
+	struct Draw
+	{
+		MATRIX4X4 modelView;
+		float normalMatrix[9];		// inverse transpose of the modelview's 3x3, column major
+		float baseColor[3];			// material ambient times the light model ambient
+		int shineTable;				// in shineTables
+		LightProducts lights[maxLights];
+		const GLfloat *positions;
+		const GLfloat *normals;
+		const void *indices;
+		bool shortIndices;
+		bool lines;
+		int firstVertex;			// in the frame's vertices
+		int numVertices;
+		int firstPrimitive;			// in the frame's primitives
+		int numPrimitives;
+	};
+
+	struct Vertex
+	{
+		float clip[4];
+		float x, y, z;				// window coordinates, x and y snapped to 1/16 pixel
+		float color[3];				// 0..255
+		int outcode;				// planes the vertex is outside of, CLIP_* bits
+	};
+
+	// Triangle set up for the tiles. Edge i runs opposite vertex i, E(p) =
+	// (p.y - edgeY)*edgeDX - (p.x - edgeX)*edgeDY is positive inside and a pixel is covered
+	// when every E >= edgeMin (0 on top left edges, the smallest float otherwise).
+	struct Triangle
+	{
+		int minX, minY, maxX, maxY;	// pixels that may be covered, on screen
+		float zMin;
+		float edgeX[3], edgeY[3], edgeDX[3], edgeDY[3], edgeMin[3];
+		float invArea;
+		float z0, dz1, dz2;			// depth at vertex 0 and differences to 1 and 2
+		float w0, w1, w2;			// 1/clip w, for perspective correct colour
+		float color0[3], dColor1[3], dColor2[3];
+	};
+
+	// One fragment per column (xMajor) or row from first to last, each at the line's
+	// centre there
+	struct Line
+	{
+		int minX, minY, maxX, maxY;
+		float zMin;
+		bool xMajor;
+		int first, last;
+		float x0, y0, z0, x1, y1, z1;
+		float color0[3], color1[3];
+	};
+
+	// Primitives of one run of setupChunkSize, and for every tile the ones touching it,
+	// as lineBit | line index or triangle index, in drawing order
+	struct Chunk
+	{
+		std::vector<Triangle> triangles;
+		std::vector<Line> lines;
+		std::vector<std::vector<unsigned int> > bins;
+		int binned;
+		int tileEntries;
+	};
+
+	enum
+	{
+		CLIP_LEFT = 1, CLIP_RIGHT = 2, CLIP_BOTTOM = 4, CLIP_TOP = 8, CLIP_NEAR = 16, CLIP_FAR = 32,
+		// Outside the guard band, far enough off screen that window coordinates lose precision
+		CLIP_GUARD_LEFT = 64, CLIP_GUARD_RIGHT = 128, CLIP_GUARD_BOTTOM = 256, CLIP_GUARD_TOP = 512,
+		CLIP_NEEDED = CLIP_NEAR | CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_BOTTOM | CLIP_GUARD_TOP
+	};
+	static const unsigned int lineBit = 0x80000000u;
+	static const int setupChunkSize = 4096;
+	static const int shineTableSize = 1024;
+
+	Draw &AddDraw(const MATRIX4X4 &modelView, int material, int numVertices, int numPrimitives);
+	int FindDraw(int first, int Draw::*field) const;
+	void TransformVertices(int begin, int end);
+	void TransformVertices(const Draw &draw, int first, int count);
+	static float Shine(const std::vector<float> &table, float x);
+	int FindShineTable(float shininess);
+	void ProjectVertex(Vertex &vertex) const;
+	void SetupPrimitives(int chunk);
+	int ClipPolygon(Vertex *polygon, int count, bool closed, int planes, Vertex *scratch) const;
+	void SetupTriangle(Chunk &chunk, const Vertex &v0, const Vertex &v1, const Vertex &v2);
+	void SetupLine(Chunk &chunk, const Vertex &v0, const Vertex &v1);
+	void Bin(Chunk &chunk, unsigned int index, int minX, int minY, int maxX, int maxY);
+	void RasterizeTile(int tile);
+	void RasterizeTriangle(const Triangle &triangle, int tileX, int tileY);
+	void RasterizeLine(const Line &line, int tileX, int tileY);
+
+	int width;
+	int height;
+	int stride;					// pixels per row, whole tiles
+	int tilesX;
+	int tilesY;
+	int blocksX;
+	unsigned int clearColor;
+	Light lights[maxLights];
+	float modelAmbient[4];
+	MATRIX4X4 projection;
+	// x^shininess at x = i/shineTableSize for each shininess seen so far
+	std::vector<std::pair<float, std::vector<float> > > shineTables;
+
+	std::vector<Draw> draws;
+	std::vector<Vertex> vertices;
+	int numPrimitives;
+	std::vector<Chunk> chunks;		// the first numChunks hold this frame's primitives
+	int numChunks;
+
+	// Pixels are packed R in the low byte to A in the high one (GL_UNSIGNED_INT_8_8_8_8_REV)
+	std::vector<unsigned int> color;
+	std::vector<float> depth;
+	std::vector<float> blockDepth;	// farthest depth in each 8x8 block, or further
+
+	SoftRasterizerStats stats;
+};
+
+#endif	//SOFTRASTERIZER_H
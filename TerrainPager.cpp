@@ -0,0 +1,407 @@
+#define GL_SILENCE_DEPRECATION
+#ifdef __APPLE__
+#include <glut/glut.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <gl/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+#include "VECTOR3D.h"
+#include "MATRIX4X4.h"
+#include "BoundingBox.h"
+#include "Frustum.h"
+#include "GLExtensions.h"
+#include "NormalKernel.h"
+#include "MaterialRegistry.h"
+#include "Profiler.h"
+#include "QuadMesh.h"
+#include "MeshAllocator.h"
+#include "Picking.h"
+#include "Heightfield.h"
+#include "ChunkedTerrain.h"
+#include "TerrainPager.h"
+
+TerrainPager::TerrainPager(int tileSize, float tileLength, int ringRadius)
+{
+	this->tileSize = tileSize < 8 ? 8 : (tileSize/8)*8;
+	this->tileLength = tileLength;
+	this->ringRadius = ringRadius < 1 ? 1 : ringRadius;
+	lodDistance = 2.0f*tileLength;
+	memoryCap = 64 << 20;
+	uploadBudget = 2.0;
+	material = -1;
+	heightFunction = NULL;
+	heightfield = NULL;
+	centerTileX = 0;
+	centerTileZ = 0;
+	frame = 0;
+	indexLists.SetTileSize(this->tileSize);
+	memset(&stats, 0, sizeof(stats));
+	stopping = false;
+}
+
+TerrainPager::~TerrainPager()
+{
+	Stop();
+	std::map<long long, Tile *>::iterator it;
+	for (it = tiles.begin(); it != tiles.end(); ++it)
+	{
+		delete it->second->mesh;
+		delete it->second;
+	}
+}
+
+void TerrainPager::Start()
+{
+	if (loader.joinable())
+		return;
+	stopping = false;
+	loader = std::thread(&TerrainPager::LoaderLoop, this);
+}
+
+void TerrainPager::Stop()
+{
+	if (!loader.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	loader.join();
+
+	// Whatever the loader finished is handed over as usual at the next Update
+}
+
+void TerrainPager::SetMaterial(VECTOR3D ambient, VECTOR3D diffuse, VECTOR3D specular, double shininess)
+{
+	material = MaterialRegistry::Shared().Add(ambient, diffuse, specular, shininess);
+}
+
+TerrainPager::Tile *TerrainPager::Find(int x, int z) const
+{
+	std::map<long long, Tile *>::const_iterator it = tiles.find(Key(x, z));
+	return it != tiles.end() ? it->second : NULL;
+}
+
+int TerrainPager::Distance(const Tile *tile) const
+{
+	int dx = abs(tile->x - centerTileX);
+	int dz = abs(tile->z - centerTileZ);
+	return dx > dz ? dx : dz;
+}
+
+int TerrainPager::SelectLevel(const VECTOR3D &center, const VECTOR3D &eye) const
+{
+	float distance = (center - eye).GetLength();
+	int level = 0;
+	float threshold = lodDistance;
+	while (distance > threshold && level < ChunkedTerrain::maxLevels-1)
+	{
+		level++;
+		threshold *= 2.0f;
+	}
+	return level;
+}
+
+void TerrainPager::LoaderLoop()
+{
+	PROFILE_THREAD("terrain loader");
+	for (;;)
+	{
+		Tile *tile;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || !queue.empty(); });
+			if (stopping)
+				return;
+			tile = queue.back();
+			queue.pop_back();
+		}
+
+		// The tile is out of the queue, so nobody else touches it until it is handed back
+		QuadMesh *mesh = BuildMesh(tile->x, tile->z);
+		tile->tree.Build(*mesh);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		tile->mesh = mesh;
+		built.push_back(tile);
+	}
+}
+
+// Loader thread. CPU side only, the GL buffers are made when the render thread uploads.
+QuadMesh *TerrainPager::BuildMesh(int x, int z)
+{
+	PROFILE_ZONE("TerrainPager::BuildMesh");
+	QuadMesh *mesh = new QuadMesh(tileSize, tileLength, &meshPool);
+	mesh->InitMesh(tileSize, VECTOR3D(0.0f, 0.0f, 0.0f), tileLength, tileLength,
+		VECTOR3D(1.0f, 0.0f, 0.0f), VECTOR3D(0.0f, 0.0f, -1.0f));
+	if (material >= 0)
+		mesh->SetMaterial(material);
+
+	if (heightfield)
+	{
+		heightfield->LoadTile(*mesh, x*tileSize, z*tileSize);
+	}
+	else if (heightFunction)
+	{
+		// Heights at world positions, vertices relative to the tile corner, with the ring
+		// of samples one past the tile for the border normals
+		int n = tileSize + 3;
+		double step = (double)tileLength / tileSize;
+		std::vector<float> heights(n*n);
+		for (int row = 0; row < n; row++)
+		{
+			float worldZ = (float)(-(z*(double)tileLength + (row - 1)*step));
+			for (int col = 0; col < n; col++)
+				heights[row*n + col] = heightFunction((float)(x*(double)tileLength + (col - 1)*step), worldZ, 0.0f);
+		}
+		mesh->UpdateMeshPadded(&heights[0]);
+	}
+	return mesh;
+}
+
+void TerrainPager::Update(double centerX, double centerZ)
+{
+	PROFILE_ZONE("TerrainPager::Update");
+	frame++;
+	centerTileX = (int)floor(centerX / tileLength);
+	centerTileZ = (int)floor(-centerZ / tileLength);
+
+	// Mark the ring, making tiles for the parts not seen before
+	std::vector<Tile *> missing;
+	for (int dz = -ringRadius; dz <= ringRadius; dz++)
+	{
+		for (int dx = -ringRadius; dx <= ringRadius; dx++)
+		{
+			Tile *&tile = tiles[Key(centerTileX + dx, centerTileZ + dz)];
+			if (!tile)
+			{
+				tile = new Tile();
+				tile->x = centerTileX + dx;
+				tile->z = centerTileZ + dz;
+				tile->mesh = NULL;
+				tile->state = TILE_QUEUED;
+				tile->level = 0;
+				missing.push_back(tile);
+			}
+			tile->lastWanted = frame;
+		}
+	}
+
+	bool queued;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// Queued tiles that left the ring before the loader got to them are dropped
+		size_t kept = 0;
+		for (size_t i = 0; i < queue.size(); i++)
+		{
+			if (queue[i]->lastWanted == frame)
+				queue[kept++] = queue[i];
+			else
+				DeleteTile(queue[i]);
+		}
+		queue.resize(kept);
+
+		// Nearest last, where the loader takes them from
+		queue.insert(queue.end(), missing.begin(), missing.end());
+		std::sort(queue.begin(), queue.end(), [&](const Tile *a, const Tile *b) { return Distance(a) > Distance(b); });
+		queued = !queue.empty();
+
+		for (size_t i = 0; i < built.size(); i++)
+			built[i]->state = TILE_BUILT;
+		stats.tilesBuilt += (int)built.size();
+		uploads.insert(uploads.end(), built.begin(), built.end());
+		built.clear();
+		stats.tilesPending = (int)queue.size();
+	}
+	if (queued)
+		wake.notify_one();
+
+	// Upload nearest first until the budget is spent
+	std::sort(uploads.begin(), uploads.end(), [&](const Tile *a, const Tile *b) { return Distance(a) < Distance(b); });
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double elapsed = 0.0;
+	size_t uploaded = 0;
+	while (uploaded < uploads.size() && (uploaded == 0 || elapsed < uploadBudget))
+	{
+		Tile *tile = uploads[uploaded++];
+		tile->mesh->Upload();
+		tile->state = TILE_RESIDENT;
+		elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+	uploads.erase(uploads.begin(), uploads.begin() + uploaded);
+	stats.uploads = (int)uploaded;
+	stats.uploadMs = elapsed;
+	if (elapsed > stats.maxUploadMs)
+		stats.maxUploadMs = elapsed;
+
+	Evict();
+}
+
+// Least recently wanted tiles outside the ring go until the total is under the cap
+void TerrainPager::Evict()
+{
+	std::vector<Tile *> candidates;
+	stats.memoryUsed = 0;
+	stats.tilesResident = 0;
+	std::map<long long, Tile *>::iterator it;
+	for (it = tiles.begin(); it != tiles.end(); ++it)
+	{
+		Tile *tile = it->second;
+		if (tile->state == TILE_QUEUED)
+			continue;
+		stats.memoryUsed += TileMemory(tile);
+		if (tile->state == TILE_RESIDENT)
+			stats.tilesResident++;
+		if (tile->lastWanted != frame)
+			candidates.push_back(tile);
+	}
+	stats.tilesPending += (int)uploads.size();
+
+	if (stats.memoryUsed <= memoryCap)
+		return;
+
+	std::sort(candidates.begin(), candidates.end(), [](const Tile *a, const Tile *b) { return a->lastWanted < b->lastWanted; });
+	for (size_t i = 0; i < candidates.size() && stats.memoryUsed > memoryCap; i++)
+	{
+		Tile *tile = candidates[i];
+		stats.memoryUsed -= TileMemory(tile);
+		if (tile->state == TILE_RESIDENT)
+			stats.tilesResident--;
+		else
+			uploads.erase(std::find(uploads.begin(), uploads.end(), tile));
+		stats.tilesEvicted++;
+		DeleteTile(tile);
+	}
+}
+
+void TerrainPager::DeleteTile(Tile *tile)
+{
+	tiles.erase(Key(tile->x, tile->z));
+	delete tile->mesh;
+	delete tile;
+}
+
+void TerrainPager::Draw(double originX, double originZ, const VECTOR3D &eye, const Frustum *frustum, CullStats *stats)
+{
+	// Levels first, so each tile can match its edges to its neighbours'
+	int side = 2*ringRadius + 1;
+	std::vector<Tile *> ring(side*side);
+	for (int dz = -ringRadius; dz <= ringRadius; dz++)
+	{
+		for (int dx = -ringRadius; dx <= ringRadius; dx++)
+		{
+			Tile *tile = Find(centerTileX + dx, centerTileZ + dz);
+			if (tile && tile->state != TILE_RESIDENT)
+				tile = NULL;
+			if (tile)
+			{
+				VECTOR3D center = (tile->mesh->GetBoundingBox().min + tile->mesh->GetBoundingBox().max) * 0.5f;
+				center.x += (float)(tile->x*(double)tileLength - originX);
+				center.z += (float)(-tile->z*(double)tileLength - originZ);
+				tile->level = SelectLevel(center, eye);
+			}
+			ring[(dz + ringRadius)*side + dx + ringRadius] = tile;
+		}
+	}
+
+	this->stats.trianglesDrawn = 0;
+	for (int rz = 0; rz < side; rz++)
+	{
+		for (int rx = 0; rx < side; rx++)
+		{
+			Tile *tile = ring[rz*side + rx];
+			if (!tile)
+				continue;
+
+			// Tile corner relative to the view origin, worked out in double
+			VECTOR3D offset((float)(tile->x*(double)tileLength - originX), 0.0f,
+			                (float)(-tile->z*(double)tileLength - originZ));
+			BBox box = tile->mesh->GetBoundingBox();
+			box.min += offset;
+			box.max += offset;
+			if (frustum && frustum->BoxOutside(box))
+			{
+				if (stats)
+					stats->culled++;
+				continue;
+			}
+			if (stats)
+				stats->drawn++;
+
+			// Sides: 0 front (first row), 1 right, 2 back (last row), 3 left. Missing
+			// neighbours leave the edge at this tile's level.
+			const Tile *neighbours[4];
+			neighbours[0] = rz > 0 ? ring[(rz-1)*side + rx] : NULL;
+			neighbours[1] = rx < side-1 ? ring[rz*side + rx+1] : NULL;
+			neighbours[2] = rz < side-1 ? ring[(rz+1)*side + rx] : NULL;
+			neighbours[3] = rx > 0 ? ring[rz*side + rx-1] : NULL;
+			int sideLevels[4];
+			for (int s = 0; s < 4; s++)
+			{
+				sideLevels[s] = neighbours[s] ? neighbours[s]->level : tile->level;
+				if (sideLevels[s] < tile->level)
+					sideLevels[s] = tile->level;
+			}
+
+			const MeshIndexList &list = indexLists.Get(tile->level, sideLevels);
+			glPushMatrix();
+			glTranslatef(offset.x, offset.y, offset.z);
+			tile->mesh->DrawMesh(list);
+			glPopMatrix();
+			CountGLCalls(3);
+			this->stats.trianglesDrawn += (int)list.indices.size()/3;
+		}
+	}
+}
+
+bool TerrainPager::Intersect(double originX, double originZ, const Ray &ray, float maxT, float &t) const
+{
+	bool hit = false;
+	std::map<long long, Tile *>::const_iterator it;
+	for (it = tiles.begin(); it != tiles.end(); ++it)
+	{
+		const Tile *tile = it->second;
+		if (tile->state != TILE_RESIDENT)
+			continue;
+
+		// Into the tile's own coordinates, the corner offset worked out in double as Draw does
+		VECTOR3D offset((float)(tile->x*(double)tileLength - originX), 0.0f,
+		                (float)(-tile->z*(double)tileLength - originZ));
+		Ray local = ray;
+		local.origin -= offset;
+		float entry, tileT;
+		int quad;
+		if (!RayHitsBox(local, tile->mesh->GetBoundingBox(), maxT, entry))
+			continue;
+		if (tile->tree.Intersect(local, maxT, tileT, quad))
+		{
+			maxT = tileT;
+			hit = true;
+		}
+	}
+	if (hit)
+		t = maxT;
+	return hit;
+}
+
+float TerrainPager::GetHeight(double x, double z) const
+{
+	if (heightfield)
+	{
+		double spacing = (double)tileLength / tileSize;
+		return heightfield->GetHeight((float)(x / spacing), (float)(-z / spacing));
+	}
+	return heightFunction ? heightFunction((float)x, (float)z, 0.0f) : 0.0f;
+}
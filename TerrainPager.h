@@ -0,0 +1,180 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	TerrainPager.h
+//	Endless terrain streamed in tiles around a moving centre
+//
+//	Every tile within ringRadius tiles of the centre is wanted. Missing ones are built
+//	(heights, normals, bounds) on a loader thread, nearest first, and handed back to the
+//	render thread, which uploads them to GL a few a frame within a time budget. Tiles
+//	that leave the ring stay cached until the memory cap is reached, then the least
+//	recently wanted are evicted first.
+//
+//	Tiles are addressed by integer coordinates and each mesh is built around its own
+//	corner, then drawn translated from the view origin, so vertex positions stay small
+//	however far the centre travels. Levels of detail work as in ChunkedTerrain.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef TERRAINPAGER_H
+#define TERRAINPAGER_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "MeshAllocator.h"
+#include "Picking.h"
+
+class Heightfield;
+
+class TerrainPager
+{
+public:
+	// Tiles of tileSize x tileSize quads (a multiple of 8), tileLength units on a side.
+	// The ring is (2*ringRadius+1)^2 tiles.
+	TerrainPager(int tileSize, float tileLength, int ringRadius);
+	// Stops the loader. Tiles free their GL buffers, so the context must be current.
+	~TerrainPager();
+
+	// Where the heights come from, set before Start. Tile (0,0) has its front left corner
+	// at the world origin and tiles run along +x and -z, like the ground mesh.
+	void SetHeightFunction(QuadMesh::HeightFunction heightFunction)
+	{
+		this->heightFunction = heightFunction;
+	}
+	// Sample (x,z) lies at world (x*spacing, -z*spacing), so tileLength should be
+	// tileSize*spacing. Tiles past the edges of the field repeat its edge heights.
+	void SetHeightfield(const Heightfield *heightfield)
+	{
+		this->heightfield = heightfield;
+	}
+
+	void SetMaterial(VECTOR3D ambient, VECTOR3D diffuse, VECTOR3D specular, double shininess);
+	void SetLodDistance(float distance)
+	{
+		lodDistance = distance;
+	}
+	// Tiles outside the ring are evicted once all tiles together use more than this.
+	// Tiles in the ring are never evicted, so the ring itself may go over.
+	void SetMemoryCap(size_t bytes)
+	{
+		memoryCap = bytes;
+	}
+	// GL upload time allowed per Update. At least one tile is uploaded each frame anyway,
+	// so the ring always fills in.
+	void SetUploadBudget(double milliseconds)
+	{
+		uploadBudget = milliseconds;
+	}
+
+	void Start();
+	void Stop();
+
+	// Render thread, once a frame: moves the ring to the tile under world (x,z), takes the
+	// tiles the loader has finished, uploads what fits in the budget and evicts.
+	void Update(double centerX, double centerZ);
+
+	// Render thread. Draws the uploaded tiles of the ring with world point (originX, 0,
+	// originZ) at the GL origin; eye and frustum are relative to that point.
+	void Draw(double originX, double originZ, const VECTOR3D &eye, const Frustum *frustum = NULL,
+	          CullStats *stats = NULL);
+	// Render thread. Nearest hit before maxT of a ray in the same coordinates as Draw's,
+	// relative to world point (originX, 0, originZ), with the uploaded tiles. Calls on
+	// several threads at once are fine while the render thread waits for them.
+	bool Intersect(double originX, double originZ, const Ray &ray, float maxT, float &t) const;
+	// Height at world (x,z) from the heightfield or height function, the one the tiles are
+	// built from, whether or not a tile is loaded there. Any thread.
+	float GetHeight(double x, double z) const;
+
+	struct Stats
+	{
+		int tilesResident;		// uploaded, in the ring or cached
+		int tilesPending;		// queued, being built, or built and waiting for upload
+		size_t memoryUsed;		// by built and uploaded tiles
+		int tilesBuilt;			// totals since the pager was created
+		int tilesEvicted;
+		int uploads;			// in the last Update
+		double uploadMs;
+		double maxUploadMs;		// longest upload time of any Update
+		int trianglesDrawn;		// by the last Draw
+	};
+
+	const Stats &GetStats() const
+	{
+		return stats;
+	}
+	// Tile meshes are allocated from here, so a tile built after one was evicted takes
+	// over its arrays
+	const MeshPool &GetMeshPool() const
+	{
+		return meshPool;
+	}
+
+private:
+	// Only the render thread changes state. The loader takes QUEUED tiles off the queue,
+	// sets their mesh and passes them back through built, both under the mutex.
+	enum TileState
+	{
+		TILE_QUEUED,		// in the queue or being built
+		TILE_BUILT,			// mesh ready, waiting for upload
+		TILE_RESIDENT		// uploaded, can be drawn
+	};
+
+	struct Tile
+	{
+		int x;
+		int z;
+		QuadMesh *mesh;
+		HeightQuadtree tree;		// over the mesh, for Intersect
+		TileState state;
+		unsigned int lastWanted;	// last Update that had it in the ring
+		int level;
+	};
+
+	static long long Key(int x, int z)
+	{
+		return (long long)(((unsigned long long)(unsigned int)x << 32) | (unsigned int)z);
+	}
+	Tile *Find(int x, int z) const;
+	// Tiles from the centre tile, along the longer axis
+	int Distance(const Tile *tile) const;
+	int SelectLevel(const VECTOR3D &center, const VECTOR3D &eye) const;
+
+	void LoaderLoop();
+	QuadMesh *BuildMesh(int x, int z);
+	void Evict();
+	size_t TileMemory(const Tile *tile) const
+	{
+		return tile->mesh->GetMemoryUsage() + tile->tree.GetMemoryUsage();
+	}
+	void DeleteTile(Tile *tile);
+
+	int tileSize;
+	float tileLength;
+	int ringRadius;
+	float lodDistance;
+	size_t memoryCap;
+	double uploadBudget;
+	int material;
+	QuadMesh::HeightFunction heightFunction;
+	const Heightfield *heightfield;
+	MeshPool meshPool;				// used by both threads
+
+	// Render thread
+	std::map<long long, Tile *> tiles;
+	std::vector<Tile *> uploads;		// built tiles waiting for upload
+	int centerTileX;
+	int centerTileZ;
+	unsigned int frame;
+	TerrainIndexLists indexLists;
+	Stats stats;
+
+	// Shared with the loader
+	std::thread loader;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<Tile *> queue;		// nearest last
+	std::vector<Tile *> built;
+	bool stopping;
+};
+
+#endif	//TERRAINPAGER_H
@@ -29,10 +29,8 @@ public:
 	VECTOR3D(const float * rhs)	:	x(*rhs), y(*(rhs+1)), z(*(rhs+2))
 	{}
 
-	VECTOR3D(const VECTOR3D & rhs)	:	x(rhs.x), y(rhs.y), z(rhs.z)
-	{}
-
-	~VECTOR3D() {}	//empty
+	// Copying and destruction are left to the compiler, so VECTOR3D stays trivially
+	// copyable and arrays of it are plain packed x,y,z floats (see MATRIX4X4.cpp)
 
 	void Set(float newX, float newY, float newZ)
 	{	x=newX;	y=newY;	z=newZ;	}
@@ -67,6 +65,9 @@ public:
 		}
 	}
 
+	VECTOR3D GetNormalized() const
+	{	VECTOR3D result(*this); result.Normalize(); return result;	}
+
 	
 	float GetLength() const
 	{	return (float)sqrt((x*x)+(y*y)+(z*z));	}
@@ -74,7 +75,7 @@ public:
 	float GetQuaddLength() const
 	{	return (x*x)+(y*y)+(z*z);	}
 
-	//rotations
+	//rotations, angles in degrees (VECTOR3D.cpp)
 	void RotateX(double angle);
 	VECTOR3D GetRotatedX(double angle) const;
 	void RotateY(double angle);
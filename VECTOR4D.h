@@ -0,0 +1,133 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	VECTOR4D.h
+//	Class declaration for a 4d vector, 16 byte aligned so its arithmetic runs on one SIMD
+//	register. Points have w = 1 and directions w = 0, so it doubles as an aligned
+//	VECTOR3D for the matrix code.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef VECTOR4D_H
+#define VECTOR4D_H
+
+#include <math.h>
+#include "MathSIMD.h"
+#include "VECTOR3D.h"
+
+class BOT_MATH_ALIGN VECTOR4D
+{
+public:
+	//constructors
+	VECTOR4D(void)	:	x(0.0f), y(0.0f), z(0.0f), w(0.0f)
+	{}
+
+	VECTOR4D(float newX, float newY, float newZ, float newW)	:	x(newX), y(newY), z(newZ), w(newW)
+	{}
+
+	VECTOR4D(const float * rhs)	:	x(rhs[0]), y(rhs[1]), z(rhs[2]), w(rhs[3])
+	{}
+
+	// A point by default, pass newW = 0 for a direction
+	VECTOR4D(const VECTOR3D & rhs, float newW = 1.0f)	:	x(rhs.x), y(rhs.y), z(rhs.z), w(newW)
+	{}
+
+	void Set(float newX, float newY, float newZ, float newW)
+	{	x=newX;	y=newY;	z=newZ;	w=newW;	}
+
+	void LoadZero(void)
+	{	x=y=z=w=0.0f;	}
+
+	VECTOR3D GetVECTOR3D() const
+	{	return VECTOR3D(x, y, z);	}
+
+	SimdFloat4 Load() const
+	{	return SimdLoad(&x);	}
+
+	static VECTOR4D FromSimd(SimdFloat4 v)
+	{	VECTOR4D result; SimdStore(&result.x, v); return result;	}
+
+	//vector algebra, over all four components
+	float DotProduct(const VECTOR4D & rhs) const
+	{
+		BOT_MATH_ALIGN float p[4];
+		SimdStore(p, SimdMul(Load(), rhs.Load()));
+		return (p[0] + p[1]) + (p[2] + p[3]);
+	}
+
+	// x, y and z only, w of the result is 0
+	VECTOR4D CrossProduct(const VECTOR4D & rhs) const
+	{	return VECTOR4D(y*rhs.z - z*rhs.y, z*rhs.x - x*rhs.z, x*rhs.y - y*rhs.x, 0.0f);	}
+
+	float GetLength() const
+	{	return (float)sqrt(DotProduct(*this));	}
+
+	float GetSquaredLength() const
+	{	return DotProduct(*this);	}
+
+	void Normalize()
+	{
+		const float norm = GetLength();
+		if(norm > 0)
+			*this = *this * (1.0f / norm);
+	}
+
+	VECTOR4D GetNormalized() const
+	{	VECTOR4D result(*this); result.Normalize(); return result;	}
+
+	//linear interpolate
+	VECTOR4D lerp(const VECTOR4D & v2, float factor) const
+	{	return FromSimd(SimdMulAdd(SimdSub(v2.Load(), Load()), SimdSplat(factor), Load()));	}
+
+	//overloaded operators
+	//binary operators
+	VECTOR4D operator+(const VECTOR4D & rhs) const
+	{	return FromSimd(SimdAdd(Load(), rhs.Load()));	}
+
+	VECTOR4D operator-(const VECTOR4D & rhs) const
+	{	return FromSimd(SimdSub(Load(), rhs.Load()));	}
+
+	VECTOR4D operator*(const float rhs) const
+	{	return FromSimd(SimdMul(Load(), SimdSplat(rhs)));	}
+
+	VECTOR4D operator/(const float rhs) const
+	{	return (rhs==0.0f) ? VECTOR4D(0.0f, 0.0f, 0.0f, 0.0f) : (*this) * (1.0f / rhs);	}
+
+	// Component by component
+	VECTOR4D operator*(const VECTOR4D & rhs) const
+	{	return FromSimd(SimdMul(Load(), rhs.Load()));	}
+
+	friend VECTOR4D operator*(float scaleFactor, const VECTOR4D & rhs)
+	{	return rhs * scaleFactor;	}
+
+	bool operator==(const VECTOR4D & rhs) const
+	{	return x==rhs.x && y==rhs.y && z==rhs.z && w==rhs.w;	}
+	bool operator!=(const VECTOR4D & rhs) const
+	{	return !((*this)==rhs);	}
+
+	//self-add etc
+	void operator+=(const VECTOR4D & rhs)
+	{	*this = *this + rhs;	}
+
+	void operator-=(const VECTOR4D & rhs)
+	{	*this = *this - rhs;	}
+
+	void operator*=(const float rhs)
+	{	*this = *this * rhs;	}
+
+	void operator/=(const float rhs)
+	{	if(rhs!=0.0f) *this = *this * (1.0f / rhs);	}
+
+	//unary operators
+	VECTOR4D operator-(void) const {return VECTOR4D(-x, -y, -z, -w);}
+	VECTOR4D operator+(void) const {return *this;}
+
+	//cast to pointer to a (float *) for glVertex4fv etc
+	operator float* () const {return (float*) this;}
+	operator const float* () const {return (const float*) this;}
+
+	//member variables
+	float x;
+	float y;
+	float z;
+	float w;
+};
+
+#endif	//VECTOR4D_H
@@ -0,0 +1,381 @@
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "MathSIMD.h"
+#include "MATRIX4X4.h"
+#include "NormalKernel.h"
+#include "VectorArrays.h"
+
+// The AVX2 kernels reuse the SSE deinterleaving from MathSIMD.h for each 128 bit half
+#if defined(BOT_MATH_SSE) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define VECTOR_ARRAYS_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+// No fma here: a fused multiply-add would round differently from the VECTOR3D methods
+#define TARGET_AVX2	__attribute__((target("avx2")))
+#endif
+#endif
+
+// 4 vectors per iteration. Each returns how many vectors it processed, the caller finishes
+// the rest with the VECTOR3D methods.
+template <bool fast>
+static int NormalizeSimd4(VECTOR3D *v, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		SimdFloat4 x, y, z;
+		SimdLoadXYZ4(&v[i].x, x, y, z);
+		SimdFloat4 len2 = SimdAdd(SimdAdd(SimdMul(x, x), SimdMul(y, y)), SimdMul(z, z));
+		SimdFloat4 nx, ny, nz;
+		if (fast)
+		{
+			SimdFloat4 r = SimdRsqrt(len2);
+			nx = SimdMul(x, r);
+			ny = SimdMul(y, r);
+			nz = SimdMul(z, r);
+		}
+		else
+		{
+			SimdFloat4 norm = SimdSqrt(len2);
+			nx = SimdDiv(x, norm);
+			ny = SimdDiv(y, norm);
+			nz = SimdDiv(z, norm);
+		}
+		SimdStoreXYZ4(&v[i].x, SimdSelectPositive(len2, nx, x), SimdSelectPositive(len2, ny, y), SimdSelectPositive(len2, nz, z));
+	}
+	return i;
+}
+
+static int CrossSimd4(const VECTOR3D *a, const VECTOR3D *b, VECTOR3D *out, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		SimdFloat4 ax, ay, az, bx, by, bz;
+		SimdLoadXYZ4(&a[i].x, ax, ay, az);
+		SimdLoadXYZ4(&b[i].x, bx, by, bz);
+		SimdStoreXYZ4(&out[i].x, SimdSub(SimdMul(ay, bz), SimdMul(az, by)),
+		                         SimdSub(SimdMul(az, bx), SimdMul(ax, bz)),
+		                         SimdSub(SimdMul(ax, by), SimdMul(ay, bx)));
+	}
+	return i;
+}
+
+static int DotSimd4(const VECTOR3D *a, const VECTOR3D *b, float *out, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		SimdFloat4 ax, ay, az, bx, by, bz;
+		SimdLoadXYZ4(&a[i].x, ax, ay, az);
+		SimdLoadXYZ4(&b[i].x, bx, by, bz);
+		SimdStore(&out[i], SimdAdd(SimdAdd(SimdMul(ax, bx), SimdMul(ay, by)), SimdMul(az, bz)));
+	}
+	return i;
+}
+
+#ifdef VECTOR_ARRAYS_AVX2
+
+// 8 packed x,y,z vectors to and from one register per component
+TARGET_AVX2 static inline void LoadXYZ8(const float *p, __m256 &x, __m256 &y, __m256 &z)
+{
+	__m128 x0, y0, z0, x1, y1, z1;
+	SimdLoadXYZ4(p, x0, y0, z0);
+	SimdLoadXYZ4(p + 12, x1, y1, z1);
+	x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+	y = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+	z = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+}
+
+TARGET_AVX2 static inline void StoreXYZ8(float *p, __m256 x, __m256 y, __m256 z)
+{
+	SimdStoreXYZ4(p, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+	SimdStoreXYZ4(p + 12, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+}
+
+// Same as NormalizeSimd4, 8 vectors per iteration
+template <bool fast>
+TARGET_AVX2 static int NormalizeAVX2(VECTOR3D *v, int count)
+{
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 threeHalves = _mm256_set1_ps(1.5f);
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 x, y, z;
+		LoadXYZ8(&v[i].x, x, y, z);
+		__m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+		__m256 nx, ny, nz;
+		if (fast)
+		{
+			__m256 r = _mm256_rsqrt_ps(len2);
+			r = _mm256_mul_ps(r, _mm256_sub_ps(threeHalves, _mm256_mul_ps(_mm256_mul_ps(half, len2), _mm256_mul_ps(r, r))));
+			nx = _mm256_mul_ps(x, r);
+			ny = _mm256_mul_ps(y, r);
+			nz = _mm256_mul_ps(z, r);
+		}
+		else
+		{
+			__m256 norm = _mm256_sqrt_ps(len2);
+			nx = _mm256_div_ps(x, norm);
+			ny = _mm256_div_ps(y, norm);
+			nz = _mm256_div_ps(z, norm);
+		}
+		__m256 nonZero = _mm256_cmp_ps(len2, _mm256_setzero_ps(), _CMP_GT_OQ);
+		StoreXYZ8(&v[i].x, _mm256_blendv_ps(x, nx, nonZero), _mm256_blendv_ps(y, ny, nonZero), _mm256_blendv_ps(z, nz, nonZero));
+	}
+	return i;
+}
+
+TARGET_AVX2 static int CrossAVX2(const VECTOR3D *a, const VECTOR3D *b, VECTOR3D *out, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 ax, ay, az, bx, by, bz;
+		LoadXYZ8(&a[i].x, ax, ay, az);
+		LoadXYZ8(&b[i].x, bx, by, bz);
+		StoreXYZ8(&out[i].x, _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by)),
+		                     _mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(ax, bz)),
+		                     _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(ay, bx)));
+	}
+	return i;
+}
+
+TARGET_AVX2 static int DotAVX2(const VECTOR3D *a, const VECTOR3D *b, float *out, int count)
+{
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 ax, ay, az, bx, by, bz;
+		LoadXYZ8(&a[i].x, ax, ay, az);
+		LoadXYZ8(&b[i].x, bx, by, bz);
+		_mm256_storeu_ps(&out[i], _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz)));
+	}
+	return i;
+}
+
+#endif	// VECTOR_ARRAYS_AVX2
+
+VectorArrayPath SelectVectorArrayPath(VectorArrayPath requested)
+{
+#if defined(VECTOR_ARRAYS_AVX2)
+	// Same CPU check as the normal kernel
+	static const bool hasAVX2 = SelectNormalKernel(NORMAL_KERNEL_AVX2) == NORMAL_KERNEL_AVX2;
+
+	if (requested == VECTOR_PATH_AUTO)
+		return hasAVX2 ? VECTOR_PATH_AVX2 : VECTOR_PATH_SIMD4;
+	if (requested == VECTOR_PATH_AVX2 && !hasAVX2)
+		return VECTOR_PATH_SIMD4;
+	return requested;
+#elif defined(BOT_MATH_SSE) || defined(BOT_MATH_NEON)
+	return requested == VECTOR_PATH_SCALAR ? VECTOR_PATH_SCALAR : VECTOR_PATH_SIMD4;
+#else
+	return VECTOR_PATH_SCALAR;
+#endif
+}
+
+const char *VectorArrayPathName(VectorArrayPath path)
+{
+	switch (path)
+	{
+	case VECTOR_PATH_SCALAR:	return "scalar";
+#if defined(BOT_MATH_NEON)
+	case VECTOR_PATH_SIMD4:		return "NEON";
+#else
+	case VECTOR_PATH_SIMD4:		return "SSE";
+#endif
+	case VECTOR_PATH_AVX2:		return "AVX2";
+	default:					return "auto";
+	}
+}
+
+void NormalizeArray(VECTOR3D *vectors, int count, VectorPrecision precision, VectorArrayPath path)
+{
+	path = SelectVectorArrayPath(path);
+	bool fast = precision == VECTOR_PRECISION_FAST;
+
+	int i = 0;
+#ifdef VECTOR_ARRAYS_AVX2
+	if (path == VECTOR_PATH_AVX2)
+		i = fast ? NormalizeAVX2<true>(vectors, count) : NormalizeAVX2<false>(vectors, count);
+#endif
+	if (path != VECTOR_PATH_SCALAR)
+		i += fast ? NormalizeSimd4<true>(vectors + i, count - i) : NormalizeSimd4<false>(vectors + i, count - i);
+	for (; i < count; i++)
+		vectors[i].Normalize();
+}
+
+void CrossArrays(const VECTOR3D *a, const VECTOR3D *b, VECTOR3D *out, int count, VectorArrayPath path)
+{
+	path = SelectVectorArrayPath(path);
+
+	int i = 0;
+#ifdef VECTOR_ARRAYS_AVX2
+	if (path == VECTOR_PATH_AVX2)
+		i = CrossAVX2(a, b, out, count);
+#endif
+	if (path != VECTOR_PATH_SCALAR)
+		i += CrossSimd4(a + i, b + i, out + i, count - i);
+	for (; i < count; i++)
+		out[i] = a[i].CrossProduct(b[i]);
+}
+
+void DotArrays(const VECTOR3D *a, const VECTOR3D *b, float *out, int count, VectorArrayPath path)
+{
+	path = SelectVectorArrayPath(path);
+
+	int i = 0;
+#ifdef VECTOR_ARRAYS_AVX2
+	if (path == VECTOR_PATH_AVX2)
+		i = DotAVX2(a, b, out, count);
+#endif
+	if (path != VECTOR_PATH_SCALAR)
+		i += DotSimd4(a + i, b + i, out + i, count - i);
+	for (; i < count; i++)
+		out[i] = a[i].DotProduct(b[i]);
+}
+
+// Benchmark helpers
+
+// Components in [-1,1], with every 64th vector zero to exercise the zero length case
+static void FillVectors(std::vector<VECTOR3D> &v, unsigned int seed)
+{
+	for (size_t i = 0; i < v.size(); i++)
+	{
+		float c[3];
+		for (int k = 0; k < 3; k++)
+		{
+			seed = seed*1664525u + 1013904223u;
+			c[k] = (float)(seed >> 8) / (float)(1 << 23) - 1.0f;
+		}
+		v[i] = (i % 64 == 63) ? VECTOR3D() : VECTOR3D(c[0], c[1], c[2]);
+	}
+}
+
+static float MaxDifference(const float *a, const float *b, size_t count)
+{
+	float maxError = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		float error = (float)fabs(a[i] - b[i]);
+		if (error > maxError)
+			maxError = error;
+	}
+	return maxError;
+}
+
+// Nanoseconds per vector, over enough repeats to process about 32M vectors after one
+// untimed warm-up run
+template <class Function>
+static double TimePerVector(int count, Function function)
+{
+	int repeats = (1 << 25) / count;
+	if (repeats < 3)
+		repeats = 3;
+
+	function();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++)
+		function();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / ((double)repeats * count);
+}
+
+static void PrintRow(int count, const char *operation, const char *path, const char *mode,
+                     double time, double scalarTime, float error)
+{
+	printf("%10d  %-10s %-7s %-6s %9.3f %8.2fx %10g\n", count, operation, path, mode,
+		time, scalarTime / time, error);
+}
+
+void BenchmarkVectorArrays(int maxCount)
+{
+	VectorArrayPath best = SelectVectorArrayPath();
+	std::vector<VectorArrayPath> paths;
+	paths.push_back(VECTOR_PATH_SCALAR);
+	if (best != VECTOR_PATH_SCALAR)
+		paths.push_back(VECTOR_PATH_SIMD4);
+	if (best == VECTOR_PATH_AVX2)
+		paths.push_back(VECTOR_PATH_AVX2);
+
+	printf("Vector arrays, best path on this CPU: %s\n", VectorArrayPathName(best));
+	printf("%10s  %-10s %-7s %-6s %9s %9s %10s\n", "vectors", "operation", "path", "mode",
+		"ns/vector", "speed-up", "max error");
+
+	MATRIX4X4 m;
+	m.LoadIdentity();
+	m.Translate(3.0f, -2.0f, 5.0f);
+	m.Rotate(30.0f, 1.0f, 2.0f, 3.0f);
+	m.Scale(1.5f, 1.5f, 1.5f);
+
+	for (long long size = maxCount < 1024 ? maxCount : 1024; size <= maxCount; size *= 4)
+	{
+		int count = (int)size;
+		std::vector<VECTOR3D> a(count), b(count), out(count), reference(count);
+		std::vector<float> dots(count), referenceDots(count);
+		FillVectors(a, 1u);
+		FillVectors(b, 2u);
+
+		// Each path is checked against the scalar results before it is timed
+		reference = a;
+		NormalizeArray(&reference[0], count, VECTOR_PRECISION_EXACT, VECTOR_PATH_SCALAR);
+		double scalarTime = 0.0;
+		for (size_t p = 0; p < paths.size(); p++)
+		{
+			for (int fast = 0; fast < (paths[p] == VECTOR_PATH_SCALAR ? 1 : 2); fast++)
+			{
+				VectorPrecision precision = fast ? VECTOR_PRECISION_FAST : VECTOR_PRECISION_EXACT;
+				out = a;
+				NormalizeArray(&out[0], count, precision, paths[p]);
+				float error = MaxDifference(&out[0].x, &reference[0].x, count*3);
+				double time = TimePerVector(count, [&]() { NormalizeArray(&out[0], count, precision, paths[p]); });
+				if (paths[p] == VECTOR_PATH_SCALAR)
+					scalarTime = time;
+				PrintRow(count, "normalize", VectorArrayPathName(paths[p]), fast ? "fast" : "exact", time, scalarTime, error);
+			}
+		}
+
+		CrossArrays(&a[0], &b[0], &reference[0], count, VECTOR_PATH_SCALAR);
+		for (size_t p = 0; p < paths.size(); p++)
+		{
+			CrossArrays(&a[0], &b[0], &out[0], count, paths[p]);
+			float error = MaxDifference(&out[0].x, &reference[0].x, count*3);
+			double time = TimePerVector(count, [&]() { CrossArrays(&a[0], &b[0], &out[0], count, paths[p]); });
+			if (paths[p] == VECTOR_PATH_SCALAR)
+				scalarTime = time;
+			PrintRow(count, "cross", VectorArrayPathName(paths[p]), "exact", time, scalarTime, error);
+		}
+
+		DotArrays(&a[0], &b[0], &referenceDots[0], count, VECTOR_PATH_SCALAR);
+		for (size_t p = 0; p < paths.size(); p++)
+		{
+			DotArrays(&a[0], &b[0], &dots[0], count, paths[p]);
+			float error = MaxDifference(&dots[0], &referenceDots[0], count);
+			double time = TimePerVector(count, [&]() { DotArrays(&a[0], &b[0], &dots[0], count, paths[p]); });
+			if (paths[p] == VECTOR_PATH_SCALAR)
+				scalarTime = time;
+			PrintRow(count, "dot", VectorArrayPathName(paths[p]), "exact", time, scalarTime, error);
+		}
+
+		// TransformPoints has one SIMD path, 4 vectors at a time
+		scalarTime = TimePerVector(count, [&]()
+		{
+			for (int i = 0; i < count; i++)
+				reference[i] = m.TransformPoint(a[i]);
+		});
+		PrintRow(count, "transform", "scalar", "exact", scalarTime, scalarTime, 0.0f);
+		if (best != VECTOR_PATH_SCALAR)
+		{
+			TransformPoints(m, &a[0], &out[0], count);
+			float error = MaxDifference(&out[0].x, &reference[0].x, count*3);
+			double time = TimePerVector(count, [&]() { TransformPoints(m, &a[0], &out[0], count); });
+			PrintRow(count, "transform", VectorArrayPathName(VECTOR_PATH_SIMD4), "exact", time, scalarTime, error);
+		}
+	}
+}
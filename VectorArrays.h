@@ -0,0 +1,50 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	VectorArrays.h
+//	VECTOR3D algebra over whole arrays. The arrays stay packed x,y,z; each block of
+//	vectors is split into one register per component, worked on 4 (SSE/NEON) or 8 (AVX2)
+//	at a time and packed back. TransformPoints/TransformDirections in MATRIX4X4.h are
+//	the matrix counterparts.
+//
+//	Exact results match VECTOR3D::Normalize, CrossProduct and DotProduct bit for bit.
+//	Fast normalization uses the reciprocal square root estimate refined once, which is
+//	within a few ulps and enough for lighting normals.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef VECTORARRAYS_H
+#define VECTORARRAYS_H
+
+#include "VECTOR3D.h"
+
+enum VectorArrayPath
+{
+	VECTOR_PATH_AUTO,		// best path supported by this CPU
+	VECTOR_PATH_SCALAR,		// the VECTOR3D methods one vector at a time
+	VECTOR_PATH_SIMD4,		// SSE on x86, NEON on ARM
+	VECTOR_PATH_AVX2
+};
+
+enum VectorPrecision
+{
+	VECTOR_PRECISION_EXACT,
+	VECTOR_PRECISION_FAST
+};
+
+// Zero length vectors are left as they are, like VECTOR3D::Normalize
+void NormalizeArray(VECTOR3D *vectors, int count, VectorPrecision precision = VECTOR_PRECISION_EXACT,
+                    VectorArrayPath path = VECTOR_PATH_AUTO);
+// out[i] = a[i] x b[i]; out may be a or b
+void CrossArrays(const VECTOR3D *a, const VECTOR3D *b, VECTOR3D *out, int count,
+                 VectorArrayPath path = VECTOR_PATH_AUTO);
+// out[i] = a[i] . b[i]
+void DotArrays(const VECTOR3D *a, const VECTOR3D *b, float *out, int count,
+               VectorArrayPath path = VECTOR_PATH_AUTO);
+
+// Paths the CPU does not support fall back to the next best one
+VectorArrayPath SelectVectorArrayPath(VectorArrayPath requested = VECTOR_PATH_AUTO);
+const char *VectorArrayPathName(VectorArrayPath path);
+
+// Micro-benchmark (--bench-vectors): times every path against the scalar VECTOR3D methods
+// on arrays from 1K up to maxCount vectors and checks each against the scalar results
+void BenchmarkVectorArrays(int maxCount);
+
+#endif	//VECTORARRAYS_H
@@ -0,0 +1,199 @@
+#include "Profiler.h"
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(int numThreads)
+{
+	quit = false;
+	job = NULL;
+	jobCount = 0;
+	jobChunk = 1;
+	jobGeneration = 0;
+	itemsDone = 0;
+	activeWorkers = 0;
+
+	if (numThreads <= 0)
+		numThreads = (int)std::thread::hardware_concurrency();
+	if (numThreads <= 0)
+		numThreads = 1;
+
+	ranges = new WorkRange[numThreads];
+	for (int i = 0; i < numThreads; i++)
+		ranges[i].items = 0;
+
+	for (int i = 1; i < numThreads; i++)
+		workers.push_back(std::thread(&WorkerPool::WorkerLoop, this, i));
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	delete[] ranges;
+}
+
+static inline unsigned long long PackRange(int begin, int end)
+{
+	return ((unsigned long long)(unsigned int)end << 32) | (unsigned int)begin;
+}
+
+static inline void UnpackRange(unsigned long long items, int &begin, int &end)
+{
+	begin = (int)(unsigned int)items;
+	end = (int)(unsigned int)(items >> 32);
+}
+
+WorkerPool &WorkerPool::Shared()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+// Claims a chunk off the front of the thread's own range
+bool WorkerPool::TakeChunk(int thread, int &begin, int &end)
+{
+	std::atomic<unsigned long long> &items = ranges[thread].items;
+	unsigned long long current = items.load();
+	for (;;)
+	{
+		int first, last;
+		UnpackRange(current, first, last);
+		if (first >= last)
+			return false;
+		int split = last - first > jobChunk ? first + jobChunk : last;
+		if (items.compare_exchange_weak(current, PackRange(split, last)))
+		{
+			begin = first;
+			end = split;
+			return true;
+		}
+	}
+}
+
+// Moves the back half of some other thread's range into this thread's empty one. Ranges
+// only ever hold items nobody has claimed, so a stolen range is never handed out twice.
+bool WorkerPool::Steal(int thread)
+{
+	int numThreads = GetNumThreads();
+	for (int i = 1; i < numThreads; i++)
+	{
+		std::atomic<unsigned long long> &victim = ranges[(thread + i) % numThreads].items;
+		unsigned long long current = victim.load();
+		for (;;)
+		{
+			int first, last;
+			UnpackRange(current, first, last);
+			if (first >= last)
+				break;
+			// Halves while there is more than a chunk left, after that the whole rest
+			int remaining = last - first;
+			int split = remaining > jobChunk ? last - remaining / 2 : first;
+			if (victim.compare_exchange_weak(current, PackRange(first, split)))
+			{
+				ranges[thread].items = PackRange(split, last);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Run chunks of this thread's range, then of stolen ones, until nothing is left to claim
+void WorkerPool::RunChunks(int thread)
+{
+	for (;;)
+	{
+		int begin, end;
+		if (!TakeChunk(thread, begin, end))
+		{
+			if (!Steal(thread))
+				break;
+			continue;
+		}
+		(*job)(begin, end);
+		itemsDone.fetch_add(end - begin);
+	}
+}
+
+void WorkerPool::WorkerLoop(int thread)
+{
+	PROFILE_THREAD("worker");
+	unsigned int seenGeneration = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || jobGeneration != seenGeneration; });
+			if (quit)
+				return;
+			seenGeneration = jobGeneration;
+			activeWorkers++;
+		}
+
+		{
+			PROFILE_ZONE("WorkerPool::RunChunks");
+			RunChunks(thread);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			activeWorkers--;
+		}
+		done.notify_all();
+	}
+}
+
+void WorkerPool::ParallelFor(int count, int grain, const RangeFunction &func)
+{
+	if (count <= 0)
+		return;
+	if (grain < 1)
+		grain = 1;
+	PROFILE_ZONE("WorkerPool::ParallelFor");
+
+	// Small jobs are not worth waking anybody for
+	if (workers.empty() || count <= grain)
+	{
+		func(0, count);
+		return;
+	}
+
+	// A few chunks per thread so a thread that falls behind still has some left to steal
+	int numThreads = GetNumThreads();
+	int chunk = count / (numThreads*4);
+	if (chunk < grain)
+		chunk = grain;
+
+	std::lock_guard<std::mutex> call(callMutex);
+
+	{
+		// A worker that woke up late for the previous job must be out of it first
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&] { return activeWorkers == 0; });
+		job = &func;
+		jobCount = count;
+		jobChunk = chunk;
+		for (int i = 0; i < numThreads; i++)
+		{
+			// Even contiguous share per thread
+			int begin = (int)((long long)count * i / numThreads);
+			int end = (int)((long long)count * (i + 1) / numThreads);
+			ranges[i].items = PackRange(begin, end);
+		}
+		itemsDone = 0;
+		jobGeneration++;
+	}
+	wake.notify_all();
+
+	RunChunks(0);
+
+	// Wait for the last chunks and for every worker to let go of the job
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return itemsDone.load() >= count && activeWorkers == 0; });
+	job = NULL;
+}
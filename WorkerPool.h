@@ -0,0 +1,74 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	WorkerPool.h
+//	Small fixed pool of worker threads for splitting loops over rows/items across cores
+//
+//	Each job starts as one contiguous range per thread. A thread takes chunks off the front
+//	of its own range, and once that is empty steals the back half of another thread's, so
+//	uneven items balance out without threads contending on one shared counter.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool
+{
+public:
+	typedef std::function<void(int begin, int end)> RangeFunction;
+
+	// numThreads counts the calling thread, 0 means one per hardware thread
+	WorkerPool(int numThreads = 0);
+	~WorkerPool();
+
+	// Runs func over [0,count) in chunks of at least grain items and returns once every
+	// chunk is done. The calling thread works on chunks too. Not reentrant, but callers on
+	// different threads may overlap: the pool runs one job at a time and the others wait.
+	// Chunks run in no particular order.
+	void ParallelFor(int count, int grain, const RangeFunction &func);
+
+	int GetNumThreads() const
+	{
+		return (int)workers.size() + 1;
+	}
+
+	// Process wide pool shared by the mesh and animation code
+	static WorkerPool &Shared();
+
+private:
+	// Items [begin,end) not yet handed out, packed as end << 32 | begin so one compare and
+	// swap claims them. Padded so threads do not share cache lines.
+	struct WorkRange
+	{
+		std::atomic<unsigned long long> items;
+		char padding[64 - sizeof(std::atomic<unsigned long long>)];
+	};
+
+	void WorkerLoop(int thread);
+	void RunChunks(int thread);
+	bool TakeChunk(int thread, int &begin, int &end);
+	bool Steal(int thread);
+
+	std::vector<std::thread> workers;
+	std::mutex callMutex;		// held by the thread whose job the pool is running
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	bool quit;
+
+	// Current job
+	const RangeFunction *job;
+	int jobCount;
+	int jobChunk;
+	unsigned int jobGeneration;
+	WorkRange *ranges;		// one per thread, the calling thread's first
+	std::atomic<int> itemsDone;
+	int activeWorkers;
+};
+
+#endif	//WORKERPOOL_H